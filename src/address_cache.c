@@ -72,6 +72,26 @@ static void free_known_addresses(struct addrinfo *ai) {
 	}
 }
 
+// Make our own copy of a resolver result, in reverse order, the same way get_known_addresses() does.
+static struct addrinfo *copy_addresses(const struct addrinfo *aip) {
+	struct addrinfo *ai = NULL;
+
+	for(; aip; aip = aip->ai_next) {
+		struct addrinfo *oai = ai;
+
+		ai = xzalloc(sizeof(*ai));
+		ai->ai_family = aip->ai_family;
+		ai->ai_socktype = aip->ai_socktype;
+		ai->ai_protocol = aip->ai_protocol;
+		ai->ai_addrlen = aip->ai_addrlen;
+		ai->ai_addr = xmalloc(ai->ai_addrlen);
+		memcpy(ai->ai_addr, aip->ai_addr, ai->ai_addrlen);
+		ai->ai_next = oai;
+	}
+
+	return ai;
+}
+
 static unsigned int find_cached(address_cache_t *cache, const sockaddr_t *sa) {
 	for(unsigned int i = 0; i < cache->data.used; i++)
 		if(!sockaddrcmp(&cache->data.address[i], sa)) {
@@ -114,7 +134,7 @@ void add_recent_address(address_cache_t *cache, const sockaddr_t *sa) {
 	}
 }
 
-const sockaddr_t *get_recent_address(address_cache_t *cache) {
+const sockaddr_t *get_recent_address(address_cache_t *cache, resolve_cb_t cb, void *data) {
 	// Check if there is an address in our cache of recently seen addresses
 	if(cache->tried < cache->data.used) {
 		return &cache->data.address[cache->tried++];
@@ -152,6 +172,8 @@ const sockaddr_t *get_recent_address(address_cache_t *cache) {
 		cache->cfg = lookup_config(cache->config_tree, "Address");
 	}
 
+	cache->resolving = false;
+
 	while(cache->cfg && !cache->aip) {
 		char *address, *port;
 
@@ -168,34 +190,24 @@ const sockaddr_t *get_recent_address(address_cache_t *cache) {
 			}
 		}
 
-		if(cache->ai) {
-			free_known_addresses(cache->ai);
-		}
+		const struct addrinfo *result;
+		resolve_status_t status = resolve_address(address, port, SOCK_STREAM, &result, cb, data);
 
-		cache->aip = cache->ai = str2addrinfo(address, port, SOCK_STREAM);
+		free(address);
+		free(port);
 
-		if(cache->ai) {
-			struct addrinfo *ai = NULL;
-
-			for(; cache->aip; cache->aip = cache->aip->ai_next) {
-				struct addrinfo *oai = ai;
-
-				ai = xzalloc(sizeof(*ai));
-				ai->ai_family = cache->aip->ai_family;
-				ai->ai_socktype = cache->aip->ai_socktype;
-				ai->ai_protocol = cache->aip->ai_protocol;
-				ai->ai_addrlen = cache->aip->ai_addrlen;
-				ai->ai_addr = xmalloc(ai->ai_addrlen);
-				memcpy(ai->ai_addr, cache->aip->ai_addr, ai->ai_addrlen);
-				ai->ai_next = oai;
-			}
+		// Come back to the same Address statement when the lookup has finished
 
-			freeaddrinfo(cache->ai);
-			cache->aip = cache->ai = ai;
+		if(status == RESOLVE_PENDING) {
+			cache->resolving = true;
+			return NULL;
 		}
 
-		free(address);
-		free(port);
+		if(cache->ai) {
+			free_known_addresses(cache->ai);
+		}
+
+		cache->aip = cache->ai = copy_addresses(result);
 
 		cache->cfg = lookup_config_next(cache->config_tree, cache->cfg);
 	}
@@ -240,6 +252,7 @@ address_cache_t *open_address_cache(node_t *node) {
 	cache->ai = NULL;
 	cache->aip = NULL;
 	cache->tried = 0;
+	cache->resolving = false;
 	cache->data.version = ADDRESS_CACHE_VERSION;
 
 	if(cache->data.used > MAX_CACHED_ADDRESSES) {
@@ -267,6 +280,7 @@ void reset_address_cache(address_cache_t *cache, const sockaddr_t *sa) {
 	cache->ai = NULL;
 	cache->aip = NULL;
 	cache->tried = 0;
+	cache->resolving = false;
 }
 
 void close_address_cache(address_cache_t *cache) {
@@ -21,6 +21,7 @@
 */
 
 #include "net.h"
+#include "resolver.h"
 
 #define MAX_CACHED_ADDRESSES 8
 #define ADDRESS_CACHE_VERSION 1
@@ -32,6 +33,7 @@ typedef struct address_cache_t {
 	struct addrinfo *ai;
 	struct addrinfo *aip;
 	unsigned int tried;
+	bool resolving;                         /* waiting for the resolver to look up an Address */
 
 	struct {
 		unsigned int version;
@@ -41,7 +43,7 @@ typedef struct address_cache_t {
 } address_cache_t;
 
 void add_recent_address(address_cache_t *cache, const sockaddr_t *sa);
-const sockaddr_t *get_recent_address(address_cache_t *cache);
+const sockaddr_t *get_recent_address(address_cache_t *cache, resolve_cb_t cb, void *data);
 
 address_cache_t *open_address_cache(struct node_t *node);
 void reset_address_cache(address_cache_t *cache, const sockaddr_t *sa);
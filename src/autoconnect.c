@@ -22,56 +22,134 @@
 #include "autoconnect.h"
 #include "connection.h"
 #include "crypto.h"
+#include "edge.h"
 #include "logger.h"
 #include "node.h"
 #include "xalloc.h"
 
-static void make_new_connection(void) {
-	/* Select a random node we haven't connected to yet. */
-	uint32_t count = 0;
+/* Candidate sets, kept up to date by autoconnect_update(), so we can pick
+   a random member without scanning all nodes. Nodes are removed by moving
+   the last member into their place. */
 
-	for splay_each(node_t, n, &node_tree) {
-		if(n == myself || n->connection || !(n->status.has_address || n->status.reachable)) {
-			continue;
+typedef struct candidate_set_t {
+	node_t **nodes;
+	uint32_t count;
+	uint32_t size;
+} candidate_set_t;
+
+enum {
+	UNCONNECTED,                    /* nodes we have no connection with, but that we know how to reach */
+	UNREACHABLE,                    /* unreachable nodes that we know an address of */
+};
+
+autoconnect_strategy_t autoconnect_strategy = AUTOCONNECT_RANDOM;
+
+static candidate_set_t candidates[2];
+
+static void set_membership(int set, node_t *n, bool member) {
+	candidate_set_t *c = &candidates[set];
+	uint32_t index = n->autoconnect_index[set];
+
+	if(member && !index) {
+		if(c->count == c->size) {
+			c->size = c->size ? c->size * 2 : 16;
+			c->nodes = xrealloc(c->nodes, c->size * sizeof(*c->nodes));
 		}
 
-		count++;
+		c->nodes[c->count++] = n;
+		n->autoconnect_index[set] = c->count;
+	} else if(!member && index) {
+		node_t *last = c->nodes[--c->count];
+		c->nodes[index - 1] = last;
+		last->autoconnect_index[set] = index;
+		n->autoconnect_index[set] = 0;
 	}
+}
 
-	if(!count) {
-		return;
-	}
+void autoconnect_update(node_t *n) {
+	bool candidate = n != myself && !n->connection;
 
-	uint32_t r = prng(count);
+	set_membership(UNCONNECTED, n, candidate && (n->status.has_address || n->status.reachable));
+	set_membership(UNREACHABLE, n, candidate && n->status.has_address && !n->status.reachable);
+}
 
-	for splay_each(node_t, n, &node_tree) {
-		if(n == myself || n->connection || !(n->status.has_address || n->status.reachable)) {
-			continue;
-		}
+void autoconnect_forget(node_t *n) {
+	set_membership(UNCONNECTED, n, false);
+	set_membership(UNREACHABLE, n, false);
+}
 
-		if(r) {
-			--r;
-			continue;
+void autoconnect_exit(void) {
+	for(size_t i = 0; i < sizeof(candidates) / sizeof(*candidates); i++) {
+		for(uint32_t j = 0; j < candidates[i].count; j++) {
+			candidates[i].nodes[j]->autoconnect_index[i] = 0;
 		}
 
-		bool found = false;
+		free(candidates[i].nodes);
+		candidates[i] = (candidate_set_t) {
+			NULL, 0, 0
+		};
+	}
+}
 
-		for list_each(outgoing_t, outgoing, &outgoing_list) {
-			if(outgoing->node == n) {
-				found = true;
-				break;
-			}
-		}
+/* Round trip time in microseconds, or -1 if we don't know it. */
+
+static int node_rtt(const node_t *n) {
+	if(n->udp_ping_rtt >= 0) {
+		return n->udp_ping_rtt;
+	}
+
+	/* The edge weight is the time it took to set up the meta connection, in milliseconds */
+	if(n->connection && n->connection->edge) {
+		return n->connection->edge->weight * 1000;
+	}
+
+	return -1;
+}
+
+static node_t *choose_candidate(const candidate_set_t *c) {
+	node_t *best = c->nodes[prng(c->count)];
+
+	if(autoconnect_strategy != AUTOCONNECT_RTT) {
+		return best;
+	}
 
-		if(!found) {
-			logger(DEBUG_CONNECTIONS, LOG_INFO, "Autoconnecting to %s", n->name);
-			outgoing_t *outgoing = xzalloc(sizeof(*outgoing));
-			outgoing->node = n;
-			list_insert_tail(&outgoing_list, outgoing);
-			setup_outgoing_connection(outgoing, false);
+	/* Compare a few random candidates, so we end up near the nodes closest
+	   to us without every node connecting to the same ones. */
+
+	int best_rtt = node_rtt(best);
+
+	for(int i = 1; i < AUTOCONNECT_RTT_SAMPLES && (uint32_t)i < c->count; i++) {
+		node_t *n = c->nodes[prng(c->count)];
+		int rtt = node_rtt(n);
+
+		if(rtt >= 0 && (best_rtt < 0 || rtt < best_rtt)) {
+			best = n;
+			best_rtt = rtt;
 		}
+	}
 
-		break;
+	return best;
+}
+
+static void autoconnect_to(node_t *n) {
+	logger(DEBUG_CONNECTIONS, LOG_INFO, "Autoconnecting to %s", n->name);
+	outgoing_t *outgoing = xzalloc(sizeof(*outgoing));
+	outgoing->node = n;
+	n->outgoings++;
+	list_insert_tail(&outgoing_list, outgoing);
+	setup_outgoing_connection(outgoing, false);
+}
+
+static void make_new_connection(void) {
+	/* Select a random node we haven't connected to yet. */
+	if(!candidates[UNCONNECTED].count) {
+		return;
+	}
+
+	node_t *n = choose_candidate(&candidates[UNCONNECTED]);
+
+	if(!n->outgoings) {
+		autoconnect_to(n);
 	}
 }
 
@@ -81,57 +159,73 @@ static void connect_to_unreachable(void) {
 	 * reachable nodes to try to connect to the unreachable ones at the
 	 * same time. This way, we back off automatically. Conversely, if there
 	 * are only a few reachable nodes, and many unreachable ones, we're
-	 * going to try harder to connect to them. */
+	 * going to try harder to connect to them.
+	 *
+	 * Picking a random number out of all nodes, and only using it if it
+	 * falls within the set of unreachable nodes, gives the same odds. */
 
 	uint32_t r = prng(node_tree.count);
 
-	for splay_each(node_t, n, &node_tree) {
-		if(r--) {
-			continue;
-		}
-
-		/* Is it unreachable and do we know an address for it? If not, return. */
-		if(n == myself || n->connection || n->status.reachable || !n->status.has_address) {
-			return;
-		}
-
-		/* Are we already trying to make an outgoing connection to it? If so, return. */
-		for list_each(outgoing_t, outgoing, &outgoing_list) {
-			if(outgoing->node == n) {
-				return;
-			}
-		}
+	if(r >= candidates[UNREACHABLE].count) {
+		return;
+	}
 
-		logger(DEBUG_CONNECTIONS, LOG_INFO, "Autoconnecting to %s", n->name);
-		outgoing_t *outgoing = xzalloc(sizeof(*outgoing));
-		outgoing->node = n;
-		list_insert_tail(&outgoing_list, outgoing);
-		setup_outgoing_connection(outgoing, false);
+	node_t *n = candidates[UNREACHABLE].nodes[r];
 
+	/* Are we already trying to make an outgoing connection to it? If so, return. */
+	if(n->outgoings) {
 		return;
 	}
+
+	autoconnect_to(n);
+}
+
+static bool is_superfluous(const connection_t *c) {
+	return c->edge && c->outgoing && c->node && c->node->edge_tree.count >= 2;
+}
+
+static void drop_connection(connection_t *c) {
+	logger(DEBUG_CONNECTIONS, LOG_INFO, "Autodisconnecting from %s", c->name);
+	list_delete(&outgoing_list, c->outgoing);
+	c->outgoing = NULL;
+	terminate_connection(c, c->edge);
 }
 
 static void drop_superfluous_outgoing_connection(void) {
-	/* Choose a random outgoing connection to a node that has at least one other connection. */
+	/* Choose a random outgoing connection to a node that has at least one other connection,
+	   or the one to the node furthest away if we prefer nodes with a low round trip time. */
 	uint32_t count = 0;
+	connection_t *furthest = NULL;
+	int furthest_rtt = -1;
 
 	for list_each(connection_t, c, &connection_list) {
-		if(!c->edge || !c->outgoing || !c->node || c->node->edge_tree.count < 2) {
+		if(!is_superfluous(c)) {
 			continue;
 		}
 
 		count++;
+
+		int rtt = node_rtt(c->node);
+
+		if(!furthest || rtt > furthest_rtt) {
+			furthest = c;
+			furthest_rtt = rtt;
+		}
 	}
 
 	if(!count) {
 		return;
 	}
 
+	if(autoconnect_strategy == AUTOCONNECT_RTT) {
+		drop_connection(furthest);
+		return;
+	}
+
 	uint32_t r = prng(count);
 
 	for list_each(connection_t, c, &connection_list) {
-		if(!c->edge || !c->outgoing || !c->node || c->node->edge_tree.count < 2) {
+		if(!is_superfluous(c)) {
 			continue;
 		}
 
@@ -139,10 +233,7 @@ static void drop_superfluous_outgoing_connection(void) {
 			continue;
 		}
 
-		logger(DEBUG_CONNECTIONS, LOG_INFO, "Autodisconnecting from %s", c->name);
-		list_delete(&outgoing_list, c->outgoing);
-		c->outgoing = NULL;
-		terminate_connection(c, c->edge);
+		drop_connection(c);
 		break;
 	}
 }
@@ -20,6 +20,26 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include "system.h"
+
+#include "connection.h"
+
+typedef enum autoconnect_strategy_t {
+	AUTOCONNECT_RANDOM,             /* connect to random nodes */
+	AUTOCONNECT_RTT,                /* prefer nodes with the lowest round trip time */
+} autoconnect_strategy_t;
+
+/* Number of candidates compared by the RTT strategy */
+#define AUTOCONNECT_RTT_SAMPLES 8
+
+extern autoconnect_strategy_t autoconnect_strategy;
+
 extern void do_autoconnect(void);
 
+/* Must be called whenever a node's reachability, address or connection changes,
+   to keep the sets of nodes AutoConnect chooses from up to date. */
+extern void autoconnect_update(node_t *n);
+extern void autoconnect_forget(node_t *n);
+extern void autoconnect_exit(void);
+
 #endif
@@ -0,0 +1,407 @@
+#include "system.h"
+
+#include "bpf.h"
+#include "utils.h"
+#include "xalloc.h"
+
+static bool check_load(uint16_t code, uint32_t k) {
+	switch(BPF_MODE(code)) {
+	case BPF_IMM:
+	case BPF_LEN:
+		return true;
+
+	case BPF_MEM:
+		return k < BPF_MEM_WORDS;
+
+	case BPF_ABS:
+	case BPF_IND:
+		return BPF_CLASS(code) == BPF_LD && BPF_SIZE(code) != 0x18;
+
+	case BPF_MSH:
+		return BPF_CLASS(code) == BPF_LDX && BPF_SIZE(code) == BPF_B;
+
+	default:
+		return false;
+	}
+}
+
+static bool check_alu(uint16_t code, uint32_t k) {
+	switch(BPF_OP(code)) {
+	case BPF_ADD:
+	case BPF_SUB:
+	case BPF_MUL:
+	case BPF_OR:
+	case BPF_AND:
+	case BPF_XOR:
+	case BPF_NEG:
+		return true;
+
+	case BPF_DIV:
+	case BPF_MOD:
+		return BPF_SRC(code) == BPF_X || k;
+
+	case BPF_LSH:
+	case BPF_RSH:
+		return BPF_SRC(code) == BPF_X || k < 32;
+
+	default:
+		return false;
+	}
+}
+
+bool bpf_check(const bpf_insn_t *prog, uint32_t len) {
+	if(!prog || !len || len > BPF_MAX_INSNS) {
+		return false;
+	}
+
+	for(uint32_t pc = 0; pc < len; pc++) {
+		const bpf_insn_t *insn = &prog[pc];
+		uint16_t code = insn->code;
+		uint32_t left = len - pc - 1;
+
+		switch(BPF_CLASS(code)) {
+		case BPF_LD:
+		case BPF_LDX:
+			if(!check_load(code, insn->k)) {
+				return false;
+			}
+
+			break;
+
+		case BPF_ST:
+		case BPF_STX:
+			if(insn->k >= BPF_MEM_WORDS) {
+				return false;
+			}
+
+			break;
+
+		case BPF_ALU:
+			if(!check_alu(code, insn->k)) {
+				return false;
+			}
+
+			break;
+
+		case BPF_JMP:
+			switch(BPF_OP(code)) {
+			case BPF_JA:
+				if(insn->k >= left) {
+					return false;
+				}
+
+				break;
+
+			case BPF_JEQ:
+			case BPF_JGT:
+			case BPF_JGE:
+			case BPF_JSET:
+				if(insn->jt >= left || insn->jf >= left) {
+					return false;
+				}
+
+				break;
+
+			default:
+				return false;
+			}
+
+			break;
+
+		case BPF_RET:
+			break;
+
+		case BPF_MISC:
+			if(BPF_MISCOP(code) != BPF_TAX && BPF_MISCOP(code) != BPF_TXA) {
+				return false;
+			}
+
+			break;
+		}
+	}
+
+	return BPF_CLASS(prog[len - 1].code) == BPF_RET;
+}
+
+static bool load(const uint8_t *packet, uint32_t len, uint32_t offset, uint32_t size, uint32_t *result) {
+	if(offset >= len || size > len - offset) {
+		return false;
+	}
+
+	uint32_t value = 0;
+
+	for(uint32_t i = 0; i < size; i++) {
+		value = value << 8 | packet[offset + i];
+	}
+
+	*result = value;
+	return true;
+}
+
+static uint32_t load_size(uint16_t code) {
+	switch(BPF_SIZE(code)) {
+	case BPF_W:
+		return 4;
+
+	case BPF_H:
+		return 2;
+
+	default:
+		return 1;
+	}
+}
+
+static uint32_t alu(uint16_t code, uint32_t a, uint32_t b) {
+	switch(BPF_OP(code)) {
+	case BPF_ADD:
+		return a + b;
+
+	case BPF_SUB:
+		return a - b;
+
+	case BPF_MUL:
+		return a * b;
+
+	case BPF_DIV:
+		return b ? a / b : 0;
+
+	case BPF_MOD:
+		return b ? a % b : 0;
+
+	case BPF_OR:
+		return a | b;
+
+	case BPF_AND:
+		return a & b;
+
+	case BPF_XOR:
+		return a ^ b;
+
+	case BPF_LSH:
+		return b < 32 ? a << b : 0;
+
+	case BPF_RSH:
+		return b < 32 ? a >> b : 0;
+
+	case BPF_NEG:
+		return -a;
+
+	default:
+		return 0;
+	}
+}
+
+static bool jump(uint16_t code, uint32_t a, uint32_t b) {
+	switch(BPF_OP(code)) {
+	case BPF_JEQ:
+		return a == b;
+
+	case BPF_JGT:
+		return a > b;
+
+	case BPF_JGE:
+		return a >= b;
+
+	case BPF_JSET:
+		return a & b;
+
+	default:
+		return false;
+	}
+}
+
+/* Loads past the end of the packet and division by zero reject the packet, like in the kernel */
+
+uint32_t bpf_run(const bpf_insn_t *prog, const uint8_t *packet, uint32_t len) {
+	uint32_t a = 0;
+	uint32_t x = 0;
+	uint32_t mem[BPF_MEM_WORDS] = {0};
+
+	for(const bpf_insn_t *insn = prog;; insn++) {
+		uint16_t code = insn->code;
+		uint32_t k = insn->k;
+
+		switch(BPF_CLASS(code)) {
+		case BPF_LD:
+			switch(BPF_MODE(code)) {
+			case BPF_IMM:
+				a = k;
+				break;
+
+			case BPF_LEN:
+				a = len;
+				break;
+
+			case BPF_MEM:
+				a = mem[k];
+				break;
+
+			case BPF_ABS:
+				if(!load(packet, len, k, load_size(code), &a)) {
+					return 0;
+				}
+
+				break;
+
+			case BPF_IND:
+				if(x + k < x || !load(packet, len, x + k, load_size(code), &a)) {
+					return 0;
+				}
+
+				break;
+			}
+
+			break;
+
+		case BPF_LDX:
+			switch(BPF_MODE(code)) {
+			case BPF_IMM:
+				x = k;
+				break;
+
+			case BPF_LEN:
+				x = len;
+				break;
+
+			case BPF_MEM:
+				x = mem[k];
+				break;
+
+			case BPF_MSH:
+				if(!load(packet, len, k, 1, &x)) {
+					return 0;
+				}
+
+				x = (x & 0xf) << 2;
+				break;
+			}
+
+			break;
+
+		case BPF_ST:
+			mem[k] = a;
+			break;
+
+		case BPF_STX:
+			mem[k] = x;
+			break;
+
+		case BPF_ALU: {
+			uint32_t b = BPF_SRC(code) == BPF_X ? x : k;
+
+			if((BPF_OP(code) == BPF_DIV || BPF_OP(code) == BPF_MOD) && !b) {
+				return 0;
+			}
+
+			a = alu(code, a, b);
+			break;
+		}
+
+		case BPF_JMP:
+			if(BPF_OP(code) == BPF_JA) {
+				insn += k;
+			} else {
+				insn += jump(code, a, BPF_SRC(code) == BPF_X ? x : k) ? insn->jt : insn->jf;
+			}
+
+			break;
+
+		case BPF_RET:
+			return BPF_RVAL(code) == BPF_A ? a : k;
+
+		case BPF_MISC:
+			if(BPF_MISCOP(code) == BPF_TAX) {
+				x = a;
+			} else {
+				a = x;
+			}
+
+			break;
+		}
+	}
+}
+
+static bool parse_number(const char **text, unsigned long max, unsigned long *result) {
+	const char *p = *text;
+
+	while(*p == ',' || isspace((unsigned char)*p)) {
+		p++;
+	}
+
+	if(!isdigit((unsigned char)*p)) {
+		return false;
+	}
+
+	char *end;
+	errno = 0;
+	*result = strtoul(p, &end, 10);
+
+	if(errno || *result > max) {
+		return false;
+	}
+
+	*text = end;
+	return true;
+}
+
+uint32_t bpf_parse(const char *text, bpf_insn_t **prog) {
+	unsigned long count;
+
+	if(!parse_number(&text, BPF_MAX_INSNS, &count) || !count) {
+		return 0;
+	}
+
+	bpf_insn_t *result = xzalloc(count * sizeof(*result));
+
+	for(unsigned long i = 0; i < count; i++) {
+		unsigned long code, jt, jf, k;
+
+		if(!parse_number(&text, UINT16_MAX, &code)
+		                || !parse_number(&text, UINT8_MAX, &jt)
+		                || !parse_number(&text, UINT8_MAX, &jf)
+		                || !parse_number(&text, UINT32_MAX, &k)) {
+			free(result);
+			return 0;
+		}
+
+		result[i].code = (uint16_t)code;
+		result[i].jt = (uint8_t)jt;
+		result[i].jf = (uint8_t)jf;
+		result[i].k = (uint32_t)k;
+	}
+
+	while(*text == ',' || isspace((unsigned char)*text)) {
+		text++;
+	}
+
+	if(*text) {
+		free(result);
+		return 0;
+	}
+
+	*prog = result;
+	return (uint32_t)count;
+}
+
+void bpf_insn_to_hex(const bpf_insn_t *insn, char hex[BPF_INSN_HEX + 1]) {
+	uint8_t bin[BPF_INSN_HEX / 2] = {
+		insn->code >> 8, insn->code, insn->jt, insn->jf,
+		insn->k >> 24, insn->k >> 16, insn->k >> 8, insn->k,
+	};
+
+	bin2hex(bin, hex, sizeof(bin));
+}
+
+bool bpf_insn_from_hex(const char *hex, bpf_insn_t *insn) {
+	uint8_t bin[BPF_INSN_HEX / 2];
+
+	if(hex2bin(hex, bin, sizeof(bin)) != sizeof(bin)) {
+		return false;
+	}
+
+	insn->code = (uint16_t)(bin[0] << 8 | bin[1]);
+	insn->jt = bin[2];
+	insn->jf = bin[3];
+	insn->k = (uint32_t)bin[4] << 24 | (uint32_t)bin[5] << 16 | (uint32_t)bin[6] << 8 | bin[7];
+	return true;
+}
@@ -0,0 +1,98 @@
+#ifndef TINC_BPF_H
+#define TINC_BPF_H
+
+#include "system.h"
+
+/* An interpreter for classic BPF programs, as generated by tcpdump -ddd or
+   libpcap's pcap_compile(). Used to filter packets captured with tinc pcap,
+   so tincd only has to copy the ones the user is interested in. */
+
+#define BPF_MAX_INSNS 4096
+#define BPF_MEM_WORDS 16
+
+/* The opcodes are the same everywhere, but may already be defined by system headers */
+#ifndef BPF_CLASS
+#define BPF_CLASS(code) ((code) & 0x07)
+#define BPF_LD          0x00
+#define BPF_LDX         0x01
+#define BPF_ST          0x02
+#define BPF_STX         0x03
+#define BPF_ALU         0x04
+#define BPF_JMP         0x05
+#define BPF_RET         0x06
+#define BPF_MISC        0x07
+
+#define BPF_SIZE(code)  ((code) & 0x18)
+#define BPF_W           0x00
+#define BPF_H           0x08
+#define BPF_B           0x10
+
+#define BPF_MODE(code)  ((code) & 0xe0)
+#define BPF_IMM         0x00
+#define BPF_ABS         0x20
+#define BPF_IND         0x40
+#define BPF_MEM         0x60
+#define BPF_LEN         0x80
+#define BPF_MSH         0xa0
+
+#define BPF_OP(code)    ((code) & 0xf0)
+#define BPF_ADD         0x00
+#define BPF_SUB         0x10
+#define BPF_MUL         0x20
+#define BPF_DIV         0x30
+#define BPF_OR          0x40
+#define BPF_AND         0x50
+#define BPF_LSH         0x60
+#define BPF_RSH         0x70
+#define BPF_NEG         0x80
+#define BPF_JA          0x00
+#define BPF_JEQ         0x10
+#define BPF_JGT         0x20
+#define BPF_JGE         0x30
+#define BPF_JSET        0x40
+
+#define BPF_SRC(code)   ((code) & 0x08)
+#define BPF_K           0x00
+#define BPF_X           0x08
+
+#define BPF_RVAL(code)  ((code) & 0x18)
+#define BPF_A           0x10
+
+#define BPF_MISCOP(code) ((code) & 0xf8)
+#define BPF_TAX         0x00
+#define BPF_TXA         0x80
+#endif
+
+/* Not in every system's headers */
+#ifndef BPF_MOD
+#define BPF_MOD         0x90
+#endif
+#ifndef BPF_XOR
+#define BPF_XOR         0xa0
+#endif
+
+typedef struct bpf_insn_t {
+	uint16_t code;
+	uint8_t jt;
+	uint8_t jf;
+	uint32_t k;
+} bpf_insn_t;
+
+/* Check that a program is safe to run: it only jumps forward to existing
+   instructions, only uses valid memory words, and always ends with a return. */
+extern bool bpf_check(const bpf_insn_t *prog, uint32_t len);
+
+/* Run a checked program on a packet. Returns how many bytes of it to capture, 0 to skip it. */
+extern uint32_t bpf_run(const bpf_insn_t *prog, const uint8_t *packet, uint32_t len);
+
+/* Parse the output of tcpdump -ddd: the number of instructions, followed by
+   four numbers for each. Returns the number of instructions, or 0 on error. */
+extern uint32_t bpf_parse(const char *text, bpf_insn_t **prog);
+
+/* Instructions are sent to tincd as 16 hexadecimal digits each, in network byte order */
+#define BPF_INSN_HEX 16
+
+extern void bpf_insn_to_hex(const bpf_insn_t *insn, char hex[BPF_INSN_HEX + 1]);
+extern bool bpf_insn_from_hex(const char *hex, bpf_insn_t *insn);
+
+#endif // TINC_BPF_H
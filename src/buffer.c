@@ -108,3 +108,230 @@ void buffer_clear(buffer_t *buffer) {
 	buffer->len = 0;
 	buffer->offset = 0;
 }
+
+/* Chunks of the default size are kept in a pool when they are released,
+   so a busy connection does not need to go back to malloc() all the time */
+
+#define CHUNK_POOL_MAX 64
+
+static buffer_chunk_t *chunk_pool;
+static uint32_t chunk_pool_count;
+
+static buffer_chunk_t *chunk_alloc(uint32_t size) {
+	buffer_chunk_t *chunk;
+
+	if(size <= BUFFER_CHUNK_SIZE && chunk_pool) {
+		chunk = chunk_pool;
+		chunk_pool = chunk->next;
+		chunk_pool_count--;
+	} else {
+		if(size < BUFFER_CHUNK_SIZE) {
+			size = BUFFER_CHUNK_SIZE;
+		}
+
+		chunk = xmalloc(sizeof(*chunk) + size);
+		chunk->size = size;
+	}
+
+	chunk->next = NULL;
+	chunk->start = 0;
+	chunk->end = 0;
+	return chunk;
+}
+
+static void chunk_free(buffer_chunk_t *chunk) {
+	if(chunk->size == BUFFER_CHUNK_SIZE && chunk_pool_count < CHUNK_POOL_MAX) {
+		chunk->next = chunk_pool;
+		chunk_pool = chunk;
+		chunk_pool_count++;
+	} else {
+		free(chunk);
+	}
+}
+
+void chunk_pool_clear(void) {
+	while(chunk_pool) {
+		buffer_chunk_t *next = chunk_pool->next;
+		free(chunk_pool);
+		chunk_pool = next;
+	}
+
+	chunk_pool_count = 0;
+}
+
+static buffer_chunk_t *chunk_buffer_append(chunk_buffer_t *buffer, uint32_t size) {
+	buffer_chunk_t *chunk = chunk_alloc(size);
+
+	if(buffer->tail) {
+		buffer->tail->next = chunk;
+	} else {
+		buffer->head = chunk;
+	}
+
+	buffer->tail = chunk;
+	return chunk;
+}
+
+// Make sure we can add size contiguous bytes to the buffer, and return a pointer to the start of those bytes.
+
+char *chunk_buffer_prepare(chunk_buffer_t *buffer, uint32_t size) {
+	buffer_chunk_t *chunk = buffer->tail;
+
+	if(!chunk || chunk->size - chunk->end < size) {
+		chunk = chunk_buffer_append(buffer, size);
+	}
+
+	char *start = chunk->data + chunk->end;
+	chunk->end += size;
+	buffer->len += size;
+	return start;
+}
+
+// Copy data into the buffer, filling up the last chunk before starting a new one.
+
+void chunk_buffer_add(chunk_buffer_t *buffer, const void *vdata, uint32_t size) {
+	const char *data = vdata;
+
+	while(size) {
+		buffer_chunk_t *chunk = buffer->tail;
+
+		if(!chunk || chunk->end == chunk->size) {
+			chunk = chunk_buffer_append(buffer, BUFFER_CHUNK_SIZE);
+		}
+
+		uint32_t len = chunk->size - chunk->end;
+
+		if(len > size) {
+			len = size;
+		}
+
+		memcpy(chunk->data + chunk->end, data, len);
+		chunk->end += len;
+		buffer->len += len;
+		data += len;
+		size -= len;
+	}
+}
+
+// Remove given number of bytes from the start of the buffer, releasing chunks that are no longer needed.
+
+void chunk_buffer_consume(chunk_buffer_t *buffer, uint32_t size) {
+	while(size && buffer->head) {
+		buffer_chunk_t *chunk = buffer->head;
+		uint32_t len = chunk->end - chunk->start;
+
+		if(len > size) {
+			len = size;
+		}
+
+		chunk->start += len;
+		buffer->len -= len;
+		size -= len;
+
+		if(chunk->start == chunk->end) {
+			buffer->head = chunk->next;
+
+			if(!buffer->head) {
+				buffer->tail = NULL;
+			}
+
+			chunk_free(chunk);
+		}
+	}
+}
+
+void chunk_buffer_clear(chunk_buffer_t *buffer) {
+	while(buffer->head) {
+		buffer_chunk_t *next = buffer->head->next;
+		chunk_free(buffer->head);
+		buffer->head = next;
+	}
+
+	buffer->tail = NULL;
+	buffer->len = 0;
+}
+
+#ifndef HAVE_WINDOWS
+// Describe the unconsumed data in at most maxiov iovecs, for use with sendmsg().
+
+int chunk_buffer_iov(const chunk_buffer_t *buffer, struct iovec *iov, int maxiov) {
+	int count = 0;
+
+	for(buffer_chunk_t *chunk = buffer->head; chunk && count < maxiov; chunk = chunk->next) {
+		if(chunk->end > chunk->start) {
+			iov[count].iov_base = chunk->data + chunk->start;
+			iov[count].iov_len = chunk->end - chunk->start;
+			count++;
+		}
+	}
+
+	return count;
+}
+#endif
+
+shared_buffer_t *shared_buffer_alloc(uint8_t type, const void *data, uint16_t len) {
+	shared_buffer_t *buffer = xmalloc(sizeof(*buffer) + len);
+	buffer->refcount = 1;
+	buffer->len = len;
+	buffer->type = type;
+	buffer->flags = 0;
+	memcpy(buffer->data, data, len);
+	return buffer;
+}
+
+shared_buffer_t *shared_buffer_ref(shared_buffer_t *buffer) {
+	buffer->refcount++;
+	return buffer;
+}
+
+void shared_buffer_unref(shared_buffer_t *buffer) {
+	if(buffer && !--buffer->refcount) {
+		free(buffer);
+	}
+}
+
+// Add a reference to the buffer to the end of the queue.
+
+void shared_queue_push(shared_queue_t *queue, shared_buffer_t *buffer) {
+	if(queue->count == queue->size) {
+		uint32_t size = queue->size ? queue->size * 2 : 16;
+		shared_buffer_t **items = xmalloc(size * sizeof(*items));
+
+		for(uint32_t i = 0; i < queue->count; i++) {
+			items[i] = queue->items[(queue->head + i) & (queue->size - 1)];
+		}
+
+		free(queue->items);
+		queue->items = items;
+		queue->size = size;
+		queue->head = 0;
+	}
+
+	queue->items[(queue->head + queue->count++) & (queue->size - 1)] = shared_buffer_ref(buffer);
+	queue->bytes += buffer->len;
+}
+
+// Remove the first buffer from the queue. The caller takes over the queue's reference to it.
+
+shared_buffer_t *shared_queue_pop(shared_queue_t *queue) {
+	if(!queue->count) {
+		return NULL;
+	}
+
+	shared_buffer_t *buffer = queue->items[queue->head];
+	queue->head = (queue->head + 1) & (queue->size - 1);
+	queue->count--;
+	queue->bytes -= buffer->len;
+	return buffer;
+}
+
+void shared_queue_clear(shared_queue_t *queue) {
+	while(queue->count) {
+		shared_buffer_unref(shared_queue_pop(queue));
+	}
+
+	free(queue->items);
+	queue->items = NULL;
+	queue->size = 0;
+	queue->head = 0;
+}
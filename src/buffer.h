@@ -17,4 +17,61 @@ extern char *buffer_readline(buffer_t *buffer);
 extern char *buffer_read(buffer_t *buffer, uint32_t size);
 extern void buffer_clear(buffer_t *buffer);
 
+/* An output buffer made of a chain of chunks, so appending never moves data that is already queued */
+
+#define BUFFER_CHUNK_SIZE 16384
+
+typedef struct buffer_chunk_t {
+	struct buffer_chunk_t *next;
+	uint32_t size;                  /* capacity of data[] */
+	uint32_t start;                 /* first byte that has not been consumed yet */
+	uint32_t end;                   /* end of the data written so far */
+	char data[];
+} buffer_chunk_t;
+
+typedef struct chunk_buffer_t {
+	buffer_chunk_t *head;
+	buffer_chunk_t *tail;
+	uint32_t len;                   /* number of unconsumed bytes in all chunks */
+} chunk_buffer_t;
+
+extern char *chunk_buffer_prepare(chunk_buffer_t *buffer, uint32_t size);
+extern void chunk_buffer_add(chunk_buffer_t *buffer, const void *data, uint32_t size);
+extern void chunk_buffer_consume(chunk_buffer_t *buffer, uint32_t size);
+extern void chunk_buffer_clear(chunk_buffer_t *buffer);
+extern void chunk_pool_clear(void);
+
+#ifndef HAVE_WINDOWS
+extern int chunk_buffer_iov(const chunk_buffer_t *buffer, struct iovec *iov, int maxiov);
+#endif
+
+/* A reference counted block of data, so the same message can be queued on many connections without copying it */
+
+#define SHARED_RAW  0x01                /* send the data as-is instead of as an SPTPS record */
+#define SHARED_MORE 0x02                /* the next buffer in the queue is part of the same message */
+
+typedef struct shared_buffer_t {
+	uint32_t refcount;
+	uint16_t len;
+	uint8_t type;                   /* SPTPS record type */
+	uint8_t flags;
+	uint8_t data[];
+} shared_buffer_t;
+
+typedef struct shared_queue_t {
+	shared_buffer_t **items;        /* ring buffer */
+	uint32_t size;                  /* number of slots, always a power of two */
+	uint32_t head;
+	uint32_t count;
+	uint32_t bytes;                 /* total length of all queued buffers */
+} shared_queue_t;
+
+extern shared_buffer_t *shared_buffer_alloc(uint8_t type, const void *data, uint16_t len) ATTR_MALLOC;
+extern shared_buffer_t *shared_buffer_ref(shared_buffer_t *buffer);
+extern void shared_buffer_unref(shared_buffer_t *buffer);
+
+extern void shared_queue_push(shared_queue_t *queue, shared_buffer_t *buffer);
+extern shared_buffer_t *shared_queue_pop(shared_queue_t *queue);
+extern void shared_queue_clear(shared_queue_t *queue);
+
 #endif
@@ -0,0 +1,293 @@
+/*
+    compression.c -- Zstandard packet and stream compression
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compression.h"
+#include "logger.h"
+#include "xalloc.h"
+
+/* Dictionaries are typically around 100 kB, refuse anything unreasonably large */
+#define DICTIONARY_MAX (4 << 20)
+
+bool stream_compression = false;
+
+#ifdef HAVE_ZSTD
+
+static ZSTD_CCtx *packet_cctx;
+static ZSTD_DCtx *packet_dctx;
+static ZSTD_CDict *packet_cdict;
+static ZSTD_DDict *packet_ddict;
+
+struct compression_stream_t {
+	ZSTD_CCtx *cctx;
+	ZSTD_DCtx *dctx;
+};
+
+/* Records are compressed and decompressed one at a time from the event loop,
+   so all connections can share these buffers. */
+
+static uint8_t stream_out[ZSTD_COMPRESSBOUND(COMPRESSION_STREAM_RECORD_MAX + 1)];
+static uint8_t stream_in[1 + UINT16_MAX + 1];
+
+static void free_dictionary(void) {
+	ZSTD_freeCDict(packet_cdict);
+	ZSTD_freeDDict(packet_ddict);
+	packet_cdict = NULL;
+	packet_ddict = NULL;
+}
+
+bool compression_load_dictionary(const char *filename) {
+	free_dictionary();
+
+	if(!filename) {
+		return true;
+	}
+
+	FILE *f = fopen(filename, "rb");
+
+	if(!f) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Could not open compression dictionary %s: %s", filename, strerror(errno));
+		return false;
+	}
+
+	uint8_t *dict = xmalloc(DICTIONARY_MAX);
+	size_t len = fread(dict, 1, DICTIONARY_MAX, f);
+	bool toolarge = !feof(f);
+	fclose(f);
+
+	if(!len || toolarge) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Compression dictionary %s is %s", filename, len ? "too large" : "empty");
+		free(dict);
+		return false;
+	}
+
+	packet_cdict = ZSTD_createCDict(dict, len, COMPRESS_ZSTD_LEVEL);
+	packet_ddict = ZSTD_createDDict(dict, len);
+	free(dict);
+
+	if(!packet_cdict || !packet_ddict) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Could not load compression dictionary %s", filename);
+		free_dictionary();
+		return false;
+	}
+
+	logger(DEBUG_ALWAYS, LOG_INFO, "Loaded compression dictionary %s with ID %u", filename, ZSTD_getDictID_fromDDict(packet_ddict));
+	return true;
+}
+
+void compression_exit(void) {
+	free_dictionary();
+	ZSTD_freeCCtx(packet_cctx);
+	ZSTD_freeDCtx(packet_dctx);
+	packet_cctx = NULL;
+	packet_dctx = NULL;
+}
+
+size_t compress_zstd(uint8_t *dest, size_t destlen, const uint8_t *source, size_t len) {
+	if(!packet_cctx) {
+		packet_cctx = ZSTD_createCCtx();
+
+		if(!packet_cctx) {
+			return 0;
+		}
+	}
+
+	size_t result;
+
+	if(packet_cdict) {
+		result = ZSTD_compress_usingCDict(packet_cctx, dest, destlen, source, len, packet_cdict);
+	} else {
+		result = ZSTD_compressCCtx(packet_cctx, dest, destlen, source, len, COMPRESS_ZSTD_LEVEL);
+	}
+
+	return ZSTD_isError(result) ? 0 : result;
+}
+
+size_t uncompress_zstd(uint8_t *dest, size_t destlen, const uint8_t *source, size_t len) {
+	if(!packet_dctx) {
+		packet_dctx = ZSTD_createDCtx();
+
+		if(!packet_dctx) {
+			return 0;
+		}
+	}
+
+	size_t result;
+
+	if(packet_ddict) {
+		result = ZSTD_decompress_usingDDict(packet_dctx, dest, destlen, source, len, packet_ddict);
+	} else {
+		result = ZSTD_decompressDCtx(packet_dctx, dest, destlen, source, len);
+	}
+
+	return ZSTD_isError(result) ? 0 : result;
+}
+
+compression_stream_t *compression_stream_new(bool compress) {
+	compression_stream_t *stream = xzalloc(sizeof(*stream));
+
+	if(compress) {
+		stream->cctx = ZSTD_createCCtx();
+
+		if(stream->cctx) {
+			ZSTD_CCtx_setParameter(stream->cctx, ZSTD_c_compressionLevel, COMPRESSION_STREAM_LEVEL);
+			ZSTD_CCtx_setParameter(stream->cctx, ZSTD_c_windowLog, COMPRESSION_STREAM_WINDOW_LOG);
+		}
+	} else {
+		stream->dctx = ZSTD_createDCtx();
+
+		if(stream->dctx) {
+			ZSTD_DCtx_setParameter(stream->dctx, ZSTD_d_windowLogMax, COMPRESSION_STREAM_WINDOW_LOG);
+		}
+	}
+
+	if(!stream->cctx && !stream->dctx) {
+		free(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+void compression_stream_free(compression_stream_t *stream) {
+	if(!stream) {
+		return;
+	}
+
+	ZSTD_freeCCtx(stream->cctx);
+	ZSTD_freeDCtx(stream->dctx);
+	free(stream);
+}
+
+/* Compress the record type and its data, and flush the result so the other side
+   can decompress it completely. On failure, the stream cannot be used anymore. */
+
+const uint8_t *compression_stream_compress(compression_stream_t *stream, uint8_t type, const void *data, size_t len, size_t *outlen) {
+	if(len > COMPRESSION_STREAM_RECORD_MAX) {
+		return NULL;
+	}
+
+	ZSTD_outBuffer out = {stream_out, sizeof(stream_out), 0};
+	ZSTD_inBuffer in = {&type, 1, 0};
+
+	if(ZSTD_isError(ZSTD_compressStream2(stream->cctx, &out, &in, ZSTD_e_continue))) {
+		return NULL;
+	}
+
+	in = (ZSTD_inBuffer) {
+		data, len, 0
+	};
+
+	size_t remaining = ZSTD_compressStream2(stream->cctx, &out, &in, ZSTD_e_flush);
+
+	if(ZSTD_isError(remaining) || remaining) {
+		return NULL;
+	}
+
+	*outlen = out.pos;
+	return stream_out;
+}
+
+/* Decompress one record, returning the record type followed by its data.
+   The buffer is only valid until the next call. */
+
+uint8_t *compression_stream_uncompress(compression_stream_t *stream, const void *data, size_t len, size_t *outlen) {
+	ZSTD_inBuffer in = {data, len, 0};
+	ZSTD_outBuffer out = {stream_in, sizeof(stream_in), 0};
+
+	while(in.pos < in.size) {
+		size_t result = ZSTD_decompressStream(stream->dctx, &out, &in);
+
+		if(ZSTD_isError(result)) {
+			logger(DEBUG_META, LOG_DEBUG, "Error decompressing record: %s", ZSTD_getErrorName(result));
+			return NULL;
+		}
+
+		// A full buffer means the record is larger than any valid one
+
+		if(out.pos == out.size) {
+			return NULL;
+		}
+	}
+
+	*outlen = out.pos;
+	return stream_in;
+}
+
+#else
+
+bool compression_load_dictionary(const char *filename) {
+	if(filename) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Compression dictionaries require ZSTD compression, which is unavailable on this node.");
+		return false;
+	}
+
+	return true;
+}
+
+void compression_exit(void) {
+}
+
+size_t compress_zstd(uint8_t *dest, size_t destlen, const uint8_t *source, size_t len) {
+	(void)dest;
+	(void)destlen;
+	(void)source;
+	(void)len;
+	return 0;
+}
+
+size_t uncompress_zstd(uint8_t *dest, size_t destlen, const uint8_t *source, size_t len) {
+	(void)dest;
+	(void)destlen;
+	(void)source;
+	(void)len;
+	return 0;
+}
+
+compression_stream_t *compression_stream_new(bool compress) {
+	(void)compress;
+	return NULL;
+}
+
+void compression_stream_free(compression_stream_t *stream) {
+	(void)stream;
+}
+
+const uint8_t *compression_stream_compress(compression_stream_t *stream, uint8_t type, const void *data, size_t len, size_t *outlen) {
+	(void)stream;
+	(void)type;
+	(void)data;
+	(void)len;
+	(void)outlen;
+	return NULL;
+}
+
+uint8_t *compression_stream_uncompress(compression_stream_t *stream, const void *data, size_t len, size_t *outlen) {
+	(void)stream;
+	(void)data;
+	(void)len;
+	(void)outlen;
+	return NULL;
+}
+
+#endif
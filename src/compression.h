@@ -19,9 +19,69 @@ typedef enum compression_level_t {
 
 	COMPRESS_LZ4 = 12,
 
+	COMPRESS_ZSTD = 13,
+
 	COMPRESS_GUARD = INT_MAX, /* ensure that sizeof(compression_level_t) == sizeof(int) */
 } compression_level_t;
 
 STATIC_ASSERT(sizeof(compression_level_t) == sizeof(int), "compression_level_t has invalid size");
 
+/* Adaptive compression: when compressing doesn't help, stop trying for a
+   while, and wait twice as long each time it fails again. This is tracked
+   per node, or per flow (IP protocol and service port) within a node. */
+
+typedef enum adaptive_compression_t {
+	ADAPTIVE_COMPRESSION_OFF,
+	ADAPTIVE_COMPRESSION_NODE,
+	ADAPTIVE_COMPRESSION_FLOW,
+} adaptive_compression_t;
+
+#define COMPRESSION_FLOWS 16            /* flow buckets per node */
+#define COMPRESSION_BACKOFF_MIN 4       /* packets to skip after the first failure */
+#define COMPRESSION_BACKOFF_MAX 4096    /* packets to skip at most */
+
+typedef struct compression_flow_t {
+	uint16_t skip;                  /* packets left to send without trying to compress */
+	uint16_t backoff;               /* packets to skip after the next failure */
+} compression_flow_t;
+
+typedef struct compression_stats_t {
+	uint64_t attempts;              /* packets we tried to compress */
+	uint64_t failures;              /* attempts that did not save enough */
+	uint64_t skipped;               /* packets sent without trying */
+	uint64_t in_bytes;              /* bytes we tried to compress */
+	uint64_t out_bytes;             /* bytes sent for those */
+	uint64_t skipped_bytes;         /* bytes sent without trying */
+	uint64_t nsec;                  /* time spent compressing */
+} compression_stats_t;
+
+/* Zstandard compression of single packets, optionally using a dictionary
+   that has been trained on typical traffic. Both sides must load the same
+   dictionary, packets compressed with another one are rejected. */
+
+#define COMPRESS_ZSTD_LEVEL 3
+
+extern bool compression_load_dictionary(const char *filename);
+extern void compression_exit(void);
+extern size_t compress_zstd(uint8_t *dest, size_t destlen, const uint8_t *source, size_t len);
+extern size_t uncompress_zstd(uint8_t *dest, size_t destlen, const uint8_t *source, size_t len);
+
+/* Stream compression of SPTPS meta connections. Each record is compressed
+   using the history of all records sent before it on the same connection,
+   so even small requests and packets shrink well. The window is kept small,
+   since every connection needs its own state on both sides. */
+
+#define COMPRESSION_STREAM_LEVEL 1
+#define COMPRESSION_STREAM_WINDOW_LOG 16
+#define COMPRESSION_STREAM_RECORD_MAX 16384   /* larger records are sent uncompressed */
+
+typedef struct compression_stream_t compression_stream_t;
+
+extern bool stream_compression;
+
+extern compression_stream_t *compression_stream_new(bool compress);
+extern void compression_stream_free(compression_stream_t *stream);
+extern const uint8_t *compression_stream_compress(compression_stream_t *stream, uint8_t type, const void *data, size_t len, size_t *outlen);
+extern uint8_t *compression_stream_uncompress(compression_stream_t *stream, const void *data, size_t len, size_t *outlen);
+
 #endif // TINC_COMPRESSION_H
@@ -25,7 +25,9 @@
 #include "cipher.h"
 #include "conf.h"
 #include "control_common.h"
+#include "dump.h"
 #include "logger.h"
+#include "meta.h"
 #include "net.h"
 #include "rsa.h"
 #include "utils.h"
@@ -51,6 +53,8 @@ void exit_connections(void) {
 
 	free_connection(everyone);
 	everyone = NULL;
+
+	chunk_pool_clear();
 }
 
 connection_t *new_connection(void) {
@@ -127,12 +131,19 @@ void free_connection(connection_t *c) {
 
 	sptps_stop(&c->sptps);
 	ecdsa_free(c->ecdsa);
+	compression_stream_free(c->compress_in);
+	compression_stream_free(c->compress_out);
 
 	free(c->hischallenge);
 	free(c->mychallenge);
+	free(c->pcap_filter);
+	free_dump(c->dump);
 
 	buffer_clear(&c->inbuf);
-	buffer_clear(&c->outbuf);
+	chunk_buffer_clear(&c->outbuf);
+	for(int lane = 0; lane < META_LANES; lane++) {
+		shared_queue_clear(&c->outqueue[lane]);
+	}
 
 	io_del(&c->io);
 
@@ -162,12 +173,33 @@ void connection_del(connection_t *c) {
 	list_delete(&connection_list, c);
 }
 
-bool dump_connections(connection_t *cdump) {
-	for list_each(connection_t, c, &connection_list) {
-		send_request(cdump, "%d %d %s %s %x %d %x",
+static void dump_connection(connection_t *cdump, const connection_t *c) {
+	if(!dump_is_json(cdump)) {
+		send_request(cdump, "%d %d %s %s %x %d %x %u %u",
 		             CONTROL, REQ_DUMP_CONNECTIONS,
 		             c->name, c->hostname, c->options, c->socket,
-		             c->status.value);
+		             c->status.value, meta_output_len(c), c->outdrops);
+		return;
+	}
+
+	json_t json;
+	json_begin(&json);
+	json_string(&json, "name", c->name);
+	json_string(&json, "hostname", c->hostname);
+	json_uint(&json, "options", c->options);
+	json_int(&json, "socket", c->socket);
+	json_uint(&json, "status", c->status.value);
+	json_bool(&json, "control", c->status.control);
+	json_uint(&json, "outq", meta_output_len(c));
+	json_uint(&json, "dropped", c->outdrops);
+	dump_json(cdump, REQ_DUMP_CONNECTIONS, &json);
+}
+
+/* There are only as many connections as direct peers, so they are dumped in one go */
+
+bool dump_connections(connection_t *cdump) {
+	for list_each(connection_t, c, &connection_list) {
+		dump_connection(cdump, c);
 	}
 
 	return send_request(cdump, "%d %d", CONTROL, REQ_DUMP_CONNECTIONS);
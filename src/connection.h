@@ -23,6 +23,7 @@
 
 #include "buffer.h"
 #include "cipher.h"
+#include "compression.h"
 #include "digest.h"
 #include "rsa.h"
 #include "list.h"
@@ -33,6 +34,7 @@
 #define OPTION_TCPONLY          0x0002
 #define OPTION_PMTU_DISCOVERY   0x0004
 #define OPTION_CLAMP_MSS        0x0008
+#define OPTION_STREAM_COMPRESSION 0x0010
 #define OPTION_VERSION(x) ((x) >> 24) /* Top 8 bits are for protocol minor version */
 
 typedef union connection_status_t {
@@ -52,10 +54,26 @@ typedef union connection_status_t {
 		bool invitation: 1;             /* 1 if this is an invitation */
 		bool invitation_used: 1;        /* 1 if the invitation has been consumed */
 		bool tarpit: 1;                 /* 1 if the connection should be added to the tarpit */
+		bool outqueue_overflow: 1;      /* 1 if one of the output lanes exceeded its limit */
+		bool outpayload: 1;             /* 1 if the payload of a PACKET or SPTPS_PACKET request is to be sent next */
+		bool events_lost: 1;            /* 1 if events were dropped because this control connection did not keep up */
+		bool fixed_weight: 1;           /* 1 if the weight of the edge was configured, and is not updated from the RTT */
 	};
 	uint32_t value;
 } connection_status_t;
 
+/* Output lanes of an SPTPS meta connection, from highest to lowest priority.
+   Requests in a higher priority lane overtake those in lower priority lanes,
+   requests within the same lane are never reordered. */
+
+typedef enum meta_lane_t {
+	LANE_CONTROL,                   /* PING, PONG and everything not listed below */
+	LANE_KEY,                       /* KEY_CHANGED, REQ_KEY and ANS_KEY */
+	LANE_TOPOLOGY,                  /* ADD_EDGE, DEL_EDGE, ADD_SUBNET and DEL_SUBNET */
+	LANE_DATA,                      /* PACKET and SPTPS_PACKET */
+	META_LANES,
+} meta_lane_t;
+
 #include "ecdsa.h"
 #include "edge.h"
 #include "net.h"
@@ -106,15 +124,23 @@ typedef struct connection_t {
 
 	ecdsa_t *ecdsa;                 /* his public ECDSA key */
 	sptps_t sptps;
+	compression_stream_t *compress_in;  /* decompresses records he sends, if we asked for it */
+	compression_stream_t *compress_out; /* compresses records we send, if both sides asked for it */
 
 	int outmaclength;
+	struct bpf_insn_t *pcap_filter; /* only capture packets accepted by this program, used for REQ_PCAP */
+	uint32_t pcap_filter_len;
 	debug_t log_level;              /* used for REQ_LOG */
+	uint32_t event_mask;            /* used for REQ_SUBSCRIBE */
+	struct dump_t *dump;            /* output format and progress of dumps, used for REQ_DUMP_* */
 
 	uint8_t *hischallenge;          /* The challenge we sent to him */
 	uint8_t *mychallenge;           /* The challenge we received */
 
 	struct buffer_t inbuf;
-	struct buffer_t outbuf;
+	struct chunk_buffer_t outbuf;
+	struct shared_queue_t outqueue[META_LANES]; /* requests that still have to be encrypted into outbuf */
+	uint32_t outdrops;              /* number of packets dropped because the output buffer was full */
 	io_t io;                        /* input/output event on this metadata connection */
 	int tcplen;                     /* length of incoming TCPpacket */
 	int sptpslen;                   /* length of incoming SPTPS packet */
@@ -18,15 +18,23 @@
 */
 
 #include "system.h"
+#include "bpf.h"
 #include "conf.h"
 #include "control.h"
 #include "control_common.h"
+#include "dump.h"
+#include "event.h"
+#include "events.h"
+#include "graph.h"
+#include "handshake.h"
 #include "logger.h"
 #include "names.h"
 #include "net.h"
 #include "netutl.h"
 #include "protocol.h"
+#include "resolver.h"
 #include "route.h"
+#include "script.h"
 #include "utils.h"
 #include "xalloc.h"
 #include "random.h"
@@ -42,6 +50,152 @@ static bool control_ok(connection_t *c, int type) {
 	return control_return(c, type, 0);
 }
 
+static void send_stat(connection_t *c, const char *name, uint64_t value) {
+	if(!dump_is_json(c)) {
+		send_request(c, "%d %d %s %"PRIu64, CONTROL, REQ_DUMP_STATS, name, value);
+		return;
+	}
+
+	json_t json;
+	json_begin(&json);
+	json_string(&json, "name", name);
+	json_uint(&json, "value", value);
+	dump_json(c, REQ_DUMP_STATS, &json);
+}
+
+static bool dump_stats(connection_t *c) {
+	const worker_stats_t *handshake = handshake_stats();
+
+	send_stat(c, "handshake_queue_depth", handshake->depth);
+	send_stat(c, "handshake_queue_max_depth", handshake->max_depth);
+	send_stat(c, "handshake_jobs", handshake->jobs);
+	send_stat(c, "handshake_latency_avg_us", handshake->jobs ? handshake->latency_total / handshake->jobs : 0);
+	send_stat(c, "handshake_latency_max_us", handshake->latency_max);
+
+	send_stat(c, "resolver_hits", resolver_stats.hits);
+	send_stat(c, "resolver_misses", resolver_stats.misses);
+	send_stat(c, "resolver_failures", resolver_stats.failures);
+
+	send_stat(c, "past_request_hits", past_request_stats.hits);
+	send_stat(c, "past_request_misses", past_request_stats.misses);
+	send_stat(c, "past_request_rotations", past_request_stats.rotations);
+	send_stat(c, "past_request_overflows", past_request_stats.overflows);
+
+	send_stat(c, "slow_callbacks", event_stats.slow_callbacks);
+
+	send_stat(c, "pcap_captured", pcap_stats.captured);
+	send_stat(c, "pcap_filtered", pcap_stats.filtered);
+	send_stat(c, "pcap_dropped", pcap_stats.dropped);
+
+	send_stat(c, "log_dropped", log_stats.dropped);
+	send_stat(c, "log_suppressed", log_stats.suppressed);
+
+	return send_request(c, "%d %d", CONTROL, REQ_DUMP_STATS);
+}
+
+static void send_latency(connection_t *c, const char *name, const histogram_t *h) {
+	uint64_t avg = h->count ? h->sum / h->count : 0;
+
+	if(!dump_is_json(c)) {
+		send_request(c, "%d %d %s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64, CONTROL, REQ_DUMP_LATENCY, name,
+		             h->count, avg, histogram_percentile(h, 50), histogram_percentile(h, 90), histogram_percentile(h, 99), h->max);
+		return;
+	}
+
+	json_t json;
+	json_begin(&json);
+	json_string(&json, "name", name);
+	json_uint(&json, "count", h->count);
+	json_uint(&json, "avg_us", avg);
+	json_uint(&json, "p50_us", histogram_percentile(h, 50));
+	json_uint(&json, "p90_us", histogram_percentile(h, 90));
+	json_uint(&json, "p99_us", histogram_percentile(h, 99));
+	json_uint(&json, "max_us", h->max);
+	dump_json(c, REQ_DUMP_LATENCY, &json);
+}
+
+static void send_slowest(connection_t *c) {
+	if(!dump_is_json(c)) {
+		send_request(c, "%d %d slowest %s %"PRIu64, CONTROL, REQ_DUMP_LATENCY, event_stats.slowest_name, event_stats.slowest);
+		return;
+	}
+
+	json_t json;
+	json_begin(&json);
+	json_string(&json, "slowest", event_stats.slowest_name);
+	json_uint(&json, "duration_us", event_stats.slowest);
+	dump_json(c, REQ_DUMP_LATENCY, &json);
+}
+
+/* The histograms are also exported as metrics, which must never go down. Resetting them
+   only takes a snapshot, and dump latency shows what was added since the last snapshot. */
+
+static const struct {
+	const char *name;
+	const histogram_t *h;
+} latencies[] = {
+	{"event_loop", &event_loop_latency},
+	{"io_callbacks", &event_stats.io},
+	{"timeout_callbacks", &event_stats.timeout},
+	{"timeouts", &event_stats.timeouts},
+	{"timeout_lag", &event_stats.timeout_lag},
+	{"graph", &graph_duration},
+	{"scripts", &script_duration},
+	{"str2addrinfo", &str2addrinfo_duration},
+	{"resolver", &resolver_stats.duration},
+};
+
+static histogram_t latency_base[sizeof(latencies) / sizeof(*latencies)];
+
+static bool dump_latency(connection_t *c, bool reset) {
+	for(size_t i = 0; i < sizeof(latencies) / sizeof(*latencies); i++) {
+		histogram_t h;
+		histogram_since(&h, latencies[i].h, &latency_base[i]);
+		send_latency(c, latencies[i].name, &h);
+
+		if(reset) {
+			latency_base[i] = *latencies[i].h;
+		}
+	}
+
+	if(event_stats.slowest_name) {
+		send_slowest(c);
+	}
+
+	if(reset) {
+		event_stats_reset();
+	}
+
+	return send_request(c, "%d %d", CONTROL, REQ_DUMP_LATENCY);
+}
+
+/* The filter for tinc pcap arrives in pieces before REQ_PCAP, as hexadecimal instructions */
+
+static bool add_pcap_filter(connection_t *c, const char *request) {
+	char hex[MAX_STRING_SIZE];
+
+	if(sscanf(request, "%*d %*d " MAX_STRING, hex) != 1) {
+		return false;
+	}
+
+	size_t count = strlen(hex) / BPF_INSN_HEX;
+
+	if(!count || strlen(hex) % BPF_INSN_HEX || c->pcap_filter_len + count > BPF_MAX_INSNS) {
+		return false;
+	}
+
+	c->pcap_filter = xrealloc(c->pcap_filter, (c->pcap_filter_len + count) * sizeof(*c->pcap_filter));
+
+	for(size_t i = 0; i < count; i++) {
+		if(!bpf_insn_from_hex(hex + i * BPF_INSN_HEX, &c->pcap_filter[c->pcap_filter_len + i])) {
+			return false;
+		}
+	}
+
+	c->pcap_filter_len += count;
+	return true;
+}
+
 bool control_h(connection_t *c, const char *request) {
 	int type;
 
@@ -55,19 +209,22 @@ bool control_h(connection_t *c, const char *request) {
 		return false;
 	}
 
+	// Answer requests in order, even if a previous dump has not been sent completely yet
+
+	if(!dump_finish(c)) {
+		return false;
+	}
+
 	switch(type) {
 	case REQ_STOP:
 		event_exit();
 		return control_ok(c, REQ_STOP);
 
 	case REQ_DUMP_NODES:
-		return dump_nodes(c);
-
 	case REQ_DUMP_EDGES:
-		return dump_edges(c);
-
 	case REQ_DUMP_SUBNETS:
-		return dump_subnets(c);
+	case REQ_DUMP_TRAFFIC:
+		return dump_start(c, type);
 
 	case REQ_DUMP_CONNECTIONS:
 		return dump_connections(c);
@@ -121,15 +278,39 @@ bool control_h(connection_t *c, const char *request) {
 		return control_return(c, REQ_DISCONNECT, found ? 0 : -2);
 	}
 
-	case REQ_DUMP_TRAFFIC:
-		return dump_traffic(c);
+	case REQ_DUMP_STATS:
+		return dump_stats(c);
+
+	case REQ_DUMP_LATENCY: {
+		int reset = 0;
+		sscanf(request, "%*d %*d %d", &reset);
+		return dump_latency(c, reset);
+	}
+
+	case REQ_PCAP_FILTER:
+		return add_pcap_filter(c, request);
 
 	case REQ_PCAP:
 		sscanf(request, "%*d %*d %d", &c->outmaclength);
+
+		if(c->pcap_filter && !bpf_check(c->pcap_filter, c->pcap_filter_len)) {
+			logger(DEBUG_ALWAYS, LOG_ERR, "Got invalid packet filter from %s (%s)", c->name, c->hostname);
+			free(c->pcap_filter);
+			c->pcap_filter = NULL;
+			c->pcap_filter_len = 0;
+			return control_return(c, REQ_PCAP, -1);
+		}
+
 		c->status.pcap = true;
 		pcap = true;
 		return true;
 
+	case REQ_DUMP_FORMAT:
+		return dump_set_format(c, request);
+
+	case REQ_SUBSCRIBE:
+		return subscribe_events(c, request);
+
 	case REQ_LOG: {
 		int level = 0;
 		sscanf(request, "%*d %*d %d", &level);
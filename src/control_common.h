@@ -41,8 +41,29 @@ enum request_type {
 	REQ_DUMP_TRAFFIC,
 	REQ_PCAP,
 	REQ_LOG,
+	REQ_DUMP_STATS,
+	REQ_DUMP_LATENCY,
+	REQ_PCAP_FILTER,
+	REQ_DUMP_FORMAT,
+	REQ_SUBSCRIBE,
 };
 
+/* Dump output formats, negotiated with REQ_DUMP_FORMAT */
+typedef enum dump_format_t {
+	DUMP_FORMAT_TEXT = 0,           /* space separated fields, the default */
+	DUMP_FORMAT_JSON = 1,           /* one JSON object per line */
+} dump_format_t;
+
+/* Events a control connection can subscribe to with REQ_SUBSCRIBE */
+typedef enum event_type_t {
+	EVENT_NODE = 1 << 0,            /* node up|down NAME [ADDRESS PORT] */
+	EVENT_EDGE = 1 << 1,            /* edge add|del FROM TO [ADDRESS PORT OPTIONS WEIGHT] */
+	EVENT_SUBNET = 1 << 2,          /* subnet up|down SUBNET OWNER */
+	EVENT_MTU = 1 << 3,             /* mtu NAME MTU */
+	EVENT_CONNECTION = 1 << 4,      /* connection up|down NAME HOSTNAME */
+	EVENT_ALL = (1 << 5) - 1,
+} event_type_t;
+
 #define TINC_CTL_VERSION_CURRENT 0
 
 #endif
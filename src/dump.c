@@ -0,0 +1,236 @@
+#include "system.h"
+
+#include "control_common.h"
+#include "dump.h"
+#include "edge.h"
+#include "logger.h"
+#include "netutl.h"
+#include "node.h"
+#include "protocol.h"
+#include "subnet.h"
+#include "xalloc.h"
+
+static void json_append(json_t *json, const char *data, size_t len) {
+	if(json->overflow || len >= sizeof(json->buf) - json->len) {
+		json->overflow = true;
+		return;
+	}
+
+	memcpy(json->buf + json->len, data, len);
+	json->len += len;
+	json->buf[json->len] = 0;
+}
+
+static void json_quote(json_t *json, const char *value) {
+	json_append(json, "\"", 1);
+
+	for(const unsigned char *p = (const unsigned char *)value; *p; p++) {
+		if(*p == '"' || *p == '\\') {
+			char escaped[2] = {'\\', *p};
+			json_append(json, escaped, 2);
+		} else if(*p < 0x20) {
+			char escaped[7];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", *p);
+			json_append(json, escaped, 6);
+		} else {
+			json_append(json, (const char *)p, 1);
+		}
+	}
+
+	json_append(json, "\"", 1);
+}
+
+static void json_key(json_t *json, const char *key) {
+	if(json->len > 1) {
+		json_append(json, ",", 1);
+	}
+
+	json_quote(json, key);
+	json_append(json, ":", 1);
+}
+
+void json_begin(json_t *json) {
+	json->len = 0;
+	json->overflow = false;
+	json_append(json, "{", 1);
+}
+
+void json_string(json_t *json, const char *key, const char *value) {
+	json_key(json, key);
+
+	if(value) {
+		json_quote(json, value);
+	} else {
+		json_append(json, "null", 4);
+	}
+}
+
+void json_int(json_t *json, const char *key, int64_t value) {
+	char buf[24];
+	int len = snprintf(buf, sizeof(buf), "%"PRId64, value);
+	json_key(json, key);
+	json_append(json, buf, len);
+}
+
+void json_uint(json_t *json, const char *key, uint64_t value) {
+	char buf[24];
+	int len = snprintf(buf, sizeof(buf), "%"PRIu64, value);
+	json_key(json, key);
+	json_append(json, buf, len);
+}
+
+void json_bool(json_t *json, const char *key, bool value) {
+	json_key(json, key);
+	json_append(json, value ? "true" : "false", value ? 4 : 5);
+}
+
+/* Adds an address and port as two strings, or as nulls if the address is not known */
+
+void json_sockaddr(json_t *json, const char *address_key, const char *port_key, const sockaddr_t *sa) {
+	if(sa->sa.sa_family == AF_UNSPEC) {
+		json_string(json, address_key, NULL);
+		json_string(json, port_key, NULL);
+		return;
+	}
+
+	char *address, *port;
+	sockaddr2str(sa, &address, &port);
+	json_string(json, address_key, address);
+	json_string(json, port_key, port);
+	free(address);
+	free(port);
+}
+
+/* Returns the finished object, or NULL if it did not fit */
+
+const char *json_end(json_t *json) {
+	json_append(json, "}", 1);
+	return json->overflow ? NULL : json->buf;
+}
+
+bool dump_json(connection_t *c, int type, json_t *json) {
+	const char *line = json_end(json);
+
+	if(!line) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Entry of dump %d too long for %s (%s)", type, c->name, c->hostname);
+		return false;
+	}
+
+	return send_request(c, "%d %d %s", CONTROL, type, line);
+}
+
+splay_node_t *dump_resume(splay_tree_t *tree, const void *cursor) {
+	if(!cursor) {
+		return tree->head;
+	}
+
+	splay_node_t *node = splay_search_closest_greater_node(tree, cursor);
+
+	if(node && !tree->compare(cursor, node->data)) {
+		node = node->next;
+	}
+
+	return node;
+}
+
+static dump_t *get_dump(connection_t *c) {
+	if(!c->dump) {
+		c->dump = xzalloc(sizeof(*c->dump));
+		c->dump->type = REQ_INVALID;
+	}
+
+	return c->dump;
+}
+
+static void reset_dump(dump_t *dump) {
+	free(dump->name);
+	free(dump->to);
+	free(dump->owner);
+	dump->name = NULL;
+	dump->to = NULL;
+	dump->owner = NULL;
+	dump->has_subnet = false;
+	dump->type = REQ_INVALID;
+}
+
+void free_dump(dump_t *dump) {
+	if(dump) {
+		reset_dump(dump);
+		free(dump);
+	}
+}
+
+bool dump_set_format(connection_t *c, const char *request) {
+	int format;
+
+	if(sscanf(request, "%*d %*d %d", &format) != 1) {
+		return false;
+	}
+
+	if(format != DUMP_FORMAT_TEXT && format != DUMP_FORMAT_JSON) {
+		return send_request(c, "%d %d %d", CONTROL, REQ_DUMP_FORMAT, -1);
+	}
+
+	get_dump(c)->format = format;
+	return send_request(c, "%d %d %d", CONTROL, REQ_DUMP_FORMAT, 0);
+}
+
+bool dump_start(connection_t *c, int type) {
+	if(!dump_finish(c)) {
+		return false;
+	}
+
+	get_dump(c)->type = type;
+	return dump_continue(c);
+}
+
+/* Send the next batch of the dump in progress, and the terminator after the last one */
+
+bool dump_continue(connection_t *c) {
+	dump_t *dump = c->dump;
+	bool done;
+
+	switch(dump->type) {
+	case REQ_DUMP_NODES:
+		done = dump_nodes(c);
+		break;
+
+	case REQ_DUMP_EDGES:
+		done = dump_edges(c);
+		break;
+
+	case REQ_DUMP_SUBNETS:
+		done = dump_subnets(c);
+		break;
+
+	case REQ_DUMP_TRAFFIC:
+		done = dump_traffic(c);
+		break;
+
+	default:
+		return false;
+	}
+
+	if(!done) {
+		return true;
+	}
+
+	int type = dump->type;
+	reset_dump(dump);
+	return send_request(c, "%d %d", CONTROL, type);
+}
+
+bool dump_finish(connection_t *c) {
+	while(dump_in_progress(c)) {
+		if(!dump_continue(c)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void dump_cursor(char **cursor, const char *value) {
+	free(*cursor);
+	*cursor = xstrdup(value);
+}
@@ -0,0 +1,63 @@
+#ifndef TINC_DUMP_H
+#define TINC_DUMP_H
+
+#include "system.h"
+
+#include "connection.h"
+#include "control_common.h"
+#include "net.h"
+#include "splay_tree.h"
+#include "subnet.h"
+
+/* Nodes, edges, subnets and traffic are dumped this many entries at a time.
+   The next batch is only produced once the previous one has been sent, so a
+   large dump neither blocks the event loop nor piles up in the output buffer. */
+#define DUMP_BATCH 128
+
+/* State of the dump in progress on a control connection */
+typedef struct dump_t {
+	int type;                       /* request being answered, REQ_INVALID if none */
+	dump_format_t format;
+	char *name;                     /* last node dumped, or the origin of the last edge */
+	char *to;                       /* destination of the last edge dumped */
+	char *owner;                    /* owner of the last subnet dumped */
+	subnet_t subnet;                /* last subnet dumped, only valid if has_subnet is set */
+	bool has_subnet;
+} dump_t;
+
+typedef struct json_t {
+	char buf[MAXBUFSIZE - 64];
+	size_t len;
+	bool overflow;
+} json_t;
+
+extern void json_begin(json_t *json);
+extern void json_string(json_t *json, const char *key, const char *value);
+extern void json_int(json_t *json, const char *key, int64_t value);
+extern void json_uint(json_t *json, const char *key, uint64_t value);
+extern void json_bool(json_t *json, const char *key, bool value);
+extern void json_sockaddr(json_t *json, const char *address_key, const char *port_key, const sockaddr_t *sa);
+extern const char *json_end(json_t *json);
+
+/* Send an object as one line of the dump of the given type */
+extern bool dump_json(struct connection_t *c, int type, json_t *json);
+
+static inline bool dump_is_json(const struct connection_t *c) {
+	return c->dump && c->dump->format == DUMP_FORMAT_JSON;
+}
+
+/* Find the first entry after the cursor, or the first entry if there is no cursor */
+extern splay_node_t *dump_resume(splay_tree_t *tree, const void *cursor);
+extern void dump_cursor(char **cursor, const char *value);
+
+extern bool dump_set_format(struct connection_t *c, const char *request);
+extern bool dump_start(struct connection_t *c, int type);
+extern bool dump_continue(struct connection_t *c);
+extern bool dump_finish(struct connection_t *c);
+extern void free_dump(dump_t *dump);
+
+static inline bool dump_in_progress(const struct connection_t *c) {
+	return c->dump && c->dump->type != REQ_INVALID;
+}
+
+#endif // TINC_DUMP_H
@@ -30,9 +30,12 @@ extern ecdsa_t *ecdsa_set_base64_public_key(const char *p) ATTR_MALLOC;
 extern char *ecdsa_get_base64_public_key(ecdsa_t *ecdsa);
 extern ecdsa_t *ecdsa_read_pem_public_key(FILE *fp) ATTR_MALLOC;
 extern ecdsa_t *ecdsa_read_pem_private_key(FILE *fp) ATTR_MALLOC;
+extern ecdsa_t *ecdsa_copy(ecdsa_t *ecdsa) ATTR_MALLOC;
+extern const char *ecdsa_implementation(void);
 extern size_t ecdsa_size(ecdsa_t *ecdsa);
 extern bool ecdsa_sign(ecdsa_t *ecdsa, const void *in, size_t inlen, void *out) ATTR_WARN_UNUSED;
 extern bool ecdsa_verify(ecdsa_t *ecdsa, const void *in, size_t inlen, const void *out) ATTR_WARN_UNUSED;
+extern bool ecdsa_verify_batch(ecdsa_t *const *ecdsa, const void *const *in, const size_t *inlen, const void *const *sig, size_t count, bool *valid);
 extern bool ecdsa_active(ecdsa_t *ecdsa);
 extern void ecdsa_free(ecdsa_t *ecdsa);
 
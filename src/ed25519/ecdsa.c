@@ -29,6 +29,7 @@ typedef struct {
 
 #include "../logger.h"
 #include "../ecdsa.h"
+#include "../random.h"
 #include "../utils.h"
 #include "../xalloc.h"
 
@@ -144,6 +145,20 @@ ecdsa_t *ecdsa_read_pem_private_key(FILE *fp) {
 	return NULL;
 }
 
+ecdsa_t *ecdsa_copy(ecdsa_t *ecdsa) {
+	ecdsa_t *copy = xmalloc(sizeof(*copy));
+	memcpy(copy, ecdsa, sizeof(*copy));
+	return copy;
+}
+
+const char *ecdsa_implementation(void) {
+#ifdef ED25519_FE51
+	return "Ed25519 with 51-bit limbs";
+#else
+	return "Ed25519 with 25.5-bit limbs";
+#endif
+}
+
 size_t ecdsa_size(ecdsa_t *ecdsa) {
 	(void)ecdsa;
 	return 64;
@@ -160,6 +175,43 @@ bool ecdsa_verify(ecdsa_t *ecdsa, const void *in, size_t len, const void *sig) {
 	return ed25519_verify(sig, in, len, ecdsa->public);
 }
 
+// Verify several signatures at once, which is cheaper than one by one if they are all valid.
+// Returns true if they are, valid[i] tells which ones are if not.
+bool ecdsa_verify_batch(ecdsa_t *const *ecdsa, const void *const *in, const size_t *inlen, const void *const *sig, size_t count, bool *valid) {
+	bool result = true;
+
+	for(size_t i = 0; i < count; i += ED25519_BATCH_MAX) {
+		size_t n = MIN(count - i, ED25519_BATCH_MAX);
+		const unsigned char *sigs[ED25519_BATCH_MAX];
+		const unsigned char *msgs[ED25519_BATCH_MAX];
+		const unsigned char *keys[ED25519_BATCH_MAX];
+		uint8_t z[ED25519_BATCH_MAX][16];
+
+		for(size_t j = 0; j < n; j++) {
+			sigs[j] = sig[i + j];
+			msgs[j] = in[i + j];
+			keys[j] = ecdsa[i + j]->public;
+		}
+
+		randomize(z, sizeof(z));
+
+		if(n > 1 && ed25519_verify_batch(sigs, msgs, inlen + i, keys, (const uint8_t (*)[16])z, n)) {
+			for(size_t j = 0; j < n; j++) {
+				valid[i + j] = true;
+			}
+
+			continue;
+		}
+
+		for(size_t j = 0; j < n; j++) {
+			valid[i + j] = ed25519_verify(sigs[j], msgs[j], inlen[i + j], keys[j]);
+			result &= valid[i + j];
+		}
+	}
+
+	return result;
+}
+
 bool ecdsa_active(ecdsa_t *ecdsa) {
 	return ecdsa;
 }
@@ -7,14 +7,31 @@
 /*
     fe means field element.
     Here the field is \Z/(2^255-19).
+*/
+
+#ifdef ED25519_FE51
+
+/*
+    Used on platforms with 64x64->128 bit multiplication.
+    An element t, entries t[0]...t[4], represents the integer
+    t[0]+2^51 t[1]+2^102 t[2]+2^153 t[3]+2^204 t[4].
+    Each t[i] is unsigned and kept below 2^52 between operations.
+*/
+
+typedef uint64_t fe[5];
+
+#else
+
+/*
     An element t, entries t[0]...t[9], represents the integer
     t[0]+2^26 t[1]+2^51 t[2]+2^77 t[3]+2^102 t[4]+...+2^230 t[9].
     Bounds on each t[i] vary depending on context.
 */
 
-
 typedef int32_t fe[10];
 
+#endif
+
 
 void fe_0(fe h);
 void fe_1(fe h);
@@ -0,0 +1,528 @@
+#include "fixedint.h"
+#include "fe.h"
+
+/*
+    Field arithmetic using five 51-bit limbs and 64x64->128 bit multiplications.
+    This is the same interface as fe.c, but about twice as fast on 64-bit CPUs.
+
+    All functions accept limbs below 2^52, and return limbs below 2^52.
+*/
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+#define MASK51 ((UINT64_C(1) << 51) - 1)
+
+
+/*
+    helper functions
+*/
+static uint64_t load_8(const unsigned char *in) {
+	uint64_t result = 0;
+
+	for(int i = 7; i >= 0; i--) {
+		result = (result << 8) | in[i];
+	}
+
+	return result;
+}
+
+static void store_8(unsigned char *out, uint64_t in) {
+	for(int i = 0; i < 8; i++) {
+		out[i] = (unsigned char)(in >> (8 * i));
+	}
+}
+
+/* Propagate carries from each limb into the next, and from the top limb into the bottom one */
+static void fe_carry(fe h) {
+	uint64_t c;
+
+	c = h[0] >> 51;
+	h[0] &= MASK51;
+	h[1] += c;
+	c = h[1] >> 51;
+	h[1] &= MASK51;
+	h[2] += c;
+	c = h[2] >> 51;
+	h[2] &= MASK51;
+	h[3] += c;
+	c = h[3] >> 51;
+	h[3] &= MASK51;
+	h[4] += c;
+	c = h[4] >> 51;
+	h[4] &= MASK51;
+	h[0] += c * 19;
+}
+
+/* Reduce the wide result of a multiplication */
+static void fe_reduce(fe h, uint128_t r0, uint128_t r1, uint128_t r2, uint128_t r3, uint128_t r4) {
+	uint64_t h0, h1, h2, h3, h4;
+
+	r1 += (uint64_t)(r0 >> 51);
+	h0 = (uint64_t)r0 & MASK51;
+	r2 += (uint64_t)(r1 >> 51);
+	h1 = (uint64_t)r1 & MASK51;
+	r3 += (uint64_t)(r2 >> 51);
+	h2 = (uint64_t)r2 & MASK51;
+	r4 += (uint64_t)(r3 >> 51);
+	h3 = (uint64_t)r3 & MASK51;
+	h0 += (uint64_t)(r4 >> 51) * 19;
+	h4 = (uint64_t)r4 & MASK51;
+	h1 += h0 >> 51;
+	h0 &= MASK51;
+
+	h[0] = h0;
+	h[1] = h1;
+	h[2] = h2;
+	h[3] = h3;
+	h[4] = h4;
+}
+
+
+
+/*
+    h = 0
+*/
+
+void fe_0(fe h) {
+	h[0] = 0;
+	h[1] = 0;
+	h[2] = 0;
+	h[3] = 0;
+	h[4] = 0;
+}
+
+
+
+/*
+    h = 1
+*/
+
+void fe_1(fe h) {
+	h[0] = 1;
+	h[1] = 0;
+	h[2] = 0;
+	h[3] = 0;
+	h[4] = 0;
+}
+
+
+
+/*
+    h = f + g
+    Can overlap h with f or g.
+*/
+
+void fe_add(fe h, const fe f, const fe g) {
+	h[0] = f[0] + g[0];
+	h[1] = f[1] + g[1];
+	h[2] = f[2] + g[2];
+	h[3] = f[3] + g[3];
+	h[4] = f[4] + g[4];
+	fe_carry(h);
+}
+
+
+
+/*
+    h = f - g
+    Can overlap h with f or g.
+
+    4*p is added first, so the limbs never go negative.
+*/
+
+void fe_sub(fe h, const fe f, const fe g) {
+	h[0] = f[0] + UINT64_C(0x1fffffffffffb4) - g[0];
+	h[1] = f[1] + UINT64_C(0x1ffffffffffffc) - g[1];
+	h[2] = f[2] + UINT64_C(0x1ffffffffffffc) - g[2];
+	h[3] = f[3] + UINT64_C(0x1ffffffffffffc) - g[3];
+	h[4] = f[4] + UINT64_C(0x1ffffffffffffc) - g[4];
+	fe_carry(h);
+}
+
+
+
+/*
+    h = -f
+*/
+
+void fe_neg(fe h, const fe f) {
+	fe zero;
+
+	fe_0(zero);
+	fe_sub(h, zero, f);
+}
+
+
+
+/*
+    Replace (f,g) with (g,g) if b == 1;
+    replace (f,g) with (f,g) if b == 0.
+
+    Preconditions: b in {0,1}.
+*/
+
+void fe_cmov(fe f, const fe g, unsigned int b) {
+	uint64_t mask = (uint64_t)0 - b;
+
+	f[0] ^= mask & (f[0] ^ g[0]);
+	f[1] ^= mask & (f[1] ^ g[1]);
+	f[2] ^= mask & (f[2] ^ g[2]);
+	f[3] ^= mask & (f[3] ^ g[3]);
+	f[4] ^= mask & (f[4] ^ g[4]);
+}
+
+
+
+/*
+    Replace (f,g) with (g,f) if b == 1;
+    replace (f,g) with (f,g) if b == 0.
+
+    Preconditions: b in {0,1}.
+*/
+
+void fe_cswap(fe f, fe g, unsigned int b) {
+	uint64_t mask = (uint64_t)0 - b;
+
+	for(int i = 0; i < 5; i++) {
+		uint64_t x = mask & (f[i] ^ g[i]);
+		f[i] ^= x;
+		g[i] ^= x;
+	}
+}
+
+
+
+/*
+    h = f
+*/
+
+void fe_copy(fe h, const fe f) {
+	h[0] = f[0];
+	h[1] = f[1];
+	h[2] = f[2];
+	h[3] = f[3];
+	h[4] = f[4];
+}
+
+
+
+/*
+    Ignores top bit of s.
+*/
+
+void fe_frombytes(fe h, const unsigned char *s) {
+	h[0] = load_8(s) & MASK51;
+	h[1] = (load_8(s + 6) >> 3) & MASK51;
+	h[2] = (load_8(s + 12) >> 6) & MASK51;
+	h[3] = (load_8(s + 19) >> 1) & MASK51;
+	h[4] = (load_8(s + 24) >> 12) & MASK51;
+}
+
+
+
+/*
+    Writes the unique representative of h modulo 2^255-19.
+*/
+
+void fe_tobytes(unsigned char *s, const fe h) {
+	fe t;
+
+	fe_copy(t, h);
+	fe_carry(t);
+	fe_carry(t);
+
+	/* Now 0 <= t < 2^255. Adding 19 makes it overflow into bit 255 if t >= p. */
+	t[0] += 19;
+	fe_carry(t);
+
+	/* Now 19 <= t < 2^255, offset by 19. Add 2^255 - 19, and drop bit 255 again. */
+	t[0] += (UINT64_C(1) << 51) - 19;
+	t[1] += (UINT64_C(1) << 51) - 1;
+	t[2] += (UINT64_C(1) << 51) - 1;
+	t[3] += (UINT64_C(1) << 51) - 1;
+	t[4] += (UINT64_C(1) << 51) - 1;
+
+	t[1] += t[0] >> 51;
+	t[0] &= MASK51;
+	t[2] += t[1] >> 51;
+	t[1] &= MASK51;
+	t[3] += t[2] >> 51;
+	t[2] &= MASK51;
+	t[4] += t[3] >> 51;
+	t[3] &= MASK51;
+	t[4] &= MASK51;
+
+	store_8(s, t[0] | (t[1] << 51));
+	store_8(s + 8, (t[1] >> 13) | (t[2] << 38));
+	store_8(s + 16, (t[2] >> 26) | (t[3] << 25));
+	store_8(s + 24, (t[3] >> 39) | (t[4] << 12));
+}
+
+
+
+/*
+    return 1 if f is in {1,3,5,...,q-2}
+    return 0 if f is in {0,2,4,...,q-1}
+*/
+
+int fe_isnegative(const fe f) {
+	unsigned char s[32];
+
+	fe_tobytes(s, f);
+
+	return s[0] & 1;
+}
+
+
+
+/*
+    return 1 if f == 0
+    return 0 if f != 0
+*/
+
+int fe_isnonzero(const fe f) {
+	unsigned char s[32];
+	unsigned char r = 0;
+
+	fe_tobytes(s, f);
+
+	for(int i = 0; i < 32; i++) {
+		r |= s[i];
+	}
+
+	return r != 0;
+}
+
+
+
+/*
+    h = f * g
+    Can overlap h with f or g.
+
+    Schoolbook multiplication, folding the upper half back in with 2^255 = 19.
+*/
+
+void fe_mul(fe h, const fe f, const fe g) {
+	uint64_t f0 = f[0];
+	uint64_t f1 = f[1];
+	uint64_t f2 = f[2];
+	uint64_t f3 = f[3];
+	uint64_t f4 = f[4];
+	uint64_t g0 = g[0];
+	uint64_t g1 = g[1];
+	uint64_t g2 = g[2];
+	uint64_t g3 = g[3];
+	uint64_t g4 = g[4];
+	uint64_t g1_19 = 19 * g1;
+	uint64_t g2_19 = 19 * g2;
+	uint64_t g3_19 = 19 * g3;
+	uint64_t g4_19 = 19 * g4;
+
+	uint128_t r0 = (uint128_t)f0 * g0 + (uint128_t)f1 * g4_19 + (uint128_t)f2 * g3_19 + (uint128_t)f3 * g2_19 + (uint128_t)f4 * g1_19;
+	uint128_t r1 = (uint128_t)f0 * g1 + (uint128_t)f1 * g0 + (uint128_t)f2 * g4_19 + (uint128_t)f3 * g3_19 + (uint128_t)f4 * g2_19;
+	uint128_t r2 = (uint128_t)f0 * g2 + (uint128_t)f1 * g1 + (uint128_t)f2 * g0 + (uint128_t)f3 * g4_19 + (uint128_t)f4 * g3_19;
+	uint128_t r3 = (uint128_t)f0 * g3 + (uint128_t)f1 * g2 + (uint128_t)f2 * g1 + (uint128_t)f3 * g0 + (uint128_t)f4 * g4_19;
+	uint128_t r4 = (uint128_t)f0 * g4 + (uint128_t)f1 * g3 + (uint128_t)f2 * g2 + (uint128_t)f3 * g1 + (uint128_t)f4 * g0;
+
+	fe_reduce(h, r0, r1, r2, r3, r4);
+}
+
+
+
+/*
+    h = f * 121666
+    Can overlap h with f.
+*/
+
+void fe_mul121666(fe h, fe f) {
+	fe_reduce(h,
+	          (uint128_t)f[0] * 121666,
+	          (uint128_t)f[1] * 121666,
+	          (uint128_t)f[2] * 121666,
+	          (uint128_t)f[3] * 121666,
+	          (uint128_t)f[4] * 121666);
+}
+
+
+
+/*
+    h = f * f
+    Can overlap h with f.
+*/
+
+void fe_sq(fe h, const fe f) {
+	uint64_t f0 = f[0];
+	uint64_t f1 = f[1];
+	uint64_t f2 = f[2];
+	uint64_t f3 = f[3];
+	uint64_t f4 = f[4];
+	uint64_t f0_2 = 2 * f0;
+	uint64_t f1_2 = 2 * f1;
+	uint64_t f3_19 = 19 * f3;
+	uint64_t f4_19 = 19 * f4;
+	uint64_t f3_38 = 2 * f3_19;
+	uint64_t f4_38 = 2 * f4_19;
+
+	uint128_t r0 = (uint128_t)f0 * f0 + (uint128_t)f1 * f4_38 + (uint128_t)f2 * f3_38;
+	uint128_t r1 = (uint128_t)f0_2 * f1 + (uint128_t)f2 * f4_38 + (uint128_t)f3 * f3_19;
+	uint128_t r2 = (uint128_t)f0_2 * f2 + (uint128_t)f1 * f1 + (uint128_t)f3 * f4_38;
+	uint128_t r3 = (uint128_t)f0_2 * f3 + (uint128_t)f1_2 * f2 + (uint128_t)f4 * f4_19;
+	uint128_t r4 = (uint128_t)f0_2 * f4 + (uint128_t)f1_2 * f3 + (uint128_t)f2 * f2;
+
+	fe_reduce(h, r0, r1, r2, r3, r4);
+}
+
+
+
+/*
+    h = 2 * f * f
+    Can overlap h with f.
+*/
+
+void fe_sq2(fe h, const fe f) {
+	fe_sq(h, f);
+	fe_add(h, h, h);
+}
+
+
+
+void fe_invert(fe out, const fe z) {
+	fe t0;
+	fe t1;
+	fe t2;
+	fe t3;
+	int i;
+
+	fe_sq(t0, z);
+	fe_sq(t1, t0);
+	fe_sq(t1, t1);
+	fe_mul(t1, z, t1);
+	fe_mul(t0, t0, t1);
+	fe_sq(t2, t0);
+	fe_mul(t1, t1, t2);
+	fe_sq(t2, t1);
+
+	for(i = 1; i < 5; ++i) {
+		fe_sq(t2, t2);
+	}
+
+	fe_mul(t1, t2, t1);
+	fe_sq(t2, t1);
+
+	for(i = 1; i < 10; ++i) {
+		fe_sq(t2, t2);
+	}
+
+	fe_mul(t2, t2, t1);
+	fe_sq(t3, t2);
+
+	for(i = 1; i < 20; ++i) {
+		fe_sq(t3, t3);
+	}
+
+	fe_mul(t2, t3, t2);
+	fe_sq(t2, t2);
+
+	for(i = 1; i < 10; ++i) {
+		fe_sq(t2, t2);
+	}
+
+	fe_mul(t1, t2, t1);
+	fe_sq(t2, t1);
+
+	for(i = 1; i < 50; ++i) {
+		fe_sq(t2, t2);
+	}
+
+	fe_mul(t2, t2, t1);
+	fe_sq(t3, t2);
+
+	for(i = 1; i < 100; ++i) {
+		fe_sq(t3, t3);
+	}
+
+	fe_mul(t2, t3, t2);
+	fe_sq(t2, t2);
+
+	for(i = 1; i < 50; ++i) {
+		fe_sq(t2, t2);
+	}
+
+	fe_mul(t1, t2, t1);
+	fe_sq(t1, t1);
+
+	for(i = 1; i < 5; ++i) {
+		fe_sq(t1, t1);
+	}
+
+	fe_mul(out, t1, t0);
+}
+
+
+
+void fe_pow22523(fe out, const fe z) {
+	fe t0;
+	fe t1;
+	fe t2;
+	int i;
+
+	fe_sq(t0, z);
+	fe_sq(t1, t0);
+	fe_sq(t1, t1);
+	fe_mul(t1, z, t1);
+	fe_mul(t0, t0, t1);
+	fe_sq(t0, t0);
+	fe_mul(t0, t1, t0);
+	fe_sq(t1, t0);
+
+	for(i = 1; i < 5; ++i) {
+		fe_sq(t1, t1);
+	}
+
+	fe_mul(t0, t1, t0);
+	fe_sq(t1, t0);
+
+	for(i = 1; i < 10; ++i) {
+		fe_sq(t1, t1);
+	}
+
+	fe_mul(t1, t1, t0);
+	fe_sq(t2, t1);
+
+	for(i = 1; i < 20; ++i) {
+		fe_sq(t2, t2);
+	}
+
+	fe_mul(t1, t2, t1);
+	fe_sq(t1, t1);
+
+	for(i = 1; i < 10; ++i) {
+		fe_sq(t1, t1);
+	}
+
+	fe_mul(t0, t1, t0);
+	fe_sq(t1, t0);
+
+	for(i = 1; i < 50; ++i) {
+		fe_sq(t1, t1);
+	}
+
+	fe_mul(t1, t1, t0);
+	fe_sq(t2, t1);
+
+	for(i = 1; i < 100; ++i) {
+		fe_sq(t2, t2);
+	}
+
+	fe_mul(t1, t2, t1);
+	fe_sq(t1, t1);
+
+	for(i = 1; i < 50; ++i) {
+		fe_sq(t1, t1);
+	}
+
+	fe_mul(t0, t1, t0);
+	fe_sq(t0, t0);
+	fe_sq(t0, t0);
+	fe_mul(out, t0, z);
+}
@@ -1,5 +1,10 @@
 #include "ge.h"
+
+#ifdef ED25519_FE51
+#include "precomp_data51.h"
+#else
 #include "precomp_data.h"
+#endif
 
 
 /*
@@ -57,6 +62,25 @@ static void slide(signed char *r, const unsigned char *a) {
 		}
 }
 
+/* Ai = A,3A,5A,7A,9A,11A,13A,15A */
+
+static void precompute(ge_cached *Ai, const ge_p3 *A) {
+	ge_p1p1 t;
+	ge_p3 u;
+	ge_p3 A2;
+	int i;
+
+	ge_p3_to_cached(&Ai[0], A);
+	ge_p3_dbl(&t, A);
+	ge_p1p1_to_p3(&A2, &t);
+
+	for(i = 1; i < 8; ++i) {
+		ge_add(&t, &A2, &Ai[i - 1]);
+		ge_p1p1_to_p3(&u, &t);
+		ge_p3_to_cached(&Ai[i], &u);
+	}
+}
+
 /*
 r = a * A + b * B
 where a = a[0]+256*a[1]+...+256^31 a[31].
@@ -65,43 +89,47 @@ B is the Ed25519 base point (x,4/5) with x positive.
 */
 
 void ge_double_scalarmult_vartime(ge_p2 *r, const unsigned char *a, const ge_p3 *A, const unsigned char *b) {
-	signed char aslide[256];
+	ge_multi_scalarmult_vartime(r, b, 1, (const unsigned char (*)[32])a, A);
+}
+
+
+/*
+r = b * B + a[0] * A[0] + ... + a[count-1] * A[count-1]
+where B is the Ed25519 base point (x,4/5) with x positive.
+
+All the points share the doublings, which makes this much faster than
+computing each product separately.
+
+Preconditions:
+  count <= GE_MULTI_MAX
+*/
+
+void ge_multi_scalarmult_vartime(ge_p2 *r, const unsigned char *b, size_t count, const unsigned char (*a)[32], const ge_p3 *A) {
+	signed char aslide[GE_MULTI_MAX][256];
 	signed char bslide[256];
-	ge_cached Ai[8]; /* A,3A,5A,7A,9A,11A,13A,15A */
+	ge_cached Ai[GE_MULTI_MAX][8];
 	ge_p1p1 t;
 	ge_p3 u;
-	ge_p3 A2;
+	size_t j;
 	int i;
-	slide(aslide, a);
+
 	slide(bslide, b);
-	ge_p3_to_cached(&Ai[0], A);
-	ge_p3_dbl(&t, A);
-	ge_p1p1_to_p3(&A2, &t);
-	ge_add(&t, &A2, &Ai[0]);
-	ge_p1p1_to_p3(&u, &t);
-	ge_p3_to_cached(&Ai[1], &u);
-	ge_add(&t, &A2, &Ai[1]);
-	ge_p1p1_to_p3(&u, &t);
-	ge_p3_to_cached(&Ai[2], &u);
-	ge_add(&t, &A2, &Ai[2]);
-	ge_p1p1_to_p3(&u, &t);
-	ge_p3_to_cached(&Ai[3], &u);
-	ge_add(&t, &A2, &Ai[3]);
-	ge_p1p1_to_p3(&u, &t);
-	ge_p3_to_cached(&Ai[4], &u);
-	ge_add(&t, &A2, &Ai[4]);
-	ge_p1p1_to_p3(&u, &t);
-	ge_p3_to_cached(&Ai[5], &u);
-	ge_add(&t, &A2, &Ai[5]);
-	ge_p1p1_to_p3(&u, &t);
-	ge_p3_to_cached(&Ai[6], &u);
-	ge_add(&t, &A2, &Ai[6]);
-	ge_p1p1_to_p3(&u, &t);
-	ge_p3_to_cached(&Ai[7], &u);
+
+	for(j = 0; j < count; ++j) {
+		slide(aslide[j], a[j]);
+		precompute(Ai[j], &A[j]);
+	}
+
 	ge_p2_0(r);
 
 	for(i = 255; i >= 0; --i) {
-		if(aslide[i] || bslide[i]) {
+		int nonzero = bslide[i];
+
+		for(j = 0; j < count; ++j) {
+			nonzero |= aslide[j][i];
+		}
+
+		if(nonzero) {
 			break;
 		}
 	}
@@ -109,12 +137,14 @@ void ge_double_scalarmult_vartime(ge_p2 *r, const unsigned char *a, const ge_p3
 	for(; i >= 0; --i) {
 		ge_p2_dbl(&t, r);
 
-		if(aslide[i] > 0) {
-			ge_p1p1_to_p3(&u, &t);
-			ge_add(&t, &u, &Ai[aslide[i] / 2]);
-		} else if(aslide[i] < 0) {
-			ge_p1p1_to_p3(&u, &t);
-			ge_sub(&t, &u, &Ai[(-aslide[i]) / 2]);
+		for(j = 0; j < count; ++j) {
+			if(aslide[j][i] > 0) {
+				ge_p1p1_to_p3(&u, &t);
+				ge_add(&t, &u, &Ai[j][aslide[j][i] / 2]);
+			} else if(aslide[j][i] < 0) {
+				ge_p1p1_to_p3(&u, &t);
+				ge_sub(&t, &u, &Ai[j][(-aslide[j][i]) / 2]);
+			}
 		}
 
 		if(bslide[i] > 0) {
@@ -130,6 +160,15 @@ void ge_double_scalarmult_vartime(ge_p2 *r, const unsigned char *a, const ge_p3
 }
 
 
+#ifdef ED25519_FE51
+static const fe d = {
+	929955233495203, 466365720129213, 1662059464998953, 2033849074728123, 1442794654840575
+        };
+
+static const fe sqrtm1 = {
+	1718705420411056, 234908883556509, 2233514472574048, 2117202627021982, 765476049583133
+        };
+#else
 static const fe d = {
 	-10913610, 13857413, -15372611, 6949391, 114729, -8787816, -6275908, -3247719, -18696448, -12055116
         };
@@ -137,6 +176,7 @@ static const fe d = {
 static const fe sqrtm1 = {
 	-32595792, -7943725, 9377950, 3500415, 12389472, -272473, -25146209, -2005654, 326686, 11406482
         };
+#endif
 
 int ge_frombytes_negate_vartime(ge_p3 *h, const unsigned char *s) {
 	fe u;
@@ -295,9 +335,15 @@ void ge_p3_dbl(ge_p1p1 *r, const ge_p3 *p) {
 r = p
 */
 
+#ifdef ED25519_FE51
+static const fe d2 = {
+	1859910466990425, 932731440258426, 1072319116312658, 1815898335770999, 633789495995903
+        };
+#else
 static const fe d2 = {
 	-21827239, -5839606, -30745221, 13898782, 229458, 15978800, -12551817, -6495438, 29715968, 9444199
         };
+#endif
 
 void ge_p3_to_cached(ge_cached *r, const ge_p3 *p) {
 	fe_add(r->YplusX, p->Y, p->X);
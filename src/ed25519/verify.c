@@ -3,6 +3,8 @@
 #include "ge.h"
 #include "sc.h"
 
+#include <string.h>
+
 static int consttime_equal(const unsigned char *x, const unsigned char *y) {
 	unsigned char r = 0;
 
@@ -75,3 +77,117 @@ int ed25519_verify(const unsigned char *signature, const unsigned char *message,
 
 	return 1;
 }
+
+/* Reject encodings that decode to a point, but that ge_tobytes() would never produce. */
+static int is_canonical(const unsigned char *s) {
+	unsigned char ones = (s[31] & 0x7f) ^ 0x7f;
+	unsigned char zeros = s[31] & 0x7f;
+	int i;
+
+	for(i = 1; i < 31; i++) {
+		ones |= s[i] ^ 0xff;
+		zeros |= s[i];
+	}
+
+	/* y >= 2^255-19 */
+	if(!ones && s[0] >= 0xed) {
+		return 0;
+	}
+
+	/* x = 0 with the sign bit set, which is only possible for y = 1 and y = -1 */
+	if(s[31] & 0x80) {
+		if((!zeros && s[0] == 1) || (!ones && s[0] == 0xec)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Points whose order divides 8. Multiplied by an even z, an order 2 point vanishes from the batch
+   equation, while ed25519_verify() rejects a signature with such an R. */
+static int is_small_order(const ge_p3 *p) {
+	static const unsigned char neutral[32] = {1};
+	unsigned char s[32];
+	ge_p1p1 t;
+	ge_p2 q;
+
+	ge_p3_dbl(&t, p);
+	ge_p1p1_to_p2(&q, &t);
+	ge_p2_dbl(&t, &q);
+	ge_p1p1_to_p2(&q, &t);
+	ge_p2_dbl(&t, &q);
+	ge_p1p1_to_p2(&q, &t);
+	ge_tobytes(s, &q);
+
+	return consttime_equal(s, neutral);
+}
+
+/*
+Check up to ED25519_BATCH_MAX signatures at once, using the random linear
+combination z[0] * (R[0] - s[0] * B + h[0] * A[0]) + ... == 0.
+The z values must be unpredictable to whoever made the signatures.
+
+Returns 1 if all signatures are valid. If not, the caller has to use
+ed25519_verify() to find out which ones are bad. Keys and R values of small
+order are rejected here, so signatures using them are always left to
+ed25519_verify(). Only a signer that deliberately adds a small order
+component to an otherwise valid R or key can still, by chance, get a
+signature through here that ed25519_verify() would reject. That signer can
+make valid signatures anyway, so this does not allow forgeries.
+*/
+int ed25519_verify_batch(const unsigned char *const *signatures, const unsigned char *const *messages, const size_t *message_lens, const unsigned char *const *public_keys, const unsigned char (*z)[16], size_t count) {
+	unsigned char scalars[2 * ED25519_BATCH_MAX][32];
+	ge_p3 points[2 * ED25519_BATCH_MAX];
+	unsigned char b[32] = {0};
+	unsigned char zero[32] = {0};
+	unsigned char zi[32] = {0};
+	unsigned char h[64];
+	unsigned char checker[32];
+	sha512_context hash;
+	ge_p2 R;
+	size_t i;
+
+	if(count > ED25519_BATCH_MAX) {
+		return 0;
+	}
+
+	for(i = 0; i < count; i++) {
+		const unsigned char *signature = signatures[i];
+
+		if(signature[63] & 224) {
+			return 0;
+		}
+
+		if(!is_canonical(signature)) {
+			return 0;
+		}
+
+		/* Both points come out negated, so the sum of all terms should be the neutral element */
+		if(ge_frombytes_negate_vartime(&points[2 * i], public_keys[i]) != 0 || is_small_order(&points[2 * i])) {
+			return 0;
+		}
+
+		if(ge_frombytes_negate_vartime(&points[2 * i + 1], signature) != 0 || is_small_order(&points[2 * i + 1])) {
+			return 0;
+		}
+
+		sha512_init(&hash);
+		sha512_update(&hash, signature, 32);
+		sha512_update(&hash, public_keys[i], 32);
+		sha512_update(&hash, messages[i], message_lens[i]);
+		sha512_final(&hash, h);
+		sc_reduce(h);
+
+		memcpy(zi, z[i], 16);
+		sc_muladd(scalars[2 * i], zi, h, zero);
+		memcpy(scalars[2 * i + 1], zi, 32);
+		sc_muladd(b, zi, signature + 32, b);
+	}
+
+	ge_multi_scalarmult_vartime(&R, b, 2 * count, (const unsigned char (*)[32])scalars, points);
+	ge_tobytes(checker, &R);
+
+	zero[0] = 1;
+	return consttime_equal(checker, zero);
+}
@@ -22,7 +22,9 @@
 
 #include "splay_tree.h"
 #include "control_common.h"
+#include "dump.h"
 #include "edge.h"
+#include "events.h"
 #include "logger.h"
 #include "netutl.h"
 #include "node.h"
@@ -87,6 +89,7 @@ void edge_add(edge_t *e) {
 		return;
 	}
 
+	event_edge(e, true);
 
 	e->reverse = lookup_edge(e->to, e->from);
 
@@ -100,6 +103,8 @@ void edge_add(edge_t *e) {
 		logger(DEBUG_ALWAYS, LOG_ERR, "Edge from %s to %s already exists in edge_weight_tree\n", e->from->name, e->to->name);
 		return;
 	}
+
+	e->to->incoming_edges++;
 }
 
 void edge_del(edge_t *e) {
@@ -107,10 +112,28 @@ void edge_del(edge_t *e) {
 		e->reverse->reverse = NULL;
 	}
 
-	splay_delete(&edge_weight_tree, e);
+	splay_node_t *node = splay_search_node(&edge_weight_tree, e);
+
+	if(node) {
+		e->to->incoming_edges--;
+		splay_delete_node(&edge_weight_tree, node);
+	}
+
+	event_edge(e, false);
 	splay_delete(&e->from->edge_tree, e);
 }
 
+/* Change the weight of an edge, keeping edge_weight_tree sorted */
+
+void edge_set_weight(edge_t *e, int weight) {
+	splay_node_t *node = splay_unlink(&edge_weight_tree, e);
+	e->weight = weight;
+
+	if(node) {
+		splay_insert_node(&edge_weight_tree, node);
+	}
+}
+
 edge_t *lookup_edge(node_t *from, node_t *to) {
 	edge_t v;
 
@@ -120,19 +143,56 @@ edge_t *lookup_edge(node_t *from, node_t *to) {
 	return splay_search(&from->edge_tree, &v);
 }
 
+static void dump_edge(connection_t *c, const edge_t *e) {
+	if(!dump_is_json(c)) {
+		char *address = sockaddr2hostname(&e->address);
+		char *local_address = sockaddr2hostname(&e->local_address);
+		send_request(c, "%d %d %s %s %s %s %x %d",
+		             CONTROL, REQ_DUMP_EDGES,
+		             e->from->name, e->to->name, address,
+		             local_address, e->options, e->weight);
+		free(address);
+		free(local_address);
+		return;
+	}
+
+	json_t json;
+	json_begin(&json);
+	json_string(&json, "from", e->from->name);
+	json_string(&json, "to", e->to->name);
+	json_sockaddr(&json, "address", "port", &e->address);
+	json_sockaddr(&json, "local_address", "local_port", &e->local_address);
+	json_uint(&json, "options", e->options);
+	json_int(&json, "weight", e->weight);
+	dump_json(c, REQ_DUMP_EDGES, &json);
+}
+
+/* Returns true once all edges have been dumped. The cursor is the origin and
+   destination of the last edge sent, so the next batch starts right after it. */
+
 bool dump_edges(connection_t *c) {
-	for splay_each(node_t, n, &node_tree) {
-		for splay_each(edge_t, e, &n->edge_tree) {
-			char *address = sockaddr2hostname(&e->address);
-			char *local_address = sockaddr2hostname(&e->local_address);
-			send_request(c, "%d %d %s %s %s %s %x %d",
-			             CONTROL, REQ_DUMP_EDGES,
-			             e->from->name, e->to->name, address,
-			             local_address, e->options, e->weight);
-			free(address);
-			free(local_address);
+	dump_t *dump = c->dump;
+	node_t from = {.name = dump->name};
+	node_t to = {.name = dump->to};
+	edge_t cursor = {.from = &from, .to = &to};
+	splay_node_t *node = dump->name ? splay_search_closest_greater_node(&node_tree, &from) : node_tree.head;
+	int count = 0;
+
+	for(; node; node = node->next) {
+		node_t *n = node->data;
+		bool resume = dump->name && !strcmp(n->name, dump->name);
+
+		for(splay_node_t *enode = dump_resume(&n->edge_tree, resume ? &cursor : NULL); enode; enode = enode->next) {
+			edge_t *e = enode->data;
+			dump_edge(c, e);
+
+			if(++count == DUMP_BATCH) {
+				dump_cursor(&dump->name, e->from->name);
+				dump_cursor(&dump->to, e->to->name);
+				return false;
+			}
 		}
 	}
 
-	return send_request(c, "%d %d", CONTROL, REQ_DUMP_EDGES);
+	return true;
 }
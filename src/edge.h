@@ -47,6 +47,7 @@ extern void free_edge(edge_t *e);
 extern void init_edge_tree(splay_tree_t *tree);
 extern void edge_add(edge_t *e);
 extern void edge_del(edge_t *e);
+extern void edge_set_weight(edge_t *e, int weight);
 extern edge_t *lookup_edge(struct node_t *from, struct node_t *to);
 extern bool dump_edges(struct connection_t *c);
 
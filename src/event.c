@@ -26,10 +26,15 @@
 #endif
 
 #include "event.h"
+#include "logger.h"
+#include "trace.h"
 #include "utils.h"
 #include "net.h"
 
 struct timeval now;
+histogram_t event_loop_latency;
+event_stats_t event_stats;
+uint64_t slow_callback_threshold = 0;
 #ifndef HAVE_WINDOWS
 
 #ifdef HAVE_SYS_EPOLL_H
@@ -108,7 +113,7 @@ static int timeout_compare(const timeout_t *a, const timeout_t *b) {
 static splay_tree_t io_tree = {.compare = (splay_compare_t)io_compare};
 static splay_tree_t timeout_tree = {.compare = (splay_compare_t)timeout_compare};
 
-void io_add(io_t *io, io_cb_t cb, void *data, int fd, int flags) {
+void io_add_named(io_t *io, io_cb_t cb, const char *name, void *data, int fd, int flags) {
 	if(io->cb) {
 		return;
 	}
@@ -127,6 +132,7 @@ void io_add(io_t *io, io_cb_t cb, void *data, int fd, int flags) {
 	event_count++;
 #endif
 	io->cb = cb;
+	io->name = name;
 	io->data = data;
 	io->node.data = io;
 
@@ -142,9 +148,9 @@ void io_add(io_t *io, io_cb_t cb, void *data, int fd, int flags) {
 }
 
 #ifdef HAVE_WINDOWS
-void io_add_event(io_t *io, io_cb_t cb, void *data, WSAEVENT event) {
+void io_add_event_named(io_t *io, io_cb_t cb, const char *name, void *data, WSAEVENT event) {
 	io->event = event;
-	io_add(io, cb, data, -1, 0);
+	io_add_named(io, cb, name, data, -1, 0);
 }
 #endif
 
@@ -245,8 +251,9 @@ void io_del(io_t *io) {
 	io->cb = NULL;
 }
 
-void timeout_add(timeout_t *timeout, timeout_cb_t cb, void *data, struct timeval *tv) {
+void timeout_add_named(timeout_t *timeout, timeout_cb_t cb, const char *name, void *data, struct timeval *tv) {
 	timeout->cb = cb;
+	timeout->name = name;
 	timeout->data = data;
 	timeout->node.data = timeout;
 
@@ -353,7 +360,41 @@ void signal_del(signal_t *sig) {
 }
 #endif
 
+void event_stats_reset(void) {
+	event_stats.slowest = 0;
+	event_stats.slowest_name = NULL;
+}
+
+static void callback_done(histogram_t *h, const struct timespec *start, const char *name) {
+	uint64_t usec = histogram_stop(h, start);
+
+	if(usec > event_stats.slowest) {
+		event_stats.slowest = usec;
+		event_stats.slowest_name = name;
+	}
+
+	if(slow_callback_threshold && usec >= slow_callback_threshold) {
+		event_stats.slow_callbacks++;
+		logger(DEBUG_ALWAYS, LOG_WARNING, "Callback %s took %"PRIu64" ms", name, usec / 1000);
+	}
+}
+
+/* The io might be freed by its callback, so remember its name beforehand */
+
+static void io_run(io_t *io, int flags) {
+	const char *name = io->name;
+	struct timespec start;
+	histogram_start(&start);
+	TRACE2(io_start, name, flags);
+	io->cb(io->data, flags);
+	TRACE1(io_done, name);
+	callback_done(&event_stats.io, &start, name);
+}
+
 static struct timeval *timeout_execute(struct timeval *diff) {
+	struct timespec begin;
+	histogram_start(&begin);
+
 	gettimeofday(&now, NULL);
 	struct timeval *tv = NULL;
 
@@ -362,7 +403,14 @@ static struct timeval *timeout_execute(struct timeval *diff) {
 		timersub(&timeout->tv, &now, diff);
 
 		if(diff->tv_sec < 0) {
+			histogram_add(&event_stats.timeout_lag, (uint64_t)(-diff->tv_sec) * 1000000 - (uint64_t)diff->tv_usec);
+
+			struct timespec start;
+			histogram_start(&start);
+			TRACE1(timeout_start, timeout->name);
 			timeout->cb(timeout->data);
+			TRACE1(timeout_done, timeout->name);
+			callback_done(&event_stats.timeout, &start, timeout->name);
 
 			if(timercmp(&timeout->tv, &now, <)) {
 				timeout_del(timeout);
@@ -373,6 +421,7 @@ static struct timeval *timeout_execute(struct timeval *diff) {
 		}
 	}
 
+	histogram_stop(&event_stats.timeouts, &begin);
 	return tv;
 }
 
@@ -392,9 +441,13 @@ bool event_loop(void) {
 	fd_set writable;
 #endif
 
+	struct timespec busy;
+	histogram_start(&busy);
+
 	while(running) {
 		struct timeval diff;
 		struct timeval *tv = timeout_execute(&diff);
+		histogram_stop(&event_loop_latency, &busy);
 #ifndef HAVE_SYS_EPOLL_H
 		memcpy(&readable, &readfds, sizeof(readable));
 		memcpy(&writable, &writefds, sizeof(writable));
@@ -421,6 +474,8 @@ bool event_loop(void) {
 		int n = select(maxfds, &readable, &writable, NULL, tv);
 #endif
 
+		histogram_start(&busy);
+
 		if(n < 0) {
 			if(sockwouldblock(sockerrno)) {
 				continue;
@@ -442,15 +497,16 @@ bool event_loop(void) {
 			io_t *io = events[i].data.ptr;
 
 			if(events[i].events & EPOLLOUT && io->flags & IO_WRITE) {
-				io->cb(io->data, IO_WRITE);
+				io_run(io, IO_WRITE);
 			}
 
 			if(curgen != io_tree.generation) {
 				break;
 			}
 
-			if(events[i].events & EPOLLIN && io->flags & IO_READ) {
-				io->cb(io->data, IO_READ);
+			/* Errors are reported like select() does, as the socket being readable */
+			if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP) && io->flags & IO_READ) {
+				io_run(io, IO_READ);
 			}
 
 			if(curgen != io_tree.generation) {
@@ -462,9 +518,9 @@ bool event_loop(void) {
 
 		for splay_each(io_t, io, &io_tree) {
 			if(FD_ISSET(io->fd, &writable)) {
-				io->cb(io->data, IO_WRITE);
+				io_run(io, IO_WRITE);
 			} else if(FD_ISSET(io->fd, &readable)) {
-				io->cb(io->data, IO_READ);
+				io_run(io, IO_READ);
 			} else {
 				continue;
 			}
@@ -486,13 +542,18 @@ bool event_loop(void) {
 #else
 	assert(WSA_WAIT_EVENT_0 == 0);
 
+	struct timespec busy;
+	histogram_start(&busy);
+
 	while(running) {
 		struct timeval diff;
 		struct timeval *tv = timeout_execute(&diff);
+		histogram_stop(&event_loop_latency, &busy);
 		DWORD timeout_ms = tv ? (DWORD)(tv->tv_sec * 1000 + tv->tv_usec / 1000 + 1) : WSA_INFINITE;
 
 		if(!event_count) {
 			Sleep(timeout_ms);
+			histogram_start(&busy);
 			continue;
 		}
 
@@ -510,7 +571,7 @@ bool event_loop(void) {
 
 		for splay_each(io_t, io, &io_tree) {
 			if(io->flags & IO_WRITE && send(io->fd, NULL, 0, 0) == 0) {
-				io->cb(io->data, IO_WRITE);
+				io_run(io, IO_WRITE);
 
 				if(curgen != io_tree.generation) {
 					break;
@@ -541,6 +602,7 @@ bool event_loop(void) {
 
 		for(DWORD event_offset = 0; event_offset < event_count;) {
 			DWORD result = WSAWaitForMultipleEvents(event_count - event_offset, &events[event_offset], FALSE, timeout_ms, FALSE);
+			histogram_start(&busy);
 
 			if(result == WSA_WAIT_TIMEOUT) {
 				break;
@@ -555,7 +617,7 @@ bool event_loop(void) {
 			io_t *io = io_map[event_index];
 
 			if(io->fd == -1) {
-				io->cb(io->data, 0);
+				io_run(io, 0);
 
 				if(curgen != io_tree.generation) {
 					break;
@@ -568,7 +630,7 @@ bool event_loop(void) {
 				}
 
 				if(network_events.lNetworkEvents & READ_EVENTS) {
-					io->cb(io->data, IO_READ);
+					io_run(io, IO_READ);
 
 					if(curgen != io_tree.generation) {
 						break;
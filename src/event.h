@@ -21,6 +21,7 @@
 */
 
 #include "system.h"
+#include "histogram.h"
 #include "splay_tree.h"
 
 #define IO_READ 1
@@ -37,6 +38,7 @@ typedef struct io_t {
 	WSAEVENT event;
 #endif
 	io_cb_t cb;
+	const char *name;               /* name of the callback, for logging slow ones */
 	void *data;
 	splay_node_t node;
 } io_t;
@@ -44,6 +46,7 @@ typedef struct io_t {
 typedef struct timeout_t {
 	struct timeval tv;
 	timeout_cb_t cb;
+	const char *name;
 	void *data;
 	splay_node_t node;
 } timeout_t;
@@ -56,14 +59,38 @@ typedef struct signal_t {
 
 extern struct timeval now;
 
-extern void io_add(io_t *io, io_cb_t cb, void *data, int fd, int flags);
+/* Time spent running callbacks between two waits for new events */
+extern histogram_t event_loop_latency;
+
+typedef struct event_stats_t {
+	histogram_t io;                 /* run time of I/O callbacks */
+	histogram_t timeout;            /* run time of timeout callbacks */
+	histogram_t timeouts;           /* time spent checking and running all expired timeouts */
+	histogram_t timeout_lag;        /* how long after their expiry timeouts ran */
+	uint64_t slow_callbacks;        /* callbacks that took longer than slow_callback_threshold */
+	uint64_t slowest;               /* longest run time of a single callback */
+	const char *slowest_name;
+} event_stats_t;
+
+extern event_stats_t event_stats;
+extern uint64_t slow_callback_threshold;        /* in microseconds, 0 to not log slow callbacks */
+
+/* Forget the slowest callback. The histograms and counters only ever increase, since they are exported as metrics. */
+extern void event_stats_reset(void);
+
+/* The callback's name is remembered, so slow callbacks can be logged by name */
+#define io_add(io, cb, ...) io_add_named(io, cb, #cb, __VA_ARGS__)
+#define timeout_add(timeout, cb, ...) timeout_add_named(timeout, cb, #cb, __VA_ARGS__)
+
+extern void io_add_named(io_t *io, io_cb_t cb, const char *name, void *data, int fd, int flags);
 #ifdef HAVE_WINDOWS
-extern void io_add_event(io_t *io, io_cb_t cb, void *data, WSAEVENT event);
+#define io_add_event(io, cb, ...) io_add_event_named(io, cb, #cb, __VA_ARGS__)
+extern void io_add_event_named(io_t *io, io_cb_t cb, const char *name, void *data, WSAEVENT event);
 #endif
 extern void io_del(io_t *io);
 extern void io_set(io_t *io, int flags);
 
-extern void timeout_add(timeout_t *timeout, timeout_cb_t cb, void *data, struct timeval *tv);
+extern void timeout_add_named(timeout_t *timeout, timeout_cb_t cb, const char *name, void *data, struct timeval *tv);
 extern void timeout_del(timeout_t *timeout);
 extern void timeout_set(timeout_t *timeout, struct timeval *tv);
 
@@ -0,0 +1,123 @@
+#include "system.h"
+
+#include "control_common.h"
+#include "events.h"
+#include "logger.h"
+#include "meta.h"
+#include "net.h"
+#include "netutl.h"
+#include "protocol.h"
+
+bool eventcontrol = false; // controlled by REQ_SUBSCRIBE <events>
+
+static void send_event(event_type_t type, const char *format, ...) ATTR_FORMAT(printf, 2, 3);
+
+static void send_event(event_type_t type, const char *format, ...) {
+	char event[MAXBUFSIZE - 16];
+	va_list args;
+
+	va_start(args, format);
+	int len = vsnprintf(event, sizeof(event), format, args);
+	va_end(args);
+
+	if(len < 0 || (size_t)len >= sizeof(event)) {
+		return;
+	}
+
+	eventcontrol = false;
+
+	for list_each(connection_t, c, &connection_list) {
+		if(!c->event_mask) {
+			continue;
+		}
+
+		eventcontrol = true;
+
+		if(!(c->event_mask & type) || c->status.events_lost) {
+			continue;
+		}
+
+		if(meta_output_len(c) >= EVENT_QUEUE_LIMIT) {
+			logger(DEBUG_CONNECTIONS, LOG_WARNING, "Dropping events for %s (%s) until it catches up", c->name, c->hostname);
+			c->status.events_lost = true;
+			continue;
+		}
+
+		send_request(c, "%d %d %s", CONTROL, REQ_SUBSCRIBE, event);
+	}
+}
+
+bool subscribe_events(connection_t *c, const char *request) {
+	unsigned int mask = EVENT_ALL;
+	sscanf(request, "%*d %*d %u", &mask);
+
+	c->event_mask = mask & EVENT_ALL;
+	c->status.events_lost = false;
+
+	if(c->event_mask) {
+		eventcontrol = true;
+	}
+
+	return send_request(c, "%d %d %d", CONTROL, REQ_SUBSCRIBE, 0);
+}
+
+/* Called when most of the output of a control connection has been sent */
+
+void events_drained(connection_t *c) {
+	if(c->status.events_lost && meta_output_len(c) < EVENT_QUEUE_LIMIT / 2) {
+		c->status.events_lost = false;
+		send_request(c, "%d %d resync", CONTROL, REQ_SUBSCRIBE);
+	}
+}
+
+void event_node(const node_t *n) {
+	if(!eventcontrol) {
+		return;
+	}
+
+	if(!n->status.reachable) {
+		send_event(EVENT_NODE, "node down %s", n->name);
+		return;
+	}
+
+	char *address, *port;
+	sockaddr2str(&n->address, &address, &port);
+	send_event(EVENT_NODE, "node up %s %s %s", n->name, address, port);
+	free(address);
+	free(port);
+}
+
+void event_edge(const edge_t *e, bool add) {
+	if(!eventcontrol) {
+		return;
+	}
+
+	if(!add) {
+		send_event(EVENT_EDGE, "edge del %s %s", e->from->name, e->to->name);
+		return;
+	}
+
+	char *address, *port;
+	sockaddr2str(&e->address, &address, &port);
+	send_event(EVENT_EDGE, "edge add %s %s %s %s %x %d", e->from->name, e->to->name, address, port, e->options, e->weight);
+	free(address);
+	free(port);
+}
+
+void event_subnet(const node_t *owner, const char *netstr, bool up) {
+	if(eventcontrol) {
+		send_event(EVENT_SUBNET, "subnet %s %s %s", up ? "up" : "down", netstr, owner->name);
+	}
+}
+
+void event_mtu(const node_t *n) {
+	if(eventcontrol) {
+		send_event(EVENT_MTU, "mtu %s %d", n->name, n->mtu);
+	}
+}
+
+void event_connection(const connection_t *c, bool up) {
+	if(eventcontrol) {
+		send_event(EVENT_CONNECTION, "connection %s %s %s", up ? "up" : "down", c->name, c->hostname);
+	}
+}
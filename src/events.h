@@ -0,0 +1,26 @@
+#ifndef TINC_EVENTS_H
+#define TINC_EVENTS_H
+
+#include "system.h"
+
+#include "connection.h"
+#include "edge.h"
+#include "node.h"
+
+/* When this much output is waiting on a subscribed control connection, further events
+   for it are dropped. Once it has caught up, it gets a resync event instead, after which
+   it should dump the nodes, edges and subnets again to find out what it missed. */
+#define EVENT_QUEUE_LIMIT (256 * 1024)
+
+extern bool eventcontrol;
+
+extern bool subscribe_events(connection_t *c, const char *request);
+extern void events_drained(connection_t *c);
+
+extern void event_node(const node_t *n);
+extern void event_edge(const edge_t *e, bool add);
+extern void event_subnet(const node_t *owner, const char *netstr, bool up);
+extern void event_mtu(const node_t *n);
+extern void event_connection(const connection_t *c, bool up);
+
+#endif // TINC_EVENTS_H
@@ -34,8 +34,10 @@
    however is not so fast, because I tried to avoid having to make a forest and
    merge trees.
 
-   For the SSSP algorithm Dijkstra's seems to be a nice choice. Currently a
-   simple breadth-first search is presented here.
+   For the SSSP algorithm Dijkstra's seems to be a nice choice. By default a
+   simple breadth-first search is used, which picks the path with the fewest
+   hops. With LatencyRouting, edge weights are kept up to date with the
+   measured round trip times, and Dijkstra's algorithm is used instead.
 
    The SSSP algorithm will also be used to determine whether nodes are directly,
    indirectly or not reachable from the source. It will also set the correct
@@ -44,8 +46,10 @@
 
 #include "system.h"
 
+#include "autoconnect.h"
 #include "connection.h"
 #include "edge.h"
+#include "events.h"
 #include "graph.h"
 #include "list.h"
 #include "logger.h"
@@ -54,6 +58,7 @@
 #include "protocol.h"
 #include "script.h"
 #include "subnet.h"
+#include "trace.h"
 #include "xalloc.h"
 
 /* Implementation of Kruskal's algorithm.
@@ -206,6 +211,97 @@ static void sssp_bfs(void) {
 	list_free(todo_list);
 }
 
+/* Nodes that have been reached but not examined yet, the one with the best path first */
+
+static int path_compare(const node_t *a, const node_t *b) {
+	if(a->status.indirect != b->status.indirect) {
+		return a->status.indirect - b->status.indirect;
+	}
+
+	if(a->path_weight != b->path_weight) {
+		return a->path_weight < b->path_weight ? -1 : 1;
+	}
+
+	return strcmp(a->name, b->name);
+}
+
+static splay_tree_t path_queue = {.compare = (splay_compare_t)path_compare};
+
+/* Implementation of Dijkstra's algorithm.
+   Like sssp_bfs(), it prefers paths on which nodes can be reached directly,
+   but among those it picks the one with the lowest sum of edge weights,
+   so indirectly reachable nodes get the relay with the lowest latency.
+   Running time: O(E log N)
+*/
+
+static void sssp_dijkstra(void) {
+	/* Clear visited status on nodes */
+
+	for splay_each(node_t, n, &node_tree) {
+		n->status.visited = false;
+		n->status.indirect = true;
+		n->distance = -1;
+	}
+
+	/* Begin with myself */
+
+	myself->status.visited = true;
+	myself->status.indirect = false;
+	myself->nexthop = myself;
+	myself->prevedge = NULL;
+	myself->via = myself;
+	myself->distance = 0;
+	myself->path_weight = 0;
+	splay_insert(&path_queue, myself);
+
+	/* Loop while there are nodes whose edges have not been examined */
+
+	while(path_queue.head) {
+		node_t *n = path_queue.head->data;
+		splay_delete_node(&path_queue, path_queue.head);
+
+		logger(DEBUG_SCARY_THINGS, LOG_DEBUG, " Examining edges from %s", n->name);
+
+		for splay_each(edge_t, e, &n->edge_tree) {
+			if(!e->reverse || e->to == myself) {
+				continue;
+			}
+
+			bool indirect = n->status.indirect || e->options & OPTION_INDIRECT;
+			uint64_t weight = n->path_weight + (uint64_t)MAX(e->weight, 0);
+
+			if(e->to->status.visited
+			                && (!e->to->status.indirect || indirect)
+			                && (e->to->status.indirect != indirect || weight >= e->to->path_weight)) {
+				continue;
+			}
+
+			// A node can only get a better path while it is still waiting to be examined
+
+			splay_node_t *queued = e->to->status.visited ? splay_unlink(&path_queue, e->to) : NULL;
+
+			e->to->status.visited = true;
+			e->to->status.indirect = indirect;
+			e->to->nexthop = (n->nexthop == myself) ? e->to : n->nexthop;
+			e->to->prevedge = e;
+			e->to->via = indirect ? n->via : e->to;
+			e->to->options = e->options;
+			e->to->distance = n->distance + 1;
+			e->to->path_weight = weight;
+
+			if(!e->to->status.reachable || (e->to->address.sa.sa_family == AF_UNSPEC && e->address.sa.sa_family != AF_UNKNOWN)) {
+				update_node_udp(e->to, &e->address);
+			}
+
+			if(queued) {
+				splay_insert_node(&path_queue, queued);
+			} else {
+				splay_insert(&path_queue, e->to);
+			}
+		}
+	}
+}
+
 static void check_reachability(void) {
 	/* Check reachability status. */
 
@@ -217,6 +313,7 @@ static void check_reachability(void) {
 		if(n->status.visited != n->status.reachable) {
 			n->status.reachable = !n->status.reachable;
 			n->last_state_change = now.tv_sec;
+			autoconnect_update(n);
 
 			if(n->status.reachable) {
 				logger(DEBUG_TRAFFIC, LOG_DEBUG, "Node %s (%s) became reachable",
@@ -254,6 +351,7 @@ static void check_reachability(void) {
 			n->maxrecentlen = 0;
 			n->minmtu = 0;
 			n->mtuprobes = 0;
+			link_stats_reset(&n->link);
 
 			timeout_del(&n->udp_ping_timeout);
 
@@ -278,6 +376,7 @@ static void check_reachability(void) {
 			free(port);
 			environment_exit(&env);
 
+			event_node(n);
 			subnet_update(n, NULL, n->status.reachable);
 
 			if(!n->status.reachable) {
@@ -306,9 +405,25 @@ static void check_reachability(void) {
 	}
 }
 
+histogram_t graph_duration;
+bool latency_routing = false;
+
 void graph(void) {
+	struct timespec start;
+	histogram_start(&start);
+	TRACE1(graph_start, latency_routing);
+
 	subnet_cache_flush_tables();
-	sssp_bfs();
+
+	if(latency_routing) {
+		sssp_dijkstra();
+	} else {
+		sssp_bfs();
+	}
+
 	check_reachability();
 	mst_kruskal();
+
+	TRACE1(graph_done, latency_routing);
+	histogram_stop(&graph_duration, &start);
 }
@@ -21,6 +21,14 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include "histogram.h"
+
+/* How long graph() took, including any scripts it ran */
+extern histogram_t graph_duration;
+
+/* Whether shortest paths are chosen on the sum of edge weights instead of the number of hops */
+extern bool latency_routing;
+
 extern void graph(void);
 
 #endif
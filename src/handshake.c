@@ -0,0 +1,78 @@
+#include "system.h"
+
+#include "conf.h"
+#include "handshake.h"
+#include "logger.h"
+#include "sptps.h"
+#include "xalloc.h"
+
+typedef struct handshake_job_t {
+	worker_job_t job;               /* must be first */
+	sptps_job_t *sptps_job;
+} handshake_job_t;
+
+static worker_pool_t handshake_pool = WORKER_POOL_INIT("handshake", 0);
+
+static void handshake_work(worker_job_t *job) {
+	sptps_job_run(((handshake_job_t *)job)->sptps_job);
+}
+
+static void handshake_work_batch(worker_job_t **jobs, size_t count) {
+	sptps_job_t *sptps_jobs[WORKER_BATCH_MAX];
+
+	for(size_t i = 0; i < count; i++) {
+		sptps_jobs[i] = ((handshake_job_t *)jobs[i])->sptps_job;
+	}
+
+	sptps_job_run_batch(sptps_jobs, count);
+}
+
+static void handshake_done(worker_job_t *job) {
+	sptps_job_t *sptps_job = ((handshake_job_t *)job)->sptps_job;
+	free(job);
+	sptps_job_finish(sptps_job);
+}
+
+static void handshake_discard(worker_job_t *job) {
+	sptps_job_free(((handshake_job_t *)job)->sptps_job);
+	free(job);
+}
+
+static bool handshake_offload(sptps_job_t *sptps_job) {
+	handshake_job_t *job = xzalloc(sizeof(*job));
+	job->job.work = handshake_work;
+	job->job.done = handshake_done;
+	job->job.discard = handshake_discard;
+	job->sptps_job = sptps_job;
+
+	if(!worker_submit(&handshake_pool, &job->job)) {
+		free(job);
+		return false;
+	}
+
+	return true;
+}
+
+void handshake_init(void) {
+	int threads = 0;
+
+	get_config_int(lookup_config(&config_tree, "HandshakeThreads"), &threads);
+
+	if(threads <= 0) {
+		return;
+	}
+
+	logger(DEBUG_ALWAYS, LOG_INFO, "Using up to %d threads for SPTPS handshakes", threads);
+	handshake_pool.max_threads = threads;
+	handshake_pool.work_batch = handshake_work_batch;
+	sptps_offload = handshake_offload;
+}
+
+void handshake_exit(void) {
+	sptps_offload = NULL;
+	worker_stop(&handshake_pool);
+}
+
+const worker_stats_t *handshake_stats(void) {
+	return &handshake_pool.stats;
+}
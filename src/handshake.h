@@ -0,0 +1,15 @@
+#ifndef TINC_HANDSHAKE_H
+#define TINC_HANDSHAKE_H
+
+#include "system.h"
+
+#include "worker.h"
+
+/* Runs the public key operations of SPTPS handshakes in a pool of threads,
+   if enabled with HandshakeThreads. */
+
+extern void handshake_init(void);
+extern void handshake_exit(void);
+extern const worker_stats_t *handshake_stats(void);
+
+#endif // TINC_HANDSHAKE_H
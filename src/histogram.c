@@ -0,0 +1,137 @@
+#include "system.h"
+
+#include "histogram.h"
+
+static int highest_bit(uint64_t x) {
+	int bit = 0;
+
+	for(int shift = 32; shift; shift /= 2) {
+		if(x >> shift) {
+			x >>= shift;
+			bit += shift;
+		}
+	}
+
+	return bit;
+}
+
+/* Buckets include their upper limit, so work with the value minus one.
+   Values below HISTOGRAM_SUB_BUCKETS get a bucket of their own, above that
+   the highest bit selects a group of buckets and the bits below it select one in that group. */
+
+int histogram_bucket(uint64_t usec) {
+	if(usec <= 1) {
+		return 0;
+	}
+
+	uint64_t x = usec - 1;
+
+	if(x < HISTOGRAM_SUB_BUCKETS) {
+		return (int)x;
+	}
+
+	int bit = highest_bit(x);
+	int shift = bit - HISTOGRAM_SUB_BITS;
+	int group = shift + 1;
+
+	if(group >= HISTOGRAM_BUCKETS / HISTOGRAM_SUB_BUCKETS) {
+		return HISTOGRAM_BUCKETS - 1;
+	}
+
+	return group * HISTOGRAM_SUB_BUCKETS + (int)((x >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+uint64_t histogram_bucket_limit(int bucket) {
+	if(bucket < HISTOGRAM_SUB_BUCKETS) {
+		return (uint64_t)bucket + 1;
+	}
+
+	int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+	return (HISTOGRAM_SUB_BUCKETS + sub + 1) << shift;
+}
+
+uint64_t histogram_percentile(const histogram_t *h, unsigned int percent) {
+	if(!h->count) {
+		return 0;
+	}
+
+	// Rank of the value we are looking for, rounded up
+
+	uint64_t rank = (h->count * percent + 99) / 100;
+	uint64_t seen = 0;
+
+	if(!rank) {
+		rank = 1;
+	}
+
+	for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += h->buckets[i];
+
+		if(seen >= rank) {
+			uint64_t limit = histogram_bucket_limit(i);
+			return limit < h->max ? limit : h->max;
+		}
+	}
+
+	return h->max;
+}
+
+void histogram_add(histogram_t *h, uint64_t usec) {
+	h->buckets[histogram_bucket(usec)]++;
+	h->count++;
+	h->sum += usec;
+
+	if(usec > h->max) {
+		h->max = usec;
+	}
+}
+
+void histogram_since(histogram_t *out, const histogram_t *h, const histogram_t *base) {
+	memset(out, 0, sizeof(*out));
+
+	if(h->count < base->count) {
+		return;
+	}
+
+	out->count = h->count - base->count;
+	out->sum = h->sum - base->sum;
+
+	int highest = -1;
+
+	for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		out->buckets[i] = h->buckets[i] - base->buckets[i];
+
+		if(out->buckets[i]) {
+			highest = i;
+		}
+	}
+
+	if(highest < 0) {
+		return;
+	}
+
+	if(highest == histogram_bucket(h->max)) {
+		out->max = h->max;
+	} else {
+		out->max = histogram_bucket_limit(highest);
+	}
+}
+
+void histogram_start(struct timespec *start) {
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+uint64_t histogram_elapsed(const struct timespec *start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	int64_t nsec = (int64_t)(end.tv_sec - start->tv_sec) * 1000000000 + (end.tv_nsec - start->tv_nsec);
+	return nsec > 0 ? (uint64_t)nsec / 1000 : 0;
+}
+
+uint64_t histogram_stop(histogram_t *h, const struct timespec *start) {
+	uint64_t usec = histogram_elapsed(start);
+	histogram_add(h, usec);
+	return usec;
+}
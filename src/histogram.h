@@ -0,0 +1,45 @@
+#ifndef TINC_HISTOGRAM_H
+#define TINC_HISTOGRAM_H
+
+#include "system.h"
+
+/* Histograms of durations in microseconds, with HDR-style log-linear buckets:
+   every power of two is split into HISTOGRAM_SUB_BUCKETS buckets of equal width,
+   so a value is never more than 1/HISTOGRAM_SUB_BUCKETS off from its bucket limit.
+   The last bucket also counts everything larger than 2^26 microseconds. */
+
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (24 * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct histogram_t {
+	uint64_t count;
+	uint64_t sum;                   /* total of all values, in microseconds */
+	uint64_t max;
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+/* Bucket a value is counted in */
+extern int histogram_bucket(uint64_t usec);
+
+/* Largest value counted in a bucket, in microseconds. The limit of every
+   HISTOGRAM_SUB_BUCKETS'th bucket is a power of two. */
+extern uint64_t histogram_bucket_limit(int bucket);
+
+/* Upper limit of the bucket the given percentile falls in, never more than the maximum */
+extern uint64_t histogram_percentile(const histogram_t *h, unsigned int percent);
+
+extern void histogram_add(histogram_t *h, uint64_t usec);
+
+/* The values added to h since it was copied to base. The maximum of those is only known
+   if it is h's maximum, otherwise the limit of the highest bucket they are in is used. */
+extern void histogram_since(histogram_t *out, const histogram_t *h, const histogram_t *base);
+
+/* Measure how long something takes, and add it to a histogram */
+extern void histogram_start(struct timespec *start);
+extern uint64_t histogram_stop(histogram_t *h, const struct timespec *start);
+
+/* Microseconds since histogram_start(), without adding it anywhere */
+extern uint64_t histogram_elapsed(const struct timespec *start);
+
+#endif // TINC_HISTOGRAM_H
@@ -74,16 +74,18 @@ static int info_node(int fd, const char *item) {
 	node_status_t status;
 	long int last_state_change;
 	int udp_ping_rtt;
+	int srtt = -1, jitter = 0;
+	unsigned int loss = 0;
 	uint64_t in_packets, in_bytes, out_packets, out_bytes;
 
 	while(recvline(fd, line, sizeof(line))) {
-		int n = sscanf(line, "%d %d %4095s %4095s %4095s port %4095s %d %d %d %d %x %"PRIx32" %4095s %4095s %d %hd %hd %hd %ld %d %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64, &code, &req, node, id, host, port, &cipher, &digest, &maclength, &compression, &options, &status_union.raw, nexthop, via, &distance, &pmtu, &minmtu, &maxmtu, &last_state_change, &udp_ping_rtt, &in_packets, &in_bytes, &out_packets, &out_bytes);
+		int n = sscanf(line, "%d %d %4095s %4095s %4095s port %4095s %d %d %d %d %x %"PRIx32" %4095s %4095s %d %hd %hd %hd %ld %d %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %d %*d %d %u", &code, &req, node, id, host, port, &cipher, &digest, &maclength, &compression, &options, &status_union.raw, nexthop, via, &distance, &pmtu, &minmtu, &maxmtu, &last_state_change, &udp_ping_rtt, &in_packets, &in_bytes, &out_packets, &out_bytes, &srtt, &jitter, &loss);
 
 		if(n == 2) {
 			break;
 		}
 
-		if(n != 24) {
+		if(n != 24 && n != 27) {
 			fprintf(stderr, "Unable to parse node dump from tincd.\n");
 			return 1;
 		}
@@ -185,7 +187,11 @@ static int info_node(int fd, const char *item) {
 	} else if(minmtu > 0) {
 		printf("directly with UDP\nPMTU:         %d\n", pmtu);
 
-		if(udp_ping_rtt != -1) {
+		if(srtt != -1) {
+			printf("RTT:          %d.%03d\n", srtt / 1000, srtt % 1000);
+			printf("Jitter:       %d.%03d\n", jitter / 1000, jitter % 1000);
+			printf("Loss:         %.2f%%\n", loss * 1e-4);
+		} else if(udp_ping_rtt != -1) {
 			printf("RTT:          %d.%03d\n", udp_ping_rtt / 1000, udp_ping_rtt % 1000);
 		}
 	} else if(!strcmp(nexthop, item)) {
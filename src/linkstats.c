@@ -0,0 +1,82 @@
+#include "system.h"
+
+#include "linkstats.h"
+
+void link_stats_reset(link_stats_t *ls) {
+	memset(ls, 0, sizeof(*ls));
+	link_stats_reset_rtt(ls);
+}
+
+void link_stats_reset_rtt(link_stats_t *ls) {
+	ls->srtt = -1;
+	ls->rttvar = 0;
+	ls->jitter = 0;
+	ls->last_rtt = -1;
+}
+
+void link_stats_rtt(link_stats_t *ls, int32_t rtt) {
+	if(rtt < 0) {
+		return;
+	}
+
+	ls->probes_answered++;
+
+	if(ls->srtt < 0) {
+		ls->srtt = rtt;
+		ls->rttvar = rtt / 2;
+		ls->jitter = 0;
+		ls->last_rtt = rtt;
+		return;
+	}
+
+	// RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R
+
+	int32_t delta = ls->srtt - rtt;
+	ls->rttvar += (abs(delta) - ls->rttvar) / 4;
+	ls->srtt -= delta / 8;
+
+	// J = J + (|D| - J) / 16
+
+	int32_t change = rtt - ls->last_rtt;
+	ls->jitter += (abs(change) - ls->jitter) / 16;
+	ls->last_rtt = rtt;
+}
+
+void link_stats_probe_lost(link_stats_t *ls) {
+	ls->probes_lost++;
+}
+
+void link_stats_sample(link_stats_t *ls, uint32_t received, uint32_t lost) {
+	// The counters start again from zero when a new session is started
+
+	if(received < ls->received) {
+		ls->received = 0;
+		ls->lost = 0;
+	}
+
+	// Packets that were counted as lost can still arrive late
+
+	uint64_t new_received = (uint64_t)(received - ls->received) + ls->probes_answered;
+	uint64_t new_lost = (uint64_t)(lost > ls->lost ? lost - ls->lost : 0) + ls->probes_lost;
+
+	ls->received = received;
+	ls->lost = lost;
+	ls->probes_answered = 0;
+	ls->probes_lost = 0;
+
+	if(!new_received && !new_lost) {
+		return;
+	}
+
+	uint32_t loss = (uint32_t)(new_lost * LINK_LOSS_SCALE / (new_received + new_lost));
+
+	// Move an eighth of the way towards the new sample, rounding so that it can reach zero
+
+	if(!ls->samples++) {
+		ls->loss = loss;
+	} else if(loss < ls->loss) {
+		ls->loss -= (ls->loss - loss + 7) / 8;
+	} else {
+		ls->loss += (loss - ls->loss) / 8;
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef TINC_LINKSTATS_H
+#define TINC_LINKSTATS_H
+
+#include "system.h"
+
+/* Smoothed estimates of the quality of the UDP path to a node. Round trip times
+   come from UDP probes, and are smoothed the way TCP does it (RFC 6298). Jitter is
+   the smoothed difference between consecutive round trip times, like RTP does it
+   (RFC 3550). Loss is sampled every time a probe is sent, from the probes that were
+   not answered and the gaps in the sequence numbers of the packets received. */
+
+#define LINK_LOSS_SCALE 1000000         /* loss is in parts per million */
+#define LINK_LOSS_HIGH 10000            /* above 1% loss, we probe more often */
+#define LINK_LOSS_LOW 1000              /* below 0.1% loss, we probe less often */
+
+typedef struct link_stats_t {
+	int32_t srtt;                   /* smoothed round trip time in microseconds, -1 if unknown */
+	int32_t rttvar;                 /* mean deviation of the round trip time in microseconds */
+	int32_t jitter;                 /* smoothed change between round trip times in microseconds */
+	int32_t last_rtt;               /* most recent round trip time in microseconds */
+	uint32_t loss;                  /* smoothed fraction of packets lost, in parts per million */
+	uint32_t samples;               /* number of loss samples taken */
+
+	uint32_t received;              /* packet counters at the previous loss sample */
+	uint32_t lost;
+	uint32_t probes_answered;       /* probes answered and unanswered since then */
+	uint32_t probes_lost;
+} link_stats_t;
+
+extern void link_stats_reset(link_stats_t *ls);
+extern void link_stats_reset_rtt(link_stats_t *ls);
+
+/* A probe was answered after rtt microseconds */
+extern void link_stats_rtt(link_stats_t *ls, int32_t rtt);
+
+/* A probe was not answered before the next one was sent */
+extern void link_stats_probe_lost(link_stats_t *ls);
+
+/* Update the loss estimate, given the total packets received and lost so far */
+extern void link_stats_sample(link_stats_t *ls, uint32_t received, uint32_t lost);
+
+static inline bool link_stats_lossy(const link_stats_t *ls) {
+	return ls->loss >= LINK_LOSS_HIGH;
+}
+
+static inline bool link_stats_stable(const link_stats_t *ls) {
+	return ls->srtt >= 0 && ls->samples >= 4 && ls->loss < LINK_LOSS_LOW;
+}
+
+#endif // TINC_LINKSTATS_H
@@ -20,6 +20,8 @@
 
 #include "system.h"
 
+#include <pthread.h>
+
 #include "conf.h"
 #include "meta.h"
 #include "names.h"
@@ -29,6 +31,7 @@
 #include "process.h"
 #include "sptps.h"
 #include "compression.h"
+#include "xalloc.h"
 
 debug_t debug_level = DEBUG_NOTHING;
 static logmode_t logmode = LOGMODE_STDERR;
@@ -40,55 +43,307 @@ static HANDLE loghandle = NULL;
 static const char *logident = NULL;
 bool logcontrol = false; // controlled by REQ_LOG <level>
 int umbilical = 0;
+log_stats_t log_stats;
 
 static bool should_log(debug_t level) {
 	return (level <= debug_level && logmode != LOGMODE_NULL) || logcontrol;
 }
 
-static void real_logger(debug_t level, int priority, const char *message) {
-	char timestr[32] = "";
-	static bool suppress = false;
+static void flush_log(void) {
+	switch(logmode) {
+	case LOGMODE_STDERR:
+		fflush(stderr);
+		break;
 
-	if(suppress) {
-		return;
+	case LOGMODE_FILE:
+		fflush(logfile);
+		break;
+
+	default:
+		break;
 	}
+}
 
-	if(level <= debug_level) {
-		switch(logmode) {
-		case LOGMODE_STDERR:
-			fprintf(stderr, "%s\n", message);
-			fflush(stderr);
-			break;
+/* Write a message to the log, and flush it if there is nothing else to write right now */
 
-		case LOGMODE_FILE:
-			if(!now.tv_sec) {
-				gettimeofday(&now, NULL);
-			}
+static void write_message(int priority, time_t when, const char *message, bool flush) {
+	char timestr[32] = "";
 
-			time_t now_sec = now.tv_sec;
-			strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", localtime(&now_sec));
-			fprintf(logfile, "%s %s[%ld]: %s\n", timestr, logident, (long)logpid, message);
-			fflush(logfile);
-			break;
+	switch(logmode) {
+	case LOGMODE_STDERR:
+		fprintf(stderr, "%s\n", message);
+		break;
 
-		case LOGMODE_SYSLOG:
+	case LOGMODE_FILE:
+		strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", localtime(&when));
+		fprintf(logfile, "%s %s[%ld]: %s\n", timestr, logident, (long)logpid, message);
+		break;
+
+	case LOGMODE_SYSLOG:
 #ifdef HAVE_WINDOWS
-			{
-				const char *messages[] = {message};
-				ReportEvent(loghandle, priority, 0, 0, NULL, 1, 0, messages, NULL);
-			}
+		{
+			const char *messages[] = {message};
+			ReportEvent(loghandle, priority, 0, 0, NULL, 1, 0, messages, NULL);
+		}
 
 #else
 #ifdef HAVE_SYSLOG_H
-			syslog(priority, "%s", message);
+		syslog(priority, "%s", message);
 #endif
 #endif
-			break;
+		break;
+
+	case LOGMODE_NULL:
+	default:
+		break;
+	}
+
+	if(flush) {
+		flush_log();
+	}
+}
+
+/* With AsyncLogging, messages are put in a queue that a background thread writes out,
+   so the daemon never waits for the disk or for syslog. The queue is a bounded
+   multi-producer ring: every slot has a sequence number that tells whether it is
+   free to be written (seq == position) or ready to be read (seq == position + 1).
+   When the queue is full, messages are dropped and counted instead. */
+
+#define LOG_QUEUE_SIZE 1024
+#define LOG_MESSAGE_SIZE 1024
+
+typedef struct log_record_t {
+	_Atomic uint32_t seq;
+	int priority;
+	time_t when;
+	char message[LOG_MESSAGE_SIZE];
+} log_record_t;
+
+static log_record_t *log_queue;
+static _Atomic uint32_t log_head;       /* next slot to be written by a producer */
+static uint32_t log_tail;               /* next slot to be read by the writer thread */
+static pthread_t log_thread;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static _Atomic bool log_sleeping;
+static _Atomic bool log_stopping;
+static bool log_async;                  /* whether AsyncLogging is enabled */
+static _Atomic bool log_running;        /* whether the writer thread is running */
+
+static bool queue_message(int priority, time_t when, const char *message) {
+	uint32_t pos = atomic_load_explicit(&log_head, memory_order_relaxed);
+	log_record_t *record;
+
+	for(;;) {
+		record = &log_queue[pos & (LOG_QUEUE_SIZE - 1)];
+		int32_t diff = (int32_t)(atomic_load_explicit(&record->seq, memory_order_acquire) - pos);
+
+		if(!diff) {
+			if(atomic_compare_exchange_weak_explicit(&log_head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if(diff < 0) {
+			atomic_fetch_add_explicit(&log_stats.dropped, 1, memory_order_relaxed);
+			return false;
+		} else {
+			pos = atomic_load_explicit(&log_head, memory_order_relaxed);
+		}
+	}
+
+	record->priority = priority;
+	record->when = when;
+	strncpy(record->message, message, sizeof(record->message) - 1);
+	record->message[sizeof(record->message) - 1] = 0;
 
-		case LOGMODE_NULL:
-		default:
+	// Publishing the record and checking whether the writer sleeps must not be reordered
+
+	atomic_store(&record->seq, pos + 1);
+
+	if(atomic_load(&log_sleeping)) {
+		pthread_mutex_lock(&log_lock);
+		pthread_cond_signal(&log_cond);
+		pthread_mutex_unlock(&log_lock);
+	}
+
+	return true;
+}
+
+static log_record_t *peek_message(void) {
+	log_record_t *record = &log_queue[log_tail & (LOG_QUEUE_SIZE - 1)];
+	return atomic_load(&record->seq) == log_tail + 1 ? record : NULL;
+}
+
+static void release_message(log_record_t *record) {
+	atomic_store_explicit(&record->seq, log_tail + LOG_QUEUE_SIZE, memory_order_release);
+	log_tail++;
+}
+
+static void *log_writer(void *arg) {
+	(void)arg;
+	uint64_t reported = atomic_load(&log_stats.dropped);
+
+	for(;;) {
+		log_record_t *record = peek_message();
+
+		if(record) {
+			write_message(record->priority, record->when, record->message, false);
+			release_message(record);
+			continue;
+		}
+
+		uint64_t dropped = atomic_load_explicit(&log_stats.dropped, memory_order_relaxed);
+
+		if(dropped != reported) {
+			char message[64];
+			snprintf(message, sizeof(message), "%"PRIu64" log messages were dropped", dropped - reported);
+			write_message(LOG_WARNING, time(NULL), message, false);
+			reported = dropped;
+		}
+
+		flush_log();
+
+		pthread_mutex_lock(&log_lock);
+		atomic_store(&log_sleeping, true);
+
+		while(!peek_message() && !atomic_load(&log_stopping)) {
+			pthread_cond_wait(&log_cond, &log_lock);
+		}
+
+		atomic_store(&log_sleeping, false);
+		pthread_mutex_unlock(&log_lock);
+
+		if(!peek_message() && atomic_load(&log_stopping)) {
 			break;
 		}
+	}
+
+	return NULL;
+}
+
+static void start_log_writer(void) {
+	if(log_running || !log_async || logmode == LOGMODE_NULL) {
+		return;
+	}
+
+	if(!log_queue) {
+		log_queue = xzalloc(LOG_QUEUE_SIZE * sizeof(*log_queue));
+	}
+
+	for(uint32_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+		atomic_store(&log_queue[i].seq, i);
+	}
+
+	atomic_store(&log_head, 0);
+	log_tail = 0;
+	atomic_store(&log_stopping, false);
+
+	int error = pthread_create(&log_thread, NULL, log_writer, NULL);
+
+	if(error) {
+		write_message(LOG_ERR, time(NULL), "Unable to start log writer thread, logging synchronously", true);
+		return;
+	}
+
+	log_running = true;
+}
+
+/* Write out everything that is still queued, and stop the writer thread */
+
+static void stop_log_writer(void) {
+	if(!log_running) {
+		return;
+	}
+
+	// Stop queueing first, so nothing is added to the queue after the thread is gone
+
+	log_running = false;
+
+	pthread_mutex_lock(&log_lock);
+	atomic_store(&log_stopping, true);
+	pthread_cond_signal(&log_cond);
+	pthread_mutex_unlock(&log_lock);
+
+	pthread_join(log_thread, NULL);
+}
+
+void logger_async(bool enable) {
+	log_async = enable;
+
+	if(enable) {
+		start_log_writer();
+	} else {
+		stop_log_writer();
+	}
+}
+
+/* LogRateLimit allows only so many messages per second from the same logger() call,
+   which is identified by its format string. The first message after a quiet period
+   says how many were suppressed. Sites share a small table, a collision just resets
+   the count. */
+
+#define RATE_LIMIT_SITES 256
+
+typedef struct rate_limit_t {
+	_Atomic(const char *) site;
+	_Atomic uint32_t second;
+	_Atomic uint32_t count;
+	_Atomic uint32_t suppressed;
+} rate_limit_t;
+
+static rate_limit_t rate_limits[RATE_LIMIT_SITES];
+static _Atomic uint32_t log_rate_limit;
+
+void logger_rate_limit(uint32_t per_second) {
+	atomic_store(&log_rate_limit, per_second);
+}
+
+static bool rate_limited(const char *site, uint32_t *suppressed) {
+	uint32_t limit = atomic_load_explicit(&log_rate_limit, memory_order_relaxed);
+
+	if(!limit) {
+		return false;
+	}
+
+	rate_limit_t *r = &rate_limits[((uintptr_t)site * UINT32_C(2654435761)) % RATE_LIMIT_SITES];
+	uint32_t second = (uint32_t)time(NULL);
+
+	if(atomic_load_explicit(&r->site, memory_order_relaxed) != site) {
+		atomic_store_explicit(&r->site, site, memory_order_relaxed);
+		atomic_store_explicit(&r->second, second, memory_order_relaxed);
+		atomic_store_explicit(&r->count, 0, memory_order_relaxed);
+		atomic_store_explicit(&r->suppressed, 0, memory_order_relaxed);
+	} else if(atomic_load_explicit(&r->second, memory_order_relaxed) != second) {
+		atomic_store_explicit(&r->second, second, memory_order_relaxed);
+		atomic_store_explicit(&r->count, 0, memory_order_relaxed);
+	}
+
+	if(atomic_fetch_add_explicit(&r->count, 1, memory_order_relaxed) < limit) {
+		*suppressed = atomic_exchange_explicit(&r->suppressed, 0, memory_order_relaxed);
+		return false;
+	}
+
+	atomic_fetch_add_explicit(&r->suppressed, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&log_stats.suppressed, 1, memory_order_relaxed);
+	return true;
+}
+
+static void real_logger(debug_t level, int priority, const char *message) {
+	static bool suppress = false;
+
+	if(suppress) {
+		return;
+	}
+
+	if(level <= debug_level) {
+		if(!now.tv_sec) {
+			gettimeofday(&now, NULL);
+		}
+
+		if(log_running) {
+			queue_message(priority, now.tv_sec, message);
+		} else {
+			write_message(priority, now.tv_sec, message, true);
+		}
 
 		if(umbilical && do_detach) {
 			size_t len = strlen(message);
@@ -125,11 +380,20 @@ static void real_logger(debug_t level, int priority, const char *message) {
 	}
 }
 
+/* Add how many messages from the same place were suppressed by the rate limit */
+
+static void add_suppressed(char *message, size_t size, int len, uint32_t suppressed) {
+	if(suppressed && len >= 0 && (size_t)len < size) {
+		snprintf(message + len, size - len, " (%u similar messages suppressed)", suppressed);
+	}
+}
+
 void logger(debug_t level, int priority, const char *format, ...) {
 	va_list ap;
 	char message[1024] = "";
+	uint32_t suppressed = 0;
 
-	if(!should_log(level)) {
+	if(!should_log(level) || rate_limited(format, &suppressed)) {
 		return;
 	}
 
@@ -139,9 +403,10 @@ void logger(debug_t level, int priority, const char *format, ...) {
 	va_end(ap);
 
 	if(len > 0 && (size_t)len < sizeof(message) - 1 && message[len - 1] == '\n') {
-		message[len - 1] = 0;
+		message[--len] = 0;
 	}
 
+	add_suppressed(message, sizeof(message), len, suppressed);
 	real_logger(level, priority, message);
 }
 
@@ -149,8 +414,9 @@ static void sptps_logger(sptps_t *s, int s_errno, const char *format, va_list ap
 	(void)s_errno;
 	char message[1024];
 	size_t msglen = sizeof(message);
+	uint32_t suppressed = 0;
 
-	if(!should_log(DEBUG_TRAFFIC)) {
+	if(!should_log(DEBUG_TRAFFIC) || rate_limited(format, &suppressed)) {
 		return;
 	}
 
@@ -167,8 +433,10 @@ static void sptps_logger(sptps_t *s, int s_errno, const char *format, va_list ap
 		connection_t *c = s->handle;
 
 		if(c) {
-			snprintf(message + len, sizeof(message) - len, " from %s (%s)", c->name, c->hostname);
+			len += snprintf(message + len, sizeof(message) - len, " from %s (%s)", c->name, c->hostname);
 		}
+
+		add_suppressed(message, sizeof(message), len, suppressed);
 	}
 
 	real_logger(DEBUG_TRAFFIC, LOG_ERR, message);
@@ -221,6 +489,8 @@ void openlogger(const char *ident, logmode_t mode) {
 	} else {
 		sptps_log = sptps_log_quiet;
 	}
+
+	start_log_writer();
 }
 
 void reopenlogger(void) {
@@ -228,20 +498,32 @@ void reopenlogger(void) {
 		return;
 	}
 
+	// The writer thread must not use the old file while it is being replaced
+
+	bool running = log_running;
+	stop_log_writer();
+
 	fflush(logfile);
 	FILE *newfile = fopen(logfilename, "a");
 
+	if(newfile) {
+		fclose(logfile);
+		logfile = newfile;
+	}
+
+	if(running) {
+		start_log_writer();
+	}
+
 	if(!newfile) {
 		logger(DEBUG_ALWAYS, LOG_ERR, "Unable to reopen log file %s: %s", logfilename, strerror(errno));
-		return;
 	}
-
-	fclose(logfile);
-	logfile = newfile;
 }
 
 
 void closelogger(void) {
+	stop_log_writer();
+
 	switch(logmode) {
 	case LOGMODE_FILE:
 		fclose(logfile);
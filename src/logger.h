@@ -69,13 +69,26 @@ enum {
 #endif
 
 #include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct log_stats_t {
+	_Atomic uint64_t dropped;       /* messages lost because the asynchronous log queue was full */
+	_Atomic uint64_t suppressed;    /* messages not logged because of LogRateLimit */
+} log_stats_t;
 
 extern debug_t debug_level;
 extern bool logcontrol;
 extern int umbilical;
+extern log_stats_t log_stats;
 extern void openlogger(const char *ident, logmode_t mode);
 extern void reopenlogger(void);
 extern void logger(debug_t level, int priority, const char *format, ...) ATTR_FORMAT(printf, 3, 4);
 extern void closelogger(void);
 
+/* Write log messages from a background thread instead of waiting for them to be written */
+extern void logger_async(bool enable);
+
+/* Allow at most this many messages per second from each place that logs, 0 for no limit */
+extern void logger_rate_limit(uint32_t per_second);
+
 #endif
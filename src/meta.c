@@ -24,6 +24,7 @@
 #include <assert.h>
 
 #include "cipher.h"
+#include "compression.h"
 #include "connection.h"
 #include "logger.h"
 #include "meta.h"
@@ -46,12 +47,117 @@ bool send_meta_sptps(void *handle, uint8_t type, const void *buffer, size_t leng
 		abort();
 	}
 
-	buffer_add(&c->outbuf, buffer, length);
+	chunk_buffer_add(&c->outbuf, buffer, length);
 	io_set(&c->io, IO_READ | IO_WRITE);
 
 	return true;
 }
 
+/* Limits on the amount of data waiting in each lane. If a peer does not keep up,
+   the connection is closed instead of buffering an unbounded amount of data.
+   Data packets are dropped much earlier, see random_early_drop(). */
+
+static const uint32_t lane_limit[META_LANES] = {
+	[LANE_CONTROL] = 1 << 20,
+	[LANE_KEY] = 4 << 20,
+	[LANE_TOPOLOGY] = 64 << 20,
+	[LANE_DATA] = 0,
+};
+
+static meta_lane_t request_lane(const void *request) {
+	switch(atoi(request)) {
+	case KEY_CHANGED:
+	case REQ_KEY:
+	case ANS_KEY:
+		return LANE_KEY;
+
+	case ADD_EDGE:
+	case DEL_EDGE:
+	case ADD_SUBNET:
+	case DEL_SUBNET:
+		return LANE_TOPOLOGY;
+
+	case PACKET:
+	case SPTPS_PACKET:
+		return LANE_DATA;
+
+	default:
+		return LANE_CONTROL;
+	}
+}
+
+/* While a batch of broadcasts is being queued, connections are only woken up
+   for writing once at the end, instead of for every request. */
+
+static int batch_depth;
+
+static void wake_writer(connection_t *c) {
+	if(!batch_depth) {
+		io_set(&c->io, IO_READ | IO_WRITE);
+	}
+}
+
+void meta_batch_begin(void) {
+	batch_depth++;
+}
+
+void meta_batch_end(void) {
+	if(--batch_depth) {
+		return;
+	}
+
+	for list_each(connection_t, c, &connection_list)
+		if(meta_output_len(c)) {
+			io_set(&c->io, IO_READ | IO_WRITE);
+		}
+}
+
+static bool queue_meta(connection_t *c, meta_lane_t lane, shared_buffer_t *buffer) {
+	shared_queue_t *queue = &c->outqueue[lane];
+
+	if(lane_limit[lane] && queue->bytes + buffer->len > lane_limit[lane]) {
+		if(!c->status.outqueue_overflow) {
+			logger(DEBUG_CONNECTIONS, LOG_WARNING, "Output queue overflow for %s (%s)", c->name, c->hostname);
+		}
+
+		c->status.outqueue_overflow = true;
+		return false;
+	}
+
+	shared_queue_push(queue, buffer);
+	wake_writer(c);
+
+	return true;
+}
+
+// Queue a private copy of a request or packet payload on an SPTPS connection.
+
+static bool queue_meta_copy(connection_t *c, uint8_t type, const void *data, size_t length, bool raw) {
+	meta_lane_t lane;
+	uint8_t flags = raw ? SHARED_RAW : 0;
+
+	if(c->status.outpayload) {
+		lane = LANE_DATA;
+		c->status.outpayload = false;
+	} else {
+		lane = type == META_RECORD_TLV ? LANE_TOPOLOGY : request_lane(data);
+
+		// Keep the request together with the payload that follows it
+
+		if(lane == LANE_DATA) {
+			flags |= SHARED_MORE;
+			c->status.outpayload = true;
+		}
+	}
+
+	shared_buffer_t *buffer = shared_buffer_alloc(type, data, length);
+	buffer->flags = flags;
+	bool result = queue_meta(c, lane, buffer);
+	shared_buffer_unref(buffer);
+
+	return result;
+}
+
 bool send_meta(connection_t *c, const void *buffer, size_t length) {
 	if(!c) {
 		logger(DEBUG_ALWAYS, LOG_ERR, "send_meta() called with NULL pointer!");
@@ -62,7 +168,7 @@ bool send_meta(connection_t *c, const void *buffer, size_t length) {
 	       (unsigned long)length, c->name, c->hostname);
 
 	if(c->protocol_minor >= 2) {
-		return sptps_send_record(&c->sptps, 0, buffer, length);
+		return queue_meta_copy(c, 0, buffer, length, false);
 	}
 
 	/* Add our data to buffer */
@@ -79,7 +185,7 @@ bool send_meta(connection_t *c, const void *buffer, size_t length) {
 
 		size_t outlen = length;
 
-		if(!cipher_encrypt(&c->legacy->out.cipher, buffer, length, buffer_prepare(&c->outbuf, length), &outlen, false) || outlen != length) {
+		if(!cipher_encrypt(&c->legacy->out.cipher, buffer, length, chunk_buffer_prepare(&c->outbuf, length), &outlen, false) || outlen != length) {
 			logger(DEBUG_ALWAYS, LOG_ERR, "Error while encrypting metadata to %s (%s)",
 			       c->name, c->hostname);
 			return false;
@@ -87,10 +193,126 @@ bool send_meta(connection_t *c, const void *buffer, size_t length) {
 
 #endif
 	} else {
-		buffer_add(&c->outbuf, buffer, length);
+		chunk_buffer_add(&c->outbuf, buffer, length);
 	}
 
-	io_set(&c->io, IO_READ | IO_WRITE);
+	wake_writer(c);
+
+	return true;
+}
+
+bool send_meta_tlv(connection_t *c, const void *buffer, size_t length) {
+	if(!c) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "send_meta_tlv() called with NULL pointer!");
+		abort();
+	}
+
+	logger(DEBUG_META, LOG_DEBUG, "Sending %lu bytes of binary metadata to %s (%s)",
+	       (unsigned long)length, c->name, c->hostname);
+
+	return queue_meta_copy(c, META_RECORD_TLV, buffer, length, false);
+}
+
+/* Queue a shared request on a connection. SPTPS connections only keep a reference
+   to it, and encrypt it when their socket is ready to send more data. */
+
+bool send_meta_shared(connection_t *c, shared_buffer_t *buffer) {
+	if(c->protocol_minor < 2) {
+		return send_meta(c, buffer->data, buffer->len);
+	}
+
+	logger(DEBUG_META, LOG_DEBUG, "Queueing %lu bytes of metadata to %s (%s)",
+	       (unsigned long)buffer->len, c->name, c->hostname);
+
+	return queue_meta(c, buffer->type == META_RECORD_TLV ? LANE_TOPOLOGY : request_lane(buffer->data), buffer);
+}
+
+/* Queue a shared buffer as-is in the data lane of a connection that is allowed to lose data,
+   like a packet capture. If more than limit bytes would be waiting, the oldest buffers are
+   dropped to make room, so a slow reader misses packets instead of slowing down tincd.
+   Returns the number of buffers that were dropped. */
+
+uint32_t send_meta_lossy(connection_t *c, shared_buffer_t *buffer, uint32_t limit) {
+	shared_queue_t *queue = &c->outqueue[LANE_DATA];
+	uint32_t dropped = 0;
+
+	while(queue->count && queue->bytes + buffer->len > limit) {
+		shared_buffer_unref(shared_queue_pop(queue));
+		dropped++;
+	}
+
+	if(buffer->len > limit) {
+		return dropped + 1;
+	}
+
+	shared_queue_push(queue, buffer);
+	wake_writer(c);
+
+	return dropped;
+}
+
+/* Compress a record using the history of everything compressed before it on this connection.
+   If data that someone else controls shares that history with a secret, the length of the
+   compressed records reveals how much they have in common. So only control and topology
+   requests are compressed, never packets or the key requests that can carry session keys. */
+
+static bool lane_compressible(meta_lane_t lane) {
+	return lane == LANE_CONTROL || lane == LANE_TOPOLOGY;
+}
+
+static bool send_meta_compressed(connection_t *c, uint8_t type, const void *data, uint16_t length) {
+	size_t outlen;
+	const uint8_t *out = compression_stream_compress(c->compress_out, type, data, length, &outlen);
+
+	if(!out) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Error while compressing metadata to %s (%s)", c->name, c->hostname);
+		return false;
+	}
+
+	return sptps_send_record(&c->sptps, META_RECORD_COMPRESSED, out, outlen);
+}
+
+/* Encrypt queued requests into the output buffer until at least limit bytes are waiting to be sent.
+   Whole messages are taken from the highest priority lane that has any. */
+
+bool flush_meta(connection_t *c, uint32_t limit) {
+	while(c->outbuf.len < limit) {
+		shared_queue_t *queue = NULL;
+		meta_lane_t lane;
+
+		for(lane = 0; lane < META_LANES; lane++) {
+			if(c->outqueue[lane].count) {
+				queue = &c->outqueue[lane];
+				break;
+			}
+		}
+
+		if(!queue) {
+			break;
+		}
+
+		bool more;
+
+		do {
+			shared_buffer_t *buffer = shared_queue_pop(queue);
+			bool result = true;
+			more = buffer->flags & SHARED_MORE;
+
+			if(buffer->flags & SHARED_RAW) {
+				chunk_buffer_add(&c->outbuf, buffer->data, buffer->len);
+			} else if(c->compress_out && lane_compressible(lane) && buffer->len <= COMPRESSION_STREAM_RECORD_MAX) {
+				result = send_meta_compressed(c, buffer->type, buffer->data, buffer->len);
+			} else {
+				result = sptps_send_record(&c->sptps, buffer->type, buffer->data, buffer->len);
+			}
+
+			shared_buffer_unref(buffer);
+
+			if(!result) {
+				return false;
+			}
+		} while(more && queue->count);
+	}
 
 	return true;
 }
@@ -104,16 +326,26 @@ void send_meta_raw(connection_t *c, const void *buffer, size_t length) {
 	logger(DEBUG_META, LOG_DEBUG, "Sending %lu bytes of raw metadata to %s (%s)",
 	       (unsigned long)length, c->name, c->hostname);
 
-	buffer_add(&c->outbuf, buffer, length);
+	if(c->status.outpayload) {
+		queue_meta_copy(c, 0, buffer, length, true);
+		return;
+	}
+
+	flush_meta(c, UINT32_MAX);
+	chunk_buffer_add(&c->outbuf, buffer, length);
 
 	io_set(&c->io, IO_READ | IO_WRITE);
 }
 
 void broadcast_meta(connection_t *from, const char *buffer, size_t length) {
+	shared_buffer_t *shared = shared_buffer_alloc(0, buffer, length);
+
 	for list_each(connection_t, c, &connection_list)
 		if(c != from && c->edge) {
-			send_meta(c, buffer, length);
+			send_meta_shared(c, shared);
 		}
+
+	shared_buffer_unref(shared);
 }
 
 bool receive_meta_sptps(void *handle, uint8_t type, const void *vdata, uint16_t length) {
@@ -125,6 +357,12 @@ bool receive_meta_sptps(void *handle, uint8_t type, const void *vdata, uint16_t
 		abort();
 	}
 
+	if(type == SPTPS_ALERT) {
+		// A handshake step that was done in the background failed
+		terminate_connection(c, c->edge);
+		return false;
+	}
+
 	if(type == SPTPS_HANDSHAKE) {
 		if(c->allow_request == ACK) {
 			return send_ack(c);
@@ -137,6 +375,25 @@ bool receive_meta_sptps(void *handle, uint8_t type, const void *vdata, uint16_t
 		return true;
 	}
 
+	/* Unpack compressed records, and handle them as if they were sent as is */
+
+	if(type == META_RECORD_COMPRESSED) {
+		if(!c->compress_in) {
+			logger(DEBUG_ALWAYS, LOG_ERR, "Got unexpected compressed metadata from %s (%s)", c->name, c->hostname);
+			return false;
+		}
+
+		size_t outlen;
+		uint8_t *out = compression_stream_uncompress(c->compress_in, data, length, &outlen);
+
+		if(!out || outlen < 2 || out[0] == META_RECORD_COMPRESSED || out[0] >= SPTPS_HANDSHAKE) {
+			logger(DEBUG_ALWAYS, LOG_ERR, "Error while decompressing metadata from %s (%s)", c->name, c->hostname);
+			return false;
+		}
+
+		return receive_meta_sptps(c, out[0], out + 1, outlen - 1);
+	}
+
 	/* Are we receiving a TCPpacket? */
 
 	if(c->tcplen) {
@@ -149,6 +406,10 @@ bool receive_meta_sptps(void *handle, uint8_t type, const void *vdata, uint16_t
 		return true;
 	}
 
+	if(type == META_RECORD_TLV) {
+		return receive_tlv_request(c, data, length);
+	}
+
 	/* Change newline to null byte, just like non-SPTPS requests */
 
 	if(data[length - 1] == '\n') {
@@ -23,11 +23,47 @@
 
 #include "connection.h"
 
+/* SPTPS record type for binary TLV requests on meta connections */
+#define META_RECORD_TLV 1
+
+/* SPTPS record type for another record compressed with the connection's stream compressor */
+#define META_RECORD_COMPRESSED 2
+
+/* How much queued data handle_meta_write() encrypts into the output buffer at a time.
+   Keep this small, so high priority requests do not have to wait for a lot of bulk data. */
+#define META_FLUSH_SIZE 16384
+
+/* When this much output is waiting on a connection, the other side is not keeping up,
+   and optional traffic such as tunneled packets should not be added to it. */
+#define META_HIGH_WATERMARK (1024 * 1024)
+
+static inline uint32_t meta_output_len(const connection_t *c) {
+	uint32_t len = c->outbuf.len;
+
+	for(int lane = 0; lane < META_LANES; lane++) {
+		len += c->outqueue[lane].bytes;
+	}
+
+	return len;
+}
+
+static inline bool meta_congested(const connection_t *c) {
+	return meta_output_len(c) >= META_HIGH_WATERMARK;
+}
+
 extern bool send_meta(struct connection_t *c, const void *buffer, size_t length);
+extern bool send_meta_tlv(struct connection_t *c, const void *buffer, size_t length);
 extern void send_meta_raw(struct connection_t *c, const void *buffer, size_t length);
 extern bool send_meta_sptps(void *handle, uint8_t type, const void *data, size_t length);
 extern bool receive_meta_sptps(void *handle, uint8_t type, const void *data, uint16_t length);
+extern bool send_meta_shared(struct connection_t *c, shared_buffer_t *buffer);
+extern uint32_t send_meta_lossy(struct connection_t *c, shared_buffer_t *buffer, uint32_t limit);
+extern bool flush_meta(struct connection_t *c, uint32_t limit);
 extern void broadcast_meta(struct connection_t *from, const char *buffer, size_t length);
 extern bool receive_meta(struct connection_t *c);
 
+/* Group many requests, for example a burst of DEL_EDGEs, so they are flushed together */
+extern void meta_batch_begin(void);
+extern void meta_batch_end(void);
+
 #endif
@@ -0,0 +1,296 @@
+/*
+    meta_speed.c -- meta protocol broadcast benchmark
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include "connection.h"
+#include "crypto.h"
+#include "ecdsa.h"
+#include "ecdsagen.h"
+#include "meta.h"
+#include "protocol.h"
+#include "random.h"
+#include "sptps.h"
+#include "xalloc.h"
+
+/* Simulates a broadcast storm on a hub with many SPTPS meta connections,
+   and compares copying each request into every connection's output buffer
+   with queueing a single shared copy. The other ends of the connections
+   are SPTPS sessions in the same process, which decrypt everything that is
+   sent to make sure nothing got lost or reordered. */
+
+typedef struct peer_t {
+	connection_t *c;
+	sptps_t sptps;
+	unsigned int received;
+} peer_t;
+
+static peer_t *peers;
+static unsigned int npeers;
+
+static bool peer_send_data(void *handle, uint8_t type, const void *data, size_t len) {
+	(void)type;
+	peer_t *peer = handle;
+	const uint8_t *p = data;
+
+	while(len) {
+		size_t done = sptps_receive_data(&peer->c->sptps, p, len);
+
+		if(!done) {
+			return false;
+		}
+
+		p += done;
+		len -= done;
+	}
+
+	return true;
+}
+
+static bool peer_receive_record(void *handle, uint8_t type, const void *data, uint16_t len) {
+	(void)data;
+	(void)len;
+	peer_t *peer = handle;
+
+	if(type < SPTPS_HANDSHAKE) {
+		peer->received++;
+	}
+
+	return true;
+}
+
+static bool hub_receive_record(void *handle, uint8_t type, const void *data, uint16_t len) {
+	(void)handle;
+	(void)type;
+	(void)data;
+	(void)len;
+	return true;
+}
+
+// Hand everything in the connection's output buffer to the other end.
+
+static void deliver(peer_t *peer) {
+	chunk_buffer_t *outbuf = &peer->c->outbuf;
+
+	while(outbuf->head) {
+		buffer_chunk_t *chunk = outbuf->head;
+		uint32_t len = chunk->end - chunk->start;
+		const uint8_t *p = (const uint8_t *)chunk->data + chunk->start;
+
+		// Processing the data can cause more data to be appended to the buffer, but chunks never move
+
+		for(uint32_t left = len; left;) {
+			size_t done = sptps_receive_data(&peer->sptps, p, left);
+
+			if(!done) {
+				fprintf(stderr, "Peer could not decrypt data\n");
+				abort();
+			}
+
+			p += done;
+			left -= done;
+		}
+
+		chunk_buffer_consume(outbuf, len);
+	}
+}
+
+static struct timespec start;
+static double elapsed;
+
+static void clock_start(void) {
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+}
+
+static double clock_stop(void) {
+	struct timespec end;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+	elapsed = (double) end.tv_sec + (double) end.tv_nsec * 1e-9
+	          - (double) start.tv_sec - (double) start.tv_nsec * 1e-9;
+	return elapsed;
+}
+
+static size_t buffered_bytes(void) {
+	size_t total = 0;
+
+	for(unsigned int i = 0; i < npeers; i++) {
+		for(buffer_chunk_t *chunk = peers[i].c->outbuf.head; chunk; chunk = chunk->next) {
+			total += sizeof(*chunk) + chunk->size;
+		}
+
+		for(int lane = 0; lane < META_LANES; lane++) {
+			const shared_queue_t *queue = &peers[i].c->outqueue[lane];
+			total += queue->size * sizeof(*queue->items);
+
+			// Count private copies, shared ones are accounted for by the caller
+
+			for(uint32_t j = 0; j < queue->count; j++) {
+				const shared_buffer_t *buffer = queue->items[(queue->head + j) & (queue->size - 1)];
+
+				if(buffer->refcount == 1) {
+					total += sizeof(*buffer) + buffer->len;
+				}
+			}
+		}
+	}
+
+	return total;
+}
+
+static void check_received(unsigned int expected) {
+	for(unsigned int i = 0; i < npeers; i++) {
+		if(peers[i].received != expected) {
+			fprintf(stderr, "Peer %u received %u requests instead of %u\n", i, peers[i].received, expected);
+			abort();
+		}
+
+		peers[i].received = 0;
+	}
+}
+
+static int run_benchmark(int argc, char *argv[]) {
+	npeers = argc > 1 ? atoi(argv[1]) : 500;
+	unsigned int nrequests = argc > 2 ? atoi(argv[2]) : 1000;
+
+	if(!npeers || !nrequests) {
+		fprintf(stderr, "Usage: %s [connections] [requests]\n", argv[0]);
+		return 1;
+	}
+
+	ecdsa_t *key1 = ecdsa_generate();
+	ecdsa_t *key2 = ecdsa_generate();
+	static edge_t edge;
+
+	peers = xzalloc(npeers * sizeof(*peers));
+
+	fprintf(stderr, "Setting up %u SPTPS meta connections\n", npeers);
+
+	for(unsigned int i = 0; i < npeers; i++) {
+		peer_t *peer = &peers[i];
+		connection_t *c = new_connection();
+		char name[32];
+
+		snprintf(name, sizeof(name), "peer%u", i);
+		c->name = xstrdup(name);
+		c->hostname = xstrdup("localhost");
+		c->protocol_minor = PROT_MINOR;
+		c->edge = &edge;
+		c->socket = -1;
+		c->io.fd = -1;
+		connection_add(c);
+		peer->c = c;
+
+		sptps_start(&c->sptps, c, true, false, key1, key2, "meta_speed", 10, send_meta_sptps, hub_receive_record);
+		sptps_start(&peer->sptps, peer, false, false, key2, key1, "meta_speed", 10, peer_send_data, peer_receive_record);
+
+		deliver(peer);
+
+		if(!c->sptps.outstate || !peer->sptps.outstate) {
+			fprintf(stderr, "SPTPS handshake failed\n");
+			return 1;
+		}
+	}
+
+	char request[MAXBUFSIZE];
+	int len = snprintf(request, sizeof(request), "%d %x %s %s %s %s %x %d %s %s\n", ADD_EDGE, 0x12345678, "node_with_a_long_name", "another_node_name", "192.0.2.1", "655", 0x0700000c, 100, "198.51.100.1", "655");
+
+	// The old way: every connection gets its own copy
+
+	fprintf(stderr, "Broadcasting %u requests of %d bytes by copying: ", nrequests, len);
+
+	clock_start();
+
+	for(unsigned int i = 0; i < nrequests; i++)
+		for list_each(connection_t, c, &connection_list) {
+			send_meta(c, request, len);
+		}
+
+	clock_stop();
+
+	fprintf(stderr, "%10.2lf ms, %8.2lf MiB buffered\n", elapsed * 1e3, buffered_bytes() / 1048576.0);
+
+	for(unsigned int i = 0; i < npeers; i++) {
+		if(!flush_meta(peers[i].c, UINT32_MAX)) {
+			return 1;
+		}
+
+		deliver(&peers[i]);
+	}
+
+	check_received(nrequests);
+
+	// The new way: one shared copy, encrypted when the connection is ready to send more
+
+	fprintf(stderr, "Broadcasting %u requests of %d bytes by sharing: ", nrequests, len);
+
+	clock_start();
+
+	for(unsigned int i = 0; i < nrequests; i++) {
+		broadcast_meta(NULL, request, len);
+	}
+
+	clock_stop();
+
+	size_t shared = buffered_bytes() + nrequests * (sizeof(shared_buffer_t) + len);
+	fprintf(stderr, "%10.2lf ms, %8.2lf MiB buffered\n", elapsed * 1e3, shared / 1048576.0);
+
+	fprintf(stderr, "Encrypting shared requests: ");
+
+	clock_start();
+
+	for(unsigned int i = 0; i < npeers; i++) {
+		if(!flush_meta(peers[i].c, UINT32_MAX)) {
+			return 1;
+		}
+	}
+
+	clock_stop();
+
+	fprintf(stderr, "%41.2lf ms\n", elapsed * 1e3);
+
+	for(unsigned int i = 0; i < npeers; i++) {
+		deliver(&peers[i]);
+	}
+
+	check_received(nrequests);
+
+	// Clean up
+
+	for(unsigned int i = 0; i < npeers; i++) {
+		sptps_stop(&peers[i].sptps);
+		peers[i].c->edge = NULL;
+	}
+
+	list_empty_list(&connection_list);
+	free(peers);
+	ecdsa_free(key1);
+	ecdsa_free(key2);
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	random_init();
+	crypto_init();
+
+	int result = run_benchmark(argc, argv);
+
+	random_exit();
+
+	return result;
+}
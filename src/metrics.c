@@ -0,0 +1,587 @@
+#include "system.h"
+
+#include "connection.h"
+#include "event.h"
+#include "graph.h"
+#include "handshake.h"
+#include "list.h"
+#include "logger.h"
+#include "meta.h"
+#include "metrics.h"
+#include "net.h"
+#include "netutl.h"
+#include "node.h"
+#include "replay.h"
+#include "resolver.h"
+#include "route.h"
+#include "script.h"
+#include "sptps.h"
+#include "subnet.h"
+#include "utils.h"
+#include "xalloc.h"
+
+#define MAX_LISTENERS 8
+#define MAX_CLIENTS 16
+#define MAX_REQUEST 1024                /* we only need the request line, the rest is ignored */
+#define CLIENT_TIMEOUT 10               /* seconds a client may take to send its request and read the response */
+
+#define CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+typedef struct metrics_client_t {
+	io_t io;
+	timeout_t timeout;
+	char request[MAX_REQUEST];
+	size_t request_len;
+	bool responding;
+	chunk_buffer_t response;
+} metrics_client_t;
+
+static void free_client(metrics_client_t *client);
+
+static io_t listeners[MAX_LISTENERS];
+static int nlisteners;
+static char *listen_address;
+static char *unix_path;
+
+static list_t clients = {
+	.head = NULL,
+	.tail = NULL,
+	.count = 0,
+	.delete = (list_action_t)free_client,
+};
+
+/* Formatting */
+
+static void emit(chunk_buffer_t *out, const char *format, ...) ATTR_FORMAT(printf, 2, 3);
+
+static void emit(chunk_buffer_t *out, const char *format, ...) {
+	char buf[1024];
+	va_list ap;
+
+	va_start(ap, format);
+	int len = vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+
+	if(len < 0) {
+		return;
+	}
+
+	if((size_t)len < sizeof(buf)) {
+		chunk_buffer_add(out, buf, len);
+		return;
+	}
+
+	char *str;
+	va_start(ap, format);
+	len = xvasprintf(&str, format, ap);
+	va_end(ap);
+
+	chunk_buffer_add(out, str, len);
+	free(str);
+}
+
+static void family(chunk_buffer_t *out, const char *name, const char *type, const char *help) {
+	emit(out, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+/* Node and connection names never contain quotes, backslashes or newlines,
+   so they can be used as label values without escaping. */
+
+static void node_counter(chunk_buffer_t *out, const char *name, const char *help, size_t offset) {
+	family(out, name, "counter", help);
+
+	for splay_each(node_t, n, &node_tree) {
+		uint64_t value;
+		memcpy(&value, (const char *)n + offset, sizeof(value));
+		emit(out, "%s_total{node=\"%s\"} %"PRIu64"\n", name, n->name, value);
+	}
+}
+
+static void emit_histogram(chunk_buffer_t *out, const char *name, const char *help, const histogram_t *h) {
+	family(out, name, "histogram", help);
+
+	// OpenMetrics buckets are cumulative, and the last one must be +Inf.
+	// Only export the ones ending at a power of two, that is precise enough for monitoring.
+
+	uint64_t count = 0;
+
+	for(int i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+		count += h->buckets[i];
+
+		if(i % HISTOGRAM_SUB_BUCKETS == HISTOGRAM_SUB_BUCKETS - 1) {
+			emit(out, "%s_bucket{le=\"%.9g\"} %"PRIu64"\n", name, histogram_bucket_limit(i) / 1e6, count);
+		}
+	}
+
+	emit(out, "%s_bucket{le=\"+Inf\"} %"PRIu64"\n", name, h->count);
+	emit(out, "%s_count %"PRIu64"\n", name, h->count);
+	emit(out, "%s_sum %.9g\n", name, h->sum / 1e6);
+}
+
+void metrics_format(chunk_buffer_t *out) {
+	node_counter(out, "tinc_node_received_packets", "Packets received from a node.", offsetof(node_t, in_packets));
+	node_counter(out, "tinc_node_received_bytes", "Bytes received from a node.", offsetof(node_t, in_bytes));
+	node_counter(out, "tinc_node_sent_packets", "Packets sent to a node.", offsetof(node_t, out_packets));
+	node_counter(out, "tinc_node_sent_bytes", "Bytes sent to a node.", offsetof(node_t, out_bytes));
+
+	family(out, "tinc_node_reachable", "gauge", "Whether a node is reachable.");
+
+	for splay_each(node_t, n, &node_tree) {
+		emit(out, "tinc_node_reachable{node=\"%s\"} %d\n", n->name, n->status.reachable);
+	}
+
+	family(out, "tinc_node_mtu_bytes", "gauge", "Path MTU to a node.");
+
+	for splay_each(node_t, n, &node_tree) {
+		if(n != myself && n->status.reachable) {
+			emit(out, "tinc_node_mtu_bytes{node=\"%s\"} %d\n", n->name, n->mtu);
+		}
+	}
+
+	family(out, "tinc_node_rtt_seconds", "gauge", "Round trip time of UDP probes to a node.");
+
+	for splay_each(node_t, n, &node_tree) {
+		if(n->udp_ping_rtt >= 0) {
+			emit(out, "tinc_node_rtt_seconds{node=\"%s\"} %.6f\n", n->name, n->udp_ping_rtt / 1e6);
+		}
+	}
+
+	family(out, "tinc_node_rtt_jitter_seconds", "gauge", "Smoothed change between round trip times of UDP probes to a node.");
+
+	for splay_each(node_t, n, &node_tree) {
+		if(n->link.srtt >= 0) {
+			emit(out, "tinc_node_rtt_jitter_seconds{node=\"%s\"} %.6f\n", n->name, n->link.jitter / 1e6);
+		}
+	}
+
+	family(out, "tinc_node_loss_ratio", "gauge", "Smoothed fraction of UDP probes and packets from a node that were lost.");
+
+	for splay_each(node_t, n, &node_tree) {
+		if(n->link.samples) {
+			emit(out, "tinc_node_loss_ratio{node=\"%s\"} %.6f\n", n->name, (double)n->link.loss / LINK_LOSS_SCALE);
+		}
+	}
+
+	// Dividing the output by the input of these gives the compression ratio
+
+	family(out, "tinc_node_compression_input_bytes", "counter", "Bytes of packets to a node that were compressed.");
+
+	for splay_each(node_t, n, &node_tree) {
+		if(n->compression_stats.attempts) {
+			emit(out, "tinc_node_compression_input_bytes_total{node=\"%s\"} %"PRIu64"\n", n->name, n->compression_stats.in_bytes);
+		}
+	}
+
+	family(out, "tinc_node_compression_output_bytes", "counter", "Bytes sent to a node for compressed packets.");
+
+	for splay_each(node_t, n, &node_tree) {
+		if(n->compression_stats.attempts) {
+			emit(out, "tinc_node_compression_output_bytes_total{node=\"%s\"} %"PRIu64"\n", n->name, n->compression_stats.out_bytes);
+		}
+	}
+
+	family(out, "tinc_connection_output_bytes", "gauge", "Bytes queued for sending on a meta connection.");
+
+	for list_each(connection_t, c, &connection_list) {
+		if(!c->status.control) {
+			emit(out, "tinc_connection_output_bytes{connection=\"%s\"} %"PRIu32"\n", c->name, meta_output_len(c));
+		}
+	}
+
+	family(out, "tinc_subnet_cache_lookups", "counter", "Subnet lookups by whether they were answered from the cache.");
+	emit(out, "tinc_subnet_cache_lookups_total{result=\"hit\"} %"PRIu64"\n", subnet_cache_stats.hits);
+	emit(out, "tinc_subnet_cache_lookups_total{result=\"miss\"} %"PRIu64"\n", subnet_cache_stats.misses);
+
+	emit_histogram(out, "tinc_graph_duration_seconds", "Time taken to recalculate the graph, including scripts.", &graph_duration);
+	emit_histogram(out, "tinc_event_loop_latency_seconds", "Time spent handling events between two waits for new events.", &event_loop_latency);
+	emit_histogram(out, "tinc_script_duration_seconds", "Time taken by scripts.", &script_duration);
+	emit_histogram(out, "tinc_io_callback_duration_seconds", "Time taken by I/O callbacks.", &event_stats.io);
+	emit_histogram(out, "tinc_timeout_callback_duration_seconds", "Time taken by timeout callbacks.", &event_stats.timeout);
+	emit_histogram(out, "tinc_timeout_lag_seconds", "How long after their expiry timeouts ran.", &event_stats.timeout_lag);
+	emit_histogram(out, "tinc_resolver_duration_seconds", "Time taken by background hostname lookups.", &resolver_stats.duration);
+	emit_histogram(out, "tinc_blocking_lookup_duration_seconds", "Time taken by hostname lookups that block the daemon.", &str2addrinfo_duration);
+
+	family(out, "tinc_slow_callbacks", "counter", "Callbacks that took longer than SlowCallbackThreshold.");
+	emit(out, "tinc_slow_callbacks_total %"PRIu64"\n", event_stats.slow_callbacks);
+
+	family(out, "tinc_sptps_handshakes", "counter", "SPTPS handshakes and key renegotiations that completed.");
+	emit(out, "tinc_sptps_handshakes_total %"PRIu64"\n", sptps_stats.handshakes);
+
+	family(out, "tinc_sptps_handshake_failures", "counter", "SPTPS handshake records that could not be processed.");
+	emit(out, "tinc_sptps_handshake_failures_total %"PRIu64"\n", sptps_stats.handshake_failures);
+
+	family(out, "tinc_replay_drops", "counter", "Packets dropped by the replay window.");
+	emit(out, "tinc_replay_drops_total{reason=\"old\"} %"PRIu64"\n", (uint64_t)replay_stats.old);
+	emit(out, "tinc_replay_drops_total{reason=\"future\"} %"PRIu64"\n", (uint64_t)replay_stats.future);
+
+	const worker_stats_t *handshake = handshake_stats();
+	family(out, "tinc_handshake_queue_depth", "gauge", "Handshakes waiting for a worker thread.");
+	emit(out, "tinc_handshake_queue_depth %"PRIu64"\n", (uint64_t)handshake->depth);
+
+	family(out, "tinc_resolver_lookups", "counter", "Hostname lookups by result.");
+	emit(out, "tinc_resolver_lookups_total{result=\"hit\"} %"PRIu64"\n", (uint64_t)resolver_stats.hits);
+	emit(out, "tinc_resolver_lookups_total{result=\"miss\"} %"PRIu64"\n", (uint64_t)resolver_stats.misses);
+	emit(out, "tinc_resolver_lookups_total{result=\"failure\"} %"PRIu64"\n", (uint64_t)resolver_stats.failures);
+
+	family(out, "tinc_pcap_packets", "counter", "Packets seen by tinc pcap clients, by what happened to them.");
+	emit(out, "tinc_pcap_packets_total{result=\"captured\"} %"PRIu64"\n", pcap_stats.captured);
+	emit(out, "tinc_pcap_packets_total{result=\"filtered\"} %"PRIu64"\n", pcap_stats.filtered);
+	emit(out, "tinc_pcap_packets_total{result=\"dropped\"} %"PRIu64"\n", pcap_stats.dropped);
+
+	family(out, "tinc_log_messages_dropped", "counter", "Log messages that were not written, by reason.");
+	emit(out, "tinc_log_messages_dropped_total{reason=\"queue_full\"} %"PRIu64"\n", (uint64_t)log_stats.dropped);
+	emit(out, "tinc_log_messages_dropped_total{reason=\"rate_limit\"} %"PRIu64"\n", (uint64_t)log_stats.suppressed);
+
+	emit(out, "# EOF\n");
+}
+
+/* Clients */
+
+static void free_client(metrics_client_t *client) {
+	io_del(&client->io);
+	timeout_del(&client->timeout);
+	closesocket(client->io.fd);
+	chunk_buffer_clear(&client->response);
+	free(client);
+}
+
+static void respond(metrics_client_t *client, const char *status, const char *type, chunk_buffer_t *body) {
+	char header[256];
+	int len = snprintf(header, sizeof(header),
+	                   "HTTP/1.1 %s\r\n"
+	                   "Content-Type: %s\r\n"
+	                   "Content-Length: %"PRIu32"\r\n"
+	                   "Connection: close\r\n"
+	                   "\r\n",
+	                   status, type, body->len);
+
+	chunk_buffer_add(&client->response, header, len);
+
+	while(body->head) {
+		const buffer_chunk_t *chunk = body->head;
+		uint32_t size = chunk->end - chunk->start;
+		chunk_buffer_add(&client->response, chunk->data + chunk->start, size);
+		chunk_buffer_consume(body, size);
+	}
+
+	client->responding = true;
+	io_set(&client->io, IO_WRITE);
+}
+
+static void handle_request(metrics_client_t *client) {
+	chunk_buffer_t body = {0};
+	char method[16], path[256];
+
+	if(sscanf(client->request, "%15s %255s HTTP/", method, path) != 2) {
+		chunk_buffer_add(&body, "Bad request\n", 12);
+		respond(client, "400 Bad Request", "text/plain", &body);
+	} else if(strcmp(method, "GET")) {
+		chunk_buffer_add(&body, "Method not allowed\n", 19);
+		respond(client, "405 Method Not Allowed", "text/plain", &body);
+	} else if(strcmp(path, "/metrics") && strcmp(path, "/")) {
+		chunk_buffer_add(&body, "Not found\n", 10);
+		respond(client, "404 Not Found", "text/plain", &body);
+	} else {
+		metrics_format(&body);
+		respond(client, "200 OK", CONTENT_TYPE, &body);
+	}
+}
+
+static void handle_client_read(metrics_client_t *client) {
+	size_t room = sizeof(client->request) - 1 - client->request_len;
+	ssize_t len = recv(client->io.fd, client->request + client->request_len, room, 0);
+
+	if(len < 0 && sockwouldblock(sockerrno)) {
+		return;
+	}
+
+	if(len <= 0) {
+		list_delete(&clients, client);
+		return;
+	}
+
+	client->request_len += len;
+	client->request[client->request_len] = 0;
+
+	if(strstr(client->request, "\r\n\r\n") || strstr(client->request, "\n\n") || client->request_len == sizeof(client->request) - 1) {
+		handle_request(client);
+	}
+}
+
+static void handle_client_write(metrics_client_t *client) {
+	const buffer_chunk_t *chunk = client->response.head;
+	ssize_t len = send(client->io.fd, chunk->data + chunk->start, chunk->end - chunk->start, 0);
+
+	if(len < 0 && sockwouldblock(sockerrno)) {
+		return;
+	}
+
+	if(len <= 0) {
+		list_delete(&clients, client);
+		return;
+	}
+
+	chunk_buffer_consume(&client->response, len);
+
+	if(!client->response.len) {
+		list_delete(&clients, client);
+	}
+}
+
+static void handle_client_io(void *data, int flags) {
+	metrics_client_t *client = data;
+
+	if(flags & IO_WRITE) {
+		handle_client_write(client);
+	} else if(!client->responding) {
+		handle_client_read(client);
+	}
+}
+
+static void handle_client_timeout(void *data) {
+	metrics_client_t *client = data;
+	logger(DEBUG_CONNECTIONS, LOG_INFO, "Metrics client timed out");
+	list_delete(&clients, client);
+}
+
+static void set_nonblocking(int fd) {
+#ifdef O_NONBLOCK
+	int flags = fcntl(fd, F_GETFL);
+
+	if(fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "fcntl for metrics socket: %s", strerror(errno));
+	}
+
+#elif defined(WIN32)
+	unsigned long arg = 1;
+
+	if(ioctlsocket(fd, FIONBIO, &arg) != 0) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "ioctlsocket for metrics socket: %s", sockstrerror(sockerrno));
+	}
+
+#endif
+}
+
+static void handle_new_client(void *data, int flags) {
+	(void)flags;
+	io_t *io = data;
+
+	int fd = accept(io->fd, NULL, NULL);
+
+	if(fd < 0) {
+		if(!sockwouldblock(sockerrno)) {
+			logger(DEBUG_ALWAYS, LOG_ERR, "Accepting a new metrics connection failed: %s", sockstrerror(sockerrno));
+		}
+
+		return;
+	}
+
+	if(clients.count >= MAX_CLIENTS) {
+		logger(DEBUG_CONNECTIONS, LOG_WARNING, "Too many metrics clients, dropping a new one");
+		closesocket(fd);
+		return;
+	}
+
+#ifdef FD_CLOEXEC
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+	set_nonblocking(fd);
+
+	metrics_client_t *client = xzalloc(sizeof(*client));
+	io_add(&client->io, handle_client_io, client, fd, IO_READ);
+	timeout_add(&client->timeout, handle_client_timeout, client, &(struct timeval) {
+		CLIENT_TIMEOUT, jitter()
+	});
+	list_insert_tail(&clients, client);
+}
+
+/* Listening sockets */
+
+static bool add_listener(int fd) {
+	if(listen(fd, 3) < 0) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Could not listen on metrics socket: %s", sockstrerror(sockerrno));
+		closesocket(fd);
+		return false;
+	}
+
+#ifdef FD_CLOEXEC
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+	set_nonblocking(fd);
+
+	io_add(&listeners[nlisteners], handle_new_client, &listeners[nlisteners], fd, IO_READ);
+	nlisteners++;
+	return true;
+}
+
+#ifndef HAVE_WINDOWS
+static bool listen_unix(const char *path) {
+	struct sockaddr_un sa_un = {
+		.sun_family = AF_UNIX,
+	};
+
+	if(strlen(path) >= sizeof(sa_un.sun_path)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Metrics socket filename %s is too long!", path);
+		return false;
+	}
+
+	strncpy(sa_un.sun_path, path, sizeof(sa_un.sun_path));
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if(fd < 0) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Could not create metrics socket: %s", sockstrerror(sockerrno));
+		return false;
+	}
+
+	if(connect(fd, (struct sockaddr *)&sa_un, sizeof(sa_un)) >= 0) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Metrics socket %s is still in use!", path);
+		close(fd);
+		return false;
+	}
+
+	unlink(path);
+
+	mode_t mask = umask(0);
+	umask(mask | 077);
+	int result = bind(fd, (struct sockaddr *)&sa_un, sizeof(sa_un));
+	umask(mask);
+
+	if(result < 0) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Could not bind metrics socket to %s: %s", path, sockstrerror(sockerrno));
+		close(fd);
+		return false;
+	}
+
+	if(!add_listener(fd)) {
+		unlink(path);
+		return false;
+	}
+
+	unix_path = xstrdup(path);
+	return true;
+}
+#endif
+
+static bool listen_inet(const char *address) {
+	char *copy = xstrdup(address);
+	const char *host = strtok(copy, " \t");
+	const char *port = strtok(NULL, " \t");
+
+	if(!host) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Invalid metrics address %s", address);
+		free(copy);
+		return false;
+	}
+
+	// Without an address, only accept connections from this host
+
+	if(!port) {
+		port = host;
+		host = "localhost";
+	}
+
+	struct addrinfo *ai = str2addrinfo(host, port, SOCK_STREAM);
+
+	if(!ai) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Could not resolve metrics address %s", address);
+		free(copy);
+		return false;
+	}
+
+	for(struct addrinfo *aip = ai; aip && nlisteners < MAX_LISTENERS; aip = aip->ai_next) {
+		int fd = socket(aip->ai_family, SOCK_STREAM, IPPROTO_TCP);
+
+		if(fd < 0) {
+			continue;
+		}
+
+		int option = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&option, sizeof(option));
+
+#if defined(IPV6_V6ONLY)
+
+		if(aip->ai_family == AF_INET6) {
+			setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&option, sizeof(option));
+		}
+
+#endif
+
+		if(bind(fd, aip->ai_addr, aip->ai_addrlen)) {
+			sockaddr_t sa;
+			memcpy(&sa, aip->ai_addr, aip->ai_addrlen);
+			char *hostname = sockaddr2hostname(&sa);
+			logger(DEBUG_ALWAYS, LOG_ERR, "Could not bind metrics socket to %s: %s", hostname, sockstrerror(sockerrno));
+			free(hostname);
+			closesocket(fd);
+			continue;
+		}
+
+		add_listener(fd);
+	}
+
+	freeaddrinfo(ai);
+	free(copy);
+	return nlisteners;
+}
+
+static void close_listeners(void) {
+	for(int i = 0; i < nlisteners; i++) {
+		io_del(&listeners[i]);
+		closesocket(listeners[i].fd);
+	}
+
+	nlisteners = 0;
+
+#ifndef HAVE_WINDOWS
+
+	if(unix_path) {
+		unlink(unix_path);
+		free(unix_path);
+		unix_path = NULL;
+	}
+
+#endif
+
+	free(listen_address);
+	listen_address = NULL;
+}
+
+bool metrics_setup(const char *address) {
+	if(address && listen_address && !strcmp(address, listen_address)) {
+		return true;
+	}
+
+	close_listeners();
+
+	if(!address) {
+		return true;
+	}
+
+	bool result;
+
+	if(*address == '/') {
+#ifndef HAVE_WINDOWS
+		result = listen_unix(address);
+#else
+		logger(DEBUG_ALWAYS, LOG_ERR, "UNIX sockets are not supported for MetricsAddress");
+		result = false;
+#endif
+	} else {
+		result = listen_inet(address);
+	}
+
+	if(!result) {
+		close_listeners();
+		return false;
+	}
+
+	listen_address = xstrdup(address);
+	logger(DEBUG_CONNECTIONS, LOG_INFO, "Serving metrics on %s", address);
+	return true;
+}
+
+void metrics_exit(void) {
+	close_listeners();
+	list_empty_list(&clients);
+}
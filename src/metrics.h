@@ -0,0 +1,20 @@
+#ifndef TINC_METRICS_H
+#define TINC_METRICS_H
+
+#include "system.h"
+
+#include "buffer.h"
+
+/* An HTTP endpoint that serves statistics in the OpenMetrics text format.
+   It is served from the event loop using non-blocking sockets, a slow or
+   stalled client never holds up packet processing. */
+
+/* Listen on a UNIX socket if address starts with a slash, otherwise on
+   "[address] port". Does nothing if we already listen there. NULL stops listening. */
+extern bool metrics_setup(const char *address);
+extern void metrics_exit(void);
+
+/* Append the current statistics to a buffer */
+extern void metrics_format(chunk_buffer_t *out);
+
+#endif // TINC_METRICS_H
@@ -31,6 +31,7 @@ char *confbase = NULL;          /* base configuration directory for this instanc
 bool confbase_given;
 char *identname = NULL;         /* program name for syslog */
 char *unixsocketname = NULL;    /* UNIX socket location */
+char *statsfilename = NULL;     /* shared statistics file location */
 char *logfilename = NULL;       /* log file location */
 char *pidfilename = NULL;
 char *program_name = NULL;
@@ -160,12 +161,25 @@ void make_names(bool daemon) {
 			strncpy(unixsocketname + len, ".socket", 8);
 		}
 	}
+
+	if(!statsfilename) {
+		size_t len = strlen(pidfilename);
+		statsfilename = xmalloc(len + 7);
+		memcpy(statsfilename, pidfilename, len);
+
+		if(len > 4 && !strcmp(pidfilename + len - 4, ".pid")) {
+			strncpy(statsfilename + len - 4, ".stats", 7);
+		} else {
+			strncpy(statsfilename + len, ".stats", 7);
+		}
+	}
 }
 
 void free_names(void) {
 	free(identname);
 	free(netname);
 	free(unixsocketname);
+	free(statsfilename);
 	free(pidfilename);
 	free(logfilename);
 	free(confbase);
@@ -175,6 +189,7 @@ void free_names(void) {
 	identname = NULL;
 	netname = NULL;
 	unixsocketname = NULL;
+	statsfilename = NULL;
 	pidfilename = NULL;
 	logfilename = NULL;
 	confbase = NULL;
@@ -30,6 +30,7 @@ extern char *netname;
 extern char *myname;
 extern char *identname;
 extern char *unixsocketname;
+extern char *statsfilename;
 extern char *logfilename;
 extern char *pidfilename;
 extern char *program_name;
@@ -27,12 +27,15 @@
 #include "conf.h"
 #include "connection.h"
 #include "crypto.h"
+#include "edge.h"
+#include "events.h"
 #include "graph.h"
 #include "logger.h"
 #include "meta.h"
 #include "names.h"
 #include "net.h"
 #include "protocol.h"
+#include "resolver.h"
 #include "subnet.h"
 #include "utils.h"
 
@@ -49,6 +52,8 @@ static struct timeval last_periodic_run_time;
 void purge(void) {
 	logger(DEBUG_PROTOCOL, LOG_DEBUG, "Purging unreachable nodes");
 
+	meta_batch_begin();
+
 	/* Remove all edges and subnets owned by unreachable nodes. */
 
 	for splay_each(node_t, n, &node_tree) {
@@ -73,14 +78,15 @@ void purge(void) {
 		}
 	}
 
+	meta_batch_end();
+
 	/* Check if anyone else claims to have an edge to an unreachable node. If not, delete node. */
 
 	for splay_each(node_t, n, &node_tree) {
 		if(!n->status.reachable) {
-			for splay_each(edge_t, e, &edge_weight_tree)
-				if(e->to == n) {
-					return;
-				}
+			if(n->incoming_edges) {
+				continue;
+			}
 
 			if(!autoconnect && (!strictsubnets || !n->subnet_tree.head))
 				/* in strictsubnets mode do not delete nodes with subnets */
@@ -120,9 +126,12 @@ void terminate_connection(connection_t *c, bool report) {
 	if(c->node) {
 		if(c->node->connection == c) {
 			c->node->connection = NULL;
+			autoconnect_update(c->node);
 		}
 
 		if(c->edge) {
+			event_connection(c, false);
+
 			if(report && !tunnelserver) {
 				send_del_edge(everyone, c->edge);
 			}
@@ -222,6 +231,12 @@ static void timeout_handler(void *data) {
 			continue;
 		}
 
+		if(c->status.outqueue_overflow) {
+			logger(DEBUG_CONNECTIONS, LOG_WARNING, "%s (%s) is not keeping up with the data we send, closing connection", c->name, c->hostname);
+			terminate_connection(c, c->edge);
+			continue;
+		}
+
 		// Bail out early if we haven't reached the ping timeout for this node yet
 		if(c->last_ping_time + pingtimeout > now.tv_sec) {
 			continue;
@@ -261,6 +276,45 @@ static void timeout_handler(void *data) {
 	});
 }
 
+/* With LatencyRouting, the weight of our edge to a node we have a meta connection with
+   is the smoothed round trip time of the UDP path to it, in milliseconds. To prevent
+   routes from flapping, a new weight is only advertised if it differs enough from the
+   current one. */
+
+static void update_edge_weights(void) {
+	bool changed = false;
+
+	for list_each(connection_t, c, &connection_list) {
+		if(!c->edge || c->status.fixed_weight || c->node->link.srtt < 0) {
+			continue;
+		}
+
+		int weight = MAX(1, (c->node->link.srtt + 500) / 1000);
+		int delta = abs(weight - c->edge->weight);
+
+		if(delta < 2 || delta * 4 <= c->edge->weight) {
+			continue;
+		}
+
+		logger(DEBUG_PROTOCOL, LOG_DEBUG, "Changing weight of edge to %s (%s) from %d to %d", c->name, c->hostname, c->edge->weight, weight);
+
+		edge_set_weight(c->edge, weight);
+		event_edge(c->edge, true);
+
+		if(tunnelserver) {
+			send_add_edge(c, c->edge);
+		} else {
+			send_add_edge(everyone, c->edge);
+		}
+
+		changed = true;
+	}
+
+	if(changed) {
+		graph();
+	}
+}
+
 static void periodic_handler(void *data) {
 	/* Check if there are too many contradicting ADD_EDGE and DEL_EDGE messages.
 	   This usually only happens when another node has the same Name as this node.
@@ -292,6 +346,10 @@ static void periodic_handler(void *data) {
 		do_autoconnect();
 	}
 
+	if(latency_routing) {
+		update_edge_weights();
+	}
+
 	timeout_set(data, &(struct timeval) {
 		5, jitter()
 	});
@@ -332,6 +390,8 @@ static void sigalrm_handler(void *data) {
 int reload_configuration(void) {
 	char fname[PATH_MAX];
 
+	resolver_flush();
+
 	/* Reread our own configuration file */
 
 	splay_empty_tree(&config_tree);
@@ -361,6 +421,7 @@ int reload_configuration(void) {
 
 	for splay_each(node_t, n, &node_tree) {
 		n->status.has_address = false;
+		autoconnect_update(n);
 	}
 
 	load_all_nodes();
@@ -452,6 +513,9 @@ int reload_configuration(void) {
 }
 
 void retry(void) {
+	/* The network might have changed, so forget cached hostname lookups */
+	resolver_flush();
+
 	/* Reset the reconnection timers for all outgoing connections */
 	for list_each(outgoing_t, outgoing, &outgoing_list) {
 		outgoing->timeout = 0;
@@ -185,6 +185,8 @@ extern char *scriptextension;
 #include "connection.h"
 #include "node.h"
 
+extern adaptive_compression_t adaptive_compression;
+
 extern void retry_outgoing(outgoing_t *outgoing);
 extern void handle_incoming_vpn_data(void *data, int flags);
 extern void finish_connecting(struct connection_t *c);
@@ -196,6 +198,8 @@ extern int setup_vpn_in_socket(const sockaddr_t *sa);
 extern bool send_sptps_data(struct node_t *to, struct node_t *from, int type, const void *data, size_t len);
 extern bool receive_sptps_record(void *handle, uint8_t type, const void *data, uint16_t len);
 extern void send_packet(struct node_t *n, vpn_packet_t *packet);
+extern length_t compress_packet(uint8_t *dest, const uint8_t *source, length_t len, compression_level_t level);
+extern length_t uncompress_packet(uint8_t *dest, const uint8_t *source, length_t len, compression_level_t level);
 extern void receive_tcppacket(struct connection_t *c, const char *buffer, size_t length);
 extern bool receive_tcppacket_sptps(struct connection_t *c, const char *buffer, size_t length);
 extern void broadcast_packet(const struct node_t *n, vpn_packet_t *packet);
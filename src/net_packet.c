@@ -45,13 +45,16 @@
 #include "digest.h"
 #include "device.h"
 #include "ethernet.h"
+#include "events.h"
 #include "ipv4.h"
 #include "ipv6.h"
 #include "logger.h"
 #include "net.h"
 #include "netutl.h"
+#include "pmtu.h"
 #include "protocol.h"
 #include "route.h"
+#include "trace.h"
 #include "utils.h"
 #include "random.h"
 
@@ -78,6 +81,7 @@ static void *lz4_state = NULL;
 static void send_udppacket(node_t *, vpn_packet_t *);
 
 unsigned replaywin = 32;
+adaptive_compression_t adaptive_compression = ADAPTIVE_COMPRESSION_FLOW;
 bool localdiscovery = true;
 bool udp_discovery = true;
 int udp_discovery_keepalive_interval = 10;
@@ -86,6 +90,81 @@ int udp_discovery_timeout = 30;
 
 #define MAX_SEQNO 1073741824
 
+/* Convert the MTU of whole IP packets to a node to the largest VPN packet that fits in them. */
+
+static length_t path_mtu_to_mtu(const node_t *n, int family, int path_mtu) {
+	int mtu = path_mtu;
+	mtu -= (family == AF_INET6) ? (int)sizeof(struct ip6_hdr) : (int)sizeof(struct ip);
+	mtu -= 8; /* UDP */
+
+	if(n->status.sptps) {
+		mtu -= SPTPS_DATAGRAM_OVERHEAD;
+
+		if((n->options >> 24) >= 4) {
+			mtu -= (int)(sizeof(node_id_t) + sizeof(node_id_t));
+		}
+
+#ifndef DISABLE_LEGACY
+	} else {
+		mtu -= (int)digest_length(n->outdigest);
+
+		/* Now it's tricky. We use CBC mode, so the length of the
+		   encrypted payload must be a multiple of the blocksize. The
+		   sequence number is also part of the encrypted payload, so we
+		   must account for it after correcting for the blocksize.
+		   Furthermore, the padding in the last block must be at least
+		   1 byte. */
+
+		length_t blocksize = cipher_blocksize(n->outcipher);
+
+		if(blocksize > 1) {
+			mtu /= blocksize;
+			mtu *= blocksize;
+			mtu--;
+		}
+
+		mtu -= 4; // seqno
+#endif
+	}
+
+	if(mtu < 0) {
+		return 0;
+	}
+
+	return mtu > MTU ? MTU : mtu;
+}
+
+/* The reverse of path_mtu_to_mtu(), used to share MTUs of probed nodes with other nodes at the same address. */
+
+static int mtu_to_path_mtu(const node_t *n, int family, length_t mtu) {
+	int path_mtu = mtu;
+
+	if(n->status.sptps) {
+		path_mtu += SPTPS_DATAGRAM_OVERHEAD;
+
+		if((n->options >> 24) >= 4) {
+			path_mtu += (int)(sizeof(node_id_t) + sizeof(node_id_t));
+		}
+
+#ifndef DISABLE_LEGACY
+	} else {
+		path_mtu += 4; // seqno
+
+		length_t blocksize = cipher_blocksize(n->outcipher);
+
+		if(blocksize > 1) {
+			path_mtu = (path_mtu / blocksize + 1) * blocksize;
+		}
+
+		path_mtu += (int)digest_length(n->outdigest);
+#endif
+	}
+
+	path_mtu += 8; /* UDP */
+	path_mtu += (family == AF_INET6) ? (int)sizeof(struct ip6_hdr) : (int)sizeof(struct ip);
+	return path_mtu;
+}
+
 static void try_fix_mtu(node_t *n) {
 	if(n->mtuprobes < 0) {
 		return;
@@ -101,6 +180,12 @@ static void try_fix_mtu(node_t *n) {
 		n->mtu = n->minmtu;
 		logger(DEBUG_TRAFFIC, LOG_INFO, "Fixing MTU of %s (%s) to %d after %d probes", n->name, n->hostname, n->mtu, n->mtuprobes);
 		n->mtuprobes = -1;
+		event_mtu(n);
+
+		/* Let other nodes at the same address start from here */
+		if(kernel_pmtu_discovery && n->mtu >= MINMTU) {
+			pmtu_learn(&n->address, mtu_to_path_mtu(n, n->address.sa.sa_family, n->mtu));
+		}
 	}
 }
 
@@ -115,6 +200,7 @@ static void reduce_mtu(node_t *n, int mtu) {
 
 	if(n->mtu > mtu) {
 		n->mtu = mtu;
+		event_mtu(n);
 	}
 
 	try_fix_mtu(n);
@@ -130,6 +216,7 @@ static void udp_probe_timeout_handler(void *data) {
 	logger(DEBUG_TRAFFIC, LOG_INFO, "Too much time has elapsed since last UDP ping response from %s (%s), stopping UDP communication", n->name, n->hostname);
 	n->status.udp_confirmed = false;
 	n->udp_ping_rtt = -1;
+	link_stats_reset_rtt(&n->link);
 	n->maxrecentlen = 0;
 	n->mtuprobes = 0;
 	n->minmtu = 0;
@@ -185,6 +272,12 @@ static void udp_probe_h(node_t *n, vpn_packet_t *packet, length_t len) {
 		timersub(&now, &n->udp_ping_sent, &rtt);
 		n->udp_ping_rtt = (int)(rtt.tv_sec * 1000000 + rtt.tv_usec);
 		n->status.ping_sent = false;
+
+		// The first reply may have waited for the tunnel to be set up
+		if(n->status.udp_confirmed) {
+			link_stats_rtt(&n->link, n->udp_ping_rtt);
+		}
+
 		logger(DEBUG_TRAFFIC, LOG_INFO, "Got type %d UDP probe reply %d from %s (%s) rtt=%d.%03d", DATA(packet)[0], len, n->name, n->hostname, n->udp_ping_rtt / 1000, n->udp_ping_rtt % 1000);
 	} else {
 		logger(DEBUG_TRAFFIC, LOG_INFO, "Got type %d UDP probe reply %d from %s (%s)", DATA(packet)[0], len, n->name, n->hostname);
@@ -273,7 +366,7 @@ static length_t compress_packet_lzo(uint8_t *dest, const uint8_t *source, length
 }
 #endif
 
-static length_t compress_packet(uint8_t *dest, const uint8_t *source, length_t len, compression_level_t level) {
+length_t compress_packet(uint8_t *dest, const uint8_t *source, length_t len, compression_level_t level) {
 	switch(level) {
 #ifdef HAVE_LZ4
 
@@ -309,6 +402,9 @@ static length_t compress_packet(uint8_t *dest, const uint8_t *source, length_t l
 
 #endif
 
+	case COMPRESS_ZSTD:
+		return compress_zstd(dest, MAXSIZE, source, len);
+
 	case COMPRESS_NONE:
 		memcpy(dest, source, len);
 		return len;
@@ -318,7 +414,7 @@ static length_t compress_packet(uint8_t *dest, const uint8_t *source, length_t l
 	}
 }
 
-static length_t uncompress_packet(uint8_t *dest, const uint8_t *source, length_t len, compression_level_t level) {
+length_t uncompress_packet(uint8_t *dest, const uint8_t *source, length_t len, compression_level_t level) {
 	switch(level) {
 #ifdef HAVE_LZ4
 
@@ -375,6 +471,9 @@ static length_t uncompress_packet(uint8_t *dest, const uint8_t *source, length_t
 
 #endif
 
+	case COMPRESS_ZSTD:
+		return uncompress_zstd(dest, MAXSIZE, source, len);
+
 	case COMPRESS_NONE:
 		memcpy(dest, source, len);
 		return len;
@@ -387,6 +486,7 @@ static length_t uncompress_packet(uint8_t *dest, const uint8_t *source, length_t
 /* VPN packet I/O */
 
 static void receive_packet(node_t *n, vpn_packet_t *packet) {
+	TRACE2(packet_receive, n->name, packet->len);
 	logger(DEBUG_TRAFFIC, LOG_DEBUG, "Received packet of %d bytes from %s (%s)",
 	       packet->len, n->name, n->hostname);
 
@@ -414,6 +514,8 @@ static bool try_mac(node_t *n, const vpn_packet_t *inpkt) {
 }
 
 static bool receive_udppacket(node_t *n, vpn_packet_t *inpkt) {
+	TRACE2(udp_receive, n->name, inpkt->len);
+
 	if(n->status.sptps) {
 		if(!n->sptps.state) {
 			if(!n->status.waitingforkey) {
@@ -490,7 +592,11 @@ static bool receive_udppacket(node_t *n, vpn_packet_t *inpkt) {
 		vpn_packet_t *outpkt = pkt[nextpkt++];
 		outlen = MAXSIZE;
 
-		if(!cipher_decrypt(n->incipher, SEQNO(inpkt), inpkt->len, SEQNO(outpkt), &outlen, true)) {
+		TRACE2(decrypt_start, true, inpkt->len);
+		bool decrypted = cipher_decrypt(n->incipher, SEQNO(inpkt), inpkt->len, SEQNO(outpkt), &outlen, true);
+		TRACE2(decrypt_done, true, decrypted);
+
+		if(!decrypted) {
 			logger(DEBUG_TRAFFIC, LOG_DEBUG, "Error decrypting packet from %s (%s)", n->name, n->hostname);
 			return false;
 		}
@@ -506,37 +612,31 @@ static bool receive_udppacket(node_t *n, vpn_packet_t *inpkt) {
 	seqno = ntohl(seqno);
 	inpkt->len -= sizeof(seqno);
 
-	if(replaywin) {
-		if(seqno != n->received_seqno + 1) {
-			if(seqno >= n->received_seqno + replaywin * 8) {
-				if(n->farfuture++ < replaywin >> 2) {
-					logger(DEBUG_TRAFFIC, LOG_WARNING, "Packet from %s (%s) is %d seqs in the future, dropped (%u)",
-					       n->name, n->hostname, seqno - n->received_seqno - 1, n->farfuture);
-					return false;
-				}
-
-				logger(DEBUG_TRAFFIC, LOG_WARNING, "Lost %d packets from %s (%s)",
-				       seqno - n->received_seqno - 1, n->name, n->hostname);
-				memset(n->late, 0, replaywin);
-			} else if(seqno <= n->received_seqno) {
-				if((n->received_seqno >= replaywin * 8 && seqno <= n->received_seqno - replaywin * 8) || !(n->late[(seqno / 8) % replaywin] & (1 << seqno % 8))) {
-					logger(DEBUG_TRAFFIC, LOG_WARNING, "Got late or replayed packet from %s (%s), seqno %d, last received %d",
-					       n->name, n->hostname, seqno, n->received_seqno);
-					return false;
-				}
-			} else {
-				for(seqno_t i = n->received_seqno + 1; i < seqno; i++) {
-					n->late[(i / 8) % replaywin] |= 1 << i % 8;
-				}
-			}
-		}
+	switch(replay_update(&n->replay, seqno)) {
+	case REPLAY_OK:
+		break;
+
+	case REPLAY_OLD:
+		logger(DEBUG_TRAFFIC, LOG_WARNING, "Got late or replayed packet from %s (%s), seqno %d, last received %d",
+		       n->name, n->hostname, seqno, n->received_seqno);
+		return false;
+
+	case REPLAY_FUTURE:
+		logger(DEBUG_TRAFFIC, LOG_WARNING, "Packet from %s (%s) is %d seqs in the future, dropped (%u)",
+		       n->name, n->hostname, seqno - n->received_seqno - 1, (unsigned int)n->replay.farfuture);
+		return false;
 
-		n->farfuture = 0;
-		n->late[(seqno / 8) % replaywin] &= ~(1 << seqno % 8);
+	case REPLAY_JUMP:
+		logger(DEBUG_TRAFFIC, LOG_WARNING, "Lost %d packets from %s (%s)",
+		       seqno - n->received_seqno - 1, n->name, n->hostname);
+		break;
 	}
 
 	if(seqno > n->received_seqno) {
+		n->lost += seqno - n->received_seqno - 1;
 		n->received_seqno = seqno;
+	} else if(n->lost) {
+		n->lost--;
 	}
 
 	n->received++;
@@ -671,6 +771,146 @@ bool receive_tcppacket_sptps(connection_t *c, const char *data, size_t len) {
 	return true;
 }
 
+/* Encrypted data looks random, and random data does not compress. Count the
+   distinct byte values in a sample of the packet: random data has more
+   than 56 different ones in 64 bytes on average, anything compressible a
+   lot less. */
+
+#define ENTROPY_SAMPLE 64
+#define ENTROPY_THRESHOLD 48
+
+static bool looks_random(const uint8_t *data, length_t len) {
+	if(len < 2 * ENTROPY_SAMPLE) {
+		return false;
+	}
+
+	uint32_t seen[256 / 32] = {0};
+	length_t stride = len / ENTROPY_SAMPLE;
+	int distinct = 0;
+
+	for(int i = 0; i < ENTROPY_SAMPLE; i++) {
+		uint8_t byte = data[i * stride];
+		uint32_t bit = UINT32_C(1) << (byte % 32);
+
+		if(!(seen[byte / 32] & bit)) {
+			seen[byte / 32] |= bit;
+			distinct++;
+		}
+	}
+
+	return distinct > ENTROPY_THRESHOLD;
+}
+
+// Find the flow a packet belongs to. Packets of the same IP protocol and the same service port share a bucket.
+// Packets too short to have an ethertype belong to no flow.
+
+static compression_flow_t *compression_flow(node_t *n, const vpn_packet_t *packet) {
+	if(adaptive_compression != ADAPTIVE_COMPRESSION_FLOW) {
+		return &n->compression_flows[0];
+	}
+
+	if(packet->len < 14) {
+		return NULL;
+	}
+
+	const uint8_t *data = DATA(packet);
+	uint16_t type = data[12] << 8 | data[13];
+	length_t ports = 0;
+	uint8_t protocol = 0;
+
+	if(type == ETH_P_IP && packet->len >= 14 + 20) {
+		protocol = data[23];
+		ports = 14 + (data[14] & 0xf) * 4;
+	} else if(type == ETH_P_IPV6 && packet->len >= 14 + 40) {
+		protocol = data[20];
+		ports = 14 + 40;
+	}
+
+	if(!ports || (protocol != IPPROTO_TCP && protocol != IPPROTO_UDP) || packet->len < ports + 4) {
+		return &n->compression_flows[protocol % COMPRESSION_FLOWS];
+	}
+
+	// The lower port number is usually the one of the service
+
+	uint16_t source = data[ports] << 8 | data[ports + 1];
+	uint16_t dest = data[ports + 2] << 8 | data[ports + 3];
+	uint32_t key = (uint32_t)protocol << 16 | MIN(source, dest);
+
+	key *= UINT32_C(0x9e3779b1);
+	return &n->compression_flows[key >> 28];
+}
+
+static void compression_backoff(compression_flow_t *flow) {
+	flow->skip = MAX(flow->backoff, COMPRESSION_BACKOFF_MIN);
+	flow->backoff = MIN(flow->skip * 2, COMPRESSION_BACKOFF_MAX);
+}
+
+static uint64_t monotonic_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Compress a packet for SPTPS, unless it doesn't look worth it. Returns the
+   length of the compressed data, or 0 if the packet should be sent as it is. */
+
+static length_t compress_sptps_packet(node_t *n, uint8_t *dest, const vpn_packet_t *packet, length_t offset) {
+	compression_stats_t *stats = &n->compression_stats;
+	const uint8_t *source = DATA(packet) + offset;
+	length_t len = packet->len - offset;
+	compression_flow_t *flow = NULL;
+
+	if(adaptive_compression != ADAPTIVE_COMPRESSION_OFF) {
+		flow = compression_flow(n, packet);
+
+		if(flow && flow->skip) {
+			flow->skip--;
+			stats->skipped++;
+			stats->skipped_bytes += len;
+			return 0;
+		}
+
+		if(flow && looks_random(source, len)) {
+			compression_backoff(flow);
+			stats->skipped++;
+			stats->skipped_bytes += len;
+			return 0;
+		}
+	}
+
+	uint64_t start = monotonic_nsec();
+	length_t result = compress_packet(dest, source, len, n->outcompression);
+	stats->nsec += monotonic_nsec() - start;
+	stats->attempts++;
+	stats->in_bytes += len;
+
+	if(!result) {
+		logger(DEBUG_TRAFFIC, LOG_ERR, "Error while compressing packet to %s (%s)", n->name, n->hostname);
+	}
+
+	// Saving just a few bytes is not worth the effort either
+
+	bool useful = result && result < len - len / 32;
+
+	if(!useful) {
+		stats->failures++;
+
+		if(flow) {
+			compression_backoff(flow);
+		}
+	} else if(flow) {
+		flow->backoff = 0;
+	}
+
+	if(!result || result >= len) {
+		stats->out_bytes += len;
+		return 0;
+	}
+
+	stats->out_bytes += result;
+	return result;
+}
+
 static void send_sptps_packet(node_t *n, vpn_packet_t *origpkt) {
 	if(!n->status.validkey && !n->connection) {
 		return;
@@ -698,11 +938,9 @@ static void send_sptps_packet(node_t *n, vpn_packet_t *origpkt) {
 
 	if(n->outcompression != COMPRESS_NONE) {
 		outpkt.offset = 0;
-		length_t len = compress_packet(DATA(&outpkt) + offset, DATA(origpkt) + offset, origpkt->len - offset, n->outcompression);
+		length_t len = compress_sptps_packet(n, DATA(&outpkt) + offset, origpkt, offset);
 
-		if(!len) {
-			logger(DEBUG_TRAFFIC, LOG_ERR, "Error while compressing packet to %s (%s)", n->name, n->hostname);
-		} else if(len < origpkt->len - offset) {
+		if(len) {
 			outpkt.len = len + offset;
 			origpkt = &outpkt;
 			type |= PKT_COMPRESSED;
@@ -874,7 +1112,11 @@ static void send_udppacket(node_t *n, vpn_packet_t *origpkt) {
 		outpkt = pkt[nextpkt++];
 		outlen = MAXSIZE;
 
-		if(!cipher_encrypt(n->outcipher, SEQNO(inpkt), inpkt->len, SEQNO(outpkt), &outlen, true)) {
+		TRACE2(encrypt_start, true, inpkt->len);
+		bool encrypted = cipher_encrypt(n->outcipher, SEQNO(inpkt), inpkt->len, SEQNO(outpkt), &outlen, true);
+		TRACE2(encrypt_done, true, inpkt->len);
+
+		if(!encrypted) {
 			logger(DEBUG_TRAFFIC, LOG_ERR, "Error while encrypting packet to %s (%s)", n->name, n->hostname);
 			goto end;
 		}
@@ -939,6 +1181,8 @@ static void send_udppacket(node_t *n, vpn_packet_t *origpkt) {
 		}
 	}
 
+	TRACE2(udp_send, n->name, inpkt->len);
+
 	if(sendto(listen_socket[sock].udp.fd, (void *)SEQNO(inpkt), inpkt->len, 0, &sa->sa, SALEN(sa->sa)) < 0 && !sockwouldblock(sockerrno)) {
 		if(sockmsgsize(sockerrno)) {
 			reduce_mtu(n, origlen - 1);
@@ -1030,6 +1274,7 @@ bool send_sptps_data(node_t *to, node_t *from, int type, const void *data, size_
 	}
 
 	logger(DEBUG_TRAFFIC, LOG_INFO, "Sending packet from %s (%s) to %s (%s) via %s (%s) (UDP)", from->name, from->hostname, to->name, to->hostname, relay->name, relay->hostname);
+	TRACE2(udp_send, relay->name, buf_ptr - buf);
 
 	if(sendto(listen_socket[sock].udp.fd, buf, buf_ptr - buf, 0, &sa->sa, SALEN(sa->sa)) < 0 && !sockwouldblock(sockerrno)) {
 		if(sockmsgsize(sockerrno)) {
@@ -1046,6 +1291,16 @@ bool send_sptps_data(node_t *to, node_t *from, int type, const void *data, size_
 bool receive_sptps_record(void *handle, uint8_t type, const void *data, uint16_t len) {
 	node_t *from = handle;
 
+	if(type == SPTPS_ALERT) {
+		// A handshake step that was done in the background failed, restart like ans_key_h() does
+		if(from->last_req_key < now.tv_sec - 10) {
+			logger(DEBUG_PROTOCOL, LOG_ERR, "SPTPS key exchange with %s (%s) failed, restarting SPTPS", from->name, from->hostname);
+			send_req_key(from);
+		}
+
+		return true;
+	}
+
 	if(type == SPTPS_HANDSHAKE) {
 		if(!from->status.validkey) {
 			from->status.validkey = true;
@@ -1184,6 +1439,22 @@ static void send_udp_probe_packet(node_t *n, size_t len) {
 	send_udppacket(n, &packet);
 }
 
+/* Probe quickly while looking for a working UDP path or while packets are being lost,
+   and slowly when the path has been reliable, but often enough to stay within the timeout.
+   Nodes we do not send anything to are not probed at all. */
+
+static int udp_probe_interval(const node_t *n) {
+	if(!n->status.udp_confirmed || n->status.ping_sent || link_stats_lossy(&n->link)) {
+		return udp_discovery_interval;
+	}
+
+	if(link_stats_stable(&n->link)) {
+		return MAX(udp_discovery_keepalive_interval, MIN(2 * udp_discovery_keepalive_interval, udp_discovery_timeout - udp_discovery_keepalive_interval));
+	}
+
+	return udp_discovery_keepalive_interval;
+}
+
 // This function tries to establish a UDP tunnel to a node so that packets can be sent.
 // If a tunnel is already established, it makes sure it stays up.
 // This function makes no guarantees - it is up to the caller to check the node's state to figure out if UDP is usable.
@@ -1218,11 +1489,19 @@ static void try_udp(node_t *n) {
 	struct timeval ping_tx_elapsed;
 	timersub(&now, &n->udp_ping_sent, &ping_tx_elapsed);
 
-	int interval = n->status.udp_confirmed
-	               ? udp_discovery_keepalive_interval
-	               : udp_discovery_interval;
+	if(ping_tx_elapsed.tv_sec >= udp_probe_interval(n)) {
+		if(n->status.udp_confirmed) {
+			if(n->status.ping_sent) {
+				link_stats_probe_lost(&n->link);
+			}
+
+			if(n->status.sptps) {
+				link_stats_sample(&n->link, n->sptps.received, n->sptps.lost);
+			} else {
+				link_stats_sample(&n->link, n->received, n->lost);
+			}
+		}
 
-	if(ping_tx_elapsed.tv_sec >= interval) {
 		gettimeofday(&now, NULL);
 		n->udp_ping_sent = now; // a probe in flight
 		n->status.ping_sent = true;
@@ -1237,10 +1516,6 @@ static void try_udp(node_t *n) {
 }
 
 static length_t choose_initial_maxmtu(node_t *n) {
-#ifdef IP_MTU
-
-	int sock = -1;
-
 	const sockaddr_t *sa = NULL;
 	size_t sockindex;
 	choose_udp_address(n, &sa, &sockindex);
@@ -1249,82 +1524,33 @@ static length_t choose_initial_maxmtu(node_t *n) {
 		return MTU;
 	}
 
-	sock = socket(sa->sa.sa_family, SOCK_DGRAM, IPPROTO_UDP);
-
-	if(sock < 0) {
-		logger(DEBUG_TRAFFIC, LOG_ERR, "Creating MTU assessment socket for %s (%s) failed: %s", n->name, n->hostname, sockstrerror(sockerrno));
-		return MTU;
-	}
-
-	if(connect(sock, &sa->sa, SALEN(sa->sa))) {
-		logger(DEBUG_TRAFFIC, LOG_ERR, "Connecting MTU assessment socket for %s (%s) failed: %s", n->name, n->hostname, sockstrerror(sockerrno));
-		closesocket(sock);
-		return MTU;
-	}
+	/* Another node at the same address might already have found out the path MTU */
+	int ip_mtu = kernel_pmtu_discovery ? pmtu_lookup(sa) : 0;
 
-	int ip_mtu;
-	socklen_t ip_mtu_len = sizeof(ip_mtu);
+	/* Otherwise, getsockopt(IP_MTU) returns the MTU of the physical interface,
+	   or a smaller one the kernel has learned from ICMP messages. */
+	if(!ip_mtu) {
+		ip_mtu = pmtu_route_mtu(sa);
 
-	if(getsockopt(sock, IPPROTO_IP, IP_MTU, (void *)&ip_mtu, &ip_mtu_len)) {
-		logger(DEBUG_TRAFFIC, LOG_ERR, "getsockopt(IP_MTU) on %s (%s) failed: %s", n->name, n->hostname, sockstrerror(sockerrno));
-		closesocket(sock);
-		return MTU;
+		if(!ip_mtu) {
+			return MTU;
+		}
 	}
 
-	closesocket(sock);
-
 	if(ip_mtu < MINMTU) {
-		logger(DEBUG_TRAFFIC, LOG_ERR, "getsockopt(IP_MTU) on %s (%s) returned absurdly small value: %d", n->name, n->hostname, ip_mtu);
+		logger(DEBUG_TRAFFIC, LOG_ERR, "Path MTU to %s (%s) has an absurdly small value: %d", n->name, n->hostname, ip_mtu);
 		return MTU;
 	}
 
-	/* getsockopt(IP_MTU) returns the MTU of the physical interface.
-	   We need to remove various overheads to get to the tinc MTU. */
-	length_t mtu = ip_mtu;
-	mtu -= (sa->sa.sa_family == AF_INET6) ? sizeof(struct ip6_hdr) : sizeof(struct ip);
-	mtu -= 8; /* UDP */
-
-	if(n->status.sptps) {
-		mtu -= SPTPS_DATAGRAM_OVERHEAD;
-
-		if((n->options >> 24) >= 4) {
-			mtu -= sizeof(node_id_t) + sizeof(node_id_t);
-		}
-
-#ifndef DISABLE_LEGACY
-	} else {
-		mtu -= digest_length(n->outdigest);
-
-		/* Now it's tricky. We use CBC mode, so the length of the
-		   encrypted payload must be a multiple of the blocksize. The
-		   sequence number is also part of the encrypted payload, so we
-		   must account for it after correcting for the blocksize.
-		   Furthermore, the padding in the last block must be at least
-		   1 byte. */
-
-		length_t blocksize = cipher_blocksize(n->outcipher);
-
-		if(blocksize > 1) {
-			mtu /= blocksize;
-			mtu *= blocksize;
-			mtu--;
-		}
-
-		mtu -= 4; // seqno
-#endif
-	}
+	/* We need to remove various overheads to get to the tinc MTU. */
+	length_t mtu = path_mtu_to_mtu(n, sa->sa.sa_family, ip_mtu);
 
-	if(mtu > MTU) {
+	if(mtu == MTU) {
 		return MTU;
 	}
 
 	logger(DEBUG_TRAFFIC, LOG_INFO, "Using system-provided maximum tinc MTU for %s (%s): %hd", n->name, n->hostname, mtu);
 	return mtu;
-
-#else
-	(void)n;
-	return MTU;
-#endif
 }
 
 /* This function tries to determines the MTU of a node.
@@ -1380,6 +1606,10 @@ static void try_mtu(node_t *n) {
 		logger(DEBUG_TRAFFIC, LOG_INFO, "Decrease in PMTU to %s (%s) detected, restarting PMTU discovery", n->name, n->hostname);
 		n->mtuprobes = 0;
 		n->minmtu = 0;
+
+		if(kernel_pmtu_discovery) {
+			pmtu_forget(&n->address);
+		}
 	}
 
 	if(n->mtuprobes < 0) {
@@ -1541,6 +1771,8 @@ void try_tx(node_t *n, bool mtu) {
 }
 
 void send_packet(node_t *n, vpn_packet_t *packet) {
+	TRACE2(packet_send, n->name, packet->len);
+
 	// If it's for myself, write it to the tun/tap device.
 
 	if(n == myself) {
@@ -1822,6 +2054,54 @@ skip_harder:
 	}
 }
 
+/* The kernel told us the path MTU to an address, apply it to all nodes using that address. */
+
+static void path_mtu_changed(const sockaddr_t *sa, int path_mtu) {
+	pmtu_learn(sa, path_mtu);
+
+	for splay_each(node_t, n, &node_tree) {
+		if(!n->status.reachable || !(n->options & OPTION_PMTU_DISCOVERY) || sockaddrcmp_noport(&n->address, sa)) {
+			continue;
+		}
+
+		length_t mtu = MAX(path_mtu_to_mtu(n, sa->sa.sa_family, path_mtu), MINMTU);
+
+		if(mtu >= n->maxmtu) {
+			continue;
+		}
+
+		logger(DEBUG_TRAFFIC, LOG_INFO, "Kernel reports path MTU %d to %s (%s), reducing MTU to %d", path_mtu, n->name, n->hostname, mtu);
+
+		if(n->minmtu > mtu) {
+			n->minmtu = mtu;
+		}
+
+		reduce_mtu(n, mtu);
+	}
+}
+
+/* Drain the socket's error queue. Returns true if there was anything in it. */
+
+static bool receive_udp_errors(listen_socket_t *ls) {
+	if(!kernel_pmtu_discovery) {
+		return false;
+	}
+
+	bool received = false;
+	sockaddr_t sa;
+	int path_mtu;
+
+	while((path_mtu = pmtu_receive_error(ls->udp.fd, &sa)) >= 0) {
+		received = true;
+
+		if(path_mtu) {
+			path_mtu_changed(&sa, path_mtu);
+		}
+	}
+
+	return received;
+}
+
 void handle_incoming_vpn_data(void *data, int flags) {
 	(void)data;
 	(void)flags;
@@ -1854,8 +2134,11 @@ void handle_incoming_vpn_data(void *data, int flags) {
 	num = recvmmsg(ls->udp.fd, msg, MAX_MSG, MSG_DONTWAIT, NULL);
 
 	if(num < 0) {
-		if(!sockwouldblock(sockerrno)) {
-			logger(DEBUG_ALWAYS, LOG_ERR, "Receiving packet failed: %s", sockstrerror(sockerrno));
+		int err = sockerrno;
+
+		/* Errors reported by ICMP are also put in the error queue, which we then handle instead */
+		if(!receive_udp_errors(ls) && !sockwouldblock(err)) {
+			logger(DEBUG_ALWAYS, LOG_ERR, "Receiving packet failed: %s", sockstrerror(err));
 		}
 
 		return;
@@ -1880,8 +2163,10 @@ void handle_incoming_vpn_data(void *data, int flags) {
 	ssize_t len = recvfrom(ls->udp.fd, (void *)DATA(&pkt), MAXSIZE, 0, &addr.sa, &addrlen);
 
 	if(len <= 0 || (size_t)len > MAXSIZE) {
-		if(!sockwouldblock(sockerrno)) {
-			logger(DEBUG_ALWAYS, LOG_ERR, "Receiving packet failed: %s", sockstrerror(sockerrno));
+		int err = sockerrno;
+
+		if(!receive_udp_errors(ls) && !sockwouldblock(err)) {
+			logger(DEBUG_ALWAYS, LOG_ERR, "Receiving packet failed: %s", sockstrerror(err));
 		}
 
 		return;
@@ -22,6 +22,7 @@
 
 #include "system.h"
 
+#include "autoconnect.h"
 #include "cipher.h"
 #include "conf_net.h"
 #include "conf.h"
@@ -33,12 +34,16 @@
 #include "digest.h"
 #include "ecdsa.h"
 #include "graph.h"
+#include "handshake.h"
 #include "logger.h"
+#include "metrics.h"
 #include "names.h"
 #include "net.h"
 #include "netutl.h"
+#include "pmtu.h"
 #include "process.h"
 #include "protocol.h"
+#include "resolver.h"
 #include "route.h"
 #include "script.h"
 #include "subnet.h"
@@ -207,6 +212,7 @@ void load_all_nodes(void) {
 
 		if(lookup_config(&config, "Address")) {
 			n->status.has_address = true;
+			autoconnect_update(n);
 		}
 
 		splay_empty_tree(&config);
@@ -365,6 +371,7 @@ bool setup_myself_reloadable(void) {
 
 	get_config_bool(lookup_config(&config_tree, "DirectOnly"), &directonly);
 	get_config_bool(lookup_config(&config_tree, "LocalDiscovery"), &localdiscovery);
+	get_config_bool(lookup_config(&config_tree, "LatencyRouting"), &latency_routing);
 
 	char *rmode = NULL;
 
@@ -409,6 +416,40 @@ bool setup_myself_reloadable(void) {
 		myself->options |= OPTION_PMTU_DISCOVERY;
 	}
 
+	kernel_pmtu_discovery = false;
+	get_config_bool(lookup_config(&config_tree, "KernelPMTUDiscovery"), &kernel_pmtu_discovery);
+
+	/* Sockets that are already open have to be told whether to queue errors from now on */
+	for(int i = 0; i < listen_sockets; i++) {
+		pmtu_set_socket_options(listen_socket[i].udp.fd, listen_socket[i].sa.sa.sa_family, kernel_pmtu_discovery && myself->options & OPTION_PMTU_DISCOVERY);
+	}
+
+	choice = false;
+	get_config_bool(lookup_config(&config_tree, "SharedStatistics"), &choice);
+
+	if(choice) {
+		start_node_stats();
+	} else {
+		stop_node_stats();
+	}
+
+	int slow_ms = 0;
+	get_config_int(lookup_config(&config_tree, "SlowCallbackThreshold"), &slow_ms);
+	slow_callback_threshold = slow_ms > 0 ? (uint64_t)slow_ms * 1000 : 0;
+
+	choice = false;
+	get_config_bool(lookup_config(&config_tree, "AsyncLogging"), &choice);
+	logger_async(choice);
+
+	int rate_limit = 0;
+	get_config_int(lookup_config(&config_tree, "LogRateLimit"), &rate_limit);
+	logger_rate_limit(rate_limit > 0 ? rate_limit : 0);
+
+	char *metrics_address = NULL;
+	get_config_string(lookup_config(&config_tree, "MetricsAddress"), &metrics_address);
+	metrics_setup(metrics_address);
+	free(metrics_address);
+
 	choice = true;
 	get_config_bool(lookup_config(&config_tree, "ClampMSS"), &choice);
 
@@ -419,6 +460,35 @@ bool setup_myself_reloadable(void) {
 	get_config_bool(lookup_config(&config_tree, "PriorityInheritance"), &priorityinheritance);
 	get_config_bool(lookup_config(&config_tree, "DecrementTTL"), &decrement_ttl);
 
+	char *acmode = NULL;
+
+	if(get_config_string(lookup_config(&config_tree, "AdaptiveCompression"), &acmode)) {
+		if(!strcasecmp(acmode, "no")) {
+			adaptive_compression = ADAPTIVE_COMPRESSION_OFF;
+		} else if(!strcasecmp(acmode, "node")) {
+			adaptive_compression = ADAPTIVE_COMPRESSION_NODE;
+		} else if(!strcasecmp(acmode, "yes") || !strcasecmp(acmode, "flow")) {
+			adaptive_compression = ADAPTIVE_COMPRESSION_FLOW;
+		} else {
+			logger(DEBUG_ALWAYS, LOG_ERR, "Invalid adaptive compression mode!");
+			free(acmode);
+			return false;
+		}
+
+		free(acmode);
+	}
+
+	get_config_bool(lookup_config(&config_tree, "StreamCompression"), &stream_compression);
+
+	char *dictionary = NULL;
+	get_config_string(lookup_config(&config_tree, "CompressionDictionary"), &dictionary);
+	bool dictionary_loaded = compression_load_dictionary(dictionary);
+	free(dictionary);
+
+	if(!dictionary_loaded) {
+		return false;
+	}
+
 	char *bmode = NULL;
 
 	if(get_config_string(lookup_config(&config_tree, "Broadcast"), &bmode)) {
@@ -524,6 +594,21 @@ bool setup_myself_reloadable(void) {
 		autoconnect = true;
 	}
 
+	char *strategy = NULL;
+	autoconnect_strategy = AUTOCONNECT_RANDOM;
+
+	if(get_config_string(lookup_config(&config_tree, "AutoConnectStrategy"), &strategy)) {
+		if(!strcasecmp(strategy, "rtt")) {
+			autoconnect_strategy = AUTOCONNECT_RTT;
+		} else if(strcasecmp(strategy, "random")) {
+			logger(DEBUG_ALWAYS, LOG_ERR, "Invalid AutoConnect strategy!");
+			free(strategy);
+			return false;
+		}
+
+		free(strategy);
+	}
+
 	get_config_bool(lookup_config(&config_tree, "DisableBuggyPeers"), &disablebuggypeers);
 
 	if(!get_config_int(lookup_config(&config_tree, "InvitationExpire"), &invitation_lifetime)) {
@@ -883,10 +968,17 @@ static bool setup_myself(void) {
 			return false;
 		}
 
+		if((unsigned)replaywin_int > REPLAY_BYTES_MAX) {
+			logger(DEBUG_ALWAYS, LOG_ERR, "ReplayWindow is too large!");
+			return false;
+		}
+
 		replaywin = (unsigned)replaywin_int;
 		sptps_replaywin = replaywin;
 	}
 
+	handshake_init();
+
 #ifndef DISABLE_LEGACY
 	/* Generate packet encryption key */
 
@@ -990,6 +1082,15 @@ static bool setup_myself(void) {
 			return false;
 #endif
 
+		case COMPRESS_ZSTD:
+#ifdef HAVE_ZSTD
+			break;
+#else
+			logger(DEBUG_ALWAYS, LOG_ERR, "Bogus compression level!");
+			logger(DEBUG_ALWAYS, LOG_ERR, "ZSTD compression is unavailable on this node.");
+			return false;
+#endif
+
 		case COMPRESS_NONE:
 			break;
 
@@ -1249,6 +1350,7 @@ void close_network_connections(void) {
 	}
 
 	list_empty_list(&outgoing_list);
+	resolver_exit();
 
 	if(myself && myself->connection) {
 		subnet_update(myself, NULL, false);
@@ -1262,12 +1364,20 @@ void close_network_connections(void) {
 		closesocket(listen_socket[i].udp.fd);
 	}
 
+	metrics_exit();
+	pmtu_exit();
 	exit_requests();
 	exit_edges();
 	exit_subnets();
+	stop_node_stats();
 	exit_nodes();
+	autoconnect_exit();
 	exit_connections();
 
+	/* Sessions detach from their handshake jobs when they are stopped, so only
+	   discard the jobs after all nodes and connections are gone */
+	handshake_exit();
+
 	if(!device_standby) {
 		device_disable();
 	}
@@ -1284,6 +1394,7 @@ void close_network_connections(void) {
 	}
 
 	exit_control();
+	compression_exit();
 
 	free(scriptextension);
 	free(scriptinterpreter);
@@ -26,12 +26,17 @@
 #include "conf.h"
 #include "connection.h"
 #include "crypto.h"
+#include "dump.h"
+#include "events.h"
 #include "list.h"
 #include "logger.h"
+#include "meta.h"
 #include "names.h"
 #include "net.h"
 #include "netutl.h"
+#include "pmtu.h"
 #include "protocol.h"
+#include "resolver.h"
 #include "utils.h"
 #include "xalloc.h"
 
@@ -52,7 +57,9 @@ io_t unix_socket;
 #endif
 
 static void free_outgoing(outgoing_t *outgoing) {
+	outgoing->node->outgoings--;
 	timeout_del(&outgoing->ev);
+	resolve_cancel(outgoing);
 	free(outgoing);
 }
 
@@ -378,6 +385,10 @@ int setup_vpn_in_socket(const sockaddr_t *sa) {
 
 #endif
 
+	if(kernel_pmtu_discovery && myself->options & OPTION_PMTU_DISCOVERY) {
+		pmtu_set_socket_options(nfd, sa->sa.sa_family, true);
+	}
+
 #if defined(SO_MARK)
 
 	if(fwmark) {
@@ -480,30 +491,59 @@ static void do_outgoing_pipe(connection_t *c, const char *command) {
 #endif
 }
 
+/* Maximum number of output buffer chunks passed to the kernel at once */
+#define META_IOV_MAX 64
+
 static void handle_meta_write(connection_t *c) {
-	if(c->outbuf.len <= c->outbuf.offset) {
+	if(!flush_meta(c, META_FLUSH_SIZE)) {
+		terminate_connection(c, c->edge);
 		return;
 	}
 
-	ssize_t outlen = send(c->socket, c->outbuf.data + c->outbuf.offset, c->outbuf.len - c->outbuf.offset, 0);
+	if(!c->outbuf.len) {
+		return;
+	}
+
+#ifdef HAVE_WINDOWS
+	const buffer_chunk_t *chunk = c->outbuf.head;
+	ssize_t outlen = send(c->socket, chunk->data + chunk->start, chunk->end - chunk->start, 0);
+#else
+	struct iovec iov[META_IOV_MAX];
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = chunk_buffer_iov(&c->outbuf, iov, META_IOV_MAX),
+	};
+	ssize_t outlen = sendmsg(c->socket, &msg, 0);
+#endif
 
 	if(outlen <= 0) {
 		if(!sockerrno || sockerrno == EPIPE) {
 			logger(DEBUG_CONNECTIONS, LOG_NOTICE, "Connection closed by %s (%s)", c->name, c->hostname);
 		} else if(sockwouldblock(sockerrno)) {
-			logger(DEBUG_META, LOG_DEBUG, "Sending %d bytes to %s (%s) would block", c->outbuf.len - c->outbuf.offset, c->name, c->hostname);
+			logger(DEBUG_META, LOG_DEBUG, "Sending %d bytes to %s (%s) would block", c->outbuf.len, c->name, c->hostname);
 			return;
 		} else {
-			logger(DEBUG_CONNECTIONS, LOG_ERR, "Could not send %d bytes of data to %s (%s): %s", c->outbuf.len - c->outbuf.offset, c->name, c->hostname, sockstrerror(sockerrno));
+			logger(DEBUG_CONNECTIONS, LOG_ERR, "Could not send %d bytes of data to %s (%s): %s", c->outbuf.len, c->name, c->hostname, sockstrerror(sockerrno));
 		}
 
 		terminate_connection(c, c->edge);
 		return;
 	}
 
-	buffer_read(&c->outbuf, outlen);
+	chunk_buffer_consume(&c->outbuf, outlen);
 
-	if(!c->outbuf.len) {
+	// Produce the next part of a large dump once most of the previous part has been sent
+
+	if(dump_in_progress(c) && meta_output_len(c) < META_FLUSH_SIZE && !dump_continue(c)) {
+		terminate_connection(c, c->edge);
+		return;
+	}
+
+	if(c->status.events_lost) {
+		events_drained(c);
+	}
+
+	if(!meta_output_len(c)) {
 		io_set(&c->io, IO_READ);
 	}
 }
@@ -558,15 +598,38 @@ static void handle_meta_io(void *data, int flags) {
 	}
 }
 
+static void resolved_outgoing_handler(void *data) {
+	setup_outgoing_connection(data, false);
+}
+
 bool do_outgoing_connection(outgoing_t *outgoing) {
 	const sockaddr_t *sa;
-	struct addrinfo *proxyai = NULL;
+	const struct addrinfo *proxyai = NULL;
 	int result;
 
+	if(proxytype && proxytype != PROXY_EXEC) {
+		resolve_status_t status = resolve_address(proxyhost, proxyport, SOCK_STREAM, &proxyai, resolved_outgoing_handler, outgoing);
+
+		if(status == RESOLVE_PENDING) {
+			return false;
+		}
+
+		if(status == RESOLVE_FAILED) {
+			logger(DEBUG_CONNECTIONS, LOG_ERR, "Could not set up a meta connection to %s", outgoing->node->name);
+			retry_outgoing(outgoing);
+			return false;
+		}
+	}
+
 begin:
-	sa = get_recent_address(outgoing->node->address_cache);
+	sa = get_recent_address(outgoing->node->address_cache, resolved_outgoing_handler, outgoing);
 
 	if(!sa) {
+		if(outgoing->node->address_cache->resolving) {
+			logger(DEBUG_CONNECTIONS, LOG_DEBUG, "Waiting for address lookup before connecting to %s", outgoing->node->name);
+			return false;
+		}
+
 		logger(DEBUG_CONNECTIONS, LOG_ERR, "Could not set up a meta connection to %s", outgoing->node->name);
 		retry_outgoing(outgoing);
 		return false;
@@ -585,13 +648,6 @@ begin:
 	} else if(proxytype == PROXY_EXEC) {
 		do_outgoing_pipe(c, proxyhost);
 	} else {
-		proxyai = str2addrinfo(proxyhost, proxyport, SOCK_STREAM);
-
-		if(!proxyai) {
-			free_connection(c);
-			goto begin;
-		}
-
 		logger(DEBUG_CONNECTIONS, LOG_INFO, "Using proxy at %s port %s", proxyhost, proxyport);
 		c->socket = socket(proxyai->ai_family, SOCK_STREAM, IPPROTO_TCP);
 		configure_tcp(c);
@@ -633,7 +689,6 @@ begin:
 		}
 
 		result = connect(c->socket, proxyai->ai_addr, proxyai->ai_addrlen);
-		freeaddrinfo(proxyai);
 	}
 
 	if(result == -1 && !sockinprogress(sockerrno)) {
@@ -861,6 +916,7 @@ void try_outgoing_connections(void) {
 			free(name);
 
 			outgoing->node = n;
+			n->outgoings++;
 			list_insert_tail(&outgoing_list, outgoing);
 			setup_outgoing_connection(outgoing, true);
 		}
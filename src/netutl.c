@@ -26,6 +26,7 @@
 #include "xalloc.h"
 
 bool hostnames = false;
+histogram_t str2addrinfo_duration;
 
 uint16_t service_to_port(const char *service) {
 	struct addrinfo *ai = str2addrinfo("localhost", service, SOCK_STREAM);
@@ -62,10 +63,13 @@ struct addrinfo *str2addrinfo(const char *address, const char *service, int sock
 	hint.ai_family = addressfamily;
 	hint.ai_socktype = socktype;
 
+	struct timespec start;
+	histogram_start(&start);
 #if HAVE_DECL_RES_INIT
 	res_init();
 #endif
 	err = getaddrinfo(address, service, &hint, &ai);
+	histogram_stop(&str2addrinfo_duration, &start);
 
 	if(err) {
 		logger(DEBUG_ALWAYS, LOG_WARNING, "Error looking up %s port %s: %s", address, service, err == EAI_SYSTEM ? strerror(errno) : gai_strerror(err));
@@ -75,11 +79,49 @@ struct addrinfo *str2addrinfo(const char *address, const char *service, int sock
 	return ai;
 }
 
+// Parse a numeric port without going through getaddrinfo().
+
+static bool parse_port(const char *port, uint16_t *result) {
+	char *end;
+
+	if(*port < '0' || *port > '9') {
+		return false;
+	}
+
+	unsigned long value = strtoul(port, &end, 10);
+
+	if(*end || value > 65535) {
+		return false;
+	}
+
+	*result = htons((uint16_t)value);
+	return true;
+}
+
 sockaddr_t str2sockaddr(const char *address, const char *port) {
 	struct addrinfo *ai, hint = {0};
 	sockaddr_t result = {0};
+	uint16_t portnum;
 	int err;
 
+	/* Fast path for plain numeric addresses, which is what ADD_EDGE requests contain */
+
+	if(parse_port(port, &portnum)) {
+		if(inet_pton(AF_INET, address, &result.in.sin_addr) == 1) {
+			result.in.sin_family = AF_INET;
+			result.in.sin_port = portnum;
+			return result;
+		}
+
+		if(!strchr(address, '%') && inet_pton(AF_INET6, address, &result.in6.sin6_addr) == 1) {
+			result.in6.sin6_family = AF_INET6;
+			result.in6.sin6_port = portnum;
+			return result;
+		}
+
+		memset(&result, 0, sizeof(result));
+	}
+
 	hint.ai_family = AF_UNSPEC;
 	hint.ai_flags = AI_NUMERICHOST;
 	hint.ai_socktype = SOCK_STREAM;
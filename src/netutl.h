@@ -21,10 +21,14 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include "histogram.h"
 #include "net.h"
 
 extern bool hostnames;
 
+/* Time taken by str2addrinfo(), which blocks while it looks up hostnames */
+extern histogram_t str2addrinfo_duration;
+
 // Converts service name (as listed in /etc/services) to port number. Returns 0 on error.
 extern uint16_t service_to_port(const char *service);
 extern struct addrinfo *str2addrinfo(const char *address, const char *service, int socktype) ATTR_MALLOC;
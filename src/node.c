@@ -21,12 +21,16 @@
 #include "system.h"
 
 #include "address_cache.h"
+#include "autoconnect.h"
 #include "control_common.h"
+#include "dump.h"
 #include "logger.h"
+#include "names.h"
 #include "net.h"
 #include "netutl.h"
 #include "node.h"
 #include "splay_tree.h"
+#include "stats_shm.h"
 #include "utils.h"
 #include "xalloc.h"
 
@@ -65,6 +69,9 @@ static splay_tree_t node_udp_tree = {
 	.compare = (splay_compare_t) node_udp_compare,
 };
 
+static stats_shm_t stats_shm;
+static timeout_t stats_timer;
+
 void exit_nodes(void) {
 	splay_empty_tree(&node_udp_tree);
 	splay_empty_tree(&node_id_tree);
@@ -74,8 +81,8 @@ void exit_nodes(void) {
 node_t *new_node(void) {
 	node_t *n = xzalloc(sizeof(*n));
 
-	if(replaywin) {
-		n->late = xzalloc(replaywin);
+	if(!replay_init(&n->replay, replaywin)) {
+		abort();
 	}
 
 	init_subnet_tree(&n->subnet_tree);
@@ -84,6 +91,7 @@ node_t *new_node(void) {
 	n->mtu = MTU;
 	n->maxmtu = MTU;
 	n->udp_ping_rtt = -1;
+	link_stats_reset(&n->link);
 
 	return n;
 }
@@ -109,10 +117,11 @@ void free_node(node_t *n) {
 	sptps_stop(&n->sptps);
 
 	timeout_del(&n->udp_ping_timeout);
+	autoconnect_forget(n);
 
 	free(n->hostname);
 	free(n->name);
-	free(n->late);
+	replay_free(&n->replay);
 
 	if(n->address_cache) {
 		close_address_cache(n->address_cache);
@@ -197,35 +206,192 @@ void update_node_udp(node_t *n, const sockaddr_t *sa) {
 	n->maxmtu = MTU;
 }
 
-bool dump_nodes(connection_t *c) {
-	for splay_each(node_t, n, &node_tree) {
-		char id[2 * sizeof(n->id) + 1];
+static void dump_node(connection_t *c, const node_t *n) {
+	char id[2 * sizeof(n->id) + 1];
 
-		for(size_t c = 0; c < sizeof(n->id); ++c) {
-			snprintf(id + 2 * c, 3, "%02x", n->id.x[c]);
-		}
+	for(size_t c = 0; c < sizeof(n->id); ++c) {
+		snprintf(id + 2 * c, 3, "%02x", n->id.x[c]);
+	}
+
+	id[sizeof(id) - 1] = 0;
 
-		id[sizeof(id) - 1] = 0;
-		send_request(c, "%d %d %s %s %s %d %d %lu %d %x %x %s %s %d %d %d %d %ld %d %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64, CONTROL, REQ_DUMP_NODES,
-		             n->name, id, n->hostname ? n->hostname : "unknown port unknown",
 #ifdef DISABLE_LEGACY
-		             0, 0, 0UL,
+	int cipher = 0, digest = 0;
+	unsigned long maclength = 0;
 #else
-		             cipher_get_nid(n->outcipher), digest_get_nid(n->outdigest), (unsigned long)digest_length(n->outdigest),
+	int cipher = cipher_get_nid(n->outcipher), digest = digest_get_nid(n->outdigest);
+	unsigned long maclength = (unsigned long)digest_length(n->outdigest);
 #endif
+
+	if(!dump_is_json(c)) {
+		send_request(c, "%d %d %s %s %s %d %d %lu %d %x %x %s %s %d %d %d %d %ld %d %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %d %d %d %u", CONTROL, REQ_DUMP_NODES,
+		             n->name, id, n->hostname ? n->hostname : "unknown port unknown",
+		             cipher, digest, maclength,
 		             n->outcompression, n->options, n->status.value,
 		             n->nexthop ? n->nexthop->name : "-", n->via && n->via->name ? n->via->name : "-", n->distance,
 		             n->mtu, n->minmtu, n->maxmtu, (long)n->last_state_change, n->udp_ping_rtt,
-		             n->in_packets, n->in_bytes, n->out_packets, n->out_bytes);
+		             n->in_packets, n->in_bytes, n->out_packets, n->out_bytes,
+		             n->link.srtt, n->link.rttvar, n->link.jitter, n->link.loss);
+		return;
 	}
 
-	return send_request(c, "%d %d", CONTROL, REQ_DUMP_NODES);
+	json_t json;
+	json_begin(&json);
+	json_string(&json, "name", n->name);
+	json_string(&json, "id", id);
+	json_sockaddr(&json, "address", "port", &n->address);
+	json_int(&json, "cipher", cipher);
+	json_int(&json, "digest", digest);
+	json_uint(&json, "maclength", maclength);
+	json_int(&json, "compression", n->outcompression);
+	json_uint(&json, "options", n->options);
+	json_uint(&json, "status", n->status.value);
+	json_bool(&json, "reachable", n->status.reachable);
+	json_bool(&json, "validkey", n->status.validkey);
+	json_bool(&json, "udp_confirmed", n->status.udp_confirmed);
+	json_string(&json, "nexthop", n->nexthop ? n->nexthop->name : NULL);
+	json_string(&json, "via", n->via ? n->via->name : NULL);
+	json_int(&json, "distance", n->distance);
+	json_int(&json, "pmtu", n->mtu);
+	json_int(&json, "minmtu", n->minmtu);
+	json_int(&json, "maxmtu", n->maxmtu);
+	json_int(&json, "last_state_change", n->last_state_change);
+	json_int(&json, "udp_ping_rtt", n->udp_ping_rtt);
+	json_uint(&json, "in_packets", n->in_packets);
+	json_uint(&json, "in_bytes", n->in_bytes);
+	json_uint(&json, "out_packets", n->out_packets);
+	json_uint(&json, "out_bytes", n->out_bytes);
+	json_int(&json, "srtt", n->link.srtt);
+	json_int(&json, "rttvar", n->link.rttvar);
+	json_int(&json, "jitter", n->link.jitter);
+	json_uint(&json, "loss_ppm", n->link.loss);
+	dump_json(c, REQ_DUMP_NODES, &json);
+}
+
+/* Returns true once all nodes have been dumped */
+
+bool dump_nodes(connection_t *c) {
+	dump_t *dump = c->dump;
+	node_t cursor = {.name = dump->name};
+	int count = 0;
+
+	for(splay_node_t *node = dump_resume(&node_tree, dump->name ? &cursor : NULL); node; node = node->next) {
+		node_t *n = node->data;
+		dump_node(c, n);
+
+		if(++count == DUMP_BATCH) {
+			dump_cursor(&dump->name, n->name);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Copy the statistics of all nodes to the shared statistics file */
+
+static void publish_node_stats(void *data) {
+	(void)data;
+
+	if(!stats_shm_resize(&stats_shm, node_tree.count)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Could not resize shared statistics file %s: %s", statsfilename, strerror(errno));
+		stop_node_stats();
+		return;
+	}
+
+	uint32_t i = 0;
+
+	for splay_each(node_t, n, &node_tree) {
+		stats_shm_data_t *d = stats_shm_write_begin(&stats_shm, i);
+		d->in_packets = n->in_packets;
+		d->in_bytes = n->in_bytes;
+		d->out_packets = n->out_packets;
+		d->out_bytes = n->out_bytes;
+		d->udp_ping_rtt = n->udp_ping_rtt;
+		d->srtt = n->link.srtt;
+		d->jitter = n->link.jitter;
+		d->loss = n->link.loss;
+		d->status = n->status.value;
+		d->mtu = n->mtu;
+		d->minmtu = n->minmtu;
+		d->maxmtu = n->maxmtu;
+		strncpy(d->name, n->name, sizeof(d->name) - 1);
+		stats_shm_write_end(&stats_shm, i++);
+	}
+
+	timeout_set(&stats_timer, &(struct timeval) {
+		1, 0
+	});
+}
+
+bool start_node_stats(void) {
+	if(stats_shm.header) {
+		return true;
+	}
+
+	if(!stats_shm_create(&stats_shm, statsfilename)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Could not create shared statistics file %s: %s", statsfilename, strerror(errno));
+		return false;
+	}
+
+	timeout_add(&stats_timer, publish_node_stats, NULL, &(struct timeval) {
+		0, 0
+	});
+
+	return true;
+}
+
+void stop_node_stats(void) {
+	timeout_del(&stats_timer);
+	stats_shm_close(&stats_shm);
+}
+
+static void dump_node_traffic(connection_t *c, const node_t *n) {
+	const compression_stats_t *stats = &n->compression_stats;
+
+	if(!dump_is_json(c)) {
+		send_request(c, "%d %d %s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %d %d %u", CONTROL, REQ_DUMP_TRAFFIC,
+		             n->name, n->in_packets, n->in_bytes, n->out_packets, n->out_bytes,
+		             stats->attempts, stats->failures, stats->skipped,
+		             stats->in_bytes, stats->out_bytes, stats->skipped_bytes,
+		             stats->nsec, n->link.srtt, n->link.jitter, n->link.loss);
+		return;
+	}
+
+	json_t json;
+	json_begin(&json);
+	json_string(&json, "name", n->name);
+	json_uint(&json, "in_packets", n->in_packets);
+	json_uint(&json, "in_bytes", n->in_bytes);
+	json_uint(&json, "out_packets", n->out_packets);
+	json_uint(&json, "out_bytes", n->out_bytes);
+	json_uint(&json, "compression_attempts", stats->attempts);
+	json_uint(&json, "compression_failures", stats->failures);
+	json_uint(&json, "compression_skipped", stats->skipped);
+	json_uint(&json, "compression_in_bytes", stats->in_bytes);
+	json_uint(&json, "compression_out_bytes", stats->out_bytes);
+	json_uint(&json, "compression_skipped_bytes", stats->skipped_bytes);
+	json_uint(&json, "compression_nsec", stats->nsec);
+	json_int(&json, "srtt", n->link.srtt);
+	json_int(&json, "jitter", n->link.jitter);
+	json_uint(&json, "loss_ppm", n->link.loss);
+	dump_json(c, REQ_DUMP_TRAFFIC, &json);
 }
 
 bool dump_traffic(connection_t *c) {
-	for splay_each(node_t, n, &node_tree)
-		send_request(c, "%d %d %s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64, CONTROL, REQ_DUMP_TRAFFIC,
-		             n->name, n->in_packets, n->in_bytes, n->out_packets, n->out_bytes);
+	dump_t *dump = c->dump;
+	node_t cursor = {.name = dump->name};
+	int count = 0;
+
+	for(splay_node_t *node = dump_resume(&node_tree, dump->name ? &cursor : NULL); node; node = node->next) {
+		node_t *n = node->data;
+		dump_node_traffic(c, n);
+
+		if(++count == DUMP_BATCH) {
+			dump_cursor(&dump->name, n->name);
+			return false;
+		}
+	}
 
-	return send_request(c, "%d %d", CONTROL, REQ_DUMP_TRAFFIC);
+	return true;
 }
@@ -26,8 +26,10 @@
 #include "connection.h"
 #include "digest.h"
 #include "event.h"
+#include "linkstats.h"
 #include "subnet.h"
 #include "compression.h"
+#include "replay.h"
 
 typedef union node_status_t {
 	struct {
@@ -74,8 +76,11 @@ typedef struct node_t {
 
 	compression_level_t incompression;      /* Compression level, 0 = no compression */
 	compression_level_t outcompression;     /* Compression level, 0 = no compression */
+	compression_flow_t compression_flows[COMPRESSION_FLOWS];
+	compression_stats_t compression_stats;
 
 	int distance;
+	uint64_t path_weight;                   /* sum of the edge weights from us to him, with LatencyRouting */
 	struct node_t *nexthop;                 /* nearest node from us to him */
 	struct edge_t *prevedge;                /* nearest node from him to us */
 	struct node_t *via;                     /* next hop for UDP packets */
@@ -83,19 +88,23 @@ typedef struct node_t {
 	splay_tree_t subnet_tree;               /* Pointer to a tree of subnets belonging to this node */
 
 	splay_tree_t edge_tree;                 /* Edges with this node as one of the endpoints */
+	uint32_t incoming_edges;                /* Number of edges in edge_weight_tree pointing to this node */
 
 	struct connection_t *connection;        /* Connection associated with this node (if a direct connection exists) */
+	uint32_t outgoings;                     /* Number of outgoing_ts for this node */
+	uint32_t autoconnect_index[2];          /* Position + 1 in the AutoConnect candidate sets, 0 if not in them */
 
 	uint32_t sent_seqno;                    /* Sequence number last sent to this node */
 	uint32_t received_seqno;                /* Sequence number last received from this node */
 	uint32_t received;                      /* Total valid packets received from this node */
-	uint32_t farfuture;                     /* Packets in a row that have arrived from the far future */
-	uint8_t *late;                          /* Bitfield marking late packets */
+	uint32_t lost;                          /* Total packets from this node skipped in the sequence numbers */
+	replay_window_t replay;                 /* Sequence numbers recently received from this node */
 
 	struct timeval udp_reply_sent;          /* Last time a (gratuitous) UDP probe reply was sent */
 	struct timeval udp_ping_sent;           /* Last time a UDP probe was sent */
 	int udp_ping_rtt;                       /* Round trip time of UDP ping (in microseconds; or -1 if !status.udp_confirmed) */
 	timeout_t udp_ping_timeout;             /* Ping timeout event */
+	link_stats_t link;                      /* Smoothed round trip time, jitter and loss of the UDP path */
 
 	struct timeval mtu_ping_sent;           /* Last time a MTU probe was sent */
 
@@ -130,6 +139,8 @@ extern node_t *lookup_node_id(const node_id_t *id);
 extern node_t *lookup_node_udp(const sockaddr_t *sa);
 extern bool dump_nodes(struct connection_t *c);
 extern bool dump_traffic(struct connection_t *c);
+extern bool start_node_stats(void);
+extern void stop_node_stats(void);
 extern void update_node_udp(node_t *n, const sockaddr_t *sa);
 
 #endif
@@ -0,0 +1,221 @@
+#include "system.h"
+
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+
+#include "event.h"
+#include "logger.h"
+#include "netutl.h"
+#include "pmtu.h"
+#include "splay_tree.h"
+#include "utils.h"
+#include "xalloc.h"
+
+typedef struct pmtu_entry_t {
+	sockaddr_t address;             /* port is ignored */
+	int mtu;
+	time_t expires;
+} pmtu_entry_t;
+
+bool kernel_pmtu_discovery = false;
+
+static int pmtu_compare(const pmtu_entry_t *a, const pmtu_entry_t *b) {
+	return sockaddrcmp_noport(&a->address, &b->address);
+}
+
+static splay_tree_t pmtu_tree = {
+	.compare = (splay_compare_t)pmtu_compare,
+	.delete = (splay_action_t)free,
+};
+
+/* Sockets used to ask the routing table about the path MTU, one per address family.
+   They are reconnected to each address in turn, instead of opening a new one every time. */
+
+static int route_fd[2] = {-1, -1};
+
+static bool is_ip(const sockaddr_t *sa) {
+	return sa->sa.sa_family == AF_INET || sa->sa.sa_family == AF_INET6;
+}
+
+void pmtu_set_socket_options(int fd, int family, bool enable) {
+	int option = enable;
+
+#ifdef IP_RECVERR
+
+	if(family == AF_INET) {
+		setsockopt(fd, IPPROTO_IP, IP_RECVERR, (void *)&option, sizeof(option));
+	}
+
+#endif
+
+#ifdef IPV6_RECVERR
+
+	if(family == AF_INET6) {
+		setsockopt(fd, IPPROTO_IPV6, IPV6_RECVERR, (void *)&option, sizeof(option));
+	}
+
+#endif
+
+	(void)fd;
+	(void)family;
+	(void)option;
+}
+
+int pmtu_receive_error(int fd, sockaddr_t *sa) {
+#if defined(IP_RECVERR) && defined(HAVE_LINUX_ERRQUEUE_H)
+	uint8_t data[1];
+	uint8_t control[256];
+	struct iovec iov = {data, sizeof(data)};
+
+	memset(sa, 0, sizeof(*sa));
+
+	struct msghdr msg = {
+		.msg_name = &sa->sa,
+		.msg_namelen = sizeof(*sa),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+
+	if(recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+		return -1;
+	}
+
+	for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		bool ipv4 = cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR;
+#ifdef IPV6_RECVERR
+		bool ipv6 = cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR;
+#else
+		bool ipv6 = false;
+#endif
+
+		if(!ipv4 && !ipv6) {
+			continue;
+		}
+
+		struct sock_extended_err err;
+		memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+
+		// The destination of the packet that caused the error is in sa, the path MTU in ee_info
+
+		if(err.ee_errno == EMSGSIZE && err.ee_info <= INT_MAX) {
+			return (int)err.ee_info;
+		}
+
+		break;
+	}
+
+	return 0;
+#else
+	(void)fd;
+	(void)sa;
+	return -1;
+#endif
+}
+
+static pmtu_entry_t *lookup(const sockaddr_t *sa) {
+	pmtu_entry_t key = {0};
+	memcpy(&key.address, sa, sizeof(key.address));
+
+	pmtu_entry_t *entry = splay_search(&pmtu_tree, &key);
+
+	if(entry && entry->expires <= now.tv_sec) {
+		splay_delete(&pmtu_tree, entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+void pmtu_learn(const sockaddr_t *sa, int mtu) {
+	if(!is_ip(sa) || mtu <= 0) {
+		return;
+	}
+
+	pmtu_entry_t *entry = lookup(sa);
+
+	if(!entry) {
+		entry = xzalloc(sizeof(*entry));
+		memcpy(&entry->address, sa, sizeof(entry->address));
+		splay_insert(&pmtu_tree, entry);
+	}
+
+	entry->mtu = mtu;
+	entry->expires = now.tv_sec + PMTU_EXPIRE;
+}
+
+void pmtu_forget(const sockaddr_t *sa) {
+	if(!is_ip(sa)) {
+		return;
+	}
+
+	pmtu_entry_t *entry = lookup(sa);
+
+	if(entry) {
+		splay_delete(&pmtu_tree, entry);
+	}
+}
+
+int pmtu_lookup(const sockaddr_t *sa) {
+	if(!is_ip(sa)) {
+		return 0;
+	}
+
+	pmtu_entry_t *entry = lookup(sa);
+	return entry ? entry->mtu : 0;
+}
+
+int pmtu_route_mtu(const sockaddr_t *sa) {
+#ifdef IP_MTU
+
+	if(!is_ip(sa)) {
+		return 0;
+	}
+
+	int *fd = &route_fd[sa->sa.sa_family == AF_INET6];
+
+	if(*fd < 0) {
+		*fd = socket(sa->sa.sa_family, SOCK_DGRAM, IPPROTO_UDP);
+
+		if(*fd < 0) {
+			logger(DEBUG_TRAFFIC, LOG_ERR, "Creating MTU assessment socket failed: %s", sockstrerror(sockerrno));
+			return 0;
+		}
+	}
+
+	if(connect(*fd, &sa->sa, SALEN(sa->sa))) {
+		char *hostname = sockaddr2hostname(sa);
+		logger(DEBUG_TRAFFIC, LOG_ERR, "Connecting MTU assessment socket to %s failed: %s", hostname, sockstrerror(sockerrno));
+		free(hostname);
+		return 0;
+	}
+
+	int mtu;
+	socklen_t mtu_len = sizeof(mtu);
+
+	if(getsockopt(*fd, IPPROTO_IP, IP_MTU, (void *)&mtu, &mtu_len)) {
+		char *hostname = sockaddr2hostname(sa);
+		logger(DEBUG_TRAFFIC, LOG_ERR, "getsockopt(IP_MTU) for %s failed: %s", hostname, sockstrerror(sockerrno));
+		free(hostname);
+		return 0;
+	}
+
+	return mtu;
+#else
+	(void)sa;
+	return 0;
+#endif
+}
+
+void pmtu_exit(void) {
+	splay_empty_tree(&pmtu_tree);
+
+	for(size_t i = 0; i < sizeof(route_fd) / sizeof(*route_fd); i++) {
+		if(route_fd[i] >= 0) {
+			closesocket(route_fd[i]);
+			route_fd[i] = -1;
+		}
+	}
+}
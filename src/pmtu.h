@@ -0,0 +1,35 @@
+#ifndef TINC_PMTU_H
+#define TINC_PMTU_H
+
+#include "system.h"
+
+#include "net.h"
+
+/* Path MTUs learned from the kernel, either from ICMP "fragmentation needed"
+   errors or from the routing table, and from nodes whose MTU has been probed.
+   They are stored per IP address, so nodes behind the same NAT router share
+   them. All MTUs here are those of whole IP packets; callers have to subtract
+   their own overhead. */
+
+/* The kernel forgets learned path MTUs after the same amount of time */
+#define PMTU_EXPIRE 600
+
+extern bool kernel_pmtu_discovery;
+
+/* Ask the kernel to queue errors on a UDP socket, so they can be read with pmtu_receive_error() */
+extern void pmtu_set_socket_options(int fd, int family, bool enable);
+
+/* Read one error from a socket's error queue. Returns the path MTU if the error
+   carries one, 0 for other errors, and -1 if the queue is empty. */
+extern int pmtu_receive_error(int fd, sockaddr_t *sa);
+
+extern void pmtu_learn(const sockaddr_t *sa, int mtu);
+extern void pmtu_forget(const sockaddr_t *sa);
+extern int pmtu_lookup(const sockaddr_t *sa);
+
+/* Ask the routing table for the path MTU, returns 0 if unknown */
+extern int pmtu_route_mtu(const sockaddr_t *sa);
+
+extern void pmtu_exit(void);
+
+#endif // TINC_PMTU_H
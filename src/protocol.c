@@ -26,6 +26,9 @@
 #include "logger.h"
 #include "meta.h"
 #include "protocol.h"
+#include "random.h"
+#include "siphash.h"
+#include "trace.h"
 #include "utils.h"
 #include "xalloc.h"
 
@@ -56,10 +59,10 @@ const request_entry_t *get_request_entry(request_t req) {
 		[TERMREQ] = {termreq_h, "TERMREQ"},
 		[PING] = {ping_h, "PING"},
 		[PONG] = {pong_h, "PONG"},
-		[ADD_SUBNET] = {add_subnet_h, "ADD_SUBNET"},
-		[DEL_SUBNET] = {del_subnet_h, "DEL_SUBNET"},
-		[ADD_EDGE] = {add_edge_h, "ADD_EDGE"},
-		[DEL_EDGE] = {del_edge_h, "DEL_EDGE"},
+		[ADD_SUBNET] = {add_subnet_h, "ADD_SUBNET", add_subnet_tlv_h},
+		[DEL_SUBNET] = {del_subnet_h, "DEL_SUBNET", del_subnet_tlv_h},
+		[ADD_EDGE] = {add_edge_h, "ADD_EDGE", add_edge_tlv_h},
+		[DEL_EDGE] = {del_edge_h, "DEL_EDGE", del_edge_tlv_h},
 		[KEY_CHANGED] = {key_changed_h, "KEY_CHANGED"},
 		[REQ_KEY] = {req_key_h, "REQ_KEY"},
 		[ANS_KEY] = {ans_key_h, "ANS_KEY"},
@@ -75,22 +78,6 @@ const request_entry_t *get_request_entry(request_t req) {
 	return &request_entries[req];
 }
 
-static int past_request_compare(const past_request_t *a, const past_request_t *b) {
-	return strcmp(a->request, b->request);
-}
-
-static void free_past_request(past_request_t *r) {
-	if(r) {
-		free((char *)r->request);
-		free(r);
-	}
-}
-
-static splay_tree_t past_request_tree = {
-	.compare = (splay_compare_t) past_request_compare,
-	.delete = (splay_action_t) free_past_request,
-};
-
 /* Generic request routines - takes care of logging and error
    detection as well */
 
@@ -177,7 +164,11 @@ bool receive_request(connection_t *c, const char *request) {
 			return false;
 		}
 
-		if(!entry->handler(c, request)) {
+		TRACE3(request_start, c->name, reqno, request);
+		bool result = entry->handler(c, request);
+		TRACE2(request_done, reqno, result);
+
+		if(!result) {
 			/* Something went wrong. Probably scriptkiddies. Terminate. */
 
 			if(reqno != TERMREQ) {
@@ -194,52 +185,405 @@ bool receive_request(connection_t *c, const char *request) {
 	return true;
 }
 
+/* Binary TLV requests.
+   Requests that have a binary form are kept as decoded structures, and are
+   converted to a text line or a TLV record only when they are actually sent,
+   depending on what each peer understands. */
+
+typedef struct encoded_request_t {
+	const void *req;
+	request_format_t *format;
+	request_encode_t *encode;
+	const char *text;
+	size_t textlen;
+	size_t tlvlen;
+	shared_buffer_t *shared_text;   /* created on first use when sending to more than one connection */
+	shared_buffer_t *shared_tlv;
+	char textbuf[MAXBUFSIZE];
+	uint8_t tlv[MAXBUFSIZE];
+} encoded_request_t;
+
+static bool wants_tlv(const connection_t *c) {
+	return c->protocol_minor >= PROT_MINOR_TLV;
+}
+
+static const char *get_text(encoded_request_t *r) {
+	if(r->text) {
+		return r->text;
+	}
+
+	int len = r->format(r->req, r->textbuf, sizeof(r->textbuf) - 1);
+
+	if(len < 0 || (size_t)len >= sizeof(r->textbuf) - 1) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Output buffer overflow while formatting request");
+		return NULL;
+	}
+
+	r->textbuf[len++] = '\n';
+	r->textbuf[len] = 0;
+	r->text = r->textbuf;
+	r->textlen = len;
+	return r->text;
+}
+
+static bool get_tlv(encoded_request_t *r) {
+	if(r->tlvlen) {
+		return true;
+	}
+
+	tlv_writer_t out;
+	tlv_writer_init(&out, r->tlv, sizeof(r->tlv));
+	r->encode(r->req, &out);
+
+	if(out.overflow) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Output buffer overflow while encoding binary request");
+		return false;
+	}
+
+	r->tlvlen = out.len;
+	return true;
+}
+
+static void init_encoded(encoded_request_t *r, const void *req, request_format_t *format, request_encode_t *encode) {
+	r->req = req;
+	r->format = format;
+	r->encode = encode;
+	r->text = NULL;
+	r->textlen = 0;
+	r->tlvlen = 0;
+	r->shared_text = NULL;
+	r->shared_tlv = NULL;
+}
+
+static void free_encoded(encoded_request_t *r) {
+	shared_buffer_unref(r->shared_text);
+	shared_buffer_unref(r->shared_tlv);
+}
+
+static bool send_encoded(connection_t *c, encoded_request_t *r) {
+	if(wants_tlv(c)) {
+		return get_tlv(r) && send_meta_tlv(c, r->tlv, r->tlvlen);
+	} else {
+		return get_text(r) && send_meta(c, r->text, r->textlen);
+	}
+}
+
+// Send an encoded request as one of many recipients, sharing the encoded form between them.
+
+static bool send_encoded_shared(connection_t *c, encoded_request_t *r) {
+	if(wants_tlv(c)) {
+		if(!r->shared_tlv) {
+			if(!get_tlv(r)) {
+				return false;
+			}
+
+			r->shared_tlv = shared_buffer_alloc(META_RECORD_TLV, r->tlv, r->tlvlen);
+		}
+
+		return send_meta_shared(c, r->shared_tlv);
+	} else {
+		if(!r->shared_text) {
+			if(!get_text(r)) {
+				return false;
+			}
+
+			r->shared_text = shared_buffer_alloc(0, r->text, r->textlen);
+		}
+
+		return send_meta_shared(c, r->shared_text);
+	}
+}
+
+static void log_encoded(const connection_t *c, const char *what, const char *direction, encoded_request_t *r) {
+	if(debug_level < DEBUG_META && !logcontrol) {
+		return;
+	}
+
+	const char *text = get_text(r);
+
+	if(text) {
+		logger(DEBUG_META, LOG_DEBUG, "%s %s %s %s (%s): %.*s", what, get_request_entry(atoi(text))->name, direction, c->name, c->hostname, (int)r->textlen - 1, text);
+	}
+}
+
+void log_tlv_request(const connection_t *c, const char *what, const void *req, request_format_t *format) {
+	if(debug_level < DEBUG_META && !logcontrol) {
+		return;
+	}
+
+	char request[MAXBUFSIZE];
+	int len = format(req, request, sizeof(request));
+
+	if(len > 0 && (size_t)len < sizeof(request)) {
+		logger(DEBUG_META, LOG_DEBUG, "%s %s from %s (%s): %s", what, get_request_entry(atoi(request))->name, c->name, c->hostname, request);
+	}
+}
+
+bool send_request_tlv(connection_t *c, const void *req, request_format_t *format, request_encode_t *encode) {
+	encoded_request_t encoded, *r = &encoded;
+	init_encoded(r, req, format, encode);
+
+	log_encoded(c, "Sending", "to", r);
+
+	if(c != everyone) {
+		return send_encoded(c, r);
+	}
+
+	for list_each(connection_t, other, &connection_list)
+		if(other->edge) {
+			send_encoded_shared(other, r);
+		}
+
+	free_encoded(r);
+	return true;
+}
+
+void forward_request_tlv(connection_t *from, const char *request, const void *req, request_format_t *format, request_encode_t *encode) {
+	encoded_request_t encoded, *r = &encoded;
+	init_encoded(r, req, format, encode);
+
+	// If we got the request as text, forward it as-is to peers that want text
+
+	if(request) {
+		size_t len = strlen(request);
+
+		if(len < sizeof(r->textbuf) - 1) {
+			memcpy(r->textbuf, request, len);
+			r->textbuf[len++] = '\n';
+			r->textbuf[len] = 0;
+			r->text = r->textbuf;
+			r->textlen = len;
+		}
+	}
+
+	log_encoded(from, "Forwarding", "from", r);
+
+	for list_each(connection_t, c, &connection_list)
+		if(c != from && c->edge) {
+			send_encoded_shared(c, r);
+		}
+
+	free_encoded(r);
+}
+
+bool receive_tlv_request(connection_t *c, const void *data, size_t len) {
+	tlv_reader_t in;
+	tlv_t field;
+	uint32_t reqno;
+
+	tlv_reader_init(&in, data, len);
+
+	if(!tlv_next(&in, &field) || field.tag != TLV_REQUEST || !tlv_get_uint32(&field, &reqno)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Bogus binary data received from %s (%s)", c->name, c->hostname);
+		return false;
+	}
+
+	if(!is_valid_request((request_t)reqno) || !get_request_entry(reqno)->tlv_handler) {
+		logger(DEBUG_META, LOG_DEBUG, "Unknown binary request %u from %s (%s)", reqno, c->name, c->hostname);
+		return false;
+	}
+
+	const request_entry_t *entry = get_request_entry(reqno);
+
+	if((c->allow_request != ALL) && (c->allow_request != (int)reqno)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Unauthorized request from %s (%s)", c->name, c->hostname);
+		return false;
+	}
+
+	if(!entry->tlv_handler(c, &in)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Error while processing %s from %s (%s)", entry->name, c->name, c->hostname);
+		return false;
+	}
+
+	return true;
+}
+
+/* Recently seen requests are remembered by a keyed 128 bit hash of their contents,
+   so memory use does not depend on the size of the requests. Hashes are stored in
+   two generations. When the current generation is pinginterval seconds old, the
+   previous one is thrown away as a whole and the current one takes its place, so a
+   request is remembered for at least pinginterval seconds. Each generation has a
+   small bloom filter in front of it, so that looking up a new request usually does
+   not have to touch the hash set itself. */
+
+#define PAST_REQUEST_MIN_SLOTS 1024
+#define PAST_REQUEST_MAX_SLOTS 65536
+
+typedef struct past_request_t {
+	uint64_t hash[2];
+} past_request_t;
+
+typedef struct past_request_generation_t {
+	past_request_t *slots;          /* open addressing, an all zero hash marks an empty slot */
+	uint8_t *bloom;                 /* 8 bits per slot */
+	size_t size;                    /* number of slots, always a power of two */
+	size_t count;
+	time_t started;
+} past_request_generation_t;
+
+past_request_stats_t past_request_stats;
+
+static past_request_generation_t past_requests[2];
+static past_request_generation_t *current_requests = &past_requests[0];
+static past_request_generation_t *previous_requests = &past_requests[1];
+static uint8_t past_request_key[SIPHASH_KEY_SIZE];
+static bool past_request_key_set;
 static timeout_t past_request_timeout;
 
-static void age_past_requests(void *data) {
-	(void)data;
-	int left = 0, deleted = 0;
+static void clear_generation(past_request_generation_t *gen) {
+	free(gen->slots);
+	free(gen->bloom);
+	gen->slots = NULL;
+	gen->bloom = NULL;
+	gen->size = 0;
+	gen->count = 0;
+}
 
-	for splay_each(past_request_t, p, &past_request_tree) {
-		if(p->firstseen + pinginterval <= now.tv_sec) {
-			splay_delete_node(&past_request_tree, node), deleted++;
-		} else {
-			left++;
+static inline bool bloom_test(const past_request_generation_t *gen, const past_request_t *p) {
+	size_t mask = gen->size * 8 - 1;
+	size_t a = p->hash[1] & mask;
+	size_t b = (p->hash[1] >> 32) & mask;
+	return (gen->bloom[a / 8] & (1 << (a % 8))) && (gen->bloom[b / 8] & (1 << (b % 8)));
+}
+
+static inline void bloom_set(past_request_generation_t *gen, const past_request_t *p) {
+	size_t mask = gen->size * 8 - 1;
+	size_t a = p->hash[1] & mask;
+	size_t b = (p->hash[1] >> 32) & mask;
+	gen->bloom[a / 8] |= 1 << (a % 8);
+	gen->bloom[b / 8] |= 1 << (b % 8);
+}
+
+static bool generation_contains(const past_request_generation_t *gen, const past_request_t *p) {
+	if(!gen->count || !bloom_test(gen, p)) {
+		return false;
+	}
+
+	size_t mask = gen->size - 1;
+
+	for(size_t i = p->hash[0] & mask; gen->slots[i].hash[0]; i = (i + 1) & mask) {
+		if(gen->slots[i].hash[0] == p->hash[0] && gen->slots[i].hash[1] == p->hash[1]) {
+			return true;
 		}
 	}
 
-	if(left || deleted) {
-		logger(DEBUG_SCARY_THINGS, LOG_DEBUG, "Aging past requests: deleted %d, left %d", deleted, left);
+	return false;
+}
+
+static void generation_insert(past_request_generation_t *gen, const past_request_t *p) {
+	size_t mask = gen->size - 1;
+	size_t i = p->hash[0] & mask;
+
+	while(gen->slots[i].hash[0]) {
+		i = (i + 1) & mask;
 	}
 
-	if(left)
+	gen->slots[i] = *p;
+	gen->count++;
+	bloom_set(gen, p);
+}
+
+static void resize_generation(past_request_generation_t *gen, size_t size) {
+	past_request_generation_t old = *gen;
+
+	gen->slots = xzalloc(size * sizeof(*gen->slots));
+	gen->bloom = xzalloc(size);
+	gen->size = size;
+	gen->count = 0;
+
+	for(size_t i = 0; i < old.size; i++) {
+		if(old.slots[i].hash[0]) {
+			generation_insert(gen, &old.slots[i]);
+		}
+	}
+
+	clear_generation(&old);
+}
+
+static void rotate_past_requests(void) {
+	size_t dropped = previous_requests->count;
+
+	clear_generation(previous_requests);
+
+	past_request_generation_t *gen = previous_requests;
+	previous_requests = current_requests;
+	current_requests = gen;
+	current_requests->started = now.tv_sec;
+
+	if(dropped || previous_requests->count) {
+		past_request_stats.rotations++;
+		logger(DEBUG_SCARY_THINGS, LOG_DEBUG, "Aging past requests: deleted %lu, left %lu, suppressed %" PRIu64 " duplicates so far", (unsigned long)dropped, (unsigned long)previous_requests->count, past_request_stats.hits);
+	}
+}
+
+static void age_past_requests(void *data) {
+	(void)data;
+
+	if(current_requests->started + pinginterval <= now.tv_sec) {
+		rotate_past_requests();
+	}
+
+	if(current_requests->count || previous_requests->count)
 		timeout_set(&past_request_timeout, &(struct timeval) {
 		10, jitter()
 	});
 }
 
-bool seen_request(const char *request) {
-	past_request_t *new, p = {0};
+bool seen_request(const void *request, size_t len) {
+	past_request_t p;
+	uint8_t hash[SIPHASH128_SIZE];
+
+	if(!past_request_key_set) {
+		randomize(past_request_key, sizeof(past_request_key));
+		past_request_key_set = true;
+	}
 
-	p.request = request;
+	siphash128(hash, request, len, past_request_key);
+	memcpy(p.hash, hash, sizeof(p.hash));
+	p.hash[0] |= 1;
 
-	if(splay_search(&past_request_tree, &p)) {
+	if(generation_contains(current_requests, &p) || generation_contains(previous_requests, &p)) {
+		past_request_stats.hits++;
 		logger(DEBUG_SCARY_THINGS, LOG_DEBUG, "Already seen request");
 		return true;
-	} else {
-		new = xmalloc(sizeof(*new));
-		new->request = xstrdup(request);
-		new->firstseen = now.tv_sec;
-		splay_insert(&past_request_tree, new);
-		timeout_add(&past_request_timeout, age_past_requests, NULL, &(struct timeval) {
-			10, jitter()
-		});
-		return false;
 	}
+
+	past_request_stats.misses++;
+
+	if(current_requests->started + pinginterval <= now.tv_sec) {
+		rotate_past_requests();
+	}
+
+	if(!current_requests->size) {
+		resize_generation(current_requests, PAST_REQUEST_MIN_SLOTS);
+	} else if(current_requests->count >= current_requests->size / 4 * 3) {
+		if(current_requests->size < PAST_REQUEST_MAX_SLOTS) {
+			resize_generation(current_requests, current_requests->size * 2);
+		} else {
+			/* Age out the generation early to bound memory use. Requests that are
+			   forgotten this way are accepted again if they come back. The edge and
+			   subnet handlers ignore those if they change nothing, but KEY_CHANGED is
+			   forwarded without such a check and can loop again, so make this visible. */
+			past_request_stats.overflows++;
+			logger(DEBUG_ALWAYS, LOG_WARNING, "Too many new requests within %d seconds, forgetting seen requests early (%" PRIu64 " times so far)", pinginterval, past_request_stats.overflows);
+			rotate_past_requests();
+			resize_generation(current_requests, PAST_REQUEST_MIN_SLOTS);
+		}
+	}
+
+	generation_insert(current_requests, &p);
+
+	if(!past_request_timeout.cb)
+		timeout_add(&past_request_timeout, age_past_requests, NULL, &(struct timeval) {
+		10, jitter()
+	});
+
+	return false;
 }
 
 void exit_requests(void) {
-	splay_empty_tree(&past_request_tree);
+	clear_generation(&past_requests[0]);
+	clear_generation(&past_requests[1]);
 
 	timeout_del(&past_request_timeout);
 }
@@ -23,11 +23,16 @@
 
 #include "ecdsa.h"
 #include "connection.h"
+#include "tlv.h"
 
 /* Protocol version. Different major versions are incompatible. */
 
 #define PROT_MAJOR 17
-#define PROT_MINOR 7
+#define PROT_MINOR 8
+
+/* Minimum minor version that understands binary TLV requests */
+
+#define PROT_MINOR_TLV 8
 
 STATIC_ASSERT(PROT_MINOR <= 255, "PROT_MINOR must not exceed 255");
 
@@ -57,21 +62,31 @@ typedef enum request_t {
 } request_t;
 
 typedef bool (request_handler_t)(connection_t *c, const char *request);
+typedef bool (tlv_request_handler_t)(connection_t *c, tlv_reader_t *in);
+
+/* Convert a decoded request to its text form (without newline), or to a binary TLV record */
+typedef int (request_format_t)(const void *req, char *buf, size_t size);
+typedef void (request_encode_t)(const void *req, tlv_writer_t *out);
 
-typedef struct past_request_t {
-	const char *request;
-	time_t firstseen;
-} past_request_t;
+typedef struct past_request_stats_t {
+	uint64_t hits;                  /* duplicate requests that were suppressed */
+	uint64_t misses;                /* new requests that were remembered */
+	uint64_t rotations;             /* generations that were aged out */
+	uint64_t overflows;             /* generations that were aged out early because they were full */
+} past_request_stats_t;
 
 typedef struct {
 	request_handler_t *const handler;
 	const char *name;
+	tlv_request_handler_t *const tlv_handler;
 } request_entry_t;
 
 extern bool tunnelserver;
 extern bool strictsubnets;
 extern bool experimental;
 
+extern past_request_stats_t past_request_stats;
+
 extern int invitation_lifetime;
 extern ecdsa_t *invitation_key;
 
@@ -94,8 +109,13 @@ extern bool send_request(struct connection_t *c, const char *format, ...) ATTR_F
 extern void forward_request(struct connection_t *c, const char *request);
 extern bool receive_request(struct connection_t *c, const char *request);
 
+extern bool send_request_tlv(struct connection_t *c, const void *req, request_format_t *format, request_encode_t *encode);
+extern void forward_request_tlv(struct connection_t *from, const char *request, const void *req, request_format_t *format, request_encode_t *encode);
+extern bool receive_tlv_request(struct connection_t *c, const void *data, size_t len);
+extern void log_tlv_request(const struct connection_t *c, const char *what, const void *req, request_format_t *format);
+
 extern void exit_requests(void);
-extern bool seen_request(const char *request);
+extern bool seen_request(const void *request, size_t len);
 
 extern const request_entry_t *get_request_entry(request_t req);
 
@@ -144,4 +164,9 @@ extern request_handler_t control_h;
 extern request_handler_t udp_info_h;
 extern request_handler_t mtu_info_h;
 
+extern tlv_request_handler_t add_subnet_tlv_h;
+extern tlv_request_handler_t del_subnet_tlv_h;
+extern tlv_request_handler_t add_edge_tlv_h;
+extern tlv_request_handler_t del_edge_tlv_h;
+
 #endif
@@ -20,6 +20,7 @@
 
 #include "system.h"
 
+#include "autoconnect.h"
 #include "conf.h"
 #include "connection.h"
 #include "control.h"
@@ -28,6 +29,7 @@
 #include "digest.h"
 #include "ecdsa.h"
 #include "edge.h"
+#include "events.h"
 #include "graph.h"
 #include "logger.h"
 #include "meta.h"
@@ -233,6 +235,11 @@ static bool finalize_invitation(connection_t *c, const char *data, uint16_t len)
 static bool receive_invitation_sptps(void *handle, uint8_t type, const void *data, uint16_t len) {
 	connection_t *c = handle;
 
+	if(type == SPTPS_ALERT) {
+		terminate_connection(c, false);
+		return false;
+	}
+
 	if(type == 128) {
 		return true;
 	}
@@ -903,8 +910,22 @@ bool send_ack(connection_t *c) {
 		c->options |= OPTION_CLAMP_MSS;
 	}
 
-	if(!get_config_int(lookup_config(c->config_tree, "Weight"), &c->estimated_weight)) {
-		get_config_int(lookup_config(&config_tree, "Weight"), &c->estimated_weight);
+	/* Only SPTPS connections can compress the meta stream */
+
+	choice = stream_compression;
+	get_config_bool(lookup_config(c->config_tree, "StreamCompression"), &choice);
+
+	if(choice && c->protocol_minor >= 2 && !c->compress_in) {
+		c->compress_in = compression_stream_new(false);
+	}
+
+	if(c->compress_in) {
+		c->options |= OPTION_STREAM_COMPRESSION;
+	}
+
+	if(get_config_int(lookup_config(c->config_tree, "Weight"), &c->estimated_weight)
+	                || get_config_int(lookup_config(&config_tree, "Weight"), &c->estimated_weight)) {
+		c->status.fixed_weight = true;
 	}
 
 	return send_request(c, "%d %s %d %x", ACK, myport.udp, c->estimated_weight, (c->options & 0xffffff) | (experimental ? (PROT_MINOR << 24) : 0));
@@ -1032,12 +1053,24 @@ bool ack_h(connection_t *c, const char *request) {
 
 	n->connection = c;
 	c->node = n;
+	autoconnect_update(n);
 
 	if(!(c->options & options & OPTION_PMTU_DISCOVERY)) {
 		c->options &= ~OPTION_PMTU_DISCOVERY;
 		options &= ~OPTION_PMTU_DISCOVERY;
 	}
 
+	/* Compress what we send only if both sides asked for it */
+
+	if(!(c->options & options & OPTION_STREAM_COMPRESSION)) {
+		c->options &= ~OPTION_STREAM_COMPRESSION;
+		options &= ~OPTION_STREAM_COMPRESSION;
+		compression_stream_free(c->compress_in);
+		c->compress_in = NULL;
+	} else if(!c->compress_out) {
+		c->compress_out = compression_stream_new(true);
+	}
+
 	c->options |= options;
 
 	if(get_config_int(lookup_config(c->config_tree, "PMTU"), &mtu) && mtu < n->mtu) {
@@ -1062,6 +1095,7 @@ bool ack_h(connection_t *c, const char *request) {
 
 	logger(DEBUG_CONNECTIONS, LOG_NOTICE, "Connection with %s (%s) activated", c->name,
 	       c->hostname);
+	event_connection(c, true);
 
 	/* Send him everything we know */
 
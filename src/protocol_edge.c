@@ -25,6 +25,7 @@
 #include "crypto.h"
 #include "connection.h"
 #include "edge.h"
+#include "events.h"
 #include "graph.h"
 #include "logger.h"
 #include "net.h"
@@ -34,71 +35,192 @@
 #include "utils.h"
 #include "xalloc.h"
 
-bool send_add_edge(connection_t *c, const edge_t *e) {
-	bool x;
+
+/* Tags of the fields in binary ADD_EDGE and DEL_EDGE requests */
+
+enum {
+	EDGE_TLV_NONCE = 1,
+	EDGE_TLV_FROM,
+	EDGE_TLV_TO,
+	EDGE_TLV_ADDRESS,
+	EDGE_TLV_OPTIONS,
+	EDGE_TLV_WEIGHT,
+	EDGE_TLV_LOCAL_ADDRESS,
+};
+
+typedef struct edge_request_t {
+	request_t type;                 /* ADD_EDGE or DEL_EDGE */
+	uint32_t nonce;
+	char *from_name;
+	char *to_name;
+	sockaddr_t address;             /* the following are only used by ADD_EDGE */
+	sockaddr_t local_address;       /* sa_family is 0 if not present */
+	uint32_t options;
+	int weight;
+} edge_request_t;
+
+static int format_edge_request(const void *vreq, char *buf, size_t size) {
+	const edge_request_t *req = vreq;
+
+	if(req->type == DEL_EDGE) {
+		return snprintf(buf, size, "%d %x %s %s", DEL_EDGE, req->nonce, req->from_name, req->to_name);
+	}
+
+	int len;
 	char *address, *port;
 
-	sockaddr2str(&e->address, &address, &port);
+	sockaddr2str(&req->address, &address, &port);
 
-	if(e->local_address.sa.sa_family) {
+	if(req->local_address.sa.sa_family) {
 		char *local_address, *local_port;
-		sockaddr2str(&e->local_address, &local_address, &local_port);
+		sockaddr2str(&req->local_address, &local_address, &local_port);
 
-		x = send_request(c, "%d %x %s %s %s %s %x %d %s %s", ADD_EDGE, prng(UINT32_MAX),
-		                 e->from->name, e->to->name, address, port,
-		                 e->options, e->weight, local_address, local_port);
+		len = snprintf(buf, size, "%d %x %s %s %s %s %x %d %s %s", ADD_EDGE, req->nonce,
+		               req->from_name, req->to_name, address, port,
+		               req->options, req->weight, local_address, local_port);
 		free(local_address);
 		free(local_port);
 	} else {
-		x = send_request(c, "%d %x %s %s %s %s %x %d", ADD_EDGE, prng(UINT32_MAX),
-		                 e->from->name, e->to->name, address, port,
-		                 e->options, e->weight);
+		len = snprintf(buf, size, "%d %x %s %s %s %s %x %d", ADD_EDGE, req->nonce,
+		               req->from_name, req->to_name, address, port,
+		               req->options, req->weight);
 	}
 
 	free(address);
 	free(port);
 
-	return x;
+	return len;
 }
 
-bool add_edge_h(connection_t *c, const char *request) {
-	edge_t *e;
-	node_t *from, *to;
-	char from_name[MAX_STRING_SIZE];
-	char to_name[MAX_STRING_SIZE];
-	char to_address[MAX_STRING_SIZE];
-	char to_port[MAX_STRING_SIZE];
-	char address_local[MAX_STRING_SIZE];
-	char port_local[MAX_STRING_SIZE];
-	sockaddr_t address, local_address = {0};
-	uint32_t options;
-	int weight;
+static void encode_edge_request(const void *vreq, tlv_writer_t *out) {
+	const edge_request_t *req = vreq;
 
-	int parameter_count = sscanf(request, "%*d %*x "MAX_STRING" "MAX_STRING" "MAX_STRING" "MAX_STRING" %x %d "MAX_STRING" "MAX_STRING,
-	                             from_name, to_name, to_address, to_port, &options, &weight, address_local, port_local);
+	tlv_put_uint(out, TLV_REQUEST, req->type);
+	tlv_put_uint(out, EDGE_TLV_NONCE, req->nonce);
+	tlv_put_string(out, EDGE_TLV_FROM, req->from_name);
+	tlv_put_string(out, EDGE_TLV_TO, req->to_name);
 
-	if(parameter_count != 6 && parameter_count != 8) {
-		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s)", "ADD_EDGE", c->name,
-		       c->hostname);
+	if(req->type == ADD_EDGE) {
+		tlv_put_sockaddr(out, EDGE_TLV_ADDRESS, &req->address);
+		tlv_put_uint(out, EDGE_TLV_OPTIONS, req->options);
+		tlv_put_uint(out, EDGE_TLV_WEIGHT, (uint32_t)req->weight);
+
+		if(req->local_address.sa.sa_family) {
+			tlv_put_sockaddr(out, EDGE_TLV_LOCAL_ADDRESS, &req->local_address);
+		}
+	}
+}
+
+static bool decode_edge_request(tlv_reader_t *in, edge_request_t *req) {
+	uint32_t seen = 0, required = 1 << EDGE_TLV_NONCE | 1 << EDGE_TLV_FROM | 1 << EDGE_TLV_TO;
+	uint32_t weight = 0;
+	bool ok = true;
+	tlv_t field;
+
+	if(req->type == ADD_EDGE) {
+		required |= 1 << EDGE_TLV_ADDRESS | 1 << EDGE_TLV_OPTIONS | 1 << EDGE_TLV_WEIGHT;
+	}
+
+	while(ok && tlv_next(in, &field)) {
+		if(field.tag < 32 && seen & 1 << field.tag) {
+			ok = false;
+			break;
+		}
+
+		switch(field.tag) {
+		case EDGE_TLV_NONCE:
+			ok = tlv_get_uint32(&field, &req->nonce);
+			break;
+
+		case EDGE_TLV_FROM:
+			ok = tlv_get_string(&field, req->from_name, MAX_STRING_SIZE);
+			break;
+
+		case EDGE_TLV_TO:
+			ok = tlv_get_string(&field, req->to_name, MAX_STRING_SIZE);
+			break;
+
+		case EDGE_TLV_ADDRESS:
+			ok = tlv_get_sockaddr(&field, &req->address);
+			break;
+
+		case EDGE_TLV_OPTIONS:
+			ok = tlv_get_uint32(&field, &req->options);
+			break;
+
+		case EDGE_TLV_WEIGHT:
+			ok = tlv_get_uint32(&field, &weight);
+			break;
+
+		case EDGE_TLV_LOCAL_ADDRESS:
+			ok = tlv_get_sockaddr(&field, &req->local_address);
+			break;
+
+		default:
+			/* Ignore fields added by newer versions */
+			continue;
+		}
+
+		seen |= 1 << field.tag;
+	}
+
+	req->weight = (int)weight;
+
+	if(!ok || in->error || (seen & required) != required) {
+		sockaddrfree(&req->address);
+		sockaddrfree(&req->local_address);
 		return false;
 	}
 
+	return true;
+}
+
+bool send_add_edge(connection_t *c, const edge_t *e) {
+	edge_request_t req = {
+		.type = ADD_EDGE,
+		.nonce = prng(UINT32_MAX),
+		.from_name = e->from->name,
+		.to_name = e->to->name,
+		.address = e->address,
+		.local_address = e->local_address,
+		.options = e->options,
+		.weight = e->weight,
+	};
+
+	return send_request_tlv(c, &req, format_edge_request, encode_edge_request);
+}
+
+/* Process an ADD_EDGE request that came in either as text or in binary form.
+   If it came in as text, request points to the original line, otherwise it is NULL.
+   The addresses in req are still owned by the caller. */
+
+static bool add_edge(connection_t *c, const edge_request_t *req, const char *request) {
+	edge_t *e;
+	node_t *from, *to;
+	const sockaddr_t *address = &req->address;
+	const sockaddr_t *local_address = &req->local_address;
+
 	/* Check if names are valid */
 
-	if(!check_id(from_name) || !check_id(to_name) || !strcmp(from_name, to_name)) {
+	if(!check_id(req->from_name) || !check_id(req->to_name) || !strcmp(req->from_name, req->to_name)) {
 		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s): %s", "ADD_EDGE", c->name,
 		       c->hostname, "invalid name");
 		return false;
 	}
 
-	if(seen_request(request)) {
+	uint8_t key[MAXBUFSIZE];
+	tlv_writer_t out;
+	tlv_writer_init(&out, key, sizeof(key));
+	encode_edge_request(req, &out);
+
+	if(out.overflow || seen_request(key, out.len)) {
 		return true;
 	}
 
 	/* Lookup nodes */
 
-	from = lookup_node(from_name);
-	to = lookup_node(to_name);
+	from = lookup_node(req->from_name);
+	to = lookup_node(req->to_name);
 
 	if(tunnelserver &&
 	                from != myself && from != c->node &&
@@ -112,40 +234,29 @@ bool add_edge_h(connection_t *c, const char *request) {
 
 	if(!from) {
 		from = new_node();
-		from->name = xstrdup(from_name);
+		from->name = xstrdup(req->from_name);
 		node_add(from);
 	}
 
 	if(!to) {
 		to = new_node();
-		to->name = xstrdup(to_name);
+		to->name = xstrdup(req->to_name);
 		node_add(to);
 	}
 
-
-	/* Convert addresses */
-
-	address = str2sockaddr(to_address, to_port);
-
-	if(parameter_count >= 8) {
-		local_address = str2sockaddr(address_local, port_local);
-	}
-
 	/* Check if edge already exists */
 
 	e = lookup_edge(from, to);
 
 	if(e) {
-		bool new_address = sockaddrcmp(&e->address, &address);
+		bool new_address = sockaddrcmp(&e->address, address);
 		// local_address.sa.sa_family will be 0 if we got it from older tinc versions
 		// local_address.sa.sa_family will be 255 (AF_UNKNOWN) if we got it from newer versions
 		// but for edge which does not have local_address
-		bool new_local_address = local_address.sa.sa_family && local_address.sa.sa_family != AF_UNKNOWN &&
-		                         sockaddrcmp(&e->local_address, &local_address);
+		bool new_local_address = local_address->sa.sa_family && local_address->sa.sa_family != AF_UNKNOWN &&
+		                         sockaddrcmp(&e->local_address, local_address);
 
-		if(e->weight == weight && e->options == options && !new_address && !new_local_address) {
-			sockaddrfree(&address);
-			sockaddrfree(&local_address);
+		if(e->weight == req->weight && e->options == req->options && !new_address && !new_local_address) {
 			return true;
 		}
 
@@ -153,35 +264,35 @@ bool add_edge_h(connection_t *c, const char *request) {
 			logger(DEBUG_PROTOCOL, LOG_WARNING, "Got %s from %s (%s) for ourself which does not match existing entry",
 			       "ADD_EDGE", c->name, c->hostname);
 			send_add_edge(c, e);
-			sockaddrfree(&address);
-			sockaddrfree(&local_address);
 			return true;
 		}
 
-		logger(DEBUG_PROTOCOL, LOG_WARNING, "Got %s from %s (%s) which does not match existing entry",
-		       "ADD_EDGE", c->name, c->hostname);
+		// With LatencyRouting, weights change all the time
+		if(e->options == req->options && !new_address && !new_local_address) {
+			logger(DEBUG_PROTOCOL, LOG_DEBUG, "Got %s from %s (%s) changing the weight of edge %s to %s from %d to %d",
+			       "ADD_EDGE", c->name, c->hostname, from->name, to->name, e->weight, req->weight);
+		} else {
+			logger(DEBUG_PROTOCOL, LOG_WARNING, "Got %s from %s (%s) which does not match existing entry",
+			       "ADD_EDGE", c->name, c->hostname);
+		}
 
-		e->options = options;
+		e->options = req->options;
 
 		if(new_address) {
 			sockaddrfree(&e->address);
-			e->address = address;
-		} else {
-			sockaddrfree(&address);
+			sockaddrcpy(&e->address, address);
 		}
 
 		if(new_local_address) {
 			sockaddrfree(&e->local_address);
-			e->local_address = local_address;
-		} else {
-			sockaddrfree(&local_address);
+			sockaddrcpy(&e->local_address, local_address);
 		}
 
-		if(e->weight != weight) {
-			splay_node_t *node = splay_unlink(&edge_weight_tree, e);
-			e->weight = weight;
-			splay_insert_node(&edge_weight_tree, node);
+		if(e->weight != req->weight) {
+			edge_set_weight(e, req->weight);
 		}
+
+		event_edge(e, true);
 	} else if(from == myself) {
 		logger(DEBUG_PROTOCOL, LOG_WARNING, "Got %s from %s (%s) for ourself which does not exist",
 		       "ADD_EDGE", c->name, c->hostname);
@@ -191,24 +302,22 @@ bool add_edge_h(connection_t *c, const char *request) {
 		e->to = to;
 		send_del_edge(c, e);
 		free_edge(e);
-		sockaddrfree(&address);
-		sockaddrfree(&local_address);
 		return true;
 	} else {
 		e = new_edge();
 		e->from = from;
 		e->to = to;
-		e->address = address;
-		e->local_address = local_address;
-		e->options = options;
-		e->weight = weight;
+		sockaddrcpy(&e->address, address);
+		sockaddrcpy(&e->local_address, local_address);
+		e->options = req->options;
+		e->weight = req->weight;
 		edge_add(e);
 	}
 
 	/* Tell the rest about the new edge */
 
 	if(!tunnelserver) {
-		forward_request(c, request);
+		forward_request_tlv(c, request, req, format_edge_request, encode_edge_request);
 	}
 
 	/* Run MST before or after we tell the rest? */
@@ -218,39 +327,105 @@ bool add_edge_h(connection_t *c, const char *request) {
 	return true;
 }
 
-bool send_del_edge(connection_t *c, const edge_t *e) {
-	return send_request(c, "%d %x %s %s", DEL_EDGE, prng(UINT32_MAX),
-	                    e->from->name, e->to->name);
+bool add_edge_h(connection_t *c, const char *request) {
+	char from_name[MAX_STRING_SIZE];
+	char to_name[MAX_STRING_SIZE];
+	char to_address[MAX_STRING_SIZE];
+	char to_port[MAX_STRING_SIZE];
+	char address_local[MAX_STRING_SIZE];
+	char port_local[MAX_STRING_SIZE];
+	edge_request_t req = {
+		.type = ADD_EDGE,
+		.from_name = from_name,
+		.to_name = to_name,
+	};
+
+	int parameter_count = sscanf(request, "%*d %x "MAX_STRING" "MAX_STRING" "MAX_STRING" "MAX_STRING" %x %d "MAX_STRING" "MAX_STRING,
+	                             &req.nonce, from_name, to_name, to_address, to_port, &req.options, &req.weight, address_local, port_local);
+
+	if(parameter_count != 7 && parameter_count != 9) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s)", "ADD_EDGE", c->name,
+		       c->hostname);
+		return false;
+	}
+
+	/* Convert addresses */
+
+	req.address = str2sockaddr(to_address, to_port);
+
+	if(parameter_count >= 9) {
+		req.local_address = str2sockaddr(address_local, port_local);
+	}
+
+	bool result = add_edge(c, &req, request);
+
+	sockaddrfree(&req.address);
+	sockaddrfree(&req.local_address);
+
+	return result;
 }
 
-bool del_edge_h(connection_t *c, const char *request) {
-	edge_t *e;
+bool add_edge_tlv_h(connection_t *c, tlv_reader_t *in) {
 	char from_name[MAX_STRING_SIZE];
 	char to_name[MAX_STRING_SIZE];
-	node_t *from, *to;
+	edge_request_t req = {
+		.type = ADD_EDGE,
+		.from_name = from_name,
+		.to_name = to_name,
+	};
 
-	if(sscanf(request, "%*d %*x "MAX_STRING" "MAX_STRING, from_name, to_name) != 2) {
-		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s)", "DEL_EDGE", c->name,
+	if(!decode_edge_request(in, &req)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s)", "ADD_EDGE", c->name,
 		       c->hostname);
 		return false;
 	}
 
+	log_tlv_request(c, "Got", &req, format_edge_request);
+
+	bool result = add_edge(c, &req, NULL);
+
+	sockaddrfree(&req.address);
+	sockaddrfree(&req.local_address);
+
+	return result;
+}
+
+bool send_del_edge(connection_t *c, const edge_t *e) {
+	edge_request_t req = {
+		.type = DEL_EDGE,
+		.nonce = prng(UINT32_MAX),
+		.from_name = e->from->name,
+		.to_name = e->to->name,
+	};
+
+	return send_request_tlv(c, &req, format_edge_request, encode_edge_request);
+}
+
+static bool del_edge(connection_t *c, const edge_request_t *req, const char *request) {
+	edge_t *e;
+	node_t *from, *to;
+
 	/* Check if names are valid */
 
-	if(!check_id(from_name) || !check_id(to_name) || !strcmp(from_name, to_name)) {
+	if(!check_id(req->from_name) || !check_id(req->to_name) || !strcmp(req->from_name, req->to_name)) {
 		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s): %s", "DEL_EDGE", c->name,
 		       c->hostname, "invalid name");
 		return false;
 	}
 
-	if(seen_request(request)) {
+	uint8_t key[MAXBUFSIZE];
+	tlv_writer_t out;
+	tlv_writer_init(&out, key, sizeof(key));
+	encode_edge_request(req, &out);
+
+	if(out.overflow || seen_request(key, out.len)) {
 		return true;
 	}
 
 	/* Lookup nodes */
 
-	from = lookup_node(from_name);
-	to = lookup_node(to_name);
+	from = lookup_node(req->from_name);
+	to = lookup_node(req->to_name);
 
 	if(tunnelserver &&
 	                from != myself && from != c->node &&
@@ -295,7 +470,7 @@ bool del_edge_h(connection_t *c, const char *request) {
 	/* Tell the rest about the deleted edge */
 
 	if(!tunnelserver) {
-		forward_request(c, request);
+		forward_request_tlv(c, request, req, format_edge_request, encode_edge_request);
 	}
 
 	/* Delete the edge */
@@ -322,3 +497,46 @@ bool del_edge_h(connection_t *c, const char *request) {
 
 	return true;
 }
+
+bool del_edge_h(connection_t *c, const char *request) {
+	char from_name[MAX_STRING_SIZE];
+	char to_name[MAX_STRING_SIZE];
+	edge_request_t req = {
+		.type = DEL_EDGE,
+		.from_name = from_name,
+		.to_name = to_name,
+	};
+
+	if(sscanf(request, "%*d %x "MAX_STRING" "MAX_STRING, &req.nonce, from_name, to_name) != 3) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s)", "DEL_EDGE", c->name,
+		       c->hostname);
+		return false;
+	}
+
+	return del_edge(c, &req, request);
+}
+
+bool del_edge_tlv_h(connection_t *c, tlv_reader_t *in) {
+	char from_name[MAX_STRING_SIZE];
+	char to_name[MAX_STRING_SIZE];
+	edge_request_t req = {
+		.type = DEL_EDGE,
+		.from_name = from_name,
+		.to_name = to_name,
+	};
+
+	if(!decode_edge_request(in, &req)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s)", "DEL_EDGE", c->name,
+		       c->hostname);
+		return false;
+	}
+
+	log_tlv_request(c, "Got", &req, format_edge_request);
+
+	bool result = del_edge(c, &req, NULL);
+
+	sockaddrfree(&req.address);
+	sockaddrfree(&req.local_address);
+
+	return result;
+}
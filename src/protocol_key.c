@@ -70,7 +70,7 @@ bool key_changed_h(connection_t *c, const char *request) {
 		return false;
 	}
 
-	if(seen_request(request)) {
+	if(seen_request(request, strlen(request))) {
 		return true;
 	}
 
@@ -382,10 +382,8 @@ bool send_ans_key(node_t *to) {
 	// Reset sequence number and late packet window
 	to->received_seqno = 0;
 	to->received = 0;
-
-	if(replaywin) {
-		memset(to->late, 0, replaywin);
-	}
+	to->lost = 0;
+	replay_reset(&to->replay);
 
 	to->status.validkey_in = true;
 
@@ -515,6 +513,15 @@ bool ans_key_h(connection_t *c, const char *request) {
 		return true;
 #endif
 
+	case COMPRESS_ZSTD:
+#ifdef HAVE_ZSTD
+		break;
+#else
+		logger(DEBUG_ALWAYS, LOG_ERR, "Node %s (%s) uses bogus compression level!", from->name, from->hostname);
+		logger(DEBUG_ALWAYS, LOG_ERR, "ZSTD compression is unavailable on this node.");
+		return true;
+#endif
+
 	case COMPRESS_NONE:
 		break;
 
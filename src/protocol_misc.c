@@ -23,6 +23,7 @@
 #include "address_cache.h"
 #include "connection.h"
 #include "crypto.h"
+#include "events.h"
 #include "logger.h"
 #include "meta.h"
 #include "net.h"
@@ -74,11 +75,15 @@ bool pong_h(connection_t *c, const char *request) {
 	return true;
 }
 
+/* Only data that has already been encrypted and data packets count here,
+   since requests in other lanes will be sent before any queued packets. */
+
 static bool random_early_drop(connection_t *c) {
-	if(c->outbuf.len > (size_t)maxoutbufsize / 2) {
-		if((c->outbuf.len - (size_t)maxoutbufsize / 2) > prng((size_t)maxoutbufsize / 2)) {
-			return true;
-		}
+	size_t outlen = c->outbuf.len + c->outqueue[LANE_DATA].bytes;
+
+	if(meta_congested(c) || (outlen > (size_t)maxoutbufsize / 2 && (outlen - (size_t)maxoutbufsize / 2) > prng((size_t)maxoutbufsize / 2))) {
+		c->outdrops++;
+		return true;
 	}
 
 	return false;
@@ -360,6 +365,7 @@ bool mtu_info_h(connection_t *c, const char *request) {
 	if(from->mtu != mtu && from->minmtu != from->maxmtu) {
 		logger(DEBUG_TRAFFIC, LOG_INFO, "Using provisional MTU %d for node %s (%s)", mtu, from->name, from->hostname);
 		from->mtu = mtu;
+		event_mtu(from);
 	}
 
 	node_t *to = lookup_node(to_name);
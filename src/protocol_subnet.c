@@ -31,54 +31,136 @@
 #include "utils.h"
 #include "xalloc.h"
 
-bool send_add_subnet(connection_t *c, const subnet_t *subnet) {
+
+/* Tags of the fields in binary ADD_SUBNET and DEL_SUBNET requests */
+
+enum {
+	SUBNET_TLV_NONCE = 1,
+	SUBNET_TLV_OWNER,
+	SUBNET_TLV_SUBNET,
+};
+
+typedef struct subnet_request_t {
+	request_t type;                 /* ADD_SUBNET or DEL_SUBNET */
+	uint32_t nonce;
+	char *owner_name;
+	subnet_t subnet;
+} subnet_request_t;
+
+static int format_subnet_request(const void *vreq, char *buf, size_t size) {
+	const subnet_request_t *req = vreq;
 	char netstr[MAXNETSTR];
 
-	if(!net2str(netstr, sizeof(netstr), subnet)) {
-		return false;
+	if(!net2str(netstr, sizeof(netstr), &req->subnet)) {
+		return -1;
 	}
 
-	return send_request(c, "%d %x %s %s", ADD_SUBNET, prng(UINT32_MAX), subnet->owner->name, netstr);
+	return snprintf(buf, size, "%d %x %s %s", req->type, req->nonce, req->owner_name, netstr);
 }
 
-bool add_subnet_h(connection_t *c, const char *request) {
-	char subnetstr[MAX_STRING_SIZE];
-	char name[MAX_STRING_SIZE];
-	node_t *owner;
-	subnet_t s = {0}, *new, *old;
+static void encode_subnet_request(const void *vreq, tlv_writer_t *out) {
+	const subnet_request_t *req = vreq;
 
-	if(sscanf(request, "%*d %*x " MAX_STRING " " MAX_STRING, name, subnetstr) != 2) {
-		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s)", "ADD_SUBNET", c->name,
-		       c->hostname);
-		return false;
+	tlv_put_uint(out, TLV_REQUEST, req->type);
+	tlv_put_uint(out, SUBNET_TLV_NONCE, req->nonce);
+	tlv_put_string(out, SUBNET_TLV_OWNER, req->owner_name);
+	tlv_put_subnet(out, SUBNET_TLV_SUBNET, &req->subnet);
+}
+
+static bool decode_subnet_request(tlv_reader_t *in, subnet_request_t *req) {
+	const uint32_t required = 1 << SUBNET_TLV_NONCE | 1 << SUBNET_TLV_OWNER | 1 << SUBNET_TLV_SUBNET;
+	uint32_t seen = 0;
+	tlv_t field;
+
+	while(tlv_next(in, &field)) {
+		bool ok;
+
+		if(field.tag < 32 && seen & 1 << field.tag) {
+			return false;
+		}
+
+		switch(field.tag) {
+		case SUBNET_TLV_NONCE:
+			ok = tlv_get_uint32(&field, &req->nonce);
+			break;
+
+		case SUBNET_TLV_OWNER:
+			ok = tlv_get_string(&field, req->owner_name, MAX_STRING_SIZE);
+			break;
+
+		case SUBNET_TLV_SUBNET:
+			ok = tlv_get_subnet(&field, &req->subnet);
+			break;
+
+		default:
+			/* Ignore fields added by newer versions */
+			continue;
+		}
+
+		if(!ok) {
+			return false;
+		}
+
+		seen |= 1 << field.tag;
 	}
 
+	return !in->error && (seen & required) == required;
+}
+
+// Check the parts of a request that do not depend on our state, and check if we have seen it before.
+
+static bool check_subnet_request(connection_t *c, const subnet_request_t *req, bool *seen) {
+	const char *name = get_request_entry(req->type)->name;
+
 	/* Check if owner name is valid */
 
-	if(!check_id(name)) {
-		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s): %s", "ADD_SUBNET", c->name,
+	if(!check_id(req->owner_name)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s): %s", name, c->name,
 		       c->hostname, "invalid name");
 		return false;
 	}
 
-	/* Check if subnet string is valid */
+	uint8_t key[MAXBUFSIZE];
+	tlv_writer_t out;
+	tlv_writer_init(&out, key, sizeof(key));
+	encode_subnet_request(req, &out);
 
-	if(!str2net(&s, subnetstr)) {
-		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s): %s", "ADD_SUBNET", c->name,
-		       c->hostname, "invalid subnet string");
+	*seen = out.overflow || seen_request(key, out.len);
+	return true;
+}
+
+bool send_add_subnet(connection_t *c, const subnet_t *subnet) {
+	subnet_request_t req = {
+		.type = ADD_SUBNET,
+		.nonce = prng(UINT32_MAX),
+		.owner_name = subnet->owner->name,
+		.subnet = *subnet,
+	};
+
+	return send_request_tlv(c, &req, format_subnet_request, encode_subnet_request);
+}
+
+static bool add_subnet(connection_t *c, const subnet_request_t *req, const char *request) {
+	char subnetstr[MAXNETSTR];
+	node_t *owner;
+	subnet_t s = req->subnet, *new, *old;
+	bool seen;
+
+	if(!check_subnet_request(c, req, &seen)) {
 		return false;
 	}
 
-	if(seen_request(request)) {
+	if(seen) {
 		return true;
 	}
 
 	/* Check if the owner of the new subnet is in the connection list */
 
-	owner = lookup_node(name);
+	owner = lookup_node(req->owner_name);
 
 	if(tunnelserver && owner != myself && owner != c->node) {
 		/* in case of tunnelserver, ignore indirect subnet registrations */
+		net2str(subnetstr, sizeof(subnetstr), &s);
 		logger(DEBUG_PROTOCOL, LOG_WARNING, "Ignoring indirect %s from %s (%s) for %s",
 		       "ADD_SUBNET", c->name, c->hostname, subnetstr);
 		return true;
@@ -86,7 +168,7 @@ bool add_subnet_h(connection_t *c, const char *request) {
 
 	if(!owner) {
 		owner = new_node();
-		owner->name = xstrdup(name);
+		owner->name = xstrdup(req->owner_name);
 		node_add(owner);
 	}
 
@@ -109,6 +191,7 @@ bool add_subnet_h(connection_t *c, const char *request) {
 	/* In tunnel server mode, we should already know all allowed subnets */
 
 	if(tunnelserver) {
+		net2str(subnetstr, sizeof(subnetstr), &s);
 		logger(DEBUG_ALWAYS, LOG_WARNING, "Ignoring unauthorized %s from %s (%s): %s",
 		       "ADD_SUBNET", c->name, c->hostname, subnetstr);
 		return true;
@@ -117,9 +200,10 @@ bool add_subnet_h(connection_t *c, const char *request) {
 	/* Ignore if strictsubnets is true, but forward it to others */
 
 	if(strictsubnets) {
+		net2str(subnetstr, sizeof(subnetstr), &s);
 		logger(DEBUG_ALWAYS, LOG_WARNING, "Ignoring unauthorized %s from %s (%s): %s",
 		       "ADD_SUBNET", c->name, c->hostname, subnetstr);
-		forward_request(c, request);
+		forward_request_tlv(c, request, req, format_subnet_request, encode_subnet_request);
 		return true;
 	}
 
@@ -135,7 +219,7 @@ bool add_subnet_h(connection_t *c, const char *request) {
 	/* Tell the rest */
 
 	if(!tunnelserver) {
-		forward_request(c, request);
+		forward_request_tlv(c, request, req, format_subnet_request, encode_subnet_request);
 	}
 
 	/* Fast handoff of roaming MAC addresses */
@@ -147,54 +231,89 @@ bool add_subnet_h(connection_t *c, const char *request) {
 	return true;
 }
 
-bool send_del_subnet(connection_t *c, const subnet_t *s) {
-	char netstr[MAXNETSTR];
+// Parse a text ADD_SUBNET or DEL_SUBNET request.
+
+static bool parse_subnet_request(connection_t *c, const char *request, subnet_request_t *req) {
+	const char *name = get_request_entry(req->type)->name;
+	char subnetstr[MAX_STRING_SIZE];
 
-	if(!net2str(netstr, sizeof(netstr), s)) {
+	if(sscanf(request, "%*d %x " MAX_STRING " " MAX_STRING, &req->nonce, req->owner_name, subnetstr) != 3) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s)", name, c->name,
+		       c->hostname);
 		return false;
 	}
 
-	return send_request(c, "%d %x %s %s", DEL_SUBNET, prng(UINT32_MAX), s->owner->name, netstr);
+	/* Check if subnet string is valid */
+
+	if(!str2net(&req->subnet, subnetstr)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s): %s", name, c->name,
+		       c->hostname, "invalid subnet string");
+		return false;
+	}
+
+	return true;
 }
 
-bool del_subnet_h(connection_t *c, const char *request) {
-	char subnetstr[MAX_STRING_SIZE];
+bool add_subnet_h(connection_t *c, const char *request) {
 	char name[MAX_STRING_SIZE];
-	node_t *owner;
-	subnet_t s = {0}, *find;
+	subnet_request_t req = {
+		.type = ADD_SUBNET,
+		.owner_name = name,
+	};
 
-	if(sscanf(request, "%*d %*x " MAX_STRING " " MAX_STRING, name, subnetstr) != 2) {
-		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s)", "DEL_SUBNET", c->name,
+	return parse_subnet_request(c, request, &req) && add_subnet(c, &req, request);
+}
+
+bool add_subnet_tlv_h(connection_t *c, tlv_reader_t *in) {
+	char name[MAX_STRING_SIZE];
+	subnet_request_t req = {
+		.type = ADD_SUBNET,
+		.owner_name = name,
+	};
+
+	if(!decode_subnet_request(in, &req)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s)", "ADD_SUBNET", c->name,
 		       c->hostname);
 		return false;
 	}
 
-	/* Check if owner name is valid */
+	log_tlv_request(c, "Got", &req, format_subnet_request);
 
-	if(!check_id(name)) {
-		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s): %s", "DEL_SUBNET", c->name,
-		       c->hostname, "invalid name");
-		return false;
-	}
+	return add_subnet(c, &req, NULL);
+}
 
-	/* Check if subnet string is valid */
+bool send_del_subnet(connection_t *c, const subnet_t *s) {
+	subnet_request_t req = {
+		.type = DEL_SUBNET,
+		.nonce = prng(UINT32_MAX),
+		.owner_name = s->owner->name,
+		.subnet = *s,
+	};
+
+	return send_request_tlv(c, &req, format_subnet_request, encode_subnet_request);
+}
 
-	if(!str2net(&s, subnetstr)) {
-		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s): %s", "DEL_SUBNET", c->name,
-		       c->hostname, "invalid subnet string");
+static bool del_subnet(connection_t *c, const subnet_request_t *req, const char *request) {
+	char subnetstr[MAXNETSTR];
+	node_t *owner;
+	subnet_t s = req->subnet, *find;
+	bool seen;
+
+	if(!check_subnet_request(c, req, &seen)) {
 		return false;
 	}
 
-	if(seen_request(request)) {
+	if(seen) {
 		return true;
 	}
 
 	/* Check if the owner of the subnet being deleted is in the connection list */
 
-	owner = lookup_node(name);
+	owner = lookup_node(req->owner_name);
 
 	if(tunnelserver && owner != myself && owner != c->node) {
 		/* in case of tunnelserver, ignore indirect subnet deletion */
+		net2str(subnetstr, sizeof(subnetstr), &s);
 		logger(DEBUG_PROTOCOL, LOG_WARNING, "Ignoring indirect %s from %s (%s) for %s",
 		       "DEL_SUBNET", c->name, c->hostname, subnetstr);
 		return true;
@@ -202,7 +321,7 @@ bool del_subnet_h(connection_t *c, const char *request) {
 
 	if(!owner) {
 		logger(DEBUG_PROTOCOL, LOG_WARNING, "Got %s from %s (%s) for %s which is not in our node tree",
-		       "DEL_SUBNET", c->name, c->hostname, name);
+		       "DEL_SUBNET", c->name, c->hostname, req->owner_name);
 		return true;
 	}
 
@@ -214,10 +333,10 @@ bool del_subnet_h(connection_t *c, const char *request) {
 
 	if(!find) {
 		logger(DEBUG_PROTOCOL, LOG_WARNING, "Got %s from %s (%s) for %s which does not appear in his subnet tree",
-		       "DEL_SUBNET", c->name, c->hostname, name);
+		       "DEL_SUBNET", c->name, c->hostname, req->owner_name);
 
 		if(strictsubnets) {
-			forward_request(c, request);
+			forward_request_tlv(c, request, req, format_subnet_request, encode_subnet_request);
 		}
 
 		return true;
@@ -239,7 +358,7 @@ bool del_subnet_h(connection_t *c, const char *request) {
 	/* Tell the rest */
 
 	if(!tunnelserver) {
-		forward_request(c, request);
+		forward_request_tlv(c, request, req, format_subnet_request, encode_subnet_request);
 	}
 
 	if(strictsubnets) {
@@ -256,3 +375,31 @@ bool del_subnet_h(connection_t *c, const char *request) {
 
 	return true;
 }
+
+bool del_subnet_h(connection_t *c, const char *request) {
+	char name[MAX_STRING_SIZE];
+	subnet_request_t req = {
+		.type = DEL_SUBNET,
+		.owner_name = name,
+	};
+
+	return parse_subnet_request(c, request, &req) && del_subnet(c, &req, request);
+}
+
+bool del_subnet_tlv_h(connection_t *c, tlv_reader_t *in) {
+	char name[MAX_STRING_SIZE];
+	subnet_request_t req = {
+		.type = DEL_SUBNET,
+		.owner_name = name,
+	};
+
+	if(!decode_subnet_request(in, &req)) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Got bad %s from %s (%s)", "DEL_SUBNET", c->name,
+		       c->hostname);
+		return false;
+	}
+
+	log_tlv_request(c, "Got", &req, format_subnet_request);
+
+	return del_subnet(c, &req, NULL);
+}
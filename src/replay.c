@@ -0,0 +1,194 @@
+#include "system.h"
+
+#include "replay.h"
+
+replay_stats_t replay_stats;
+
+bool replay_init(replay_window_t *w, unsigned int bytes) {
+	memset(w, 0, sizeof(*w));
+
+	if(!bytes) {
+		return true;
+	}
+
+	if(bytes > REPLAY_BYTES_MAX) {
+		errno = EINVAL;
+		return false;
+	}
+
+	// The oldest and the newest block in the window may both be partial, so we need one more
+
+	uint32_t size = bytes * 8;
+	uint32_t blocks = (size + REPLAY_BLOCK_SIZE - 1) / REPLAY_BLOCK_SIZE + 1;
+	uint32_t slots = 1;
+
+	while(slots < blocks) {
+		slots <<= 1;
+	}
+
+	w->slots = calloc(slots, sizeof(*w->slots));
+
+	if(!w->slots) {
+		return false;
+	}
+
+	w->mask = slots - 1;
+	w->size = size;
+	w->farfuture_max = bytes >> 2;
+	return true;
+}
+
+void replay_free(replay_window_t *w) {
+	free((void *)w->slots);
+	memset(w, 0, sizeof(*w));
+}
+
+// Forget everything. Must not be called while other threads use the window.
+
+void replay_reset(replay_window_t *w) {
+	if(!w->slots) {
+		return;
+	}
+
+	for(uint32_t i = 0; i <= w->mask; i++) {
+		atomic_store(&w->slots[i], 0);
+	}
+
+	atomic_store(&w->next, 0);
+	atomic_store(&w->farfuture, 0);
+}
+
+/* Sequence numbers on the wire are only 32 bits, and wrap around in long sessions.
+   Internally they are extended to 64 bits, picking the value closest to next. */
+
+static inline uint64_t extend(uint32_t seqno, uint64_t next) {
+	uint64_t extended = (next & ~(uint64_t)UINT32_MAX) | seqno;
+
+	if(extended + (UINT64_C(1) << 31) < next) {
+		extended += UINT64_C(1) << 32;
+	} else if(extended > next + (UINT64_C(1) << 31) && extended > UINT32_MAX) {
+		extended -= UINT64_C(1) << 32;
+	}
+
+	return extended;
+}
+
+static inline bool too_old(const replay_window_t *w, uint64_t seqno, uint64_t next) {
+	return seqno + w->size < next;
+}
+
+static inline bool far_future(const replay_window_t *w, uint64_t seqno, uint64_t next) {
+	return seqno >= next + w->size;
+}
+
+/* Slots only have room for the lower 32 bits of the block number, so compare them
+   in serial number arithmetic: positive if the slot holds a newer block. */
+
+static inline int32_t slot_age(uint64_t slot, uint64_t block) {
+	return (int32_t)((uint32_t)(slot >> 32) - (uint32_t)block);
+}
+
+replay_result_t replay_check(replay_window_t *w, uint32_t wire_seqno) {
+	if(!w->slots) {
+		return REPLAY_OK;
+	}
+
+	uint64_t next = atomic_load(&w->next);
+	uint64_t seqno = extend(wire_seqno, next);
+	replay_result_t result = REPLAY_OK;
+
+	if(too_old(w, seqno, next)) {
+		return REPLAY_OLD;
+	}
+
+	if(far_future(w, seqno, next)) {
+		if(atomic_load(&w->farfuture) < w->farfuture_max) {
+			return REPLAY_FUTURE;
+		}
+
+		result = REPLAY_JUMP;
+	}
+
+	uint64_t block = seqno >> REPLAY_BLOCK_BITS;
+	uint64_t bit = UINT64_C(1) << (seqno & (REPLAY_BLOCK_SIZE - 1));
+	uint64_t slot = atomic_load(&w->slots[block & w->mask]);
+	int32_t age = slot_age(slot, block);
+
+	if(age > 0 || (!age && (slot & bit))) {
+		return REPLAY_OLD;
+	}
+
+	return result;
+}
+
+static replay_result_t update(replay_window_t *w, uint32_t wire_seqno) {
+	if(!w->slots) {
+		return REPLAY_OK;
+	}
+
+	uint64_t next = atomic_load(&w->next);
+	uint64_t seqno = extend(wire_seqno, next);
+	replay_result_t result = REPLAY_OK;
+
+	if(too_old(w, seqno, next)) {
+		return REPLAY_OLD;
+	}
+
+	// Prevent packets that jump far ahead of the queue from causing many others to be dropped,
+	// unless we have seen lots of them, in which case we consider the others lost.
+
+	if(far_future(w, seqno, next)) {
+		if(atomic_fetch_add(&w->farfuture, 1) < w->farfuture_max) {
+			return REPLAY_FUTURE;
+		}
+
+		result = REPLAY_JUMP;
+	}
+
+	// Set our bit, claiming the slot first if it still holds an older block
+
+	uint64_t block = seqno >> REPLAY_BLOCK_BITS;
+	uint64_t bit = UINT64_C(1) << (seqno & (REPLAY_BLOCK_SIZE - 1));
+	_Atomic uint64_t *slot = &w->slots[block & w->mask];
+	uint64_t old = atomic_load(slot);
+	uint64_t new;
+
+	do {
+		int32_t age = slot_age(old, block);
+
+		if(age > 0) {
+			return REPLAY_OLD;
+		}
+
+		if(!age) {
+			if(old & bit) {
+				return REPLAY_OLD;
+			}
+
+			new = old | bit;
+		} else {
+			new = block << 32 | bit;
+		}
+	} while(!atomic_compare_exchange_weak(slot, &old, new));
+
+	// Move the window forward, unless another thread already moved it further
+
+	while(seqno >= next && !atomic_compare_exchange_weak(&w->next, &next, seqno + 1)) {
+		// next has been updated, try again
+	}
+
+	atomic_store(&w->farfuture, 0);
+	return result;
+}
+
+replay_result_t replay_update(replay_window_t *w, uint32_t seqno) {
+	replay_result_t result = update(w, seqno);
+
+	if(result == REPLAY_OLD) {
+		atomic_fetch_add_explicit(&replay_stats.old, 1, memory_order_relaxed);
+	} else if(result == REPLAY_FUTURE) {
+		atomic_fetch_add_explicit(&replay_stats.future, 1, memory_order_relaxed);
+	}
+
+	return result;
+}
@@ -0,0 +1,56 @@
+#ifndef TINC_REPLAY_H
+#define TINC_REPLAY_H
+
+#include "system.h"
+
+#include <stdatomic.h>
+
+/* A replay window remembers which of the most recent sequence numbers have
+   been received, in the style of RFC 6479. Each 64-bit slot covers a block of
+   32 sequence numbers: the upper half holds the block number, the lower half a
+   bit for each sequence number that has been received. Slots are reused in a
+   ring, and a slot holding an older block is simply overwritten when a newer
+   block needs it, so large gaps cost nothing. All updates are single atomic
+   operations, so several threads can check and mark packets at the same time.
+   Sequence numbers may wrap around; they are tracked as 64-bit numbers internally,
+   so a sequence number is only ever compared to ones less than 2^31 away. */
+
+#define REPLAY_BLOCK_BITS 5
+#define REPLAY_BLOCK_SIZE (1 << REPLAY_BLOCK_BITS)
+#define REPLAY_BYTES_MAX (UINT32_MAX / 16)
+
+typedef enum replay_result_t {
+	REPLAY_OK,                      /* not seen before */
+	REPLAY_OLD,                     /* seen before, or too old to tell */
+	REPLAY_FUTURE,                  /* too far ahead, dropped */
+	REPLAY_JUMP,                    /* too far ahead, but so many were that packets in between must have been lost */
+} replay_result_t;
+
+typedef struct replay_window_t {
+	_Atomic uint64_t *slots;        /* NULL if replay protection is disabled */
+	uint32_t mask;                  /* number of slots - 1 */
+	uint32_t size;                  /* how far behind the newest packet others are still accepted */
+	uint32_t farfuture_max;         /* packets in a row from the far future to drop before jumping ahead */
+	_Atomic uint64_t next;          /* one more than the highest sequence number received, without wrapping */
+	_Atomic uint32_t farfuture;     /* packets in a row that have arrived from the far future */
+} replay_window_t;
+
+typedef struct replay_stats_t {
+	_Atomic uint64_t old;           /* packets dropped because they were seen before or were too old */
+	_Atomic uint64_t future;        /* packets dropped because they were too far ahead */
+} replay_stats_t;
+
+extern replay_stats_t replay_stats;
+
+/* The window tracks at least bytes * 8 sequence numbers. Zero bytes disables it. */
+extern bool replay_init(replay_window_t *w, unsigned int bytes) ATTR_WARN_UNUSED;
+extern void replay_free(replay_window_t *w);
+extern void replay_reset(replay_window_t *w);
+
+/* Check a sequence number without changing the window */
+extern replay_result_t replay_check(replay_window_t *w, uint32_t seqno);
+
+/* Check a sequence number and, if it is acceptable, mark it as received */
+extern replay_result_t replay_update(replay_window_t *w, uint32_t seqno);
+
+#endif // TINC_REPLAY_H
@@ -0,0 +1,270 @@
+#include "system.h"
+
+#include "logger.h"
+#include "net.h"
+#include "resolver.h"
+#include "splay_tree.h"
+#include "worker.h"
+#include "xalloc.h"
+
+/* Maximum number of lookups running in parallel */
+#define RESOLVER_THREADS 4
+
+typedef struct resolve_waiter_t {
+	struct resolve_waiter_t *next;
+	resolve_cb_t cb;
+	void *data;
+} resolve_waiter_t;
+
+typedef struct resolve_entry_t {
+	worker_job_t job;               /* must be first */
+
+	char *address;
+	char *service;
+	int socktype;
+	int family;
+
+	/* Only accessed by the event loop thread */
+	bool pending;
+	time_t expires;
+	resolve_waiter_t *waiters;
+
+	/* Written by the thread doing the lookup */
+	int error;
+	int syserror;
+	uint64_t usec;
+	struct addrinfo *ai;
+} resolve_entry_t;
+
+resolver_stats_t resolver_stats;
+
+static int entry_compare(const resolve_entry_t *a, const resolve_entry_t *b) {
+	int result = strcmp(a->address, b->address);
+
+	if(result) {
+		return result;
+	}
+
+	result = strcmp(a->service, b->service);
+
+	if(result) {
+		return result;
+	}
+
+	result = a->socktype - b->socktype;
+
+	if(result) {
+		return result;
+	}
+
+	return a->family - b->family;
+}
+
+static splay_tree_t entry_tree = {.compare = (splay_compare_t)entry_compare};
+
+static worker_pool_t resolver_pool = WORKER_POOL_INIT("resolver", RESOLVER_THREADS);
+
+static void free_entry(resolve_entry_t *entry) {
+	for(resolve_waiter_t *waiter = entry->waiters, *next; waiter; waiter = next) {
+		next = waiter->next;
+		free(waiter);
+	}
+
+	if(entry->ai) {
+		freeaddrinfo(entry->ai);
+	}
+
+	free(entry->address);
+	free(entry->service);
+	free(entry);
+}
+
+static void lookup(resolve_entry_t *entry, int flags) {
+	struct addrinfo hint = {
+		.ai_family = entry->family,
+		.ai_socktype = entry->socktype,
+		.ai_flags = flags,
+	};
+
+#if HAVE_DECL_RES_INIT
+
+	if(!(flags & AI_NUMERICHOST)) {
+		res_init();
+	}
+
+#endif
+	// This runs in a worker thread, the time is added to the histogram when the lookup is finished
+
+	struct timespec start;
+	histogram_start(&start);
+	entry->error = getaddrinfo(entry->address, entry->service, &hint, &entry->ai);
+	entry->syserror = entry->error == EAI_SYSTEM ? errno : 0;
+	entry->usec = histogram_elapsed(&start);
+
+	if(entry->error) {
+		entry->ai = NULL;
+	}
+}
+
+// Make the result available to callers, and tell everyone waiting for it.
+
+static void finish_entry(resolve_entry_t *entry) {
+	entry->pending = false;
+	histogram_add(&resolver_stats.duration, entry->usec);
+
+	if(entry->error) {
+		resolver_stats.failures++;
+		entry->expires = now.tv_sec + RESOLVER_NEGATIVE_TTL;
+		logger(DEBUG_ALWAYS, LOG_WARNING, "Error looking up %s port %s: %s", entry->address, entry->service, entry->error == EAI_SYSTEM ? strerror(entry->syserror) : gai_strerror(entry->error));
+	} else {
+		entry->expires = now.tv_sec + RESOLVER_POSITIVE_TTL;
+	}
+
+	// Callbacks might cancel other waiters, so unlink them one at a time
+
+	while(entry->waiters) {
+		resolve_waiter_t *waiter = entry->waiters;
+		entry->waiters = waiter->next;
+
+		resolve_cb_t cb = waiter->cb;
+		void *data = waiter->data;
+		free(waiter);
+
+		cb(data);
+	}
+}
+
+static void resolve_work(worker_job_t *job) {
+	lookup((resolve_entry_t *)job, 0);
+}
+
+static void resolve_done(worker_job_t *job) {
+	finish_entry((resolve_entry_t *)job);
+}
+
+static void resolve_discard(worker_job_t *job) {
+	free_entry((resolve_entry_t *)job);
+}
+
+static void purge_expired(void) {
+	for splay_each(resolve_entry_t, entry, &entry_tree) {
+		if(!entry->pending && entry->expires <= now.tv_sec) {
+			splay_delete_node(&entry_tree, node);
+			free_entry(entry);
+		}
+	}
+}
+
+resolve_status_t resolve_address(const char *address, const char *service, int socktype, const struct addrinfo **ai, resolve_cb_t cb, void *data) {
+	resolve_entry_t key = {
+		.address = (char *)address,
+		.service = (char *)service,
+		.socktype = socktype,
+		.family = addressfamily,
+	};
+
+	*ai = NULL;
+
+	resolve_entry_t *entry = splay_search(&entry_tree, &key);
+
+	if(entry && !entry->pending && entry->expires <= now.tv_sec) {
+		splay_delete(&entry_tree, entry);
+		free_entry(entry);
+		entry = NULL;
+	}
+
+	if(entry) {
+		resolver_stats.hits++;
+	} else {
+		resolver_stats.misses++;
+		purge_expired();
+
+		entry = xzalloc(sizeof(*entry));
+		entry->address = xstrdup(address);
+		entry->service = xstrdup(service);
+		entry->socktype = socktype;
+		entry->family = addressfamily;
+		splay_insert(&entry_tree, entry);
+
+		// Numeric addresses never block, and if there are no threads we have to do it the old way
+
+		lookup(entry, AI_NUMERICHOST);
+
+		if(entry->error) {
+			entry->job.work = resolve_work;
+			entry->job.done = resolve_done;
+			entry->job.discard = resolve_discard;
+			entry->pending = worker_submit(&resolver_pool, &entry->job);
+
+			if(!entry->pending) {
+				lookup(entry, 0);
+			}
+		}
+
+		if(!entry->pending) {
+			finish_entry(entry);
+		}
+	}
+
+	if(entry->pending) {
+		if(!cb) {
+			return RESOLVE_PENDING;
+		}
+
+		for(resolve_waiter_t *waiter = entry->waiters; waiter; waiter = waiter->next) {
+			if(waiter->cb == cb && waiter->data == data) {
+				return RESOLVE_PENDING;
+			}
+		}
+
+		resolve_waiter_t *waiter = xmalloc(sizeof(*waiter));
+		waiter->cb = cb;
+		waiter->data = data;
+		waiter->next = entry->waiters;
+		entry->waiters = waiter;
+		return RESOLVE_PENDING;
+	}
+
+	*ai = entry->ai;
+	return entry->ai ? RESOLVE_OK : RESOLVE_FAILED;
+}
+
+// Forget all callbacks for the given data, for example because it is about to be freed.
+
+void resolve_cancel(void *data) {
+	for splay_each(resolve_entry_t, entry, &entry_tree) {
+		for(resolve_waiter_t **prev = &entry->waiters, *waiter; (waiter = *prev);) {
+			if(waiter->data == data) {
+				*prev = waiter->next;
+				free(waiter);
+			} else {
+				prev = &waiter->next;
+			}
+		}
+	}
+}
+
+// Forget all results, so the next lookups go to the DNS again. Lookups in progress are not affected.
+
+void resolver_flush(void) {
+	for splay_each(resolve_entry_t, entry, &entry_tree) {
+		if(!entry->pending) {
+			splay_delete_node(&entry_tree, node);
+			free_entry(entry);
+		}
+	}
+}
+
+void resolver_exit(void) {
+	// Entries with lookups in progress belong to the pool until they are done
+
+	for splay_each(resolve_entry_t, entry, &entry_tree) {
+		splay_delete_node(&entry_tree, node);
+
+		if(!entry->pending) {
+			free_entry(entry);
+		}
+	}
+
+	worker_stop(&resolver_pool);
+}
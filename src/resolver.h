@@ -0,0 +1,41 @@
+#ifndef TINC_RESOLVER_H
+#define TINC_RESOLVER_H
+
+#include "system.h"
+
+#include "histogram.h"
+
+/* Asynchronous hostname resolution.
+
+   Lookups are done by a small pool of threads, so a slow DNS server does not
+   block the event loop. Results, including failures, are cached for a while,
+   so retrying an outgoing connection does not cause a new lookup every time. */
+
+/* Seconds to remember successful and failed lookups */
+#define RESOLVER_POSITIVE_TTL 60
+#define RESOLVER_NEGATIVE_TTL 10
+
+typedef enum resolve_status_t {
+	RESOLVE_OK,             /* *ai points to the cached result */
+	RESOLVE_FAILED,         /* the name could not be resolved */
+	RESOLVE_PENDING,        /* cb(data) will be called when the lookup has finished */
+} resolve_status_t;
+
+typedef void (*resolve_cb_t)(void *data);
+
+typedef struct resolver_stats_t {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long failures;
+	histogram_t duration;           /* time taken by lookups that were not cached */
+} resolver_stats_t;
+
+extern resolver_stats_t resolver_stats;
+
+/* The result returned in *ai stays valid until control returns to the event loop. */
+extern resolve_status_t resolve_address(const char *address, const char *service, int socktype, const struct addrinfo **ai, resolve_cb_t cb, void *data);
+extern void resolve_cancel(void *data);
+extern void resolver_flush(void);
+extern void resolver_exit(void);
+
+#endif // TINC_RESOLVER_H
@@ -20,6 +20,7 @@
 
 #include "system.h"
 
+#include "bpf.h"
 #include "connection.h"
 #include "control_common.h"
 #include "crypto.h"
@@ -32,6 +33,7 @@
 #include "protocol.h"
 #include "route.h"
 #include "subnet.h"
+#include "trace.h"
 #include "utils.h"
 
 rmode_t routing_mode = RMODE_ROUTER;
@@ -557,6 +559,8 @@ static void learn_mac(mac_t *address) {
 }
 
 static void route_broadcast(node_t *source, vpn_packet_t *packet) {
+	TRACE4(route, source->name, NULL, NULL, packet->len);
+
 	if(decrement_ttl && source != myself)
 		if(!do_decrement_ttl(source, packet)) {
 			return;
@@ -671,6 +675,7 @@ static void route_ipv4(node_t *source, vpn_packet_t *packet) {
 	}
 
 	via = (subnet->owner->via == myself) ? subnet->owner->nexthop : subnet->owner->via;
+	TRACE4(route, source->name, subnet->owner->name, via ? via->name : NULL, packet->len);
 
 	if(via == source) {
 		logger(DEBUG_TRAFFIC, LOG_ERR, "Routing loop for packet from %s (%s)!", source->name, source->hostname);
@@ -765,6 +770,7 @@ static void route_ipv6(node_t *source, vpn_packet_t *packet) {
 	}
 
 	via = (subnet->owner->via == myself) ? subnet->owner->nexthop : subnet->owner->via;
+	TRACE4(route, source->name, subnet->owner->name, via ? via->name : NULL, packet->len);
 
 	if(via == source) {
 		logger(DEBUG_TRAFFIC, LOG_ERR, "Routing loop for packet from %s (%s)!", source->name, source->hostname);
@@ -1071,6 +1077,7 @@ static void route_mac(node_t *source, vpn_packet_t *packet) {
 	// Handle packets larger than PMTU
 
 	node_t *via = (subnet->owner->via == myself) ? subnet->owner->nexthop : subnet->owner->via;
+	TRACE4(route, source->name, subnet->owner->name, via ? via->name : NULL, packet->len);
 
 	if(directonly && subnet->owner != via) {
 		return;
@@ -1106,8 +1113,30 @@ static void route_mac(node_t *source, vpn_packet_t *packet) {
 	send_packet(subnet->owner, packet);
 }
 
+/* Captures waiting to be read by a tinc pcap client are limited to this many bytes.
+   If it does not keep up, the oldest ones are dropped instead of buffering more. */
+#define PCAP_RING_SIZE (1024 * 1024)
+
+pcap_stats_t pcap_stats;
+
+static shared_buffer_t *capture_packet(const vpn_packet_t *packet, uint32_t len, const struct timeval *tv) {
+	char buffer[64 + MAXSIZE];
+	int hlen = snprintf(buffer, 64, "%d %d %u %u %ld %ld\n", CONTROL, REQ_PCAP, len, (unsigned int)packet->len, (long)tv->tv_sec, (long)tv->tv_usec);
+
+	memcpy(buffer + hlen, DATA(packet), len);
+
+	shared_buffer_t *capture = shared_buffer_alloc(0, buffer, hlen + len);
+	capture->flags = SHARED_RAW;
+	return capture;
+}
+
 static void send_pcap(vpn_packet_t *packet) {
+	shared_buffer_t *capture = NULL;
+	uint32_t caplen = 0;
+	struct timeval tv;
+
 	pcap = false;
+	gettimeofday(&tv, NULL);
 
 	for list_each(connection_t, c, &connection_list) {
 		if(!c->status.pcap) {
@@ -1115,15 +1144,44 @@ static void send_pcap(vpn_packet_t *packet) {
 		}
 
 		pcap = true;
-		int len = packet->len;
+		uint32_t len = packet->len;
+
+		if(c->pcap_filter) {
+			uint32_t result = bpf_run(c->pcap_filter, DATA(packet), packet->len);
+
+			if(!result) {
+				pcap_stats.filtered++;
+				continue;
+			}
 
-		if(c->outmaclength && c->outmaclength < len) {
+			if(result < len) {
+				len = result;
+			}
+		}
+
+		if(c->outmaclength > 0 && (uint32_t)c->outmaclength < len) {
 			len = c->outmaclength;
 		}
 
-		if(send_request(c, "%d %d %d", CONTROL, REQ_PCAP, len)) {
-			send_meta(c, DATA(packet), len);
+		// Clients that want the same part of the packet share one copy of it
+
+		if(!capture || len != caplen) {
+			if(capture) {
+				shared_buffer_unref(capture);
+			}
+
+			capture = capture_packet(packet, len, &tv);
+			caplen = len;
 		}
+
+		uint32_t dropped = send_meta_lossy(c, capture, PCAP_RING_SIZE);
+		c->outdrops += dropped;
+		pcap_stats.dropped += dropped;
+		pcap_stats.captured++;
+	}
+
+	if(capture) {
+		shared_buffer_unref(capture);
 	}
 }
 
@@ -52,6 +52,14 @@ extern bool priorityinheritance;
 extern int macexpire;
 extern bool pcap;
 
+typedef struct pcap_stats_t {
+	uint64_t captured;              /* packets queued for tinc pcap clients */
+	uint64_t filtered;              /* packets rejected by a client's filter */
+	uint64_t dropped;               /* captures dropped because a client did not read them fast enough */
+} pcap_stats_t;
+
+extern pcap_stats_t pcap_stats;
+
 extern mac_t mymac;
 
 extern void route(struct node_t *source, struct vpn_packet_t *packet);
@@ -140,6 +140,8 @@ void environment_exit(environment_t *env) {
 	free(env->entries);
 }
 
+histogram_t script_duration;
+
 bool execute_script(const char *name, environment_t *env) {
 	char scriptname[PATH_MAX];
 	char *command;
@@ -210,7 +212,10 @@ bool execute_script(const char *name, environment_t *env) {
 		xasprintf(&command, "\"%s\"", scriptname);
 	}
 
+	struct timespec start;
+	histogram_start(&start);
 	int status = system(command);
+	histogram_stop(&script_duration, &start);
 
 	free(command);
 
@@ -23,6 +23,8 @@
 
 #include "system.h"
 
+#include "histogram.h"
+
 typedef struct environment {
 	int n;
 	int size;
@@ -34,6 +36,9 @@ extern void environment_update(environment_t *env, int pos, const char *format,
 extern void environment_init(environment_t *env);
 extern void environment_exit(environment_t *env);
 
+/* How long scripts took to run */
+extern histogram_t script_duration;
+
 extern bool execute_script(const char *name, environment_t *env);
 
 #endif
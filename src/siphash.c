@@ -0,0 +1,77 @@
+#include "system.h"
+
+#include "siphash.h"
+
+static inline uint64_t rotl(uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t load64_le(const uint8_t *p) {
+	uint64_t v = 0;
+
+	for(int i = 7; i >= 0; i--) {
+		v = (v << 8) | p[i];
+	}
+
+	return v;
+}
+
+static inline void store64_le(uint8_t *p, uint64_t v) {
+	for(int i = 0; i < 8; i++) {
+		p[i] = (uint8_t)(v >> (8 * i));
+	}
+}
+
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32); \
+		v2 += v3; v3 = rotl(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = rotl(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32); \
+	} while(0)
+
+void siphash128(uint8_t out[SIPHASH128_SIZE], const void *vin, size_t inlen, const uint8_t key[SIPHASH_KEY_SIZE]) {
+	const uint8_t *in = vin;
+	const uint64_t k0 = load64_le(key);
+	const uint64_t k1 = load64_le(key + 8);
+
+	uint64_t v0 = UINT64_C(0x736f6d6570736575) ^ k0;
+	uint64_t v1 = UINT64_C(0x646f72616e646f6d) ^ k1 ^ 0xee;
+	uint64_t v2 = UINT64_C(0x6c7967656e657261) ^ k0;
+	uint64_t v3 = UINT64_C(0x7465646279746573) ^ k1;
+
+	const uint8_t *end = in + inlen - (inlen % 8);
+
+	for(; in != end; in += 8) {
+		uint64_t m = load64_le(in);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	uint64_t b = (uint64_t)inlen << 56;
+
+	for(size_t i = 0; i < inlen % 8; i++) {
+		b |= (uint64_t)in[i] << (8 * i);
+	}
+
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+
+	v2 ^= 0xee;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	store64_le(out, v0 ^ v1 ^ v2 ^ v3);
+
+	v1 ^= 0xdd;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	store64_le(out + 8, v0 ^ v1 ^ v2 ^ v3);
+}
@@ -0,0 +1,14 @@
+#ifndef TINC_SIPHASH_H
+#define TINC_SIPHASH_H
+
+#include "system.h"
+
+#define SIPHASH_KEY_SIZE 16
+#define SIPHASH128_SIZE 16
+
+/* SipHash-2-4 with 128 bits of output, as described in the reference implementation by
+   Jean-Philippe Aumasson and Daniel J. Bernstein. */
+
+extern void siphash128(uint8_t out[SIPHASH128_SIZE], const void *in, size_t inlen, const uint8_t key[SIPHASH_KEY_SIZE]);
+
+#endif // TINC_SIPHASH_H
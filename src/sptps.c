@@ -26,9 +26,36 @@
 #include "prf.h"
 #include "sptps.h"
 #include "random.h"
+#include "trace.h"
 #include "xalloc.h"
 
 unsigned int sptps_replaywin = 16;
+sptps_stats_t sptps_stats;
+
+bool (*sptps_offload)(sptps_job_t *job);
+
+// Public key operations done during a handshake. Everything is a private copy, since the session can go away while the job runs.
+struct sptps_job_t {
+	sptps_t *s;                     // NULL if the session was stopped in the mean time
+	size_t msglen;
+
+	// Verify his SIG record and compute the shared secret
+	ecdsa_t *hiskey;
+	uint8_t *hismsg;
+	uint8_t *hissig;
+	ecdh_t *ecdh;
+	uint8_t hispubkey[ECDH_SIZE];
+	bool verified;
+	bool computed;
+	uint8_t shared[ECDH_SHARED_SIZE];
+
+	// Sign our own SIG record
+	ecdsa_t *mykey;
+	uint8_t *mymsg;
+	uint8_t *mysig;
+	size_t siglen;
+	bool signed_ok;
+};
 
 /*
    Nonce MUST be exchanged first (done)
@@ -120,7 +147,9 @@ static bool send_record_priv_datagram(sptps_t *s, uint8_t type, const void *data
 
 	if(s->outstate) {
 		// If first handshake has finished, encrypt and HMAC
+		TRACE2(encrypt_start, true, len);
 		chacha_poly1305_encrypt(s->outcipher, seqno, buffer + 4, len + 1, buffer + 4, NULL);
+		TRACE2(encrypt_done, true, len);
 		return s->send_data(s->handle, type, buffer, len + 21UL);
 	} else {
 		// Otherwise send as plaintext
@@ -145,7 +174,9 @@ static bool send_record_priv(sptps_t *s, uint8_t type, const void *data, uint16_
 
 	if(s->outstate) {
 		// If first handshake has finished, encrypt and HMAC
+		TRACE2(encrypt_start, false, len);
 		chacha_poly1305_encrypt(s->outcipher, seqno, buffer + 2, len + 1, buffer + 2, NULL);
+		TRACE2(encrypt_done, false, len);
 		return s->send_data(s->handle, type, buffer, len + 19UL);
 	} else {
 		// Otherwise send as plaintext
@@ -202,23 +233,117 @@ static void fill_msg(uint8_t *msg, bool initiator, const sptps_kex_t *kex0, cons
 	memcpy(msg, s->label, s->labellen);
 }
 
-// Send a SIGnature record, containing an Ed25519 signature over both KEX records.
-static bool send_sig(sptps_t *s) {
-	// Concatenate both KEX messages, plus tag indicating if it is from the connection originator, plus label
-	size_t msglen = sigmsg_len(s->labellen);
-	uint8_t *msg = alloca(msglen);
-	fill_msg(msg, s->initiator, s->mykex, s->hiskex, s);
+static sptps_job_t *new_job(sptps_t *s) {
+	sptps_job_t *job = xzalloc(sizeof(*job));
+	job->s = s;
+	job->msglen = sigmsg_len(s->labellen);
+	return job;
+}
+
+void sptps_job_free(sptps_job_t *job) {
+	if(!job) {
+		return;
+	}
+
+	ecdsa_free(job->hiskey);
+	free(job->hismsg);
+	free(job->hissig);
+	ecdh_free(job->ecdh);
+	memzero(job->shared, sizeof(job->shared));
+	ecdsa_free(job->mykey);
+	free(job->mymsg);
+	free(job->mysig);
+	free(job);
+}
+
+// Prepare a signature over both KEX messages, plus tag indicating if it is from the connection originator, plus label.
+static void add_sign(sptps_t *s, sptps_job_t *job) {
+	job->mykey = ecdsa_copy(s->mykey);
+	job->mymsg = xmalloc(job->msglen);
+	fill_msg(job->mymsg, s->initiator, s->mykex, s->hiskex, s);
+	job->siglen = ecdsa_size(s->mykey);
+	job->mysig = xmalloc(job->siglen);
+}
+
+// Run several jobs at once. The signatures are verified together, which is faster than one at a time.
+void sptps_job_run_batch(sptps_job_t *const *jobs, size_t count) {
+	ecdsa_t **keys = alloca(count * sizeof(*keys));
+	const void **msgs = alloca(count * sizeof(*msgs));
+	const void **sigs = alloca(count * sizeof(*sigs));
+	size_t *lens = alloca(count * sizeof(*lens));
+	bool *valid = alloca(count * sizeof(*valid));
+	size_t n = 0;
+
+	for(size_t i = 0; i < count; i++) {
+		if(jobs[i]->hiskey) {
+			keys[n] = jobs[i]->hiskey;
+			msgs[n] = jobs[i]->hismsg;
+			sigs[n] = jobs[i]->hissig;
+			lens[n] = jobs[i]->msglen;
+			n++;
+		}
+	}
+
+	if(n == 1) {
+		valid[0] = ecdsa_verify(keys[0], msgs[0], lens[0], sigs[0]);
+	} else if(n) {
+		ecdsa_verify_batch(keys, msgs, lens, sigs, n, valid);
+	}
+
+	n = 0;
 
-	// Sign the result.
-	size_t siglen = ecdsa_size(s->mykey);
-	uint8_t *sig = alloca(siglen);
+	for(size_t i = 0; i < count; i++) {
+		sptps_job_t *job = jobs[i];
 
-	if(!ecdsa_sign(s->mykey, msg, msglen, sig)) {
+		if(job->hiskey) {
+			job->verified = valid[n++];
+
+			if(!job->verified) {
+				continue;
+			}
+
+			job->computed = ecdh_compute_shared(job->ecdh, job->hispubkey, job->shared);
+			job->ecdh = NULL;
+		}
+
+		if(job->mykey) {
+			job->signed_ok = ecdsa_sign(job->mykey, job->mymsg, job->msglen, job->mysig);
+		}
+	}
+}
+
+void sptps_job_run(sptps_job_t *job) {
+	sptps_job_run_batch(&job, 1);
+}
+
+static bool finish_job(sptps_t *s, sptps_job_t *job);
+
+// Run a job in the background if possible. The session is suspended until it has finished.
+static bool run_job(sptps_t *s, sptps_job_t *job) {
+	if(sptps_offload && sptps_offload(job)) {
+		s->job = job;
+		return true;
+	}
+
+	sptps_job_run(job);
+	bool result = finish_job(s, job);
+	sptps_job_free(job);
+	return result;
+}
+
+// Send a SIGnature record, containing an Ed25519 signature over both KEX records.
+static bool send_sig_record(sptps_t *s, const sptps_job_t *job) {
+	if(!job->signed_ok) {
 		return error(s, EINVAL, "Failed to sign SIG record");
 	}
 
-	// Send the SIG exchange record.
-	return send_record_priv(s, SPTPS_HANDSHAKE, sig, siglen);
+	return send_record_priv(s, SPTPS_HANDSHAKE, job->mysig, job->siglen);
+}
+
+static bool send_sig(sptps_t *s) {
+	sptps_job_t *job = new_job(s);
+	add_sign(s, job);
+	return run_job(s, job);
 }
 
 // Generate key material from the shared secret created from the ECDHE key exchange.
@@ -320,35 +445,43 @@ static bool receive_sig(sptps_t *s, const uint8_t *data, uint16_t len) {
 		return error(s, EIO, "Invalid KEX record length");
 	}
 
+	sptps_job_t *job = new_job(s);
+
 	// Concatenate both KEX messages, plus tag indicating if it is from the connection originator
-	const size_t msglen = sigmsg_len(s->labellen);
-	uint8_t *msg = alloca(msglen);
-	fill_msg(msg, !s->initiator, s->hiskex, s->mykex, s);
+	job->hiskey = ecdsa_copy(s->hiskey);
+	job->hismsg = xmalloc(job->msglen);
+	fill_msg(job->hismsg, !s->initiator, s->hiskex, s->mykex, s);
+	job->hissig = xmalloc(len);
+	memcpy(job->hissig, data, len);
 
-	// Verify signature.
-	if(!ecdsa_verify(s->hiskey, msg, msglen, data)) {
-		return error(s, EIO, "Failed to verify SIG record");
+	job->ecdh = s->ecdh;
+	s->ecdh = NULL;
+	memcpy(job->hispubkey, s->hiskex->pubkey, ECDH_SIZE);
+
+	// The responder sends its own SIG record right after verifying the initiator's
+	if(!s->initiator) {
+		add_sign(s, job);
 	}
 
-	// Compute shared secret.
-	uint8_t shared[ECDH_SHARED_SIZE];
+	return run_job(s, job);
+}
 
-	if(!ecdh_compute_shared(s->ecdh, s->hiskex->pubkey, shared)) {
-		memzero(shared, sizeof(shared));
-		return error(s, EINVAL, "Failed to compute ECDH shared secret");
+// Continue after his SIG record has been checked.
+static bool finish_sig(sptps_t *s, sptps_job_t *job) {
+	if(!job->verified) {
+		return error(s, EIO, "Failed to verify SIG record");
 	}
 
-	s->ecdh = NULL;
+	if(!job->computed) {
+		return error(s, EINVAL, "Failed to compute ECDH shared secret");
+	}
 
 	// Generate key material from shared secret.
-	bool generated = generate_key_material(s, shared, sizeof(shared));
-	memzero(shared, sizeof(shared));
-
-	if(!generated) {
+	if(!generate_key_material(s, job->shared, sizeof(job->shared))) {
 		return false;
 	}
 
-	if(!s->initiator && !send_sig(s)) {
+	if(!s->initiator && !send_sig_record(s, job)) {
 		return false;
 	}
 
@@ -370,9 +503,31 @@ static bool receive_sig(sptps_t *s, const uint8_t *data, uint16_t len) {
 		return error(s, EINVAL, "Failed to set key");
 	}
 
+	if(s->outstate) {
+		s->state = SPTPS_ACK;
+	} else {
+		s->outstate = true;
+
+		if(!receive_ack(s, NULL, 0)) {
+			return false;
+		}
+
+		sptps_stats.handshakes++;
+		s->receive_record(s->handle, SPTPS_HANDSHAKE, NULL, 0);
+		s->state = SPTPS_SECONDARY_KEX;
+	}
+
 	return true;
 }
 
+static bool finish_job(sptps_t *s, sptps_job_t *job) {
+	if(job->hiskey) {
+		return finish_sig(s, job);
+	} else {
+		return send_sig_record(s, job);
+	}
+}
+
 // Force another Key EXchange (for testing purposes).
 bool sptps_force_kex(sptps_t *s) {
 	if(!s->outstate || s->state != SPTPS_SECONDARY_KEX) {
@@ -408,24 +563,7 @@ static bool receive_handshake(sptps_t *s, const uint8_t *data, uint16_t len) {
 	case SPTPS_SIG:
 
 		// If we already sent our secondary public ECDH key, we expect the peer to send his.
-		if(!receive_sig(s, data, len)) {
-			return false;
-		}
-
-		if(s->outstate) {
-			s->state = SPTPS_ACK;
-		} else {
-			s->outstate = true;
-
-			if(!receive_ack(s, NULL, 0)) {
-				return false;
-			}
-
-			s->receive_record(s->handle, SPTPS_HANDSHAKE, NULL, 0);
-			s->state = SPTPS_SECONDARY_KEX;
-		}
-
-		return true;
+		return receive_sig(s, data, len);
 
 	case SPTPS_ACK:
 
@@ -434,6 +572,7 @@ static bool receive_handshake(sptps_t *s, const uint8_t *data, uint16_t len) {
 			return false;
 		}
 
+		sptps_stats.handshakes++;
 		s->receive_record(s->handle, SPTPS_HANDSHAKE, NULL, 0);
 		s->state = SPTPS_SECONDARY_KEX;
 		return true;
@@ -448,58 +587,36 @@ static bool sptps_check_seqno(sptps_t *s, uint32_t seqno, bool update_state) {
 	// Replay protection using a sliding window of configurable size.
 	// s->inseqno is expected sequence number
 	// seqno is received sequence number
-	// s->late[] is a circular buffer, a 1 bit means a packet has not been received yet
-	// The circular buffer contains bits for sequence numbers from s->inseqno - s->replaywin * 8 to (but excluding) s->inseqno.
-	if(s->replaywin) {
-		if(seqno != s->inseqno) {
-			if(seqno >= s->inseqno + s->replaywin * 8) {
-				// Prevent packets that jump far ahead of the queue from causing many others to be dropped.
-				bool farfuture = s->farfuture < s->replaywin >> 2;
-
-				if(update_state) {
-					s->farfuture++;
-				}
-
-				if(farfuture) {
-					return update_state ? error(s, EIO, "Packet is %d seqs in the future, dropped (%u)\n", seqno - s->inseqno, s->farfuture) : false;
-				}
-
-				// Unless we have seen lots of them, in which case we consider the others lost.
-				if(update_state) {
-					warning(s, "Lost %d packets\n", seqno - s->inseqno);
-				}
-
-				if(update_state) {
-					// Mark all packets in the replay window as being late.
-					memset(s->late, 255, s->replaywin);
-				}
-			} else if(seqno < s->inseqno) {
-				// If the sequence number is farther in the past than the bitmap goes, or if the packet was already received, drop it.
-				if((s->inseqno >= s->replaywin * 8 && seqno < s->inseqno - s->replaywin * 8) || !(s->late[(seqno / 8) % s->replaywin] & (1 << seqno % 8))) {
-					return update_state ? error(s, EIO, "Received late or replayed packet, seqno %d, last received %d\n", seqno, s->inseqno) : false;
-				}
-			} else if(update_state) {
-				// We missed some packets. Mark them in the bitmap as being late.
-				for(uint32_t i = s->inseqno; i < seqno; i++) {
-					s->late[(i / 8) % s->replaywin] |= 1 << i % 8;
-				}
-			}
-		}
+	switch(update_state ? replay_update(&s->replay, seqno) : replay_check(&s->replay, seqno)) {
+	case REPLAY_OK:
+		break;
 
+	case REPLAY_OLD:
+		return update_state ? error(s, EIO, "Received late or replayed packet, seqno %d, last received %d\n", seqno, s->inseqno) : false;
+
+	case REPLAY_FUTURE:
+		return update_state ? error(s, EIO, "Packet is %d seqs in the future, dropped (%u)\n", seqno - s->inseqno, (unsigned int)s->replay.farfuture) : false;
+
+	case REPLAY_JUMP:
 		if(update_state) {
-			// Mark the current packet as not being late.
-			s->late[(seqno / 8) % s->replaywin] &= ~(1 << seqno % 8);
-			s->farfuture = 0;
+			warning(s, "Lost %d packets\n", seqno - s->inseqno);
 		}
+
+		break;
 	}
 
 	if(update_state) {
-		if(seqno >= s->inseqno) {
+		// Sequence numbers wrap around in long sessions
+		if((int32_t)(seqno - s->inseqno) >= 0) {
+			s->lost += seqno - s->inseqno;
 			s->inseqno = seqno + 1;
+		} else if(s->lost) {
+			s->lost--; // one of the packets we skipped arrived late
 		}
 
 		if(!s->inseqno) {
 			s->received = 0;
+			s->lost = 0;
 		} else {
 			s->received++;
 		}
@@ -562,7 +679,11 @@ static bool sptps_receive_data_datagram(sptps_t *s, const uint8_t *data, size_t
 	uint8_t *buffer = alloca(len);
 	size_t outlen;
 
-	if(!chacha_poly1305_decrypt(s->incipher, seqno, data, len, buffer, &outlen)) {
+	TRACE2(decrypt_start, true, len);
+	bool decrypted = chacha_poly1305_decrypt(s->incipher, seqno, data, len, buffer, &outlen);
+	TRACE2(decrypt_done, true, decrypted);
+
+	if(!decrypted) {
 		return error(s, EIO, "Failed to decrypt and verify packet");
 	}
 
@@ -589,6 +710,7 @@ static bool sptps_receive_data_datagram(sptps_t *s, const uint8_t *data, size_t
 		}
 	} else if(type == SPTPS_HANDSHAKE) {
 		if(!receive_handshake(s, data, len)) {
+			sptps_stats.handshake_failures++;
 			return false;
 		}
 	} else {
@@ -598,6 +720,97 @@ static bool sptps_receive_data_datagram(sptps_t *s, const uint8_t *data, size_t
 	return true;
 }
 
+// Keep data received while a job is running. Datagrams are stored with their length in front.
+static bool suspend(sptps_t *s, const uint8_t *data, size_t len) {
+	size_t needed = len + (s->datagram ? sizeof(uint32_t) : 0);
+
+	if(s->suspendedlen + needed > SPTPS_SUSPEND_MAX) {
+		return error(s, ENOBUFS, "Too much data received during handshake");
+	}
+
+	s->suspended = xrealloc(s->suspended, s->suspendedlen + needed);
+	uint8_t *p = s->suspended + s->suspendedlen;
+
+	if(s->datagram) {
+		uint32_t len32 = len;
+		memcpy(p, &len32, sizeof(len32));
+		p += sizeof(len32);
+	}
+
+	memcpy(p, data, len);
+	s->suspendedlen += needed;
+	return true;
+}
+
+// Process data that was received while a job was running, until another job is started.
+static bool resume(sptps_t *s) {
+	uint8_t *data = s->suspended;
+	size_t len = s->suspendedlen;
+	size_t pos = 0;
+
+	s->suspended = NULL;
+	s->suspendedlen = 0;
+
+	while(pos < len && !s->job) {
+		if(s->datagram) {
+			uint32_t len32;
+			memcpy(&len32, data + pos, sizeof(len32));
+			pos += sizeof(len32);
+
+			// A datagram that can't be handled is just dropped, unless it was part of the first handshake
+			if(!sptps_receive_data(s, data + pos, len32) && !s->instate) {
+				free(data);
+				return false;
+			}
+
+			pos += len32;
+		} else {
+			size_t done = sptps_receive_data(s, data + pos, len - pos);
+
+			if(!done) {
+				free(data);
+				return false;
+			}
+
+			pos += done;
+		}
+	}
+
+	// Nothing can have been added in the mean time, a record that starts a job is always the last one handled
+	if(pos < len) {
+		memmove(data, data + pos, len - pos);
+		s->suspended = data;
+		s->suspendedlen = len - pos;
+	} else {
+		free(data);
+	}
+
+	return true;
+}
+
+void sptps_job_finish(sptps_job_t *job) {
+	sptps_t *s = job->s;
+
+	// The session was stopped or restarted while the job was running
+	if(!s || s->job != job) {
+		sptps_job_free(job);
+		return;
+	}
+
+	s->job = NULL;
+	bool result = finish_job(s, job);
+	sptps_job_free(job);
+
+	if(result) {
+		result = resume(s);
+	}
+
+	if(!result) {
+		sptps_stats.handshake_failures++;
+		s->receive_record(s->handle, SPTPS_ALERT, NULL, 0);
+	}
+}
+
 // Receive incoming data. Check if it contains a complete record, if so, handle it.
 size_t sptps_receive_data(sptps_t *s, const void *vdata, size_t len) {
 	const uint8_t *data = vdata;
@@ -607,6 +820,10 @@ size_t sptps_receive_data(sptps_t *s, const void *vdata, size_t len) {
 		return error(s, EIO, "Invalid session state zero");
 	}
 
+	if(s->job) {
+		return suspend(s, data, len) ? len : false;
+	}
+
 	if(s->datagram) {
 		return sptps_receive_data_datagram(s, data, len) ? len : false;
 	}
@@ -671,7 +888,11 @@ size_t sptps_receive_data(sptps_t *s, const void *vdata, size_t len) {
 
 	// Check HMAC and decrypt.
 	if(s->instate) {
-		if(!chacha_poly1305_decrypt(s->incipher, seqno, s->inbuf + 2UL, s->reclen + 17UL, s->inbuf + 2UL, NULL)) {
+		TRACE2(decrypt_start, false, s->reclen);
+		bool decrypted = chacha_poly1305_decrypt(s->incipher, seqno, s->inbuf + 2UL, s->reclen + 17UL, s->inbuf + 2UL, NULL);
+		TRACE2(decrypt_done, false, decrypted);
+
+		if(!decrypted) {
 			return error(s, EINVAL, "Failed to decrypt and verify record");
 		}
 	}
@@ -691,6 +912,7 @@ size_t sptps_receive_data(sptps_t *s, const void *vdata, size_t len) {
 		}
 	} else if(type == SPTPS_HANDSHAKE) {
 		if(!receive_handshake(s, s->inbuf + 3, s->reclen)) {
+			sptps_stats.handshake_failures++;
 			return false;
 		}
 	} else {
@@ -712,16 +934,11 @@ bool sptps_start(sptps_t *s, void *handle, bool initiator, bool datagram, ecdsa_
 	s->datagram = datagram;
 	s->mykey = mykey;
 	s->hiskey = hiskey;
-	s->replaywin = sptps_replaywin;
 
-	if(s->replaywin) {
-		s->late = malloc(s->replaywin);
-
-		if(!s->late) {
-			return error(s, errno, strerror(errno));
-		}
+	// Only datagrams can arrive out of order
 
-		memset(s->late, 0, s->replaywin);
+	if(!replay_init(&s->replay, datagram ? sptps_replaywin : 0)) {
+		return error(s, errno, strerror(errno));
 	}
 
 	s->label = malloc(labellen);
@@ -753,7 +970,13 @@ bool sptps_start(sptps_t *s, void *handle, bool initiator, bool datagram, ecdsa_
 
 // Stop a SPTPS session.
 bool sptps_stop(sptps_t *s) {
+	// A job that is still running will be freed when it has finished
+	if(s->job) {
+		s->job->s = NULL;
+	}
+
 	// Clean up any resources.
+	free(s->suspended);
 	chacha_poly1305_exit(s->incipher);
 	chacha_poly1305_exit(s->outcipher);
 	ecdh_free(s->ecdh);
@@ -762,7 +985,7 @@ bool sptps_stop(sptps_t *s) {
 	free_sptps_kex(s->hiskex);
 	free_sptps_key(s->key);
 	free(s->label);
-	free(s->late);
+	replay_free(&s->replay);
 	memset(s, 0, sizeof(*s));
 	return true;
 }
@@ -25,6 +25,7 @@
 #include "chacha-poly1305/chacha-poly1305.h"
 #include "ecdh.h"
 #include "ecdsa.h"
+#include "replay.h"
 
 #define SPTPS_VERSION 0
 
@@ -67,6 +68,8 @@ typedef union sptps_key_t {
 
 STATIC_ASSERT(sizeof(sptps_key_t) == 128, "sptps_key_t has invalid size");
 
+typedef struct sptps_job_t sptps_job_t;
+
 typedef struct sptps {
 	bool initiator;
 	bool datagram;
@@ -80,9 +83,8 @@ typedef struct sptps {
 	chacha_poly1305_ctx_t *incipher;
 	uint32_t inseqno;
 	uint32_t received;
-	unsigned int replaywin;
-	unsigned int farfuture;
-	uint8_t *late;
+	uint32_t lost;
+	replay_window_t replay;
 
 	bool outstate;
 	chacha_poly1305_ctx_t *outcipher;
@@ -101,8 +103,37 @@ typedef struct sptps {
 	void *handle;
 	send_data_t send_data;
 	receive_record_t receive_record;
+
+	sptps_job_t *job;               // handshake operation running in the background
+	uint8_t *suspended;             // data received while the job is running
+	size_t suspendedlen;
 } sptps_t;
 
+/* Public key operations during the handshake can be run in the background by
+   setting sptps_offload. It should arrange for sptps_job_run() to be called in
+   another thread, and then for sptps_job_finish() to be called in the thread
+   that owns the session, or sptps_job_free() if the result is not needed
+   anymore. If it returns false, the job is run immediately instead.
+
+   While a job is running, the session buffers received data, and processes it
+   after the job has finished. If that fails, receive_record() is called with
+   type SPTPS_ALERT, and the session should be stopped. */
+
+#define SPTPS_SUSPEND_MAX (4 * 1024 * 1024)
+
+typedef struct sptps_stats_t {
+	uint64_t handshakes;            /* handshakes and key renegotiations that completed */
+	uint64_t handshake_failures;    /* handshake records that could not be processed */
+} sptps_stats_t;
+
+extern sptps_stats_t sptps_stats;
+
+extern bool (*sptps_offload)(sptps_job_t *job);
+extern void sptps_job_run(sptps_job_t *job);
+extern void sptps_job_run_batch(sptps_job_t *const *jobs, size_t count);
+extern void sptps_job_finish(sptps_job_t *job);
+extern void sptps_job_free(sptps_job_t *job);
+
 extern unsigned int sptps_replaywin;
 extern void sptps_log_quiet(sptps_t *s, int s_errno, const char *format, va_list ap);
 extern void sptps_log_stderr(sptps_t *s, int s_errno, const char *format, va_list ap);
@@ -81,6 +81,8 @@ static void receive_data(sptps_t *sptps) {
 	}
 }
 
+#define BATCH_SIZE 16
+
 struct timespec start;
 struct timespec end;
 double elapsed;
@@ -116,6 +118,8 @@ static int run_benchmark(int argc, char *argv[]) {
 	randomize(buf2, sizeof(buf2));
 	randomize(buf3, sizeof(buf3));
 
+	fprintf(stderr, "Using %s\n", ecdsa_implementation());
+
 	// Key generation
 
 	fprintf(stderr, "Generating keys for %lg seconds: ", duration);
@@ -150,6 +154,35 @@ static int run_benchmark(int argc, char *argv[]) {
 
 	fprintf(stderr, "%18.2lf op/s\n", rate);
 
+	// Batches of signatures from different messages
+
+	ecdsa_t *batch_keys[BATCH_SIZE];
+	const void *batch_msgs[BATCH_SIZE];
+	const void *batch_sigs[BATCH_SIZE];
+	size_t batch_lens[BATCH_SIZE];
+	bool batch_valid[BATCH_SIZE];
+
+	for(int i = 0; i < BATCH_SIZE; i++) {
+		batch_keys[i] = key1;
+		batch_msgs[i] = buf1 + 64 * i;
+		batch_sigs[i] = buf3 + 64 * i;
+		batch_lens[i] = 256;
+
+		if(!ecdsa_sign(key1, batch_msgs[i], batch_lens[i], buf3 + 64 * i)) {
+			return 1;
+		}
+	}
+
+	fprintf(stderr, "Ed25519 batch verify for %lg seconds: ", duration);
+
+	for(clock_start(); clock_countto(duration);)
+		if(!ecdsa_verify_batch(batch_keys, batch_msgs, batch_lens, batch_sigs, BATCH_SIZE, batch_valid)) {
+			fprintf(stderr, "Signature verification failed\n");
+			return 1;
+		}
+
+	fprintf(stderr, "%12.2lf op/s\n", rate * BATCH_SIZE);
+
 	ecdh1 = ecdh_generate_public(buf1);
 	fprintf(stderr, "ECDH for %lg seconds: ", duration);
 
@@ -0,0 +1,279 @@
+#include "system.h"
+
+#include "stats_shm.h"
+#include "xalloc.h"
+
+#define HEADER_SIZE sizeof(stats_shm_header_t)
+#define NODE_SIZE sizeof(stats_shm_node_t)
+
+/* How often a reader tries to get a consistent copy of a slot before giving up,
+   in case tincd died while it was updating it */
+#define READ_ATTEMPTS 1000
+
+#ifdef HAVE_SYS_MMAN_H
+
+static size_t file_size(uint32_t capacity) {
+	return HEADER_SIZE + (size_t)capacity * NODE_SIZE;
+}
+
+static stats_shm_node_t *get_node(const stats_shm_t *shm, uint32_t index) {
+	return (stats_shm_node_t *)((char *)shm->header + shm->header->header_size + (size_t)index * shm->header->node_size);
+}
+
+static bool map(stats_shm_t *shm, size_t size) {
+	int prot = shm->writer ? PROT_READ | PROT_WRITE : PROT_READ;
+	void *addr = mmap(NULL, size, prot, MAP_SHARED, shm->fd, 0);
+
+	if(addr == MAP_FAILED) {
+		return false;
+	}
+
+	if(shm->header) {
+		munmap(shm->header, shm->size);
+	}
+
+	shm->header = addr;
+	shm->size = size;
+	return true;
+}
+
+bool stats_shm_create(stats_shm_t *shm, const char *path) {
+	memset(shm, 0, sizeof(*shm));
+	shm->writer = true;
+
+	// Readers that still have the old file open will see that it was closed
+
+	int oldfd = open(path, O_RDWR);
+
+	if(oldfd >= 0) {
+		stats_shm_header_t header;
+
+		if(read(oldfd, &header, sizeof(header)) == sizeof(header) && header.magic == STATS_SHM_MAGIC) {
+			uint32_t closed = 1;
+			ssize_t result = pwrite(oldfd, &closed, sizeof(closed), offsetof(stats_shm_header_t, closed));
+			(void)result;
+		}
+
+		close(oldfd);
+	}
+
+	unlink(path);
+
+	shm->fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+	if(shm->fd < 0) {
+		shm->writer = false;
+		return false;
+	}
+
+	uint32_t capacity = 64;
+
+	if(ftruncate(shm->fd, (off_t)file_size(capacity)) || !map(shm, file_size(capacity))) {
+		close(shm->fd);
+		unlink(path);
+		memset(shm, 0, sizeof(*shm));
+		return false;
+	}
+
+	stats_shm_header_t *header = shm->header;
+	header->magic = STATS_SHM_MAGIC;
+	header->version = STATS_SHM_VERSION;
+	header->header_size = HEADER_SIZE;
+	header->node_size = NODE_SIZE;
+	header->pid = (uint32_t)getpid();
+	atomic_store(&header->capacity, capacity);
+
+	shm->path = xstrdup(path);
+	return true;
+}
+
+bool stats_shm_resize(stats_shm_t *shm, uint32_t count) {
+	if(!shm->header || !shm->writer) {
+		return false;
+	}
+
+	uint32_t capacity = atomic_load_explicit(&shm->header->capacity, memory_order_relaxed);
+
+	if(count > capacity) {
+		while(capacity < count) {
+			capacity *= 2;
+		}
+
+		if(ftruncate(shm->fd, (off_t)file_size(capacity)) || !map(shm, file_size(capacity))) {
+			return false;
+		}
+
+		atomic_store_explicit(&shm->header->capacity, capacity, memory_order_release);
+	}
+
+	atomic_store_explicit(&shm->header->count, count, memory_order_release);
+	atomic_store_explicit(&shm->header->updated, (int64_t)time(NULL), memory_order_relaxed);
+	return true;
+}
+
+stats_shm_data_t *stats_shm_write_begin(stats_shm_t *shm, uint32_t index) {
+	stats_shm_node_t *node = get_node(shm, index);
+	uint32_t seqno = atomic_load_explicit(&node->seqno, memory_order_relaxed);
+	atomic_store_explicit(&node->seqno, seqno + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	return &node->data;
+}
+
+void stats_shm_write_end(stats_shm_t *shm, uint32_t index) {
+	stats_shm_node_t *node = get_node(shm, index);
+	uint32_t seqno = atomic_load_explicit(&node->seqno, memory_order_relaxed);
+	atomic_store_explicit(&node->seqno, seqno + 1, memory_order_release);
+}
+
+bool stats_shm_open(stats_shm_t *shm, const char *path) {
+	memset(shm, 0, sizeof(*shm));
+	shm->fd = open(path, O_RDONLY);
+
+	if(shm->fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+
+	if(fstat(shm->fd, &st) || (size_t)st.st_size < HEADER_SIZE || !map(shm, (size_t)st.st_size)) {
+		close(shm->fd);
+		memset(shm, 0, sizeof(*shm));
+		return false;
+	}
+
+	const stats_shm_header_t *header = shm->header;
+
+	if(header->magic != STATS_SHM_MAGIC || header->version != STATS_SHM_VERSION
+	                || header->header_size < HEADER_SIZE || header->node_size < NODE_SIZE
+	                || atomic_load(&header->closed)) {
+		stats_shm_close(shm);
+		return false;
+	}
+
+	// A tincd that crashed could not mark its file closed
+
+	if(kill((pid_t)header->pid, 0) && errno == ESRCH) {
+		stats_shm_close(shm);
+		return false;
+	}
+
+	return true;
+}
+
+uint32_t stats_shm_count(stats_shm_t *shm) {
+	if(!shm->header || atomic_load_explicit(&shm->header->closed, memory_order_relaxed)) {
+		return 0;
+	}
+
+	return atomic_load_explicit(&shm->header->count, memory_order_acquire);
+}
+
+bool stats_shm_read(stats_shm_t *shm, uint32_t index, stats_shm_data_t *data) {
+	if(!shm->header || index >= atomic_load_explicit(&shm->header->count, memory_order_acquire)) {
+		return false;
+	}
+
+	// Follow the file if it has grown since we mapped it
+
+	size_t needed = shm->header->header_size + ((size_t)index + 1) * shm->header->node_size;
+
+	if(needed > shm->size) {
+		struct stat st;
+
+		if(fstat(shm->fd, &st) || (size_t)st.st_size < needed || !map(shm, (size_t)st.st_size)) {
+			return false;
+		}
+	}
+
+	const stats_shm_node_t *node = get_node(shm, index);
+
+	for(int attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+		uint32_t before = atomic_load_explicit(&node->seqno, memory_order_acquire);
+
+		if(before & 1) {
+			continue;
+		}
+
+		memcpy(data, &node->data, sizeof(*data));
+		atomic_thread_fence(memory_order_acquire);
+
+		if(atomic_load_explicit(&node->seqno, memory_order_relaxed) == before) {
+			data->name[sizeof(data->name) - 1] = 0;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void stats_shm_close(stats_shm_t *shm) {
+	if(!shm->header) {
+		return;
+	}
+
+	if(shm->writer) {
+		atomic_store(&shm->header->closed, 1);
+
+		// Only remove the file if it has not been replaced by another tincd
+
+		struct stat ours, current;
+
+		if(!fstat(shm->fd, &ours) && !stat(shm->path, &current) && ours.st_dev == current.st_dev && ours.st_ino == current.st_ino) {
+			unlink(shm->path);
+		}
+	}
+
+	munmap(shm->header, shm->size);
+	close(shm->fd);
+	free(shm->path);
+	memset(shm, 0, sizeof(*shm));
+}
+
+#else
+
+bool stats_shm_create(stats_shm_t *shm, const char *path) {
+	(void)path;
+	memset(shm, 0, sizeof(*shm));
+	return false;
+}
+
+bool stats_shm_resize(stats_shm_t *shm, uint32_t count) {
+	(void)shm;
+	(void)count;
+	return false;
+}
+
+stats_shm_data_t *stats_shm_write_begin(stats_shm_t *shm, uint32_t index) {
+	(void)shm;
+	(void)index;
+	abort();
+}
+
+void stats_shm_write_end(stats_shm_t *shm, uint32_t index) {
+	(void)shm;
+	(void)index;
+}
+
+bool stats_shm_open(stats_shm_t *shm, const char *path) {
+	(void)path;
+	memset(shm, 0, sizeof(*shm));
+	return false;
+}
+
+uint32_t stats_shm_count(stats_shm_t *shm) {
+	(void)shm;
+	return 0;
+}
+
+bool stats_shm_read(stats_shm_t *shm, uint32_t index, stats_shm_data_t *data) {
+	(void)shm;
+	(void)index;
+	(void)data;
+	return false;
+}
+
+void stats_shm_close(stats_shm_t *shm) {
+	(void)shm;
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef TINC_STATS_SHM_H
+#define TINC_STATS_SHM_H
+
+#include "system.h"
+
+#include <stdatomic.h>
+
+/* A file that tincd maps into memory and regularly updates with statistics
+   about every node, so monitoring tools can read them without asking tincd.
+   Each node slot is protected by a sequence lock: tincd makes its sequence
+   number odd while updating the slot, and readers retry if the number was odd
+   or changed while they copied the slot. The file only grows while tincd runs.
+   When tincd stops or replaces the file, it marks it closed. */
+
+#define STATS_SHM_MAGIC 0x54494e43      /* "TINC" */
+#define STATS_SHM_VERSION 1
+#define STATS_SHM_NAME_SIZE 128         /* longer node names are truncated */
+
+typedef struct stats_shm_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;           /* offset of the first node slot */
+	uint32_t node_size;             /* size of a node slot */
+	_Atomic uint32_t capacity;      /* number of slots the file has room for */
+	_Atomic uint32_t count;         /* number of slots in use */
+	_Atomic uint32_t closed;        /* set when tincd no longer updates this file */
+	uint32_t pid;                   /* process ID of the tincd writing this file */
+	_Atomic int64_t updated;        /* time of the last update, in seconds since the epoch */
+	uint8_t reserved[24];
+} stats_shm_header_t;
+
+typedef struct stats_shm_data_t {
+	uint64_t in_packets;
+	uint64_t in_bytes;
+	uint64_t out_packets;
+	uint64_t out_bytes;
+	int32_t udp_ping_rtt;           /* in microseconds, -1 if unknown */
+	uint32_t status;                /* node_status_t */
+	uint16_t mtu;
+	uint16_t minmtu;
+	uint16_t maxmtu;
+	uint16_t reserved;
+	char name[STATS_SHM_NAME_SIZE];
+	int32_t srtt;                   /* smoothed round trip time in microseconds, -1 if unknown */
+	int32_t jitter;                 /* in microseconds */
+	uint32_t loss;                  /* in parts per million */
+	uint32_t reserved2;
+} stats_shm_data_t;
+
+typedef struct stats_shm_node_t {
+	_Atomic uint32_t seqno;         /* odd while the slot is being updated */
+	uint32_t reserved;
+	stats_shm_data_t data;
+} stats_shm_node_t;
+
+/* All zeroes if not open */
+typedef struct stats_shm_t {
+	int fd;
+	bool writer;
+	char *path;
+	size_t size;
+	stats_shm_header_t *header;     /* NULL if not open */
+} stats_shm_t;
+
+/* Create a new statistics file for writing, replacing any existing one */
+extern bool stats_shm_create(stats_shm_t *shm, const char *path);
+
+/* Make room for count slots, and mark that many as in use */
+extern bool stats_shm_resize(stats_shm_t *shm, uint32_t count);
+
+/* Update a slot. Between these calls, the returned data may be changed freely. */
+extern stats_shm_data_t *stats_shm_write_begin(stats_shm_t *shm, uint32_t index);
+extern void stats_shm_write_end(stats_shm_t *shm, uint32_t index);
+
+/* Open an existing statistics file for reading. Fails if tincd has closed it. */
+extern bool stats_shm_open(stats_shm_t *shm, const char *path);
+
+/* Number of slots in use, or 0 if the file was closed */
+extern uint32_t stats_shm_count(stats_shm_t *shm);
+
+/* Get a consistent copy of a slot */
+extern bool stats_shm_read(stats_shm_t *shm, uint32_t index, stats_shm_data_t *data);
+
+/* Close the file. If we were writing it, mark it closed and remove it. */
+extern void stats_shm_close(stats_shm_t *shm);
+
+#endif // TINC_STATS_SHM_H
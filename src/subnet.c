@@ -23,6 +23,8 @@
 #include "splay_tree.h"
 #include "control_common.h"
 #include "crypto.h"
+#include "dump.h"
+#include "events.h"
 #include "hash.h"
 #include "logger.h"
 #include "net.h"
@@ -111,6 +113,8 @@ hash_new(ipv4_t, ipv4_cache);
 hash_new(ipv6_t, ipv6_cache);
 hash_new(mac_t, mac_cache);
 
+subnet_cache_stats_t subnet_cache_stats;
+
 
 void subnet_cache_flush_table(subnet_type_t stype) {
 	// NOTE: a subnet type of SUBNET_TYPES can be used to clear all hash tables
@@ -224,9 +228,12 @@ subnet_t *lookup_subnet_mac(const node_t *owner, const mac_t *address) {
 	// Check if this address is cached
 
 	if((r = hash_search(mac_t, &mac_cache, address))) {
+		subnet_cache_stats.hits++;
 		return r;
 	}
 
+	subnet_cache_stats.misses++;
+
 	// Search all subnets for a matching one
 
 	for splay_each(subnet_t, p, owner ? &owner->subnet_tree : &subnet_tree) {
@@ -258,9 +265,12 @@ subnet_t *lookup_subnet_ipv4(const ipv4_t *address) {
 	// Check if this address is cached
 
 	if((r = hash_search(ipv4_t, &ipv4_cache, address))) {
+		subnet_cache_stats.hits++;
 		return r;
 	}
 
+	subnet_cache_stats.misses++;
+
 	// Search all subnets for a matching one
 
 	for splay_each(subnet_t, p, &subnet_tree) {
@@ -292,9 +302,12 @@ subnet_t *lookup_subnet_ipv6(const ipv6_t *address) {
 	// Check if this address is cached
 
 	if((r = hash_search(ipv6_t, &ipv6_cache, address))) {
+		subnet_cache_stats.hits++;
 		return r;
 	}
 
+	subnet_cache_stats.misses++;
+
 	// Search all subnets for a matching one
 
 	for splay_each(subnet_t, p, &subnet_tree) {
@@ -350,6 +363,8 @@ void subnet_update(node_t *owner, subnet_t *subnet, bool up) {
 				continue;
 			}
 
+			event_subnet(owner, netstr, up);
+
 			// Strip the weight from the subnet, and put it in its own environment variable
 			char *weight = strchr(netstr, '#');
 
@@ -367,6 +382,8 @@ void subnet_update(node_t *owner, subnet_t *subnet, bool up) {
 		}
 	} else {
 		if(net2str(netstr, sizeof(netstr), subnet)) {
+			event_subnet(owner, netstr, up);
+
 			// Strip the weight from the subnet, and put it in its own environment variable
 			char *weight = strchr(netstr, '#');
 
@@ -387,18 +404,55 @@ void subnet_update(node_t *owner, subnet_t *subnet, bool up) {
 	environment_exit(&env);
 }
 
-bool dump_subnets(connection_t *c) {
-	for splay_each(subnet_t, subnet, &subnet_tree) {
-		char netstr[MAXNETSTR];
+static void dump_subnet(connection_t *c, const subnet_t *subnet) {
+	char netstr[MAXNETSTR];
 
-		if(!net2str(netstr, sizeof(netstr), subnet)) {
-			continue;
-		}
+	if(!net2str(netstr, sizeof(netstr), subnet)) {
+		return;
+	}
 
+	if(!dump_is_json(c)) {
 		send_request(c, "%d %d %s %s",
 		             CONTROL, REQ_DUMP_SUBNETS,
 		             netstr, subnet->owner ? subnet->owner->name : "(broadcast)");
+		return;
+	}
+
+	json_t json;
+	json_begin(&json);
+	json_string(&json, "subnet", netstr);
+	json_string(&json, "owner", subnet->owner ? subnet->owner->name : NULL);
+	dump_json(c, REQ_DUMP_SUBNETS, &json);
+}
+
+/* Returns true once all subnets have been dumped */
+
+bool dump_subnets(connection_t *c) {
+	dump_t *dump = c->dump;
+	node_t owner = {.name = dump->owner};
+	subnet_t cursor = dump->subnet;
+	cursor.owner = dump->owner ? &owner : NULL;
+	int count = 0;
+
+	for(splay_node_t *node = dump_resume(&subnet_tree, dump->has_subnet ? &cursor : NULL); node; node = node->next) {
+		subnet_t *subnet = node->data;
+		dump_subnet(c, subnet);
+
+		if(++count == DUMP_BATCH) {
+			dump->subnet = *subnet;
+			dump->subnet.owner = NULL;
+			dump->has_subnet = true;
+
+			if(subnet->owner) {
+				dump_cursor(&dump->owner, subnet->owner->name);
+			} else {
+				free(dump->owner);
+				dump->owner = NULL;
+			}
+
+			return false;
+		}
 	}
 
-	return send_request(c, "%d %d", CONTROL, REQ_DUMP_SUBNETS);
+	return true;
 }
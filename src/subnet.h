@@ -62,7 +62,13 @@ typedef struct subnet_t {
 
 #define MAXNETSTR 64
 
+typedef struct subnet_cache_stats_t {
+	uint64_t hits;
+	uint64_t misses;
+} subnet_cache_stats_t;
+
 extern splay_tree_t subnet_tree;
+extern subnet_cache_stats_t subnet_cache_stats;
 
 extern int subnet_compare(const struct subnet_t *a, const struct subnet_t *b);
 extern subnet_t *new_subnet(void) ATTR_MALLOC;
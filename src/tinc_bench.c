@@ -0,0 +1,980 @@
+/*
+    tinc_bench.c -- microbenchmarks for the hot paths of tincd
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include "connection.h"
+#include "crypto.h"
+#include "device.h"
+#include "edge.h"
+#include "event.h"
+#include "graph.h"
+#include "names.h"
+#include "net.h"
+#include "netutl.h"
+#include "node.h"
+#include "protocol.h"
+#include "random.h"
+#include "route.h"
+#include "subnet.h"
+#include "version.h"
+#include "xalloc.h"
+
+/* Runs the code that handles every packet and every meta request on a
+   synthetic mesh, without any sockets or a real tun device. Everything is
+   generated from a seed, so the same parameters always give the same
+   workload. The mesh consists of N nodes connected by E bidirectional
+   links, and S subnets of each type spread evenly over all nodes.
+
+   Packets that are routed are all addressed to subnets owned by ourself, so
+   route() ends in a write to the dummy device. The encryption that would
+   follow for packets to other nodes is measured by sptps_speed. */
+
+#define PACKETS 1024            /* size of the ring of pregenerated packets */
+#define REQUESTS 1024           /* size of the ring of pregenerated meta requests */
+#define IDLE_PIPES_MAX 256      /* idle connections watched by the event loop */
+#define ITERATIONS_MAX (1 << 30)
+#define SUBNET_TYPES (SUBNET_IPV6 + 1)
+
+typedef struct benchmark_t {
+	const char *name;
+	void (*setup)(const struct benchmark_t *bench);
+	void (*run)(const struct benchmark_t *bench, size_t iterations);
+	int arg;
+	bool packets;                   /* each iteration handles one packet from the mix */
+} benchmark_t;
+
+typedef struct result_t {
+	const benchmark_t *bench;
+	size_t iterations;
+	double elapsed;
+	uint64_t allocations;
+} result_t;
+
+/* Parameters */
+
+static unsigned int nnodes = 1000;
+static unsigned int nlinks = 3000;
+static unsigned int nsubnets = 10000;
+static uint64_t seed = 1;
+static double bench_time = 1.0;
+static bool json;
+static const char *packet_mix = "64:7,576:4,1500:1";
+
+/* Allocation counting, if the linker lets us wrap malloc(). This only sees
+   calls made by tinc itself, not those inside shared libraries like zlib. */
+
+static uint64_t allocations;
+
+#ifdef HAVE_MALLOC_WRAP
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+	allocations++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	allocations++;
+	return __real_realloc(ptr, size);
+}
+#endif
+
+/* A small generator of our own, so the workload does not depend on how tinc seeds its PRNG */
+
+static uint64_t random_state;
+
+static uint64_t next_random(void) {
+	uint64_t z = (random_state += UINT64_C(0x9e3779b97f4a7c15));
+	z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+	return z ^ (z >> 31);
+}
+
+static uint32_t random_below(uint32_t limit) {
+	return next_random() % limit;
+}
+
+/* Synthetic mesh */
+
+static node_t **nodes;
+static edge_t **edges;
+static unsigned int nedges;
+static char fake_confbase[] = "/nonexistent";
+
+static void make_address(sockaddr_t *sa, unsigned int index) {
+	// 198.18.0.0/15 is reserved for benchmarking
+	memset(sa, 0, sizeof(*sa));
+	sa->in.sin_family = AF_INET;
+	sa->in.sin_addr.s_addr = htonl(0xc6120000 | (index & 0x1ffff));
+	sa->in.sin_port = htons(655);
+}
+
+static void add_edge_pair(unsigned int a, unsigned int b, int weight) {
+	for(int i = 0; i < 2; i++) {
+		edge_t *e = new_edge();
+		e->from = nodes[i ? b : a];
+		e->to = nodes[i ? a : b];
+		e->weight = weight;
+		make_address(&e->address, i ? a : b);
+		edge_add(e);
+		edges[nedges++] = e;
+	}
+}
+
+static void make_subnet(subnet_t *s, subnet_type_t type, unsigned int index) {
+	memset(s, 0, sizeof(*s));
+	s->type = type;
+	s->weight = 10;
+
+	switch(type) {
+	case SUBNET_IPV4:
+		s->net.ipv4.prefixlength = 24;
+		s->net.ipv4.address.x[0] = 10;
+		s->net.ipv4.address.x[1] = index >> 8;
+		s->net.ipv4.address.x[2] = index;
+		break;
+
+	case SUBNET_IPV6:
+		s->net.ipv6.prefixlength = 64;
+		s->net.ipv6.address.x[0] = htons(0xfd00);
+		s->net.ipv6.address.x[3] = htons(index);
+		break;
+
+	case SUBNET_MAC:
+		s->net.mac.address.x[0] = 0x02;
+		s->net.mac.address.x[2] = index >> 24;
+		s->net.mac.address.x[3] = index >> 16;
+		s->net.mac.address.x[4] = index >> 8;
+		s->net.mac.address.x[5] = index;
+		break;
+	}
+}
+
+static void setup_mesh(void) {
+	nodes = xzalloc(nnodes * sizeof(*nodes));
+	edges = xzalloc(2 * nlinks * sizeof(*edges));
+
+	for(unsigned int i = 0; i < nnodes; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "node%u", i);
+
+		node_t *n = new_node();
+		n->name = xstrdup(name);
+		n->hostname = xstrdup("bench");
+		node_add(n);
+		nodes[i] = n;
+	}
+
+	myself = nodes[0];
+
+	// A random spanning tree makes sure every node is reachable, the rest of the links are random
+
+	unsigned int links = 0;
+
+	for(unsigned int i = 1; i < nnodes; i++, links++) {
+		add_edge_pair(i, random_below(i), 1 + random_below(1000));
+	}
+
+	while(links < nlinks) {
+		unsigned int a = random_below(nnodes);
+		unsigned int b = random_below(nnodes);
+
+		if(a == b || lookup_edge(nodes[a], nodes[b])) {
+			continue;
+		}
+
+		add_edge_pair(a, b, 1 + random_below(1000));
+		links++;
+	}
+
+	for(unsigned int i = 0; i < nsubnets; i++) {
+		for(int t = 0; t < SUBNET_TYPES; t++) {
+			subnet_t *s = new_subnet();
+			make_subnet(s, t, i);
+			subnet_add(nodes[i % nnodes], s);
+		}
+	}
+
+	graph();
+}
+
+/* Subnet lookups, for random addresses in random subnets */
+
+static ipv4_t ipv4_queries[PACKETS];
+static ipv6_t ipv6_queries[PACKETS];
+static mac_t mac_queries[PACKETS];
+
+static void setup_queries(void) {
+	for(size_t i = 0; i < PACKETS; i++) {
+		subnet_t s;
+		unsigned int index = random_below(nsubnets);
+
+		make_subnet(&s, SUBNET_IPV4, index);
+		ipv4_queries[i] = s.net.ipv4.address;
+		ipv4_queries[i].x[3] = 1 + random_below(254);
+
+		make_subnet(&s, SUBNET_IPV6, index);
+		ipv6_queries[i] = s.net.ipv6.address;
+		ipv6_queries[i].x[7] = htons(1 + random_below(0xfffe));
+
+		make_subnet(&s, SUBNET_MAC, index);
+		mac_queries[i] = s.net.mac.address;
+	}
+}
+
+static void run_lookup(const benchmark_t *bench, size_t iterations) {
+	size_t found = 0;
+
+	for(size_t i = 0; i < iterations; i++) {
+		size_t q = i % PACKETS;
+
+		switch(bench->arg) {
+		case SUBNET_IPV4:
+			found += !!lookup_subnet_ipv4(&ipv4_queries[q]);
+			break;
+
+		case SUBNET_IPV6:
+			found += !!lookup_subnet_ipv6(&ipv6_queries[q]);
+			break;
+
+		case SUBNET_MAC:
+			found += !!lookup_subnet_mac(NULL, &mac_queries[q]);
+			break;
+		}
+	}
+
+	if(found != iterations) {
+		fprintf(stderr, "%s: only %lu of %lu lookups succeeded\n", bench->name, (unsigned long)found, (unsigned long)iterations);
+		abort();
+	}
+}
+
+/* Packets, from a random remote node to a random subnet of our own */
+
+static vpn_packet_t *ipv4_packets;
+static vpn_packet_t *ipv6_packets;
+static node_t *packet_sources[PACKETS];
+static uint8_t compressed[PACKETS][MAXSIZE];
+static length_t compressed_len[PACKETS];
+static uint64_t mix_bytes;
+
+static unsigned int mix_sizes[16];
+static unsigned int mix_weights[16];
+static unsigned int mix_count;
+static unsigned int mix_total;
+
+static bool parse_packet_mix(const char *mix) {
+	const char *p = mix;
+
+	mix_count = 0;
+	mix_total = 0;
+
+	while(*p) {
+		char *end;
+		unsigned long size = strtoul(p, &end, 10);
+		unsigned long weight = 1;
+
+		if(end == p || size < 48 || size > MTU - 18 || mix_count >= sizeof(mix_sizes) / sizeof(*mix_sizes)) {
+			return false;
+		}
+
+		p = end;
+
+		if(*p == ':') {
+			weight = strtoul(++p, &end, 10);
+
+			if(end == p || !weight || weight > 1000) {
+				return false;
+			}
+
+			p = end;
+		}
+
+		if(*p == ',') {
+			p++;
+		} else if(*p) {
+			return false;
+		}
+
+		mix_sizes[mix_count] = size;
+		mix_weights[mix_count] = weight;
+		mix_total += weight;
+		mix_count++;
+	}
+
+	return mix_count > 0;
+}
+
+static unsigned int random_packet_size(void) {
+	unsigned int r = random_below(mix_total);
+
+	for(unsigned int i = 0;; i++) {
+		if(r < mix_weights[i]) {
+			return mix_sizes[i];
+		}
+
+		r -= mix_weights[i];
+	}
+}
+
+static void fill_payload(uint8_t *p, size_t len) {
+	// Something that compresses a bit, but not too well
+	for(size_t i = 0; i < len; i++) {
+		p[i] = 'a' + random_below(16);
+	}
+}
+
+static void setup_packets(void) {
+	ipv4_packets = xzalloc(PACKETS * sizeof(*ipv4_packets));
+	ipv6_packets = xzalloc(PACKETS * sizeof(*ipv6_packets));
+
+	unsigned int nlocal = (nsubnets + nnodes - 1) / nnodes;
+
+	for(size_t i = 0; i < PACKETS; i++) {
+		unsigned int size = random_packet_size();
+		unsigned int index = nnodes * random_below(nlocal);
+		subnet_t s;
+
+		packet_sources[i] = nodes[1 + random_below(nnodes - 1)];
+		mix_bytes += size;
+
+		// Ethernet header, addressed to one of our MAC subnets so the packets also work in switch mode
+
+		vpn_packet_t *packet = &ipv4_packets[i];
+		packet->offset = DEFAULT_PACKET_OFFSET;
+		packet->len = 14 + size;
+
+		uint8_t *data = DATA(packet);
+		make_subnet(&s, SUBNET_MAC, index);
+		memcpy(data, &s.net.mac.address, 6);
+		data[6] = 0x02;
+		data[7] = 0x01;
+		data[12] = 0x08;
+		data[13] = 0x00;
+
+		// IPv4 and UDP header
+
+		data = DATA(packet) + 14;
+		data[0] = 0x45;
+		data[2] = size >> 8;
+		data[3] = size;
+		data[8] = 64;
+		data[9] = 17;
+		data[12] = 10;
+		data[13] = 255;
+		data[14] = 0;
+		data[15] = 1;
+		make_subnet(&s, SUBNET_IPV4, index);
+		memcpy(data + 16, &s.net.ipv4.address, 3);
+		data[19] = 1 + random_below(254);
+		fill_payload(data + 28, size - 28);
+
+		// The same for IPv6
+
+		packet = &ipv6_packets[i];
+		packet->offset = DEFAULT_PACKET_OFFSET;
+		packet->len = 14 + size;
+		data = DATA(packet);
+		memcpy(data, DATA(&ipv4_packets[i]), 12);
+		data[12] = 0x86;
+		data[13] = 0xdd;
+
+		data = DATA(packet) + 14;
+		data[0] = 0x60;
+		data[4] = (size - 40) >> 8;
+		data[5] = size - 40;
+		data[6] = 17;
+		data[7] = 64;
+		data[8] = 0xfd;
+		data[23] = 1;
+		make_subnet(&s, SUBNET_IPV6, index);
+		memcpy(data + 24, &s.net.ipv6.address, 16);
+		data[39] = 1 + random_below(254);
+		fill_payload(data + 48, size - 48);
+	}
+}
+
+static void run_route(const benchmark_t *bench, size_t iterations) {
+	vpn_packet_t *packets = bench->arg == SUBNET_IPV6 ? ipv6_packets : ipv4_packets;
+	uint64_t out_packets = myself->out_packets;
+
+	routing_mode = bench->arg == SUBNET_MAC ? RMODE_SWITCH : RMODE_ROUTER;
+
+	for(size_t i = 0; i < iterations; i++) {
+		size_t p = i % PACKETS;
+		route(packet_sources[p], &packets[p]);
+	}
+
+	routing_mode = RMODE_ROUTER;
+
+	if(myself->out_packets - out_packets != iterations) {
+		fprintf(stderr, "%s: only %lu of %lu packets were delivered\n", bench->name, (unsigned long)(myself->out_packets - out_packets), (unsigned long)iterations);
+		abort();
+	}
+}
+
+/* Compression */
+
+static void setup_uncompress(const benchmark_t *bench) {
+	for(size_t i = 0; i < PACKETS; i++) {
+		compressed_len[i] = compress_packet(compressed[i], DATA(&ipv4_packets[i]), ipv4_packets[i].len, bench->arg);
+	}
+}
+
+static void run_compress(const benchmark_t *bench, size_t iterations) {
+	static uint8_t buf[MAXSIZE];
+
+	for(size_t i = 0; i < iterations; i++) {
+		const vpn_packet_t *packet = &ipv4_packets[i % PACKETS];
+
+		if(!compress_packet(buf, DATA(packet), packet->len, bench->arg)) {
+			fprintf(stderr, "%s: compression failed\n", bench->name);
+			abort();
+		}
+	}
+}
+
+static void run_uncompress(const benchmark_t *bench, size_t iterations) {
+	static uint8_t buf[MAXSIZE];
+
+	for(size_t i = 0; i < iterations; i++) {
+		size_t p = i % PACKETS;
+
+		if(uncompress_packet(buf, compressed[p], compressed_len[p], bench->arg) != ipv4_packets[p].len) {
+			fprintf(stderr, "%s: decompression failed\n", bench->name);
+			abort();
+		}
+	}
+}
+
+/* Graph algorithms */
+
+static void run_graph(const benchmark_t *bench, size_t iterations) {
+	(void)bench;
+
+	for(size_t i = 0; i < iterations; i++) {
+		graph();
+	}
+}
+
+/* Meta protocol requests that do not change anything, but do have to be parsed and checked */
+
+static connection_t *bench_connection;
+static char *requests[REQUESTS];
+static size_t nonce_offset[REQUESTS];
+static uint32_t nonce;
+
+static void setup_requests(const benchmark_t *bench) {
+	if(!bench_connection) {
+		bench_connection = new_connection();
+		bench_connection->name = xstrdup("bench");
+		bench_connection->hostname = xstrdup("bench");
+		bench_connection->allow_request = ALL;
+		bench_connection->node = nodes[1];
+	}
+
+	for(size_t i = 0; i < REQUESTS; i++) {
+		free(requests[i]);
+
+		if(bench->arg == ADD_EDGE) {
+			const edge_t *e = edges[random_below(nedges)];
+			char *address, *port;
+
+			sockaddr2str(&e->address, &address, &port);
+			xasprintf(&requests[i], "%d %08x %s %s %s %s %x %d", ADD_EDGE, 0, e->from->name, e->to->name, address, port, e->options, e->weight);
+			free(address);
+			free(port);
+		} else {
+			subnet_t s;
+			char netstr[MAXNETSTR];
+			unsigned int index = random_below(nsubnets);
+
+			make_subnet(&s, random_below(SUBNET_TYPES), index);
+			net2str(netstr, sizeof(netstr), &s);
+			xasprintf(&requests[i], "%d %08x %s %s", ADD_SUBNET, 0, nodes[index % nnodes]->name, netstr);
+		}
+
+		nonce_offset[i] = strchr(requests[i], ' ') + 1 - requests[i];
+	}
+}
+
+static void run_requests(const benchmark_t *bench, size_t iterations) {
+	static const char hex[] = "0123456789abcdef";
+
+	for(size_t i = 0; i < iterations; i++) {
+		size_t r = i % REQUESTS;
+		char *p = requests[r] + nonce_offset[r];
+
+		// Every request gets a fresh nonce, otherwise we would only measure the duplicate check
+
+		nonce++;
+
+		for(int j = 0; j < 8; j++) {
+			p[j] = hex[(nonce >> (28 - 4 * j)) & 0xf];
+		}
+
+		if(!receive_request(bench_connection, requests[r])) {
+			fprintf(stderr, "%s: request was rejected: %s\n", bench->name, requests[r]);
+			abort();
+		}
+	}
+}
+
+/* Event loop: wakeups on one pipe while many other connections are idle */
+
+static int loop_pipe[2] = {-1, -1};
+static int idle_pipes[IDLE_PIPES_MAX][2];
+static io_t loop_io;
+static io_t idle_io[IDLE_PIPES_MAX];
+static timeout_t loop_timeout;
+static size_t loop_remaining;
+static unsigned int nidle;
+
+static void loop_timeout_handler(void *data) {
+	(void)data;
+	timeout_set(&loop_timeout, &(struct timeval) {
+		3600, 0
+	});
+}
+
+static void loop_handler(void *data, int flags) {
+	(void)data;
+	(void)flags;
+	char c;
+
+	if(read(loop_pipe[0], &c, 1) != 1) {
+		abort();
+	}
+
+	if(--loop_remaining) {
+		if(write(loop_pipe[1], &c, 1) != 1) {
+			abort();
+		}
+	} else {
+		event_exit();
+	}
+}
+
+static void idle_handler(void *data, int flags) {
+	(void)data;
+	(void)flags;
+	fprintf(stderr, "Idle connection became active\n");
+	abort();
+}
+
+static void setup_loop(const benchmark_t *bench) {
+	(void)bench;
+
+	if(loop_pipe[0] != -1) {
+		return;
+	}
+
+	if(pipe(loop_pipe)) {
+		fprintf(stderr, "Could not create pipe: %s\n", strerror(errno));
+		abort();
+	}
+
+	io_add(&loop_io, loop_handler, NULL, loop_pipe[0], IO_READ);
+
+	nidle = MIN(nnodes, IDLE_PIPES_MAX);
+
+	for(unsigned int i = 0; i < nidle; i++) {
+		if(pipe(idle_pipes[i])) {
+			fprintf(stderr, "Could not create pipe: %s\n", strerror(errno));
+			abort();
+		}
+
+		io_add(&idle_io[i], idle_handler, NULL, idle_pipes[i][0], IO_READ);
+	}
+
+	timeout_add(&loop_timeout, loop_timeout_handler, NULL, &(struct timeval) {
+		3600, 0
+	});
+}
+
+static void run_loop(const benchmark_t *bench, size_t iterations) {
+	(void)bench;
+
+	loop_remaining = iterations;
+
+	if(write(loop_pipe[1], "", 1) != 1 || !event_loop()) {
+		fprintf(stderr, "Event loop failed\n");
+		abort();
+	}
+}
+
+static void exit_loop(void) {
+	if(loop_pipe[0] == -1) {
+		return;
+	}
+
+	timeout_del(&loop_timeout);
+	io_del(&loop_io);
+	close(loop_pipe[0]);
+	close(loop_pipe[1]);
+
+	for(unsigned int i = 0; i < nidle; i++) {
+		io_del(&idle_io[i]);
+		close(idle_pipes[i][0]);
+		close(idle_pipes[i][1]);
+	}
+}
+
+static const benchmark_t benchmarks[] = {
+	{"lookup_subnet_ipv4", NULL, run_lookup, SUBNET_IPV4, false},
+	{"lookup_subnet_ipv6", NULL, run_lookup, SUBNET_IPV6, false},
+	{"lookup_subnet_mac", NULL, run_lookup, SUBNET_MAC, false},
+	{"route_ipv4", NULL, run_route, SUBNET_IPV4, true},
+	{"route_ipv6", NULL, run_route, SUBNET_IPV6, true},
+	{"route_mac", NULL, run_route, SUBNET_MAC, true},
+#ifdef HAVE_ZLIB
+	{"compress_zlib_1", NULL, run_compress, COMPRESS_ZLIB_1, true},
+	{"compress_zlib_6", NULL, run_compress, COMPRESS_ZLIB_6, true},
+	{"compress_zlib_9", NULL, run_compress, COMPRESS_ZLIB_9, true},
+	{"uncompress_zlib", setup_uncompress, run_uncompress, COMPRESS_ZLIB_6, true},
+#endif
+#ifdef HAVE_LZO
+	{"compress_lzo_lo", NULL, run_compress, COMPRESS_LZO_LO, true},
+	{"compress_lzo_hi", NULL, run_compress, COMPRESS_LZO_HI, true},
+	{"uncompress_lzo", setup_uncompress, run_uncompress, COMPRESS_LZO_LO, true},
+#endif
+#ifdef HAVE_LZ4
+	{"compress_lz4", NULL, run_compress, COMPRESS_LZ4, true},
+	{"uncompress_lz4", setup_uncompress, run_uncompress, COMPRESS_LZ4, true},
+#endif
+#ifdef HAVE_ZSTD
+	{"compress_zstd", NULL, run_compress, COMPRESS_ZSTD, true},
+	{"uncompress_zstd", setup_uncompress, run_uncompress, COMPRESS_ZSTD, true},
+#endif
+	{"graph", NULL, run_graph, 0, false},
+	{"meta_add_edge", setup_requests, run_requests, ADD_EDGE, false},
+	{"meta_add_subnet", setup_requests, run_requests, ADD_SUBNET, false},
+	{"event_loop", setup_loop, run_loop, 0, false},
+};
+
+#define NBENCHMARKS (sizeof(benchmarks) / sizeof(*benchmarks))
+
+/* Running and reporting */
+
+static double cpu_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// Keep doubling (or better, predicting) the number of iterations until one run takes long enough.
+
+static void run_one(const benchmark_t *bench, result_t *result) {
+	if(bench->setup) {
+		bench->setup(bench);
+	}
+
+	size_t iterations = 1;
+
+	while(true) {
+		gettimeofday(&now, NULL);
+
+		uint64_t allocations_start = allocations;
+		double start = cpu_time();
+		bench->run(bench, iterations);
+		double elapsed = cpu_time() - start;
+
+		result->bench = bench;
+		result->iterations = iterations;
+		result->elapsed = elapsed;
+		result->allocations = allocations - allocations_start;
+
+		if(elapsed >= bench_time || iterations >= ITERATIONS_MAX) {
+			break;
+		}
+
+		double goal = elapsed > 0 ? iterations * bench_time * 1.2 / elapsed : iterations * 100.0;
+		iterations = MIN(MAX(goal, iterations * 2.0), MIN(iterations * 100.0, (double)ITERATIONS_MAX));
+	}
+}
+
+static void print_result(const result_t *result) {
+	double ns = result->elapsed * 1e9 / result->iterations;
+
+	printf("%-22s %12lu %12.1lf ns/op %14.0lf ops/s", result->bench->name, (unsigned long)result->iterations, ns, result->iterations / result->elapsed);
+
+#ifdef HAVE_MALLOC_WRAP
+	printf(" %10.3lf allocs/op", (double)result->allocations / result->iterations);
+#endif
+
+	if(result->bench->packets) {
+		printf(" %10.1lf MiB/s", mix_bytes / (double)PACKETS * result->iterations / result->elapsed / 1048576.0);
+	}
+
+	printf("\n");
+}
+
+static void print_json(const result_t *results, size_t count) {
+	printf("{\n");
+	printf("  \"version\": \"%s\",\n", BUILD_VERSION);
+	printf("  \"seed\": %" PRIu64 ",\n", seed);
+	printf("  \"nodes\": %u,\n", nnodes);
+	printf("  \"edges\": %u,\n", 2 * nlinks);
+	printf("  \"subnets\": %u,\n", 3 * nsubnets);
+	printf("  \"packet_mix\": \"%s\",\n", packet_mix);
+	printf("  \"mean_packet_size\": %.1lf,\n", mix_bytes / (double)PACKETS);
+	printf("  \"benchmarks\": [");
+
+	for(size_t i = 0; i < count; i++) {
+		const result_t *result = &results[i];
+
+		printf("%s\n    {\"name\": \"%s\", \"iterations\": %lu, \"ns_per_op\": %.2lf, \"ops_per_sec\": %.1lf, \"allocs_per_op\": ",
+		       i ? "," : "", result->bench->name, (unsigned long)result->iterations,
+		       result->elapsed * 1e9 / result->iterations, result->iterations / result->elapsed);
+
+#ifdef HAVE_MALLOC_WRAP
+		printf("%.3lf", (double)result->allocations / result->iterations);
+#else
+		printf("null");
+#endif
+
+		if(result->bench->packets) {
+			printf(", \"bytes_per_op\": %.1lf", mix_bytes / (double)PACKETS);
+		}
+
+		printf("}");
+	}
+
+	printf("\n  ]\n}\n");
+}
+
+static struct option const long_options[] = {
+	{"nodes", required_argument, NULL, 'n'},
+	{"edges", required_argument, NULL, 'e'},
+	{"subnets", required_argument, NULL, 's'},
+	{"packets", required_argument, NULL, 'p'},
+	{"seed", required_argument, NULL, 'S'},
+	{"time", required_argument, NULL, 't'},
+	{"json", no_argument, NULL, 'j'},
+	{"list", no_argument, NULL, 'l'},
+	{"help", no_argument, NULL, 1},
+	{NULL, 0, NULL, 0}
+};
+
+static void usage(void) {
+	static const char *message =
+	        "Usage: %s [options] [benchmark...]\n"
+	        "\n"
+	        "Runs all benchmarks, or only those whose names start with one of the given arguments.\n"
+	        "\n"
+	        "Valid options are:\n"
+	        "  -n, --nodes N           Number of nodes in the mesh (default 1000).\n"
+	        "  -e, --edges E           Number of links between nodes, each is a pair of edges (default 3000).\n"
+	        "  -s, --subnets S         Number of subnets of each type (default 10000).\n"
+	        "  -p, --packets MIX       Packet sizes and their weights (default 64:7,576:4,1500:1).\n"
+	        "  -S, --seed SEED         Seed for generating the workload (default 1).\n"
+	        "  -t, --time SECONDS      Minimum CPU time to spend on each benchmark (default 1).\n"
+	        "  -j, --json              Write the results as JSON.\n"
+	        "  -l, --list              List the available benchmarks.\n"
+	        "\n"
+	        "Report bugs to tinc@tinc-vpn.org.\n";
+
+	fprintf(stderr, message, program_name);
+}
+
+static bool selected(const benchmark_t *bench, int argc, char *argv[]) {
+	if(!argc) {
+		return true;
+	}
+
+	for(int i = 0; i < argc; i++) {
+		if(!strncmp(bench->name, argv[i], strlen(argv[i]))) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int run_benchmarks(int argc, char *argv[]) {
+	int r;
+	int option_index = 0;
+
+	program_name = argv[0];
+
+	while((r = getopt_long(argc, argv, "n:e:s:p:S:t:jl", long_options, &option_index)) != EOF) {
+		switch(r) {
+		case 'n':
+			nnodes = atoi(optarg);
+			break;
+
+		case 'e':
+			nlinks = atoi(optarg);
+			break;
+
+		case 's':
+			nsubnets = atoi(optarg);
+			break;
+
+		case 'p':
+			packet_mix = optarg;
+			break;
+
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+
+		case 't':
+			bench_time = atof(optarg);
+			break;
+
+		case 'j':
+			json = true;
+			break;
+
+		case 'l':
+			for(size_t i = 0; i < NBENCHMARKS; i++) {
+				printf("%s\n", benchmarks[i].name);
+			}
+
+			return 0;
+
+		case 1:
+			usage();
+			return 0;
+
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if(nnodes < 2 || nlinks < nnodes - 1 || nlinks > (uint64_t)nnodes * (nnodes - 1) / 2) {
+		fprintf(stderr, "Need at least 2 nodes, and between N-1 and N*(N-1)/2 links\n");
+		return 1;
+	}
+
+	if(!nsubnets || nsubnets > 65536) {
+		fprintf(stderr, "Need between 1 and 65536 subnets\n");
+		return 1;
+	}
+
+	if(!parse_packet_mix(packet_mix)) {
+		fprintf(stderr, "Invalid packet mix: %s\n", packet_mix);
+		return 1;
+	}
+
+	if(!(bench_time > 0)) {
+		fprintf(stderr, "Invalid time: %lf\n", bench_time);
+		return 1;
+	}
+
+	size_t count = 0;
+
+	for(size_t i = 0; i < NBENCHMARKS; i++) {
+		count += selected(&benchmarks[i], argc, argv);
+	}
+
+	if(!count) {
+		fprintf(stderr, "No benchmarks match\n");
+		return 1;
+	}
+
+	// Nothing we call should touch the outside world
+
+	confbase = fake_confbase;
+	devops = dummy_devops;
+	random_state = seed;
+	gettimeofday(&now, NULL);
+	init_subnets();
+
+	fprintf(stderr, "Setting up %u nodes, %u edges and %u subnets with seed %" PRIu64 "\n", nnodes, 2 * nlinks, 3 * nsubnets, seed);
+
+	setup_mesh();
+	setup_queries();
+	setup_packets();
+
+	result_t *results = xzalloc(count * sizeof(*results));
+	size_t done = 0;
+
+	for(size_t i = 0; i < NBENCHMARKS; i++) {
+		if(!selected(&benchmarks[i], argc, argv)) {
+			continue;
+		}
+
+		run_one(&benchmarks[i], &results[done]);
+
+		if(!json) {
+			print_result(&results[done]);
+			fflush(stdout);
+		}
+
+		done++;
+	}
+
+	if(json) {
+		print_json(results, done);
+	}
+
+	// Clean up
+
+	exit_loop();
+
+	for(size_t i = 0; i < REQUESTS; i++) {
+		free(requests[i]);
+	}
+
+	if(bench_connection) {
+		free_connection(bench_connection);
+	}
+
+	exit_requests();
+	exit_edges();
+	exit_subnets();
+	exit_nodes();
+	confbase = NULL;
+	myself = NULL;
+
+	free(results);
+	free(ipv4_packets);
+	free(ipv6_packets);
+	free(edges);
+	free(nodes);
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	random_init();
+	crypto_init();
+
+	int result = run_benchmarks(argc, argv);
+
+	random_exit();
+
+	return result;
+}
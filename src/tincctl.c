@@ -24,7 +24,12 @@
 #include "readline/history.h"
 #endif
 
+#ifdef HAVE_LIBPCAP
+#include <pcap.h>
+#endif
+
 #include "xalloc.h"
+#include "bpf.h"
 #include "protocol.h"
 #include "control_common.h"
 #include "crypto.h"
@@ -42,6 +47,7 @@
 #include "keys.h"
 #include "random.h"
 #include "pidfile.h"
+#include "stats_shm.h"
 
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
@@ -100,6 +106,9 @@ static void version(void) {
 #ifdef HAVE_CURSES
 	        " curses"
 #endif
+#ifdef HAVE_LIBPCAP
+	        " libpcap"
+#endif
 #ifndef DISABLE_LEGACY
 	        " legacy_protocol"
 #endif
@@ -148,13 +157,17 @@ static void usage(bool status) {
 		        "  generate-rsa-keys [bits]   Generate a new RSA public/private key pair.\n"
 #endif
 		        "  generate-ed25519-keys      Generate a new Ed25519 public/private key pair.\n"
-		        "  dump                       Dump a list of one of the following things:\n"
+		        "  dump [--json]              Dump a list of one of the following things:\n"
 		        "    [reachable] nodes        - all known nodes in the VPN\n"
 		        "    edges                    - all known connections in the VPN\n"
 		        "    subnets                  - all known subnets in the VPN\n"
 		        "    connections              - all meta connections with ourself\n"
 		        "    [di]graph                - graph of the VPN in dotty format\n"
 		        "    invitations              - outstanding invitations\n"
+		        "    stats                    - internal statistics of the daemon\n"
+		        "    traffic                  - traffic and compression statistics per node\n"
+		        "    latency [reset]          - event loop and callback timing [and reset it]\n"
+		        "                             [--json prints one JSON object per line]\n"
 		        "  info NODE|SUBNET|ADDRESS   Give information about a particular NODE, SUBNET or ADDRESS.\n"
 		        "  purge                      Purge unreachable nodes\n"
 		        "  debug N                    Set debug level\n"
@@ -163,8 +176,11 @@ static void usage(bool status) {
 #ifdef HAVE_CURSES
 		        "  top                        Show real-time statistics\n"
 #endif
-		        "  pcap [snaplen]             Dump traffic in pcap format [up to snaplen bytes per packet]\n"
+		        "  stats [--shm]              Show traffic, MTU and RTT of each node [from the shared statistics file]\n"
+		        "  pcap [snaplen] [filter]    Dump traffic in pcap format [up to snaplen bytes per packet]\n"
+		        "                             [only packets matching a tcpdump expression or tcpdump -ddd output]\n"
 		        "  log [level]                Dump log output [up to the specified level]\n"
+		        "  events [type...]           Show changes as they happen [only node, edge, subnet, mtu or connection]\n"
 		        "  export                     Export host configuration of local node to standard output\n"
 		        "  export-all                 Export all host configuration files to standard output\n"
 		        "  import                     Import host configuration file(s) from standard input\n"
@@ -554,7 +570,21 @@ bool sendline(int fd, const char *format, ...) {
 	return true;
 }
 
-static void pcap(int fd, FILE *out, uint32_t snaplen) {
+/* Number of filter instructions sent to tincd per request */
+#define PCAP_FILTER_BATCH 64
+
+static bool pcap(int fd, FILE *out, uint32_t snaplen, const bpf_insn_t *filter, uint32_t filter_len) {
+	for(uint32_t i = 0; i < filter_len; i += PCAP_FILTER_BATCH) {
+		char hex[PCAP_FILTER_BATCH * BPF_INSN_HEX + 1];
+		uint32_t count = filter_len - i < PCAP_FILTER_BATCH ? filter_len - i : PCAP_FILTER_BATCH;
+
+		for(uint32_t j = 0; j < count; j++) {
+			bpf_insn_to_hex(&filter[i + j], hex + j * BPF_INSN_HEX);
+		}
+
+		sendline(fd, "%d %d %s", CONTROL, REQ_PCAP_FILTER, hex);
+	}
+
 	sendline(fd, "%d %d %d", CONTROL, REQ_PCAP, snaplen);
 	char data[9018];
 
@@ -586,18 +616,41 @@ static void pcap(int fd, FILE *out, uint32_t snaplen) {
 	fwrite(&header, sizeof(header), 1, out);
 	fflush(out);
 
-	char line[32];
+	char line[64];
 
 	while(recvline(fd, line, sizeof(line))) {
 		int code, req;
-		unsigned long len;
-		int n = sscanf(line, "%d %d %lu", &code, &req, &len);
-		gettimeofday(&tv, NULL);
+		long len, sec, usec;
+		unsigned long origlen;
+		int n = sscanf(line, "%d %d %ld %lu %ld %ld", &code, &req, &len, &origlen, &sec, &usec);
 
-		if(n != 3 || code != CONTROL || req != REQ_PCAP || len > sizeof(data)) {
+		if(n >= 2 && code == CONTROL && req == REQ_INVALID) {
+			fprintf(stderr, "The tinc daemon does not support packet filters.\n");
+			return false;
+		}
+
+		if(n >= 3 && code == CONTROL && req == REQ_PCAP && len < 0) {
+			fprintf(stderr, "The tinc daemon rejected the packet filter.\n");
+			return false;
+		}
+
+		if(n < 3 || code != CONTROL || req != REQ_PCAP || (unsigned long)len > sizeof(data)) {
 			break;
 		}
 
+		// Older versions of tincd do not tell when the packet was captured, or how long it was
+
+		if(n == 6) {
+			tv.tv_sec = sec;
+			tv.tv_usec = usec;
+		} else {
+			gettimeofday(&tv, NULL);
+		}
+
+		if(n < 4) {
+			origlen = len;
+		}
+
 		if(!recvdata(fd, data, len)) {
 			break;
 		}
@@ -605,11 +658,13 @@ static void pcap(int fd, FILE *out, uint32_t snaplen) {
 		packet.tv_sec = tv.tv_sec;
 		packet.tv_usec = tv.tv_usec;
 		packet.len = len;
-		packet.origlen = len;
+		packet.origlen = origlen;
 		fwrite(&packet, sizeof(packet), 1, out);
 		fwrite(data, len, 1, out);
 		fflush(out);
 	}
+
+	return true;
 }
 
 static void log_control(int fd, FILE *out, int level) {
@@ -1145,8 +1200,54 @@ static int dump_invitations(void) {
 	return 0;
 }
 
+/* Old versions of tincd only report the last round trip time, not the smoothed one */
+
+static void print_link_stats(int udp_ping_rtt, int srtt, int jitter, unsigned int loss) {
+	if(srtt != -1) {
+		printf(" rtt %d.%03d jitter %d.%03d", srtt / 1000, srtt % 1000, jitter / 1000, jitter % 1000);
+	} else if(udp_ping_rtt != -1) {
+		printf(" rtt %d.%03d", udp_ping_rtt / 1000, udp_ping_rtt % 1000);
+	}
+
+	if(loss) {
+		printf(" loss %.2f%%", loss * 1e-4);
+	}
+}
+
+/* Ask tincd to send dumps as JSON objects. Old versions of tincd do not know this request. */
+
+static bool request_json_dumps(void) {
+	sendline(fd, "%d %d %d", CONTROL, REQ_DUMP_FORMAT, DUMP_FORMAT_JSON);
+
+	int result;
+
+	if(!recvline(fd, line, sizeof(line)) || sscanf(line, "%d %d %d", &code, &req, &result) != 3 || code != CONTROL || req != REQ_DUMP_FORMAT || result) {
+		fprintf(stderr, "This version of tincd cannot send dumps as JSON.\n");
+		return false;
+	}
+
+	return true;
+}
+
 static int cmd_dump(int argc, char *argv[]) {
 	bool only_reachable = false;
+	bool json = false;
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcasecmp(argv[i], "--json")) {
+			json = true;
+			memmove(&argv[i], &argv[i + 1], (argc - i - 1) * sizeof(*argv));
+			argc--;
+			i--;
+		}
+	}
+
+	bool reset = false;
+
+	if(argc == 3 && !strcasecmp(argv[1], "latency") && !strcasecmp(argv[2], "reset")) {
+		reset = true;
+		argc--;
+	}
 
 	if(argc > 2 && !strcasecmp(argv[1], "reachable")) {
 		if(strcasecmp(argv[2], "nodes")) {
@@ -1166,6 +1267,11 @@ static int cmd_dump(int argc, char *argv[]) {
 		return 1;
 	}
 
+	if(json && (!strcasecmp(argv[1], "invitations") || !strcasecmp(argv[1], "graph") || !strcasecmp(argv[1], "digraph"))) {
+		fprintf(stderr, "Cannot dump %s as JSON.\n", argv[1]);
+		return 1;
+	}
+
 	if(!strcasecmp(argv[1], "invitations")) {
 		return dump_invitations();
 	}
@@ -1174,6 +1280,10 @@ static int cmd_dump(int argc, char *argv[]) {
 		return 1;
 	}
 
+	if(json && !request_json_dumps()) {
+		return 1;
+	}
+
 	int do_graph = 0;
 
 	if(!strcasecmp(argv[1], "nodes")) {
@@ -1184,6 +1294,12 @@ static int cmd_dump(int argc, char *argv[]) {
 		sendline(fd, "%d %d", CONTROL, REQ_DUMP_SUBNETS);
 	} else if(!strcasecmp(argv[1], "connections")) {
 		sendline(fd, "%d %d", CONTROL, REQ_DUMP_CONNECTIONS);
+	} else if(!strcasecmp(argv[1], "stats")) {
+		sendline(fd, "%d %d", CONTROL, REQ_DUMP_STATS);
+	} else if(!strcasecmp(argv[1], "traffic")) {
+		sendline(fd, "%d %d", CONTROL, REQ_DUMP_TRAFFIC);
+	} else if(!strcasecmp(argv[1], "latency")) {
+		sendline(fd, "%d %d %d", CONTROL, REQ_DUMP_LATENCY, reset);
 	} else if(!strcasecmp(argv[1], "graph")) {
 		sendline(fd, "%d %d", CONTROL, REQ_DUMP_NODES);
 		sendline(fd, "%d %d", CONTROL, REQ_DUMP_EDGES);
@@ -1224,6 +1340,22 @@ static int cmd_dump(int argc, char *argv[]) {
 			break;
 		}
 
+		if(json) {
+			int offset = 0;
+			sscanf(line, "%*d %*d %n", &offset);
+
+			if(line[offset] != '{') {
+				fprintf(stderr, "Unable to parse dump from tincd: %s\n", line);
+				return 1;
+			}
+
+			if(!only_reachable || strstr(line + offset, "\"reachable\":true")) {
+				printf("%s\n", line + offset);
+			}
+
+			continue;
+		}
+
 		char node[4096];
 		char id[4096];
 		char from[4096];
@@ -1245,9 +1377,11 @@ static int cmd_dump(int argc, char *argv[]) {
 
 		switch(req) {
 		case REQ_DUMP_NODES: {
-			int n = sscanf(line, "%*d %*d %4095s %4095s %4095s port %4095s %d %d %d %d %x %"PRIx32" %4095s %4095s %d %hd %hd %hd %ld %d %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64, node, id, host, port, &cipher, &digest, &maclength, &compression, &options, &status.value, nexthop, via, &distance, &pmtu, &minmtu, &maxmtu, &last_state_change, &udp_ping_rtt, &in_packets, &in_bytes, &out_packets, &out_bytes);
+			int srtt = -1, jitter = 0;
+			unsigned int loss = 0;
+			int n = sscanf(line, "%*d %*d %4095s %4095s %4095s port %4095s %d %d %d %d %x %"PRIx32" %4095s %4095s %d %hd %hd %hd %ld %d %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %d %*d %d %u", node, id, host, port, &cipher, &digest, &maclength, &compression, &options, &status.value, nexthop, via, &distance, &pmtu, &minmtu, &maxmtu, &last_state_change, &udp_ping_rtt, &in_packets, &in_bytes, &out_packets, &out_bytes, &srtt, &jitter, &loss);
 
-			if(n != 22) {
+			if(n != 22 && n != 25) {
 				fprintf(stderr, "Unable to parse node dump from tincd: %s\n", line);
 				return 1;
 			}
@@ -1275,11 +1409,7 @@ static int cmd_dump(int argc, char *argv[]) {
 
 				printf("%s id %s at %s port %s cipher %d digest %d maclength %d compression %d options %x status %04x nexthop %s via %s distance %d pmtu %d (min %d max %d) rx %"PRIu64" %"PRIu64" tx %"PRIu64" %"PRIu64,
 				       node, id, host, port, cipher, digest, maclength, compression, options, status.value, nexthop, via, distance, pmtu, minmtu, maxmtu, in_packets, in_bytes, out_packets, out_bytes);
-
-				if(udp_ping_rtt != -1) {
-					printf(" rtt %d.%03d", udp_ping_rtt / 1000, udp_ping_rtt % 1000);
-				}
-
+				print_link_stats(udp_ping_rtt, srtt, jitter, loss);
 				printf("\n");
 			}
 		}
@@ -1320,14 +1450,71 @@ static int cmd_dump(int argc, char *argv[]) {
 		break;
 
 		case REQ_DUMP_CONNECTIONS: {
-			int n = sscanf(line, "%*d %*d %4095s %4095s port %4095s %x %d %x", node, host, port, &options, &socket, &status.value);
+			unsigned int outq = 0, dropped = 0;
+			int n = sscanf(line, "%*d %*d %4095s %4095s port %4095s %x %d %x %u %u", node, host, port, &options, &socket, &status.value, &outq, &dropped);
 
-			if(n != 6) {
+			if(n != 6 && n != 8) {
 				fprintf(stderr, "Unable to parse connection dump from tincd.\n");
 				return 1;
 			}
 
-			printf("%s at %s port %s options %x socket %d status %x\n", node, host, port, options, socket, status.value);
+			printf("%s at %s port %s options %x socket %d status %x outq %u dropped %u\n", node, host, port, options, socket, status.value, outq, dropped);
+		}
+		break;
+
+		case REQ_DUMP_STATS: {
+			uint64_t value;
+			int n = sscanf(line, "%*d %*d %4095s %"PRIu64, node, &value);
+
+			if(n != 2) {
+				fprintf(stderr, "Unable to parse stats dump from tincd.\n");
+				return 1;
+			}
+
+			printf("%s %"PRIu64"\n", node, value);
+		}
+		break;
+
+		case REQ_DUMP_TRAFFIC: {
+			uint64_t attempts = 0, failures = 0, skipped = 0, compress_in = 0, compress_out = 0, skipped_bytes = 0, nsec = 0;
+			int n = sscanf(line, "%*d %*d %4095s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64, node, &in_packets, &in_bytes, &out_packets, &out_bytes, &attempts, &failures, &skipped, &compress_in, &compress_out, &skipped_bytes, &nsec);
+
+			if(n != 5 && n != 12) {
+				fprintf(stderr, "Unable to parse traffic dump from tincd.\n");
+				return 1;
+			}
+
+			printf("%s rx %"PRIu64" %"PRIu64" tx %"PRIu64" %"PRIu64, node, in_packets, in_bytes, out_packets, out_bytes);
+
+			if(attempts || skipped) {
+				// Assume skipped packets would have cost as much per byte as the ones we did compress
+				double ratio = compress_in ? (double)compress_out / (double)compress_in : 1.0;
+				double saved = compress_in ? (double)skipped_bytes * (double)nsec / (double)compress_in : 0.0;
+
+				printf(" compression ratio %.3f attempts %"PRIu64" failed %"PRIu64" skipped %"PRIu64" cpu %.3f ms saved %.3f ms",
+				       ratio, attempts, failures, skipped, (double)nsec * 1e-6, saved * 1e-6);
+			}
+
+			printf("\n");
+		}
+		break;
+
+		case REQ_DUMP_LATENCY: {
+			uint64_t count, avg, p50, p90, p99, max;
+
+			if(sscanf(line, "%*d %*d slowest %4095s %"PRIu64, node, &max) == 2) {
+				printf("slowest callback %s %"PRIu64" us\n", node, max);
+				break;
+			}
+
+			int n = sscanf(line, "%*d %*d %4095s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64, node, &count, &avg, &p50, &p90, &p99, &max);
+
+			if(n != 7) {
+				fprintf(stderr, "Unable to parse latency dump from tincd.\n");
+				return 1;
+			}
+
+			printf("%s count %"PRIu64" avg %"PRIu64" p50 %"PRIu64" p90 %"PRIu64" p99 %"PRIu64" max %"PRIu64" us\n", node, count, avg, p50, p90, p99, max);
 		}
 		break;
 
@@ -1468,12 +1655,19 @@ static int cmd_top(int argc, char *argv[]) {
 	}
 
 #ifdef HAVE_CURSES
+	stats_shm_t shm;
+
+	if(stats_shm_open(&shm, statsfilename)) {
+		top(-1, &shm);
+		stats_shm_close(&shm);
+		return 0;
+	}
 
 	if(!connect_tincd(true)) {
 		return 1;
 	}
 
-	top(fd);
+	top(fd, NULL);
 	return 0;
 #else
 	fprintf(stderr, "This version of tinc was compiled without support for the curses library.\n");
@@ -1481,18 +1675,187 @@ static int cmd_top(int argc, char *argv[]) {
 #endif
 }
 
-static int cmd_pcap(int argc, char *argv[]) {
-	if(argc > 2) {
+static void print_node_stats(const char *node, unsigned int status, int pmtu, int minmtu, int maxmtu, uint64_t in_packets, uint64_t in_bytes, uint64_t out_packets, uint64_t out_bytes, int udp_ping_rtt, int srtt, int jitter, unsigned int loss) {
+	printf("%s status %04x pmtu %d (min %d max %d) rx %"PRIu64" %"PRIu64" tx %"PRIu64" %"PRIu64,
+	       node, status, pmtu, minmtu, maxmtu, in_packets, in_bytes, out_packets, out_bytes);
+	print_link_stats(udp_ping_rtt, srtt, jitter, loss);
+	printf("\n");
+}
+
+static int cmd_stats(int argc, char *argv[]) {
+	bool use_shm = false;
+
+	if(argc > 1 && !strcasecmp(argv[1], "--shm")) {
+		use_shm = true;
+		argc--;
+		argv++;
+	}
+
+	if(argc > 1) {
 		fprintf(stderr, "Too many arguments!\n");
 		return 1;
 	}
 
+	if(use_shm) {
+		stats_shm_t shm;
+		errno = 0;
+
+		if(!stats_shm_open(&shm, statsfilename)) {
+			fprintf(stderr, "Could not open shared statistics file %s: %s\n", statsfilename, errno ? strerror(errno) : "not updated by tincd");
+			return 1;
+		}
+
+		uint32_t count = stats_shm_count(&shm);
+
+		for(uint32_t i = 0; i < count; i++) {
+			stats_shm_data_t d;
+
+			if(stats_shm_read(&shm, i, &d)) {
+				print_node_stats(d.name, d.status, d.mtu, d.minmtu, d.maxmtu, d.in_packets, d.in_bytes, d.out_packets, d.out_bytes, d.udp_ping_rtt, d.srtt, d.jitter, d.loss);
+			}
+		}
+
+		stats_shm_close(&shm);
+		return 0;
+	}
+
 	if(!connect_tincd(true)) {
 		return 1;
 	}
 
-	pcap(fd, stdout, argc > 1 ? atoi(argv[1]) : 0);
+	sendline(fd, "%d %d", CONTROL, REQ_DUMP_NODES);
+
+	char line[4096];
+	char node[4096];
+	int code, req;
+	unsigned int status;
+	short int pmtu, minmtu, maxmtu;
+	int udp_ping_rtt;
+	uint64_t in_packets, in_bytes, out_packets, out_bytes;
+
+	while(recvline(fd, line, sizeof(line))) {
+		int srtt = -1, jitter = 0;
+		unsigned int loss = 0;
+		int n = sscanf(line, "%d %d %4095s %*s %*s port %*s %*d %*d %*d %*d %*x %x %*s %*s %*d %hd %hd %hd %*d %d %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %d %*d %d %u", &code, &req, node, &status, &pmtu, &minmtu, &maxmtu, &udp_ping_rtt, &in_packets, &in_bytes, &out_packets, &out_bytes, &srtt, &jitter, &loss);
+
+		if(n == 2) {
+			return 0;
+		}
+
+		if(n != 12 && n != 15) {
+			fprintf(stderr, "Unable to parse node dump from tincd: %s\n", line);
+			return 1;
+		}
+
+		print_node_stats(node, status, pmtu, minmtu, maxmtu, in_packets, in_bytes, out_packets, out_bytes, udp_ping_rtt, srtt, jitter, loss);
+	}
+
+	fprintf(stderr, "Error receiving node dump from tincd.\n");
+	return 1;
+}
+
+/* Turn a filter into a BPF program. It is either the output of tcpdump -ddd,
+   or an expression that libpcap can compile. */
+
+static uint32_t compile_filter(const char *expression, uint32_t snaplen, bpf_insn_t **prog) {
+	if(!expression[strspn(expression, "0123456789, \t\r\n")]) {
+		uint32_t len = bpf_parse(expression, prog);
+
+		if(!len) {
+			fprintf(stderr, "Could not parse BPF program.\n");
+		}
+
+		return len;
+	}
+
+#ifdef HAVE_LIBPCAP
+	pcap_t *handle = pcap_open_dead(DLT_EN10MB, snaplen ? (int)snaplen : 65535);
+
+	if(!handle) {
+		fprintf(stderr, "Could not initialize libpcap.\n");
+		return 0;
+	}
+
+	struct bpf_program program;
+
+	if(pcap_compile(handle, &program, expression, 1, PCAP_NETMASK_UNKNOWN)) {
+		fprintf(stderr, "Invalid filter expression: %s\n", pcap_geterr(handle));
+		pcap_close(handle);
+		return 0;
+	}
+
+	uint32_t len = program.bf_len;
+	*prog = xzalloc(len * sizeof(**prog));
+
+	for(uint32_t i = 0; i < len; i++) {
+		(*prog)[i].code = program.bf_insns[i].code;
+		(*prog)[i].jt = program.bf_insns[i].jt;
+		(*prog)[i].jf = program.bf_insns[i].jf;
+		(*prog)[i].k = program.bf_insns[i].k;
+	}
+
+	pcap_freecode(&program);
+	pcap_close(handle);
+	return len;
+#else
+	(void)snaplen;
+	(void)prog;
+	fprintf(stderr, "This version of tinc cannot compile filter expressions, use the output of tcpdump -ddd instead.\n");
 	return 0;
+#endif
+}
+
+static int cmd_pcap(int argc, char *argv[]) {
+	uint32_t snaplen = 0;
+	int first = 1;
+
+	if(argc > 1 && argv[1][0] && !argv[1][strspn(argv[1], "0123456789")]) {
+		snaplen = atoi(argv[1]);
+		first = 2;
+	}
+
+	bpf_insn_t *filter = NULL;
+	uint32_t filter_len = 0;
+
+	if(argc > first) {
+		size_t size = 1;
+
+		for(int i = first; i < argc; i++) {
+			size += strlen(argv[i]) + 1;
+		}
+
+		char *expression = xzalloc(size);
+
+		for(int i = first; i < argc; i++) {
+			if(i > first) {
+				strcat(expression, " ");
+			}
+
+			strcat(expression, argv[i]);
+		}
+
+		filter_len = compile_filter(expression, snaplen, &filter);
+		free(expression);
+
+		if(!filter_len) {
+			return 1;
+		}
+
+		if(!bpf_check(filter, filter_len)) {
+			fprintf(stderr, "Invalid BPF program.\n");
+			free(filter);
+			return 1;
+		}
+	}
+
+	if(!connect_tincd(true)) {
+		free(filter);
+		return 1;
+	}
+
+	bool result = pcap(fd, stdout, snaplen, filter, filter_len);
+	free(filter);
+	return result ? 0 : 1;
 }
 
 #ifdef SIGINT
@@ -1529,6 +1892,74 @@ static int cmd_log(int argc, char *argv[]) {
 	return 0;
 }
 
+static const struct {
+	const char *name;
+	event_type_t type;
+} event_types[] = {
+	{"node", EVENT_NODE},
+	{"edge", EVENT_EDGE},
+	{"subnet", EVENT_SUBNET},
+	{"mtu", EVENT_MTU},
+	{"connection", EVENT_CONNECTION},
+};
+
+static int cmd_events(int argc, char *argv[]) {
+	unsigned int mask = 0;
+
+	for(int i = 1; i < argc; i++) {
+		size_t j;
+
+		for(j = 0; j < sizeof(event_types) / sizeof(*event_types); j++) {
+			if(!strcasecmp(argv[i], event_types[j].name)) {
+				mask |= event_types[j].type;
+				break;
+			}
+		}
+
+		if(j == sizeof(event_types) / sizeof(*event_types)) {
+			fprintf(stderr, "Unknown event type '%s'.\n", argv[i]);
+			usage(true);
+			return 1;
+		}
+	}
+
+	if(!connect_tincd(true)) {
+		return 1;
+	}
+
+	sendline(fd, "%d %d %u", CONTROL, REQ_SUBSCRIBE, mask ? mask : EVENT_ALL);
+
+	int result;
+
+	if(!recvline(fd, line, sizeof(line)) || sscanf(line, "%d %d %d", &code, &req, &result) != 3 || code != CONTROL || req != REQ_SUBSCRIBE || result) {
+		fprintf(stderr, "This version of tincd cannot send events.\n");
+		return 1;
+	}
+
+#ifdef SIGINT
+	signal(SIGINT, sigint_handler);
+#endif
+
+	while(recvline(fd, line, sizeof(line))) {
+		int offset = 0;
+
+		if(sscanf(line, "%d %d %n", &code, &req, &offset) != 2 || code != CONTROL || req != REQ_SUBSCRIBE || !offset) {
+			break;
+		}
+
+		printf("%s\n", line + offset);
+		fflush(stdout);
+	}
+
+#ifdef SIGINT
+	signal(SIGINT, SIG_DFL);
+#endif
+
+	closesocket(fd);
+	fd = -1;
+	return 0;
+}
+
 static int cmd_pid(int argc, char *argv[]) {
 	(void)argv;
 
@@ -1638,12 +2069,16 @@ ecdsa_t *get_pubkey(FILE *f) {
 
 const var_t variables[] = {
 	/* Server configuration */
+	{"AdaptiveCompression", VAR_SERVER | VAR_SAFE},
 	{"AddressFamily", VAR_SERVER | VAR_SAFE},
+	{"AsyncLogging", VAR_SERVER},
 	{"AutoConnect", VAR_SERVER | VAR_SAFE},
+	{"AutoConnectStrategy", VAR_SERVER | VAR_SAFE},
 	{"BindToAddress", VAR_SERVER | VAR_MULTIPLE},
 	{"BindToInterface", VAR_SERVER},
 	{"Broadcast", VAR_SERVER | VAR_SAFE},
 	{"BroadcastSubnet", VAR_SERVER | VAR_MULTIPLE | VAR_SAFE},
+	{"CompressionDictionary", VAR_SERVER},
 	{"ConnectTo", VAR_SERVER | VAR_MULTIPLE | VAR_SAFE},
 	{"DecrementTTL", VAR_SERVER | VAR_SAFE},
 	{"Device", VAR_SERVER},
@@ -1655,18 +2090,23 @@ const var_t variables[] = {
 	{"Forwarding", VAR_SERVER},
 	{"FWMark", VAR_SERVER},
 	{"GraphDumpFile", VAR_SERVER | VAR_OBSOLETE},
+	{"HandshakeThreads", VAR_SERVER},
 	{"Hostnames", VAR_SERVER},
 	{"IffOneQueue", VAR_SERVER},
 	{"Interface", VAR_SERVER},
 	{"InvitationExpire", VAR_SERVER},
+	{"KernelPMTUDiscovery", VAR_SERVER | VAR_SAFE},
 	{"KeyExpire", VAR_SERVER | VAR_SAFE},
+	{"LatencyRouting", VAR_SERVER | VAR_SAFE},
 	{"ListenAddress", VAR_SERVER | VAR_MULTIPLE},
 	{"LocalDiscovery", VAR_SERVER | VAR_SAFE},
 	{"LogLevel", VAR_SERVER},
+	{"LogRateLimit", VAR_SERVER},
 	{"MACExpire", VAR_SERVER | VAR_SAFE},
 	{"MaxConnectionBurst", VAR_SERVER | VAR_SAFE},
 	{"MaxOutputBufferSize", VAR_SERVER | VAR_SAFE},
 	{"MaxTimeout", VAR_SERVER | VAR_SAFE},
+	{"MetricsAddress", VAR_SERVER},
 	{"Mode", VAR_SERVER | VAR_SAFE},
 	{"Name", VAR_SERVER},
 	{"PingInterval", VAR_SERVER | VAR_SAFE},
@@ -1679,6 +2119,8 @@ const var_t variables[] = {
 	{"ReplayWindow", VAR_SERVER | VAR_SAFE},
 	{"ScriptsExtension", VAR_SERVER},
 	{"ScriptsInterpreter", VAR_SERVER},
+	{"SharedStatistics", VAR_SERVER},
+	{"SlowCallbackThreshold", VAR_SERVER},
 	{"StrictSubnets", VAR_SERVER | VAR_SAFE},
 	{"TunnelServer", VAR_SERVER | VAR_SAFE},
 	{"UDPDiscovery", VAR_SERVER | VAR_SAFE},
@@ -1709,6 +2151,7 @@ const var_t variables[] = {
 	{"Port", VAR_HOST},
 	{"PublicKey", VAR_HOST | VAR_OBSOLETE},
 	{"PublicKeyFile", VAR_SERVER | VAR_HOST | VAR_OBSOLETE},
+	{"StreamCompression", VAR_SERVER | VAR_HOST | VAR_SAFE},
 	{"Subnet", VAR_HOST | VAR_MULTIPLE | VAR_SAFE},
 	{"TCPOnly", VAR_SERVER | VAR_HOST | VAR_SAFE},
 	{"Weight", VAR_HOST | VAR_SAFE},
@@ -2978,8 +3421,10 @@ static const struct {
 	{"connect", cmd_connect, false},
 	{"disconnect", cmd_disconnect, false},
 	{"top", cmd_top, false},
+	{"stats", cmd_stats, false},
 	{"pcap", cmd_pcap, false},
 	{"log", cmd_log, false},
+	{"events", cmd_events, false},
 	{"pid", cmd_pid, false},
 	{"config", cmd_config, true},
 	{"add", cmd_config, false},
@@ -3032,7 +3477,7 @@ static char *complete_command(const char *text, int state) {
 }
 
 static char *complete_dump(const char *text, int state) {
-	const char *matches[] = {"reachable", "nodes", "edges", "subnets", "connections", "graph", NULL};
+	const char *matches[] = {"reachable", "nodes", "edges", "subnets", "connections", "graph", "stats", "traffic", "latency", "--json", NULL};
 	static int i;
 
 	if(!state) {
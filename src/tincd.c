@@ -403,6 +403,9 @@ int main(int argc, char **argv) {
 #ifdef HAVE_LZ4
 		        " comp_lz4"
 #endif
+#ifdef HAVE_ZSTD
+		        " comp_zstd"
+#endif
 #ifndef DISABLE_LEGACY
 		        " legacy_protocol"
 #endif
@@ -420,6 +423,9 @@ int main(int argc, char **argv) {
 #endif
 #ifdef ENABLE_VDE
 		        " vde"
+#endif
+#ifdef ENABLE_USDT
+		        " usdt"
 #endif
 		        "\n\n"
 		        "Copyright (C) 1998-2021 Ivo Timmermans, Guus Sliepen and others.\n"
@@ -618,6 +624,7 @@ end:
 	close_network_connections();
 
 	logger(DEBUG_ALWAYS, LOG_NOTICE, "Terminating");
+	logger_async(false);
 
 	free(priority);
 
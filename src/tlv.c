@@ -0,0 +1,357 @@
+#include "system.h"
+
+#include "tlv.h"
+#include "xalloc.h"
+
+#define MAX_VARINT_SIZE 10
+
+/* Same limit as MAX_STRING in protocol.h */
+#define MAX_ADDRESS_LEN 2048
+
+/* Address families as they appear on the wire, independent of the host's AF_* values */
+
+enum {
+	TLV_AF_UNSPEC = 0,
+	TLV_AF_INET = 4,
+	TLV_AF_INET6 = 6,
+	TLV_AF_UNKNOWN = 255,
+};
+
+static size_t varint_encode(uint8_t *buf, uint64_t value) {
+	size_t len = 0;
+
+	while(value >= 0x80) {
+		buf[len++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+
+	buf[len++] = (uint8_t)value;
+	return len;
+}
+
+static bool varint_decode(const uint8_t *buf, size_t len, uint64_t *value, size_t *used) {
+	uint64_t result = 0;
+
+	for(size_t i = 0; i < len && i < MAX_VARINT_SIZE; i++) {
+		uint64_t bits = buf[i] & 0x7f;
+
+		if(i == MAX_VARINT_SIZE - 1 && bits > 1) {
+			return false;
+		}
+
+		result |= bits << (7 * i);
+
+		if(!(buf[i] & 0x80)) {
+			*value = result;
+			*used = i + 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void tlv_writer_init(tlv_writer_t *out, void *buf, size_t size) {
+	out->data = buf;
+	out->size = size;
+	out->len = 0;
+	out->overflow = false;
+}
+
+// Reserve room for a field with a value of the given length, and return a pointer to where the value goes.
+
+static uint8_t *tlv_prepare(tlv_writer_t *out, uint8_t tag, size_t len) {
+	uint8_t header[1 + MAX_VARINT_SIZE];
+	header[0] = tag;
+	size_t headerlen = 1 + varint_encode(header + 1, len);
+
+	if(out->overflow || out->size - out->len < headerlen + len) {
+		out->overflow = true;
+		return NULL;
+	}
+
+	memcpy(out->data + out->len, header, headerlen);
+	uint8_t *value = out->data + out->len + headerlen;
+	out->len += headerlen + len;
+	return value;
+}
+
+void tlv_put_data(tlv_writer_t *out, uint8_t tag, const void *data, size_t len) {
+	uint8_t *value = tlv_prepare(out, tag, len);
+
+	if(value && len) {
+		memcpy(value, data, len);
+	}
+}
+
+void tlv_put_uint(tlv_writer_t *out, uint8_t tag, uint64_t value) {
+	uint8_t buf[MAX_VARINT_SIZE];
+	tlv_put_data(out, tag, buf, varint_encode(buf, value));
+}
+
+void tlv_put_string(tlv_writer_t *out, uint8_t tag, const char *str) {
+	tlv_put_data(out, tag, str, strlen(str));
+}
+
+void tlv_put_sockaddr(tlv_writer_t *out, uint8_t tag, const sockaddr_t *sa) {
+	uint8_t *value;
+
+	switch(sa->sa.sa_family) {
+	case AF_INET:
+		value = tlv_prepare(out, tag, 1 + 4 + 2);
+
+		if(value) {
+			value[0] = TLV_AF_INET;
+			memcpy(value + 1, &sa->in.sin_addr, 4);
+			memcpy(value + 5, &sa->in.sin_port, 2);
+		}
+
+		break;
+
+	case AF_INET6:
+		value = tlv_prepare(out, tag, 1 + 16 + 2 + 4);
+
+		if(value) {
+			uint32_t scope_id = htonl(sa->in6.sin6_scope_id);
+			value[0] = TLV_AF_INET6;
+			memcpy(value + 1, &sa->in6.sin6_addr, 16);
+			memcpy(value + 17, &sa->in6.sin6_port, 2);
+			memcpy(value + 19, &scope_id, 4);
+		}
+
+		break;
+
+	case AF_UNKNOWN: {
+		size_t addrlen = strlen(sa->unknown.address);
+		size_t portlen = strlen(sa->unknown.port);
+		value = tlv_prepare(out, tag, 1 + addrlen + 1 + portlen);
+
+		if(value) {
+			value[0] = TLV_AF_UNKNOWN;
+			memcpy(value + 1, sa->unknown.address, addrlen);
+			value[1 + addrlen] = 0;
+			memcpy(value + 2 + addrlen, sa->unknown.port, portlen);
+		}
+
+		break;
+	}
+
+	default:
+		value = tlv_prepare(out, tag, 1);
+
+		if(value) {
+			value[0] = TLV_AF_UNSPEC;
+		}
+
+		break;
+	}
+}
+
+void tlv_put_subnet(tlv_writer_t *out, uint8_t tag, const subnet_t *subnet) {
+	uint8_t buf[1 + 1 + sizeof(ipv6_t) + 4];
+	size_t len = 0;
+
+	buf[len++] = (uint8_t)subnet->type;
+
+	switch(subnet->type) {
+	case SUBNET_MAC:
+		memcpy(buf + len, &subnet->net.mac.address, sizeof(mac_t));
+		len += sizeof(mac_t);
+		break;
+
+	case SUBNET_IPV4:
+		buf[len++] = (uint8_t)subnet->net.ipv4.prefixlength;
+		memcpy(buf + len, &subnet->net.ipv4.address, sizeof(ipv4_t));
+		len += sizeof(ipv4_t);
+		break;
+
+	case SUBNET_IPV6:
+		buf[len++] = (uint8_t)subnet->net.ipv6.prefixlength;
+		memcpy(buf + len, &subnet->net.ipv6.address, sizeof(ipv6_t));
+		len += sizeof(ipv6_t);
+		break;
+
+	default:
+		out->overflow = true;
+		return;
+	}
+
+	uint32_t weight = htonl((uint32_t)subnet->weight);
+	memcpy(buf + len, &weight, 4);
+	len += 4;
+
+	tlv_put_data(out, tag, buf, len);
+}
+
+void tlv_reader_init(tlv_reader_t *in, const void *data, size_t len) {
+	in->data = data;
+	in->len = len;
+	in->pos = 0;
+	in->error = false;
+}
+
+// Get the next field. Returns false at the end of the input, or if the input is malformed.
+
+bool tlv_next(tlv_reader_t *in, tlv_t *field) {
+	if(in->error || in->pos >= in->len) {
+		return false;
+	}
+
+	const uint8_t *p = in->data + in->pos;
+	size_t left = in->len - in->pos;
+	uint64_t len;
+	size_t used;
+
+	if(left < 2 || !varint_decode(p + 1, left - 1, &len, &used) || len > left - 1 - used) {
+		in->error = true;
+		return false;
+	}
+
+	field->tag = p[0];
+	field->len = len;
+	field->value = p + 1 + used;
+	in->pos += 1 + used + len;
+	return true;
+}
+
+bool tlv_get_uint(const tlv_t *field, uint64_t *value) {
+	size_t used;
+	return varint_decode(field->value, field->len, value, &used) && used == field->len;
+}
+
+bool tlv_get_uint32(const tlv_t *field, uint32_t *value) {
+	uint64_t result;
+
+	if(!tlv_get_uint(field, &result) || result > UINT32_MAX) {
+		return false;
+	}
+
+	*value = (uint32_t)result;
+	return true;
+}
+
+bool tlv_get_string(const tlv_t *field, char *buf, size_t size) {
+	if(field->len >= size || memchr(field->value, 0, field->len)) {
+		return false;
+	}
+
+	memcpy(buf, field->value, field->len);
+	buf[field->len] = 0;
+	return true;
+}
+
+bool tlv_get_sockaddr(const tlv_t *field, sockaddr_t *sa) {
+	const uint8_t *value = field->value;
+
+	memset(sa, 0, sizeof(*sa));
+
+	if(!field->len) {
+		return false;
+	}
+
+	switch(value[0]) {
+	case TLV_AF_UNSPEC:
+		return field->len == 1;
+
+	case TLV_AF_INET:
+		if(field->len != 1 + 4 + 2) {
+			return false;
+		}
+
+		sa->in.sin_family = AF_INET;
+		memcpy(&sa->in.sin_addr, value + 1, 4);
+		memcpy(&sa->in.sin_port, value + 5, 2);
+		return true;
+
+	case TLV_AF_INET6: {
+		if(field->len != 1 + 16 + 2 + 4) {
+			return false;
+		}
+
+		uint32_t scope_id;
+		sa->in6.sin6_family = AF_INET6;
+		memcpy(&sa->in6.sin6_addr, value + 1, 16);
+		memcpy(&sa->in6.sin6_port, value + 17, 2);
+		memcpy(&scope_id, value + 19, 4);
+		sa->in6.sin6_scope_id = ntohl(scope_id);
+		return true;
+	}
+
+	case TLV_AF_UNKNOWN: {
+		const uint8_t *sep = memchr(value + 1, 0, field->len - 1);
+
+		if(!sep) {
+			return false;
+		}
+
+		size_t addrlen = sep - (value + 1);
+		size_t portlen = field->len - 2 - addrlen;
+
+		if(!addrlen || !portlen || memchr(sep + 1, 0, portlen) || addrlen > MAX_ADDRESS_LEN || portlen > MAX_ADDRESS_LEN) {
+			return false;
+		}
+
+		sa->unknown.family = AF_UNKNOWN;
+		sa->unknown.address = xzalloc(addrlen + 1);
+		memcpy(sa->unknown.address, value + 1, addrlen);
+		sa->unknown.port = xzalloc(portlen + 1);
+		memcpy(sa->unknown.port, sep + 1, portlen);
+		return true;
+	}
+
+	default:
+		return false;
+	}
+}
+
+bool tlv_get_subnet(const tlv_t *field, subnet_t *subnet) {
+	const uint8_t *value = field->value;
+	size_t len = field->len;
+
+	memset(subnet, 0, sizeof(*subnet));
+
+	if(len < 1 + 4) {
+		return false;
+	}
+
+	size_t netlen = len - 1 - 4;
+
+	switch(value[0]) {
+	case SUBNET_MAC:
+		if(netlen != sizeof(mac_t)) {
+			return false;
+		}
+
+		subnet->type = SUBNET_MAC;
+		memcpy(&subnet->net.mac.address, value + 1, sizeof(mac_t));
+		break;
+
+	case SUBNET_IPV4:
+		if(netlen != 1 + sizeof(ipv4_t) || value[1] > 32) {
+			return false;
+		}
+
+		subnet->type = SUBNET_IPV4;
+		subnet->net.ipv4.prefixlength = value[1];
+		memcpy(&subnet->net.ipv4.address, value + 2, sizeof(ipv4_t));
+		break;
+
+	case SUBNET_IPV6:
+		if(netlen != 1 + sizeof(ipv6_t) || value[1] > 128) {
+			return false;
+		}
+
+		subnet->type = SUBNET_IPV6;
+		subnet->net.ipv6.prefixlength = value[1];
+		memcpy(&subnet->net.ipv6.address, value + 2, sizeof(ipv6_t));
+		break;
+
+	default:
+		return false;
+	}
+
+	uint32_t weight;
+	memcpy(&weight, value + len - 4, 4);
+	subnet->weight = (int)ntohl(weight);
+	return true;
+}
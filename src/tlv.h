@@ -0,0 +1,53 @@
+#ifndef TINC_TLV_H
+#define TINC_TLV_H
+
+#include "system.h"
+
+#include "net.h"
+#include "subnet.h"
+
+/* Compact binary encoding for meta protocol requests.
+
+   A message is a sequence of fields, each consisting of a one byte tag,
+   a varint length and the value. Integers are stored as varints,
+   strings without their terminating NUL byte. The first field of
+   every request carries the request number in tag TLV_REQUEST. */
+
+#define TLV_REQUEST 0
+
+typedef struct tlv_writer_t {
+	uint8_t *data;
+	size_t size;
+	size_t len;
+	bool overflow;                  /* set if a field did not fit */
+} tlv_writer_t;
+
+typedef struct tlv_reader_t {
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+	bool error;                     /* set if the input was truncated or malformed */
+} tlv_reader_t;
+
+typedef struct tlv_t {
+	uint8_t tag;
+	size_t len;
+	const uint8_t *value;
+} tlv_t;
+
+extern void tlv_writer_init(tlv_writer_t *out, void *buf, size_t size);
+extern void tlv_put_uint(tlv_writer_t *out, uint8_t tag, uint64_t value);
+extern void tlv_put_data(tlv_writer_t *out, uint8_t tag, const void *data, size_t len);
+extern void tlv_put_string(tlv_writer_t *out, uint8_t tag, const char *str);
+extern void tlv_put_sockaddr(tlv_writer_t *out, uint8_t tag, const sockaddr_t *sa);
+extern void tlv_put_subnet(tlv_writer_t *out, uint8_t tag, const subnet_t *subnet);
+
+extern void tlv_reader_init(tlv_reader_t *in, const void *data, size_t len);
+extern bool tlv_next(tlv_reader_t *in, tlv_t *field);
+extern bool tlv_get_uint(const tlv_t *field, uint64_t *value);
+extern bool tlv_get_uint32(const tlv_t *field, uint32_t *value);
+extern bool tlv_get_string(const tlv_t *field, char *buf, size_t size);
+extern bool tlv_get_sockaddr(const tlv_t *field, sockaddr_t *sa);
+extern bool tlv_get_subnet(const tlv_t *field, subnet_t *subnet);
+
+#endif // TINC_TLV_H
@@ -27,6 +27,7 @@
 #include "control_common.h"
 #include "list.h"
 #include "names.h"
+#include "stats_shm.h"
 #include "tincctl.h"
 #include "top.h"
 #include "xalloc.h"
@@ -42,6 +43,9 @@ typedef struct nodestats_t {
 	float in_bytes_rate;
 	float out_packets_rate;
 	float out_bytes_rate;
+	int srtt;
+	int jitter;
+	unsigned int loss;
 	bool known;
 } nodestats_t;
 
@@ -53,6 +57,8 @@ static const char *const sortname[] = {
 	"out bytes",
 	"tot pkts",
 	"tot bytes",
+	"rtt",
+	"loss",
 };
 
 static int sortmode = 0;
@@ -67,16 +73,76 @@ static float bscale = 1;
 static const char *punit = "pkts";
 static float pscale = 1;
 
-static bool update(int fd) {
-	if(!sendline(fd, "%d %d", CONTROL, REQ_DUMP_TRAFFIC)) {
-		return false;
-	}
+static float interval;
+static list_node_t *cursor;
 
+static void begin_update(void) {
 	gettimeofday(&cur, NULL);
 
 	timersub(&cur, &prev, &diff);
 	prev = cur;
-	float interval = (float) diff.tv_sec + (float) diff.tv_usec * 1e-6f;
+	interval = (float) diff.tv_sec + (float) diff.tv_usec * 1e-6f;
+
+	for list_each(nodestats_t, ns, &node_list) {
+		ns->known = false;
+	}
+
+	cursor = node_list.head;
+}
+
+static void update_node(const char *name, uint64_t in_packets, uint64_t in_bytes, uint64_t out_packets, uint64_t out_bytes, int srtt, int jitter, unsigned int loss) {
+	nodestats_t *found = NULL;
+
+	// Nodes arrive sorted by name, so continue searching where the previous one was found
+
+	for(; cursor; cursor = cursor->next) {
+		nodestats_t *ns = cursor->data;
+		int result = strcmp(name, ns->name);
+
+		if(result > 0) {
+			continue;
+		}
+
+		if(result == 0) {
+			found = ns;
+			cursor = cursor->next;
+		} else {
+			found = xzalloc(sizeof(*found));
+			found->name = xstrdup(name);
+			list_insert_before(&node_list, cursor, found);
+			changed = true;
+		}
+
+		break;
+	}
+
+	if(!found) {
+		found = xzalloc(sizeof(*found));
+		found->name = xstrdup(name);
+		list_insert_tail(&node_list, found);
+		changed = true;
+	}
+
+	found->known = true;
+	found->in_packets_rate = (float)(in_packets - found->in_packets) / interval;
+	found->in_bytes_rate = (float)(in_bytes - found->in_bytes) / interval;
+	found->out_packets_rate = (float)(out_packets - found->out_packets) / interval;
+	found->out_bytes_rate = (float)(out_bytes - found->out_bytes) / interval;
+	found->in_packets = in_packets;
+	found->in_bytes = in_bytes;
+	found->out_packets = out_packets;
+	found->out_bytes = out_bytes;
+	found->srtt = srtt;
+	found->jitter = jitter;
+	found->loss = loss;
+}
+
+static bool update(int fd) {
+	if(!sendline(fd, "%d %d", CONTROL, REQ_DUMP_TRAFFIC)) {
+		return false;
+	}
+
+	begin_update();
 
 	char line[4096];
 	char name[4096];
@@ -87,61 +153,46 @@ static bool update(int fd) {
 	uint64_t out_packets;
 	uint64_t out_bytes;
 
-	for list_each(nodestats_t, ns, &node_list) {
-		ns->known = false;
-	}
-
 	while(recvline(fd, line, sizeof(line))) {
-		int n = sscanf(line, "%d %d %4095s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64, &code, &req, name, &in_packets, &in_bytes, &out_packets, &out_bytes);
+		// Old versions of tincd do not send the compression statistics and link quality
+		int srtt = -1, jitter = 0;
+		unsigned int loss = 0;
+		int n = sscanf(line, "%d %d %4095s %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %*u %*u %*u %*u %*u %*u %*u %d %d %u", &code, &req, name, &in_packets, &in_bytes, &out_packets, &out_bytes, &srtt, &jitter, &loss);
 
 		if(n == 2) {
 			return true;
 		}
 
-		if(n != 7) {
+		if(n != 7 && n != 10) {
 			return false;
 		}
 
-		nodestats_t *found = NULL;
+		update_node(name, in_packets, in_bytes, out_packets, out_bytes, srtt, jitter, loss);
+	}
 
-		for list_each(nodestats_t, ns, &node_list) {
-			int result = strcmp(name, ns->name);
+	return false;
+}
 
-			if(result > 0) {
-				continue;
-			}
+// Read the counters from the shared statistics file instead of asking tincd
 
-			if(result == 0) {
-				found = ns;
-				break;
-			} else {
-				found = xzalloc(sizeof(*found));
-				found->name = xstrdup(name);
-				list_insert_before(&node_list, node, found);
-				changed = true;
-				break;
-			}
-		}
+static bool update_shm(stats_shm_t *shm) {
+	uint32_t count = stats_shm_count(shm);
 
-		if(!found) {
-			found = xzalloc(sizeof(*found));
-			found->name = xstrdup(name);
-			list_insert_tail(&node_list, found);
-			changed = true;
-		}
+	if(!count) {
+		return false;
+	}
+
+	begin_update();
 
-		found->known = true;
-		found->in_packets_rate = (float)(in_packets - found->in_packets) / interval;
-		found->in_bytes_rate = (float)(in_bytes - found->in_bytes) / interval;
-		found->out_packets_rate = (float)(out_packets - found->out_packets) / interval;
-		found->out_bytes_rate = (float)(out_bytes - found->out_bytes) / interval;
-		found->in_packets = in_packets;
-		found->in_bytes = in_bytes;
-		found->out_packets = out_packets;
-		found->out_bytes = out_bytes;
+	for(uint32_t i = 0; i < count; i++) {
+		stats_shm_data_t data;
+
+		if(stats_shm_read(shm, i, &data)) {
+			update_node(data.name, data.in_packets, data.in_bytes, data.out_packets, data.out_bytes, data.srtt, data.jitter, data.loss);
+		}
 	}
 
-	return false;
+	return true;
 }
 
 static int cmpfloat(float a, float b) {
@@ -164,6 +215,16 @@ static int cmpu64(uint64_t a, uint64_t b) {
 	}
 }
 
+static int cmpint(int a, int b) {
+	if(a < b) {
+		return -1;
+	} else if(a > b) {
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
 static int sortfunc(const void *a, const void *b) {
 	const nodestats_t *na = *(const nodestats_t **)a;
 	const nodestats_t *nb = *(const nodestats_t **)b;
@@ -224,6 +285,14 @@ static int sortfunc(const void *a, const void *b) {
 
 		break;
 
+	case 7:
+		result = -cmpint(na->srtt, nb->srtt);
+		break;
+
+	case 8:
+		result = -cmpint((int)na->loss, (int)nb->loss);
+		break;
+
 	default:
 		result = strcmp(na->name, nb->name);
 		break;
@@ -241,7 +310,7 @@ static void redraw(void) {
 
 	mvprintw(0, 0, "Tinc %-16s  Nodes: %4d  Sort: %-10s  %s", netname ? netname : "", node_list.count, sortname[sortmode], cumulative ? "Cumulative" : "Current");
 	attrset(A_REVERSE);
-	mvprintw(2, 0, "Node                IN %s   IN %s   OUT %s  OUT %s", punit, bunit, punit, bunit);
+	mvprintw(2, 0, "Node                IN %s   IN %s   OUT %s  OUT %s    RTT ms   JITTER LOSS %%", punit, bunit, punit, bunit);
 	chgat(-1, A_REVERSE, 0, NULL);
 
 	static nodestats_t **sorted = 0;
@@ -285,6 +354,12 @@ static void redraw(void) {
 		else
 			mvprintw(row, 0, "%-16s %10.0f %10.0f %10.0f %10.0f",
 			         node->name, node->in_packets_rate * pscale, node->in_bytes_rate * bscale, node->out_packets_rate * pscale, node->out_bytes_rate * bscale);
+
+		if(node->srtt != -1) {
+			printw(" %8.3f %8.3f %6.2f", (float) node->srtt * 1e-3f, (float) node->jitter * 1e-3f, (float) node->loss * 1e-4f);
+		} else {
+			printw(" %8s %8s %6s", "-", "-", "-");
+		}
 	}
 
 	attrset(A_NORMAL);
@@ -293,13 +368,13 @@ static void redraw(void) {
 	refresh();
 }
 
-void top(int fd) {
+void top(int fd, stats_shm_t *shm) {
 	initscr();
 	timeout(delay);
 	bool running = true;
 
 	while(running) {
-		if(!update(fd)) {
+		if(shm ? !update_shm(shm) : !update(fd)) {
 			break;
 		}
 
@@ -353,6 +428,14 @@ void top(int fd) {
 			sortmode = 5;
 			break;
 
+		case 'r':
+			sortmode = 7;
+			break;
+
+		case 'l':
+			sortmode = 8;
+			break;
+
 		case 'b':
 			bunit = "bytes";
 			bscale = 1;
@@ -20,6 +20,9 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
-extern void top(int fd);
+#include "stats_shm.h"
+
+/* Show statistics from the shared statistics file if shm is not NULL, otherwise ask tincd over fd */
+extern void top(int fd, stats_shm_t *shm);
 
 #endif
@@ -0,0 +1,28 @@
+#ifndef TINC_TRACE_H
+#define TINC_TRACE_H
+
+#include "system.h"
+
+/* Static tracepoints for bpftrace, perf probe and SystemTap, all under the
+   "tinc" provider. A probe is a single nop instruction plus a note in the ELF
+   file, and its arguments are only evaluated when tinc is built with -Dusdt.
+   Without it, the macros expand to nothing at all. See doc/bpftrace/ for
+   examples and a list of all the probes. */
+
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+
+#define TRACE0(name) DTRACE_PROBE(tinc, name)
+#define TRACE1(name, a) DTRACE_PROBE1(tinc, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(tinc, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(tinc, name, a, b, c)
+#define TRACE4(name, a, b, c, d) DTRACE_PROBE4(tinc, name, a, b, c, d)
+#else
+#define TRACE0(name) do {} while(0)
+#define TRACE1(name, a) do {} while(0)
+#define TRACE2(name, a, b) do {} while(0)
+#define TRACE3(name, a, b, c) do {} while(0)
+#define TRACE4(name, a, b, c, d) do {} while(0)
+#endif
+
+#endif // TINC_TRACE_H
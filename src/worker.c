@@ -0,0 +1,268 @@
+#include "system.h"
+
+#include "logger.h"
+#include "worker.h"
+
+static void wake_event_loop(worker_pool_t *pool) {
+#ifdef HAVE_WINDOWS
+	WSASetEvent(pool->event);
+#else
+
+	if(write(pool->wakefd[1], "", 1) != 1) {
+		// The pipe is full, so the event loop will wake up anyway
+	}
+
+#endif
+}
+
+static void *worker_thread(void *arg) {
+	worker_pool_t *pool = arg;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while(!pool->stopping) {
+		if(!pool->queue_head) {
+			pool->idle_threads++;
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			pool->idle_threads--;
+			continue;
+		}
+
+		// Take our share of the queue, or just one job if they can't be batched
+
+		worker_job_t *batch[WORKER_BATCH_MAX];
+		size_t count = 0;
+		size_t max = 1;
+
+		if(pool->work_batch) {
+			max = MIN(WORKER_BATCH_MAX, MAX(1, pool->queued / (size_t)pool->threads));
+		}
+
+		while(pool->queue_head && count < max) {
+			batch[count] = pool->queue_head;
+			pool->queue_head = batch[count]->next;
+			count++;
+		}
+
+		if(!pool->queue_head) {
+			pool->queue_tail = NULL;
+		}
+
+		pool->queued -= count;
+		pthread_mutex_unlock(&pool->lock);
+
+		if(pool->work_batch) {
+			pool->work_batch(batch, count);
+		} else {
+			batch[0]->work(batch[0]);
+		}
+
+		pthread_mutex_lock(&pool->lock);
+
+		// Nobody is going to call done() anymore
+
+		if(pool->stopping) {
+			for(size_t i = 0; i < count; i++) {
+				batch[i]->discard(batch[i]);
+			}
+
+			break;
+		}
+
+		if(!pool->done) {
+			wake_event_loop(pool);
+		}
+
+		for(size_t i = 0; i < count; i++) {
+			batch[i]->next = pool->done;
+			pool->done = batch[i];
+		}
+	}
+
+	pool->threads--;
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static void worker_handler(void *data, int flags) {
+	(void)flags;
+	worker_pool_t *pool = data;
+
+#ifdef HAVE_WINDOWS
+	WSAResetEvent(pool->event);
+#else
+	char buf[64];
+
+	while(read(pool->wakefd[0], buf, sizeof(buf)) > 0) {
+		// Drain the pipe
+	}
+
+#endif
+
+	pthread_mutex_lock(&pool->lock);
+	worker_job_t *list = pool->done;
+	pool->done = NULL;
+	pthread_mutex_unlock(&pool->lock);
+
+	// The list is in reverse order, but jobs are independent of each other anyway
+
+	while(list) {
+		worker_job_t *job = list;
+		list = job->next;
+		job->next = NULL;
+
+		struct timeval now, latency;
+		gettimeofday(&now, NULL);
+		timersub(&now, &job->submitted, &latency);
+		uint64_t usec = (uint64_t)latency.tv_sec * 1000000 + latency.tv_usec;
+
+		pool->stats.depth--;
+		pool->stats.jobs++;
+		pool->stats.latency_total += usec;
+
+		if(usec > pool->stats.latency_max) {
+			pool->stats.latency_max = usec;
+		}
+
+		job->done(job);
+	}
+}
+
+static bool init_wakeup(worker_pool_t *pool) {
+	if(pool->io.cb) {
+		return true;
+	}
+
+#ifdef HAVE_WINDOWS
+	pool->event = WSACreateEvent();
+
+	if(pool->event == WSA_INVALID_EVENT) {
+		return false;
+	}
+
+	io_add_event(&pool->io, worker_handler, pool, pool->event);
+#else
+
+	if(pipe(pool->wakefd)) {
+		return false;
+	}
+
+	for(int i = 0; i < 2; i++) {
+		fcntl(pool->wakefd[i], F_SETFL, fcntl(pool->wakefd[i], F_GETFL) | O_NONBLOCK);
+#ifdef FD_CLOEXEC
+		fcntl(pool->wakefd[i], F_SETFD, FD_CLOEXEC);
+#endif
+	}
+
+	io_add(&pool->io, worker_handler, pool, pool->wakefd[0], IO_READ);
+#endif
+
+	return true;
+}
+
+// Start another thread if all existing ones are busy. Returns false if there are no threads at all.
+
+static bool start_thread(worker_pool_t *pool) {
+	if(pool->stopping || !init_wakeup(pool)) {
+		return false;
+	}
+
+	if(pool->idle_threads > 0 || pool->threads >= pool->max_threads) {
+		return pool->threads > 0;
+	}
+
+	// The threads must not handle signals meant for the event loop
+
+#ifndef HAVE_WINDOWS
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+#endif
+
+	pthread_t thread;
+	int error = pthread_create(&thread, NULL, worker_thread, pool);
+
+#ifndef HAVE_WINDOWS
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+#endif
+
+	if(error) {
+		logger(DEBUG_ALWAYS, LOG_ERR, "Unable to start %s thread: [%d] %s", pool->name, error, strerror(error));
+		return pool->threads > 0;
+	}
+
+	pthread_detach(thread);
+	pool->threads++;
+	return true;
+}
+
+bool worker_submit(worker_pool_t *pool, worker_job_t *job) {
+	pthread_mutex_lock(&pool->lock);
+
+	if(!start_thread(pool)) {
+		pthread_mutex_unlock(&pool->lock);
+		return false;
+	}
+
+	gettimeofday(&job->submitted, NULL);
+	job->next = NULL;
+
+	if(pool->queue_tail) {
+		pool->queue_tail->next = job;
+	} else {
+		pool->queue_head = job;
+	}
+
+	pool->queue_tail = job;
+	pool->queued++;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	if(++pool->stats.depth > pool->stats.max_depth) {
+		pool->stats.max_depth = pool->stats.depth;
+	}
+
+	return true;
+}
+
+// Stop the pool. Threads might be blocked for a long time, so don't wait for them.
+
+void worker_stop(worker_pool_t *pool) {
+	pthread_mutex_lock(&pool->lock);
+
+	pool->stopping = true;
+
+	worker_job_t *queued = pool->queue_head;
+	worker_job_t *done = pool->done;
+	pool->queue_head = pool->queue_tail = pool->done = NULL;
+	pool->queued = 0;
+
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for(worker_job_t *job = queued, *next; job; job = next) {
+		next = job->next;
+		job->discard(job);
+	}
+
+	for(worker_job_t *job = done, *next; job; job = next) {
+		next = job->next;
+		job->discard(job);
+	}
+
+	pool->stats.depth = 0;
+
+	// Threads that are still running discard their jobs without waking us up, so it is safe to close the pipe
+
+	if(pool->io.cb) {
+		io_del(&pool->io);
+#ifdef HAVE_WINDOWS
+		WSACloseEvent(pool->event);
+		pool->event = WSA_INVALID_EVENT;
+#else
+		close(pool->wakefd[0]);
+		close(pool->wakefd[1]);
+		pool->wakefd[0] = pool->wakefd[1] = -1;
+#endif
+	}
+}
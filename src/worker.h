@@ -0,0 +1,88 @@
+#ifndef TINC_WORKER_H
+#define TINC_WORKER_H
+
+#include "system.h"
+
+#include <pthread.h>
+
+#include "event.h"
+
+/* Pools of threads that do slow work, like DNS lookups or public key
+   operations, outside of the event loop.
+
+   A job's work() function is called in one of the pool's threads. When it
+   returns, done() is called from the event loop. If the pool is stopped
+   before that happens, discard() is called instead, possibly from a worker
+   thread, so it must not touch anything but the job itself.
+
+   If the pool has a work_batch() function, it is called instead of work()
+   with several jobs at once when more jobs are queued than there are
+   threads, so the work can be shared between them. */
+
+typedef struct worker_job_t worker_job_t;
+typedef void (*worker_cb_t)(worker_job_t *job);
+
+struct worker_job_t {
+	worker_job_t *next;
+	worker_cb_t work;
+	worker_cb_t done;
+	worker_cb_t discard;
+	struct timeval submitted;
+};
+
+typedef void (*worker_batch_cb_t)(worker_job_t **jobs, size_t count);
+
+/* Maximum number of jobs passed to work_batch() */
+#define WORKER_BATCH_MAX 16
+
+typedef struct worker_stats_t {
+	unsigned int depth;             /* jobs submitted but not done yet */
+	unsigned int max_depth;
+	unsigned long jobs;             /* jobs done */
+	uint64_t latency_total;         /* microseconds from submission until done() was called */
+	uint64_t latency_max;
+} worker_stats_t;
+
+typedef struct worker_pool_t {
+	const char *name;
+	int max_threads;
+	worker_batch_cb_t work_batch;
+	worker_stats_t stats;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	worker_job_t *queue_head;
+	worker_job_t *queue_tail;
+	size_t queued;
+	worker_job_t *done;
+	int threads;
+	int idle_threads;
+	bool stopping;
+
+	io_t io;
+#ifdef HAVE_WINDOWS
+	WSAEVENT event;
+#else
+	int wakefd[2];
+#endif
+} worker_pool_t;
+
+#ifdef HAVE_WINDOWS
+#define WORKER_WAKEUP_INIT .event = WSA_INVALID_EVENT
+#else
+#define WORKER_WAKEUP_INIT .wakefd = {-1, -1}
+#endif
+
+#define WORKER_POOL_INIT(poolname, threads) { \
+	.name = poolname, \
+	.max_threads = threads, \
+	.lock = PTHREAD_MUTEX_INITIALIZER, \
+	.cond = PTHREAD_COND_INITIALIZER, \
+	WORKER_WAKEUP_INIT, \
+}
+
+/* Returns false if the pool has no threads, the caller should then do the work itself. */
+extern bool worker_submit(worker_pool_t *pool, worker_job_t *job);
+extern void worker_stop(worker_pool_t *pool);
+
+#endif // TINC_WORKER_H
@@ -63,6 +63,7 @@ def get_levels(features: T.Container[Feature]) -> T.Tuple[T.List[int], T.List[in
         (Feature.COMP_ZLIB, 1, 9),
         (Feature.COMP_LZO, 10, 11),
         (Feature.COMP_LZ4, 12, 12),
+        (Feature.COMP_ZSTD, 13, 13),
     ):
         lvls = range(lvl_min, lvl_max + 1)
         if comp in features:
@@ -112,8 +113,8 @@ def init(ctx: Test) -> T.Tuple[Tinc, Tinc]:
     return foo, bar
 
 
-def test_valid_level(foo: Tinc, bar: Tinc) -> None:
-    """Test that supported compression level works correctly."""
+def test_transfer(foo: Tinc, bar: Tinc) -> None:
+    """Test that data sent from bar arrives at foo."""
     while True:
         env = foo[Script.SUBNET_UP].wait().env
         if env.get("SUBNET") == bar.address:
@@ -140,6 +141,17 @@ def test_valid_level(foo: Tinc, bar: Tinc) -> None:
     check.equals(CONTENT, recv.rstrip())
 
 
+def test_valid_level(foo: Tinc, bar: Tinc) -> None:
+    """Test that supported compression level works correctly."""
+    test_transfer(foo, bar)
+
+    # Only bar was restarted with the new level, so only foo compresses what it sends
+    log.info("check compression statistics")
+    out, _ = foo.cmd("dump", "traffic")
+    line = next(line for line in out.splitlines() if line.startswith(f"{bar} "))
+    check.is_in("compression ratio", line)
+
+
 def test_bogus_level(node: Tinc) -> None:
     """Test that unsupported compression level fails to start."""
     tincd = node.tincd()
@@ -163,6 +175,24 @@ def run_tests() -> None:
             test_valid_level(foo, bar)
             bar.cmd("stop")
 
+    if Feature.COMP_ZSTD in node.features:
+        with Test("stream compression") as ctx:
+            foo, bar = init(ctx)
+            for node in foo, bar:
+                node.cmd("set", "StreamCompression", "yes")
+            foo.cmd("reload")
+
+            # Make foo send packets to bar over the compressed meta connection
+            bar.cmd("set", "TCPOnly", "yes")
+            bar.cmd("start")
+            test_transfer(foo, bar)
+
+            out, _ = foo.cmd("dump", "connections")
+            line = next(line for line in out.splitlines() if line.startswith(f"{bar} "))
+            options = int(line.split(" options ")[1].split()[0], 16)
+            check.true(options & 0x10)
+            bar.cmd("stop")
+
     with Test("test bogus levels") as ctx:
         node = ctx.node()
         for level in bogus:
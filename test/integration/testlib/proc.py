@@ -42,6 +42,7 @@ class Feature(Enum):
     COMP_LZ4 = "comp_lz4"
     COMP_LZO = "comp_lzo"
     COMP_ZLIB = "comp_zlib"
+    COMP_ZSTD = "comp_zstd"
     CURSES = "curses"
     JUMBOGRAMS = "jumbograms"
     LEGACY_PROTOCOL = "legacy_protocol"
@@ -0,0 +1,138 @@
+#include "unittest.h"
+#include "../../src/autoconnect.h"
+#include "../../src/node.h"
+#include "../../src/xalloc.h"
+
+#define NODES 500
+
+static node_t *nodes[NODES];
+
+static int setup(void **state) {
+	(void)state;
+
+	myself = new_node();
+
+	for(int i = 0; i < NODES; i++) {
+		nodes[i] = new_node();
+	}
+
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	for(int i = 0; i < NODES; i++) {
+		free_node(nodes[i]);
+	}
+
+	free_node(myself);
+	myself = NULL;
+	autoconnect_exit();
+	return 0;
+}
+
+static bool unconnected(const node_t *n) {
+	return n != myself && !n->connection && (n->status.has_address || n->status.reachable);
+}
+
+static bool unreachable(const node_t *n) {
+	return n != myself && !n->connection && n->status.has_address && !n->status.reachable;
+}
+
+/* Every node must be in a set exactly when it matches, and positions must be unique */
+
+static void check_sets(void) {
+	bool used[2][NODES + 1] = {{false}};
+	uint32_t members[2] = {0, 0};
+
+	for(int i = 0; i < NODES; i++) {
+		node_t *n = nodes[i];
+		bool match[2] = {unconnected(n), unreachable(n)};
+
+		for(int set = 0; set < 2; set++) {
+			uint32_t index = n->autoconnect_index[set];
+			assert_int_equal(match[set], index != 0);
+
+			if(index) {
+				assert_true(index <= NODES);
+				assert_false(used[set][index]);
+				used[set][index] = true;
+				members[set]++;
+			}
+		}
+	}
+
+	// Positions are dense, so a random position always hits a member
+
+	for(int set = 0; set < 2; set++) {
+		for(uint32_t index = 1; index <= members[set]; index++) {
+			assert_true(used[set][index]);
+		}
+	}
+
+	assert_int_equal(0, myself->autoconnect_index[0]);
+	assert_int_equal(0, myself->autoconnect_index[1]);
+}
+
+static void test_sets_follow_node_state(void **state) {
+	(void)state;
+
+	connection_t *c = xzalloc(sizeof(*c));
+
+	myself->status.has_address = true;
+	myself->status.reachable = true;
+	autoconnect_update(myself);
+
+	srand(1);
+
+	for(int round = 0; round < 20000; round++) {
+		node_t *n = nodes[rand() % NODES];
+
+		switch(rand() % 3) {
+		case 0:
+			n->status.has_address = !n->status.has_address;
+			break;
+
+		case 1:
+			n->status.reachable = !n->status.reachable;
+			break;
+
+		default:
+			n->connection = n->connection ? NULL : c;
+			break;
+		}
+
+		autoconnect_update(n);
+
+		if(round % 100 == 0) {
+			check_sets();
+		}
+	}
+
+	check_sets();
+
+	// Forgotten nodes leave the sets without disturbing the others
+
+	for(int i = 0; i < NODES; i += 2) {
+		autoconnect_forget(nodes[i]);
+		nodes[i]->status.has_address = false;
+		nodes[i]->status.reachable = false;
+	}
+
+	check_sets();
+
+	for(int i = 0; i < NODES; i++) {
+		nodes[i]->connection = NULL;
+	}
+
+	free(c);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_sets_follow_node_state, setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,184 @@
+#include "unittest.h"
+#include "../../src/bpf.h"
+
+// Output of tcpdump -ddd "ip and tcp dst port 80"
+static const char *http_program =
+        "11\n"
+        "40 0 0 12\n"
+        "21 0 8 2048\n"
+        "48 0 0 23\n"
+        "21 0 6 6\n"
+        "40 0 0 20\n"
+        "69 4 0 8191\n"
+        "177 0 0 14\n"
+        "72 0 0 16\n"
+        "21 0 1 80\n"
+        "6 0 0 262144\n"
+        "6 0 0 0\n";
+
+static void make_packet(uint8_t packet[54], uint16_t port) {
+	memset(packet, 0, 54);
+	packet[12] = 0x08;      // IPv4
+	packet[14] = 0x45;      // 20 byte header
+	packet[23] = 6;         // TCP
+	packet[36] = port >> 8;
+	packet[37] = port & 0xff;
+}
+
+static void test_bpf_parse(void **state) {
+	(void)state;
+
+	bpf_insn_t *prog = NULL;
+	assert_int_equal(11, bpf_parse(http_program, &prog));
+	assert_int_equal(40, prog[0].code);
+	assert_int_equal(12, prog[0].k);
+	assert_int_equal(8, prog[1].jf);
+	assert_int_equal(262144, prog[9].k);
+	free(prog);
+
+	// Commas are accepted as separators too
+
+	assert_int_equal(1, bpf_parse("1,6 0 0 65535", &prog));
+	assert_int_equal(65535, prog[0].k);
+	free(prog);
+
+	assert_int_equal(0, bpf_parse("", &prog));
+	assert_int_equal(0, bpf_parse("0", &prog));
+	assert_int_equal(0, bpf_parse("2\n6 0 0 0\n", &prog));
+	assert_int_equal(0, bpf_parse("1\n6 0 0 0 6\n", &prog));
+	assert_int_equal(0, bpf_parse("1\n6 0 256 0\n", &prog));
+	assert_int_equal(0, bpf_parse("1\n6 0 0 x\n", &prog));
+}
+
+static void test_bpf_run(void **state) {
+	(void)state;
+
+	bpf_insn_t *prog = NULL;
+	uint32_t len = bpf_parse(http_program, &prog);
+	assert_true(bpf_check(prog, len));
+
+	uint8_t packet[54];
+
+	make_packet(packet, 80);
+	assert_int_equal(262144, bpf_run(prog, packet, sizeof(packet)));
+
+	make_packet(packet, 443);
+	assert_int_equal(0, bpf_run(prog, packet, sizeof(packet)));
+
+	// Fragments do not have a TCP header
+
+	make_packet(packet, 80);
+	packet[21] = 1;
+	assert_int_equal(0, bpf_run(prog, packet, sizeof(packet)));
+
+	// Loads past the end of the packet reject it
+
+	make_packet(packet, 80);
+	assert_int_equal(0, bpf_run(prog, packet, 37));
+	assert_int_equal(262144, bpf_run(prog, packet, 38));
+
+	free(prog);
+}
+
+static void test_bpf_alu(void **state) {
+	(void)state;
+
+	// Return the packet length times three, divided by a value from memory
+	const bpf_insn_t prog[] = {
+		{BPF_LD | BPF_W | BPF_LEN, 0, 0, 0},
+		{BPF_ALU | BPF_MUL | BPF_K, 0, 0, 3},
+		{BPF_LDX | BPF_W | BPF_MEM, 0, 0, 1},
+		{BPF_ALU | BPF_DIV | BPF_X, 0, 0, 0},
+		{BPF_RET | BPF_A, 0, 0, 0},
+	};
+
+	uint8_t packet[10] = {0};
+
+	assert_true(bpf_check(prog, 5));
+
+	// Memory starts out zeroed, so this divides by zero
+	assert_int_equal(0, bpf_run(prog, packet, sizeof(packet)));
+
+	// Store 2 first, and jump over a return
+	const bpf_insn_t prog2[] = {
+		{BPF_LD | BPF_IMM, 0, 0, 2},
+		{BPF_ST, 0, 0, 1},
+		{BPF_LD | BPF_W | BPF_LEN, 0, 0, 0},
+		{BPF_ALU | BPF_MUL | BPF_K, 0, 0, 3},
+		{BPF_LDX | BPF_W | BPF_MEM, 0, 0, 1},
+		{BPF_ALU | BPF_DIV | BPF_X, 0, 0, 0},
+		{BPF_JMP | BPF_JA, 0, 0, 1},
+		{BPF_RET | BPF_K, 0, 0, 0},
+		{BPF_RET | BPF_A, 0, 0, 0},
+	};
+
+	assert_true(bpf_check(prog2, 9));
+	assert_int_equal(15, bpf_run(prog2, packet, sizeof(packet)));
+}
+
+static void test_bpf_check(void **state) {
+	(void)state;
+
+	const bpf_insn_t ret = {BPF_RET | BPF_K, 0, 0, 0};
+	assert_true(bpf_check(&ret, 1));
+	assert_false(bpf_check(&ret, 0));
+	assert_false(bpf_check(NULL, 1));
+
+	// Must end with a return
+	const bpf_insn_t no_ret[] = {ret, {BPF_LD | BPF_IMM, 0, 0, 0}};
+	assert_false(bpf_check(no_ret, 2));
+
+	// Jumps must stay inside the program
+	const bpf_insn_t jump[] = {{BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0}, ret};
+	assert_false(bpf_check(jump, 2));
+
+	const bpf_insn_t jump_always[] = {{BPF_JMP | BPF_JA, 0, 0, 1}, ret};
+	assert_false(bpf_check(jump_always, 2));
+
+	// Only BPF_MEM_WORDS memory words
+	const bpf_insn_t store[] = {{BPF_ST, 0, 0, BPF_MEM_WORDS}, ret};
+	assert_false(bpf_check(store, 2));
+
+	const bpf_insn_t load[] = {{BPF_LD | BPF_W | BPF_MEM, 0, 0, BPF_MEM_WORDS}, ret};
+	assert_false(bpf_check(load, 2));
+
+	// No division by a constant zero
+	const bpf_insn_t div[] = {{BPF_ALU | BPF_DIV | BPF_K, 0, 0, 0}, ret};
+	assert_false(bpf_check(div, 2));
+
+	// Unknown instructions
+	const bpf_insn_t unknown[] = {{BPF_ALU | 0xf0, 0, 0, 1}, ret};
+	assert_false(bpf_check(unknown, 2));
+}
+
+static void test_bpf_hex(void **state) {
+	(void)state;
+
+	const bpf_insn_t insn = {0x1234, 0x56, 0x78, 0x9abcdef0};
+	char hex[BPF_INSN_HEX + 1];
+
+	bpf_insn_to_hex(&insn, hex);
+	assert_string_equal("123456789ABCDEF0", hex);
+
+	bpf_insn_t result;
+	assert_true(bpf_insn_from_hex(hex, &result));
+	assert_int_equal(insn.code, result.code);
+	assert_int_equal(insn.jt, result.jt);
+	assert_int_equal(insn.jf, result.jf);
+	assert_int_equal(insn.k, result.k);
+
+	assert_false(bpf_insn_from_hex("123456789ABCDEF", &result));
+	assert_false(bpf_insn_from_hex("123456789ABCDEFX", &result));
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_bpf_parse),
+		cmocka_unit_test(test_bpf_run),
+		cmocka_unit_test(test_bpf_alu),
+		cmocka_unit_test(test_bpf_check),
+		cmocka_unit_test(test_bpf_hex),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
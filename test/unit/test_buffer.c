@@ -0,0 +1,189 @@
+#include "unittest.h"
+#include "../../src/buffer.h"
+
+static void test_chunk_buffer_add_spans_chunks(void **state) {
+	(void)state;
+
+	static char data[BUFFER_CHUNK_SIZE * 3];
+	chunk_buffer_t buffer = {0};
+
+	for(size_t i = 0; i < sizeof(data); i++) {
+		data[i] = (char)i;
+	}
+
+	chunk_buffer_add(&buffer, data, 100);
+	chunk_buffer_add(&buffer, data + 100, sizeof(data) - 100);
+	assert_int_equal(sizeof(data), buffer.len);
+
+	// Data comes out in the same order, regardless of how it was split up
+
+	size_t pos = 0;
+
+	while(buffer.head) {
+		buffer_chunk_t *chunk = buffer.head;
+		uint32_t len = chunk->end - chunk->start;
+
+		assert_true(len <= BUFFER_CHUNK_SIZE);
+		assert_memory_equal(data + pos, chunk->data + chunk->start, len);
+
+		pos += len;
+		chunk_buffer_consume(&buffer, len);
+	}
+
+	assert_int_equal(sizeof(data), pos);
+	assert_int_equal(0, buffer.len);
+	assert_null(buffer.tail);
+
+	chunk_pool_clear();
+}
+
+static void test_chunk_buffer_prepare_is_contiguous(void **state) {
+	(void)state;
+
+	chunk_buffer_t buffer = {0};
+
+	chunk_buffer_add(&buffer, "x", 1);
+
+	char *small = chunk_buffer_prepare(&buffer, BUFFER_CHUNK_SIZE - 1);
+	assert_ptr_equal(buffer.head->data + 1, small);
+
+	// A request that does not fit in the last chunk gets a new one, even if it is larger than a chunk
+
+	char *large = chunk_buffer_prepare(&buffer, BUFFER_CHUNK_SIZE * 2);
+	assert_ptr_equal(buffer.tail->data, large);
+	assert_true(buffer.tail->size >= BUFFER_CHUNK_SIZE * 2);
+	memset(large, 0, BUFFER_CHUNK_SIZE * 2);
+
+	assert_int_equal(BUFFER_CHUNK_SIZE * 3, buffer.len);
+
+	chunk_buffer_consume(&buffer, BUFFER_CHUNK_SIZE + 10);
+	assert_int_equal(BUFFER_CHUNK_SIZE * 2 - 10, buffer.len);
+	assert_int_equal(10, buffer.head->start);
+
+	chunk_buffer_clear(&buffer);
+	assert_int_equal(0, buffer.len);
+	assert_null(buffer.head);
+
+	chunk_pool_clear();
+}
+
+#ifndef HAVE_WINDOWS
+static void test_chunk_buffer_iov(void **state) {
+	(void)state;
+
+	chunk_buffer_t buffer = {0};
+	struct iovec iov[2];
+
+	assert_int_equal(0, chunk_buffer_iov(&buffer, iov, 2));
+
+	for(int i = 0; i < 3; i++) {
+		memset(chunk_buffer_prepare(&buffer, BUFFER_CHUNK_SIZE), 'a' + i, BUFFER_CHUNK_SIZE);
+	}
+
+	chunk_buffer_consume(&buffer, 5);
+
+	assert_int_equal(2, chunk_buffer_iov(&buffer, iov, 2));
+	assert_int_equal(BUFFER_CHUNK_SIZE - 5, iov[0].iov_len);
+	assert_int_equal('a', *(char *)iov[0].iov_base);
+	assert_int_equal(BUFFER_CHUNK_SIZE, iov[1].iov_len);
+	assert_int_equal('b', *(char *)iov[1].iov_base);
+
+	chunk_buffer_clear(&buffer);
+	chunk_pool_clear();
+}
+#endif
+
+static void test_shared_buffer_refcount(void **state) {
+	(void)state;
+
+	shared_buffer_t *buffer = shared_buffer_alloc(1, "foo", 3);
+	assert_int_equal(1, buffer->refcount);
+	assert_int_equal(1, buffer->type);
+	assert_int_equal(3, buffer->len);
+	assert_memory_equal("foo", buffer->data, 3);
+
+	assert_ptr_equal(buffer, shared_buffer_ref(buffer));
+	assert_int_equal(2, buffer->refcount);
+
+	shared_buffer_unref(buffer);
+	assert_int_equal(1, buffer->refcount);
+	shared_buffer_unref(buffer);
+
+	shared_buffer_unref(NULL);
+}
+
+static void test_shared_queue_fifo(void **state) {
+	(void)state;
+
+	shared_queue_t queue = {0};
+	shared_buffer_t *a = shared_buffer_alloc(0, "a", 1);
+	shared_buffer_t *b = shared_buffer_alloc(0, "bb", 2);
+
+	assert_null(shared_queue_pop(&queue));
+
+	// Interleave pushes and pops so the ring buffer wraps around while growing
+
+	for(int i = 0; i < 100; i++) {
+		shared_queue_push(&queue, a);
+		shared_queue_push(&queue, b);
+
+		if(i % 2) {
+			shared_buffer_t *first = shared_queue_pop(&queue);
+			assert_ptr_equal(i % 4 == 1 ? a : b, first);
+			shared_buffer_unref(first);
+		}
+	}
+
+	assert_int_equal(150, queue.count);
+	assert_int_equal(75 * 1 + 75 * 2, queue.bytes);
+	assert_int_equal(76, a->refcount);
+	assert_int_equal(76, b->refcount);
+
+	for(uint32_t i = 0; i < 150; i++) {
+		shared_buffer_t *next = shared_queue_pop(&queue);
+		assert_ptr_equal(i % 2 ? b : a, next);
+		shared_buffer_unref(next);
+	}
+
+	assert_int_equal(0, queue.bytes);
+	assert_int_equal(1, a->refcount);
+	assert_int_equal(1, b->refcount);
+
+	shared_queue_clear(&queue);
+	shared_buffer_unref(a);
+	shared_buffer_unref(b);
+}
+
+static void test_shared_queue_clear_drops_references(void **state) {
+	(void)state;
+
+	shared_queue_t queue = {0};
+	shared_buffer_t *buffer = shared_buffer_alloc(0, "x", 1);
+
+	for(int i = 0; i < 20; i++) {
+		shared_queue_push(&queue, buffer);
+	}
+
+	assert_int_equal(21, buffer->refcount);
+
+	shared_queue_clear(&queue);
+	assert_int_equal(1, buffer->refcount);
+	assert_int_equal(0, queue.count);
+	assert_null(queue.items);
+
+	shared_buffer_unref(buffer);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_chunk_buffer_add_spans_chunks),
+		cmocka_unit_test(test_chunk_buffer_prepare_is_contiguous),
+#ifndef HAVE_WINDOWS
+		cmocka_unit_test(test_chunk_buffer_iov),
+#endif
+		cmocka_unit_test(test_shared_buffer_refcount),
+		cmocka_unit_test(test_shared_queue_fifo),
+		cmocka_unit_test(test_shared_queue_clear_drops_references),
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,184 @@
+#include "unittest.h"
+#include "../../src/compression.h"
+
+#ifdef HAVE_ZSTD
+
+static compression_stream_t *zout;
+static compression_stream_t *zin;
+
+static int setup(void **state) {
+	(void)state;
+
+	zout = compression_stream_new(true);
+	zin = compression_stream_new(false);
+	return !zout || !zin;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	compression_stream_free(zout);
+	compression_stream_free(zin);
+	return 0;
+}
+
+static void roundtrip(uint8_t type, const char *data, size_t len, size_t *compressed) {
+	size_t outlen;
+	const uint8_t *out = compression_stream_compress(zout, type, data, len, &outlen);
+	assert_non_null(out);
+
+	uint8_t copy[256];
+	assert_true(outlen <= sizeof(copy));
+	memcpy(copy, out, outlen);
+	*compressed = outlen;
+
+	uint8_t *in = compression_stream_uncompress(zin, copy, outlen, &outlen);
+	assert_non_null(in);
+	assert_int_equal(len + 1, outlen);
+	assert_int_equal(type, in[0]);
+	assert_memory_equal(data, in + 1, len);
+}
+
+static void test_stream_records_are_complete(void **state) {
+	(void)state;
+
+	static const char *requests[] = {
+		"12 1 foo bar 192.0.2.1 655 0 1\n",
+		"12 2 foo baz 192.0.2.2 655 0 1\n",
+		"8\n",
+		"12 3 bar baz 192.0.2.3 655 0 1\n",
+		"9\n",
+	};
+
+	for(size_t i = 0; i < sizeof(requests) / sizeof(*requests); i++) {
+		size_t compressed;
+		roundtrip(0, requests[i], strlen(requests[i]), &compressed);
+	}
+}
+
+static void test_stream_uses_history(void **state) {
+	(void)state;
+
+	const char *request = "12 1 foo bar 192.0.2.1 655 0 1\n";
+	size_t first, second;
+
+	roundtrip(0, request, strlen(request), &first);
+	roundtrip(0, request, strlen(request), &second);
+
+	// The second copy only refers back to the first one
+
+	assert_true(second < first);
+	assert_true(second < strlen(request) / 2);
+}
+
+static void test_stream_rejects_garbage(void **state) {
+	(void)state;
+
+	size_t outlen;
+	assert_null(compression_stream_uncompress(zin, "garbage", 7, &outlen));
+}
+
+static void test_stream_rejects_large_records(void **state) {
+	(void)state;
+
+	static char data[COMPRESSION_STREAM_RECORD_MAX + 1];
+	size_t outlen;
+
+	assert_null(compression_stream_compress(zout, 0, data, sizeof(data), &outlen));
+	assert_non_null(compression_stream_compress(zout, 0, data, sizeof(data) - 1, &outlen));
+}
+
+static void test_packet_roundtrip(void **state) {
+	(void)state;
+
+	uint8_t packet[1500];
+	uint8_t compressed[1600];
+	uint8_t uncompressed[1600];
+
+	for(size_t i = 0; i < sizeof(packet); i++) {
+		packet[i] = i % 64;
+	}
+
+	size_t len = compress_zstd(compressed, sizeof(compressed), packet, sizeof(packet));
+	assert_true(len > 0 && len < sizeof(packet));
+
+	assert_int_equal(sizeof(packet), uncompress_zstd(uncompressed, sizeof(uncompressed), compressed, len));
+	assert_memory_equal(packet, uncompressed, sizeof(packet));
+
+	// Truncated packets and packets that do not fit are rejected
+
+	assert_int_equal(0, uncompress_zstd(uncompressed, sizeof(uncompressed), compressed, len - 1));
+	assert_int_equal(0, uncompress_zstd(uncompressed, 100, compressed, len));
+}
+
+static void test_dictionary_helps_small_packets(void **state) {
+	(void)state;
+
+	const char *sample = "GET /index.html HTTP/1.1\r\nHost: www.example.com\r\nUser-Agent: test\r\n\r\n";
+	const char *packet = "GET /about.html HTTP/1.1\r\nHost: www.example.com\r\nUser-Agent: test\r\n\r\n";
+	uint8_t compressed[256];
+	uint8_t uncompressed[256];
+
+	size_t plain = compress_zstd(compressed, sizeof(compressed), (const uint8_t *)packet, strlen(packet));
+	assert_true(plain > 0);
+
+	char filename[] = "/tmp/tinc-dictionary-XXXXXX";
+	int fd = mkstemp(filename);
+	assert_true(fd >= 0);
+	assert_int_equal(strlen(sample), write(fd, sample, strlen(sample)));
+	close(fd);
+
+	bool loaded = compression_load_dictionary(filename);
+	unlink(filename);
+	assert_true(loaded);
+
+	size_t len = compress_zstd(compressed, sizeof(compressed), (const uint8_t *)packet, strlen(packet));
+	assert_true(len > 0 && len < plain);
+	assert_int_equal(strlen(packet), uncompress_zstd(uncompressed, sizeof(uncompressed), compressed, len));
+	assert_memory_equal(packet, uncompressed, strlen(packet));
+
+	assert_true(compression_load_dictionary(NULL));
+}
+
+static void test_missing_dictionary(void **state) {
+	(void)state;
+
+	assert_false(compression_load_dictionary("/nonexistent/dictionary"));
+	assert_true(compression_load_dictionary(NULL));
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_stream_records_are_complete, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_stream_uses_history, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_stream_rejects_garbage, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_stream_rejects_large_records, setup, teardown),
+		cmocka_unit_test(test_packet_roundtrip),
+		cmocka_unit_test(test_dictionary_helps_small_packets),
+		cmocka_unit_test(test_missing_dictionary),
+	};
+
+	int result = cmocka_run_group_tests(tests, NULL, NULL);
+	compression_exit();
+	return result;
+}
+
+#else
+
+static void test_zstd_unavailable(void **state) {
+	(void)state;
+
+	assert_null(compression_stream_new(false));
+	assert_true(compression_load_dictionary(NULL));
+	assert_false(compression_load_dictionary("dictionary"));
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_zstd_unavailable),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+#endif
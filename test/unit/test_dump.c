@@ -0,0 +1,177 @@
+#include "unittest.h"
+#include "../../src/dump.h"
+#include "../../src/edge.h"
+#include "../../src/meta.h"
+#include "../../src/xalloc.h"
+
+#define NODES 30
+#define EDGES_PER_NODE 10
+
+static connection_t *c;
+static node_t *nodes[NODES];
+
+static int setup(void **state) {
+	(void)state;
+
+	c = new_connection();
+	c->name = xstrdup("<control>");
+	c->hostname = xstrdup("localhost port unix");
+	c->protocol_minor = PROT_MINOR;
+	c->io.fd = -1;
+
+	for(int i = 0; i < NODES; i++) {
+		nodes[i] = new_node();
+		xasprintf(&nodes[i]->name, "n%02d", i);
+		node_add(nodes[i]);
+	}
+
+	for(int i = 0; i < NODES; i++) {
+		for(int j = 1; j <= EDGES_PER_NODE; j++) {
+			edge_t *e = new_edge();
+			e->from = nodes[i];
+			e->to = nodes[(i + j) % NODES];
+			e->weight = j;
+			edge_add(e);
+		}
+	}
+
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	free_connection(c);
+	c = NULL;
+	exit_edges();
+	exit_nodes();
+	return 0;
+}
+
+static char seen[NODES * EDGES_PER_NODE][512];
+static int nseen;
+
+/* Take everything sent to the control connection so far, count the lines of the given
+   dump type and its terminators, and check that no line was sent twice */
+
+static int take_lines(int type, int *terminators) {
+	char prefix[16];
+	snprintf(prefix, sizeof(prefix), "%d %d ", CONTROL, type);
+
+	char terminator[16];
+	snprintf(terminator, sizeof(terminator), "%d %d\n", CONTROL, type);
+
+	int count = 0;
+	shared_queue_t *queue = &c->outqueue[LANE_CONTROL];
+
+	while(queue->count) {
+		shared_buffer_t *buffer = shared_queue_pop(queue);
+		char line[512] = "";
+		memcpy(line, buffer->data, MIN(buffer->len, sizeof(line) - 1));
+		shared_buffer_unref(buffer);
+
+		if(!strcmp(line, terminator)) {
+			(*terminators)++;
+			continue;
+		}
+
+		assert_memory_equal(prefix, line, strlen(prefix));
+
+		for(int i = 0; i < nseen; i++) {
+			assert_int_not_equal(0, strcmp(seen[i], line));
+		}
+
+		assert_true(nseen < NODES * EDGES_PER_NODE);
+		strcpy(seen[nseen++], line);
+		count++;
+	}
+
+	return count;
+}
+
+static void test_json_objects(void **state) {
+	(void)state;
+
+	json_t json;
+	json_begin(&json);
+	json_string(&json, "name", "a\"b\\c\n");
+	json_int(&json, "int", -5);
+	json_uint(&json, "uint", UINT64_MAX);
+	json_bool(&json, "bool", true);
+	json_string(&json, "null", NULL);
+	assert_string_equal("{\"name\":\"a\\\"b\\\\c\\u000a\",\"int\":-5,\"uint\":18446744073709551615,\"bool\":true,\"null\":null}", json_end(&json));
+
+	// Objects that do not fit are not cut off, but rejected
+
+	json_begin(&json);
+
+	for(size_t i = 0; i < sizeof(json.buf); i++) {
+		json_bool(&json, "x", false);
+	}
+
+	assert_null(json_end(&json));
+}
+
+static void test_edges_are_dumped_in_batches(void **state) {
+	(void)state;
+
+	int terminators = 0;
+	nseen = 0;
+
+	assert_true(dump_start(c, REQ_DUMP_EDGES));
+	assert_true(dump_in_progress(c));
+	assert_int_equal(DUMP_BATCH, take_lines(REQ_DUMP_EDGES, &terminators));
+	assert_int_equal(0, terminators);
+
+	// Edges that disappear before their turn are skipped, including those of the node the dump stopped at
+
+	node_t *last = nodes[DUMP_BATCH / EDGES_PER_NODE];
+
+	for splay_each(edge_t, e, &last->edge_tree) {
+		edge_del(e);
+	}
+
+	assert_true(dump_finish(c));
+	assert_false(dump_in_progress(c));
+
+	int left = NODES * EDGES_PER_NODE - (DUMP_BATCH / EDGES_PER_NODE + 1) * EDGES_PER_NODE;
+	assert_int_equal(left, take_lines(REQ_DUMP_EDGES, &terminators));
+	assert_int_equal(1, terminators);
+}
+
+static void test_json_format_is_negotiated(void **state) {
+	(void)state;
+
+	int terminators = 0;
+	nseen = 0;
+
+	assert_true(dump_set_format(c, "18 19 1"));
+	assert_true(dump_set_format(c, "18 19 42"));
+	assert_false(dump_set_format(c, "18 19"));
+
+	shared_queue_t *queue = &c->outqueue[LANE_CONTROL];
+	assert_int_equal(2, queue->count);
+	assert_memory_equal("18 19 0\n", queue->items[queue->head]->data, 8);
+	assert_memory_equal("18 19 -1\n", queue->items[(queue->head + 1) & (queue->size - 1)]->data, 9);
+	shared_queue_clear(queue);
+
+	assert_true(dump_is_json(c));
+	assert_true(dump_start(c, REQ_DUMP_NODES));
+	assert_true(dump_finish(c));
+
+	shared_buffer_t *first = queue->items[queue->head];
+	assert_memory_equal("18 3 {\"name\":\"n00\",", first->data, 19);
+
+	assert_int_equal(NODES, take_lines(REQ_DUMP_NODES, &terminators));
+	assert_int_equal(1, terminators);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_json_objects),
+		cmocka_unit_test_setup_teardown(test_edges_are_dumped_in_batches, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_json_format_is_negotiated, setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
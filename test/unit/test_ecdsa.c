@@ -0,0 +1,190 @@
+#include "unittest.h"
+#include "../../src/ecdsa.h"
+#include "../../src/ecdsagen.h"
+#include "../../src/random.h"
+#include "../../src/utils.h"
+
+#define COUNT 40
+
+static ecdsa_t *keys[COUNT];
+static uint8_t msgs[COUNT][100];
+static uint8_t sigs[COUNT][64];
+static size_t lens[COUNT];
+static bool valid[COUNT];
+
+static const void *msgp[COUNT];
+static const void *sigp[COUNT];
+
+static int setup(void **state) {
+	(void)state;
+
+	randomize(msgs, sizeof(msgs));
+
+	for(int i = 0; i < COUNT; i++) {
+		keys[i] = ecdsa_generate();
+		lens[i] = i + 1;
+		msgp[i] = msgs[i];
+		sigp[i] = sigs[i];
+
+		if(!ecdsa_sign(keys[i], msgs[i], lens[i], sigs[i])) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	for(int i = 0; i < COUNT; i++) {
+		ecdsa_free(keys[i]);
+	}
+
+	return 0;
+}
+
+static void test_batch_all_valid(void **state) {
+	(void)state;
+
+	memset(valid, 0, sizeof(valid));
+	assert_true(ecdsa_verify_batch(keys, msgp, lens, sigp, COUNT, valid));
+
+	for(int i = 0; i < COUNT; i++) {
+		assert_true(valid[i]);
+	}
+}
+
+static void test_batch_finds_bad_signatures(void **state) {
+	(void)state;
+
+	// A flipped bit in R, in s, and in the message
+	sigs[3][5] ^= 1;
+	sigs[17][40] ^= 1;
+	msgs[33][0] ^= 1;
+
+	assert_false(ecdsa_verify_batch(keys, msgp, lens, sigp, COUNT, valid));
+
+	for(int i = 0; i < COUNT; i++) {
+		assert_int_equal(i != 3 && i != 17 && i != 33, valid[i]);
+		assert_int_equal(valid[i], ecdsa_verify(keys[i], msgs[i], lens[i], sigs[i]));
+	}
+
+	sigs[3][5] ^= 1;
+	sigs[17][40] ^= 1;
+	msgs[33][0] ^= 1;
+}
+
+static void test_batch_rejects_wrong_key(void **state) {
+	(void)state;
+
+	ecdsa_t *saved = keys[0];
+	keys[0] = keys[1];
+
+	assert_false(ecdsa_verify_batch(keys, msgp, lens, sigp, 2, valid));
+	assert_false(valid[0]);
+	assert_true(valid[1]);
+
+	keys[0] = saved;
+}
+
+static void test_batch_rejects_non_canonical_r(void **state) {
+	(void)state;
+
+	// An R with y >= p decodes to a point, but is not a valid encoding
+	uint8_t *r = sigs[5];
+	memset(r, 0xff, 32);
+	r[0] = 0xee;
+	r[31] = 0x7f;
+
+	assert_false(ecdsa_verify_batch(keys, msgp, lens, sigp, 8, valid));
+	assert_false(valid[5]);
+	assert_true(valid[4]);
+
+	assert_true(ecdsa_sign(keys[5], msgs[5], lens[5], sigs[5]));
+}
+
+// Signatures with R = s * B for fixed scalars s
+static const char *const weak_sigs_hex[8] = {
+	"f612b7b7bb71a390ba572315fada1228789841dd5fd12e3f87c40719221b8b52807d540f67c852c4a968cb7959c28f8ab99bc88a34b2b78b123ce0b4eb4f180c",
+	"5694e31872c55638761e033da1dc73b0354ece312ca9ee8571ab566e45c298596b89c3f2cd92fec167466b77105d50a5068870516d19f54ceac1d6f348221e0e",
+	"5a400775c71bda2cf7c85c520edd9737f5b20589bb656ad86da069246c2a5ebfcbc46be568b08c38396a5bb2bcc8ef8dd23b612467c088ea842a737efa2a690b",
+	"a5a4b1642e21b5dbdb8a7870bc3c4f6e7608b45c06d5580d6c8c05cc4933c2329047b290bd3536503c9844b069d80ee3e0c8b57a2f14db0cf8c76a6572a9ad0c",
+	"910cf6f4c6457455832635c127a7e14141ca184b5eaf22781cf915f60c18ed47d5b4f4b179d8150650e82928c219c673a4e818f8c20f183c1095b5107e38ed0f",
+	"8ee5d946db4f282c69152a1821aa0bca108a0a09f1454ea8e4a8ee2973865d71deafec0df7af31a91007dc3352addf9cb01ba1c3106240d97a11c756e9a81404",
+	"fd261f7dc329afa2e900845e0ce4ec9f25d35dee4aa890311d333c13c922fb4ea05d359eb829cb48f16c0f9fb6b24f66b1b6fa5fc934012f9ccaeb16d7aeda05",
+	"4ecd42447665bc59ba0b3804a3258edf6d212bf1aebba8112208e82049f651e64ed58475ccd8d9dfdd31a0bf7f42bed7cba4178f11ac68e3f8b142185b9d010b",
+};
+
+static void test_batch_matches_verify_for_small_order_key(void **state) {
+	(void)state;
+
+	// The point of order 2. With s * B as R, a signature is only valid if the hash is even.
+	uint8_t public[32];
+	memset(public, 0xff, sizeof(public));
+	public[0] = 0xec;
+	public[31] = 0x7f;
+
+	char b64[64];
+	b64encode_tinc(public, b64, sizeof(public));
+	ecdsa_t *weak = ecdsa_set_base64_public_key(b64);
+	assert_non_null(weak);
+
+	ecdsa_t *weak_keys[8];
+	uint8_t weak_sigs[8][64];
+	const void *weak_sigp[8];
+	uint8_t weak_msgs[8][32];
+	const void *weak_msgp[8];
+	size_t weak_lens[8];
+
+	for(int i = 0; i < 8; i++) {
+		assert_int_equal(64, hex2bin(weak_sigs_hex[i], weak_sigs[i], 64));
+		weak_keys[i] = weak;
+		weak_sigp[i] = weak_sigs[i];
+		weak_msgp[i] = weak_msgs[i];
+		weak_lens[i] = sizeof(weak_msgs[i]);
+	}
+
+	int accepted = 0;
+
+	// New messages every round give the hashes a different parity
+	for(int round = 0; round < 16; round++) {
+		bool all_valid = true;
+
+		randomize(weak_msgs, sizeof(weak_msgs));
+
+		for(int i = 0; i < 8; i++) {
+			all_valid &= ecdsa_verify(weak, weak_msgs[i], weak_lens[i], weak_sigs[i]);
+		}
+
+		assert_int_equal(all_valid, ecdsa_verify_batch(weak_keys, weak_msgp, weak_lens, weak_sigp, 8, valid));
+
+		for(int i = 0; i < 8; i++) {
+			bool ok = ecdsa_verify(weak, weak_msgs[i], weak_lens[i], weak_sigs[i]);
+			assert_int_equal(valid[i], ok);
+			accepted += ok;
+		}
+	}
+
+	// Some of them have to be valid, or the fixtures are wrong
+	assert_true(accepted > 0);
+
+	ecdsa_free(weak);
+}
+
+int main(void) {
+	random_init();
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_batch_all_valid),
+		cmocka_unit_test(test_batch_finds_bad_signatures),
+		cmocka_unit_test(test_batch_rejects_wrong_key),
+		cmocka_unit_test(test_batch_rejects_non_canonical_r),
+		cmocka_unit_test(test_batch_matches_verify_for_small_order_key),
+	};
+
+	int result = cmocka_run_group_tests(tests, setup, teardown);
+
+	random_exit();
+	return result;
+}
@@ -0,0 +1,76 @@
+#include "unittest.h"
+#include "../../src/connection.h"
+#include "../../src/xalloc.h"
+
+static node_t *a, *b, *c;
+
+static node_t *make_node(const char *name) {
+	node_t *n = new_node();
+	n->name = xstrdup(name);
+	return n;
+}
+
+static edge_t *make_edge(node_t *from, node_t *to, int weight) {
+	edge_t *e = new_edge();
+	e->from = from;
+	e->to = to;
+	e->weight = weight;
+	edge_add(e);
+	return e;
+}
+
+static int setup(void **state) {
+	(void)state;
+
+	a = make_node("a");
+	b = make_node("b");
+	c = make_node("c");
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	exit_edges();
+	free_node(a);
+	free_node(b);
+	free_node(c);
+	return 0;
+}
+
+static void test_incoming_edges_are_counted(void **state) {
+	(void)state;
+
+	edge_t *ac = make_edge(a, c, 10);
+	edge_t *bc = make_edge(b, c, 10);
+	make_edge(c, a, 20);
+
+	assert_int_equal(1, a->incoming_edges);
+	assert_int_equal(0, b->incoming_edges);
+	assert_int_equal(2, c->incoming_edges);
+
+	// A duplicate edge is not added, so it must not be counted
+
+	edge_t *dup = new_edge();
+	dup->from = a;
+	dup->to = c;
+	dup->weight = 30;
+	edge_add(dup);
+	free_edge(dup);
+	assert_int_equal(2, c->incoming_edges);
+
+	edge_del(ac);
+	assert_int_equal(1, c->incoming_edges);
+
+	edge_del(bc);
+	assert_int_equal(0, c->incoming_edges);
+	assert_int_equal(1, a->incoming_edges);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_incoming_edges_are_counted, setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,131 @@
+#include "unittest.h"
+#include "../../src/control_common.h"
+#include "../../src/events.h"
+#include "../../src/meta.h"
+#include "../../src/xalloc.h"
+
+static connection_t *c;
+static node_t *a, *b;
+
+static node_t *make_node(const char *name) {
+	node_t *n = new_node();
+	n->name = xstrdup(name);
+	return n;
+}
+
+static int setup(void **state) {
+	(void)state;
+
+	c = new_connection();
+	c->name = xstrdup("<control>");
+	c->hostname = xstrdup("localhost port unix");
+	c->protocol_minor = PROT_MINOR;
+	c->io.fd = -1;
+	connection_add(c);
+
+	a = make_node("a");
+	b = make_node("b");
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	connection_del(c);
+	c = NULL;
+	free_node(a);
+	free_node(b);
+	return 0;
+}
+
+/* Check that the next line sent to the control connection is the given event */
+
+static void assert_event(const char *event) {
+	shared_queue_t *queue = &c->outqueue[LANE_CONTROL];
+	assert_true(queue->count);
+
+	char expected[256];
+	snprintf(expected, sizeof(expected), "%d %d %s\n", CONTROL, REQ_SUBSCRIBE, event);
+
+	shared_buffer_t *buffer = shared_queue_pop(queue);
+	assert_int_equal(strlen(expected), buffer->len);
+	assert_memory_equal(expected, buffer->data, buffer->len);
+	shared_buffer_unref(buffer);
+}
+
+static void test_only_subscribed_events_are_sent(void **state) {
+	(void)state;
+
+	// Nothing is sent before subscribing
+
+	event_node(a);
+	assert_int_equal(0, meta_output_len(c));
+
+	char request[32];
+	snprintf(request, sizeof(request), "%d %d %d", CONTROL, REQ_SUBSCRIBE, EVENT_NODE | EVENT_SUBNET);
+	assert_true(subscribe_events(c, request));
+	assert_event("0");
+
+	a->status.reachable = true;
+	event_node(a);
+	assert_event("node up a unspec unspec");
+
+	edge_t e = {.from = a, .to = b, .weight = 10};
+	event_edge(&e, true);
+	event_mtu(a);
+	assert_int_equal(0, meta_output_len(c));
+
+	event_subnet(b, "10.0.0.0/8", false);
+	assert_event("subnet down 10.0.0.0/8 b");
+
+	// Unsubscribing stops the events
+
+	snprintf(request, sizeof(request), "%d %d 0", CONTROL, REQ_SUBSCRIBE);
+	assert_true(subscribe_events(c, request));
+	assert_event("0");
+
+	a->status.reachable = false;
+	event_node(a);
+	assert_int_equal(0, meta_output_len(c));
+}
+
+static void test_resync_after_overflow(void **state) {
+	(void)state;
+
+	char request[32];
+	snprintf(request, sizeof(request), "%d %d", CONTROL, REQ_SUBSCRIBE);
+	assert_true(subscribe_events(c, request));
+	assert_event("0");
+
+	// Pretend the subscriber stopped reading
+
+	static uint8_t backlog[EVENT_QUEUE_LIMIT];
+	chunk_buffer_add(&c->outbuf, backlog, sizeof(backlog));
+
+	event_node(a);
+	event_node(b);
+	assert_true(c->status.events_lost);
+	assert_int_equal(sizeof(backlog), meta_output_len(c));
+
+	// Nothing happens until it has caught up
+
+	events_drained(c);
+	assert_true(c->status.events_lost);
+
+	chunk_buffer_consume(&c->outbuf, sizeof(backlog));
+	events_drained(c);
+	assert_false(c->status.events_lost);
+	assert_event("resync");
+
+	event_node(a);
+	assert_event("node down a");
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_only_subscribed_events_are_sent, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_resync_after_overflow, setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
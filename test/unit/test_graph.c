@@ -0,0 +1,156 @@
+#include "unittest.h"
+#include "../../src/edge.h"
+#include "../../src/graph.h"
+#include "../../src/script.h"
+#include "../../src/xalloc.h"
+
+// silence -Wmissing-prototypes
+bool __wrap_execute_script(const char *name, environment_t *env);
+
+bool __wrap_execute_script(const char *name, environment_t *env) {
+	(void)name;
+	(void)env;
+	return true;
+}
+
+static node_t *a, *b, *c, *d;
+
+static node_t *make_node(const char *name) {
+	node_t *n = new_node();
+	n->name = xstrdup(name);
+	node_add(n);
+	return n;
+}
+
+static void make_edge(node_t *from, node_t *to, int weight, uint32_t options) {
+	edge_t *e = new_edge();
+	e->from = from;
+	e->to = to;
+	e->weight = weight;
+	e->options = options;
+	edge_add(e);
+}
+
+static void connect_nodes(node_t *from, node_t *to, int weight, uint32_t options) {
+	make_edge(from, to, weight, options);
+	make_edge(to, from, weight, options);
+}
+
+static int setup(void **state) {
+	(void)state;
+
+	myself = a = make_node("a");
+	b = make_node("b");
+	c = make_node("c");
+	d = make_node("d");
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	latency_routing = false;
+	exit_edges();
+	exit_nodes();
+	myself = NULL;
+	return 0;
+}
+
+/* The direct edge from a to d is much heavier than the path through b */
+
+static void make_triangle(void) {
+	connect_nodes(a, b, 10, 0);
+	connect_nodes(b, d, 10, 0);
+	connect_nodes(a, d, 500, 0);
+}
+
+/* Node d can only be reached through b or c. The path through b has the lowest
+   total weight, but the last hop through c is the cheapest. */
+
+static void make_relays(void) {
+	connect_nodes(a, b, 10, 0);
+	connect_nodes(a, c, 200, 0);
+	connect_nodes(b, d, 100, OPTION_INDIRECT);
+	connect_nodes(c, d, 5, OPTION_INDIRECT);
+}
+
+static void test_bfs_uses_fewest_hops(void **state) {
+	(void)state;
+
+	make_triangle();
+	graph();
+
+	assert_true(d->status.reachable);
+	assert_int_equal(1, d->distance);
+	assert_ptr_equal(d, d->nexthop);
+}
+
+static void test_bfs_uses_weight_of_last_hop(void **state) {
+	(void)state;
+
+	make_relays();
+	graph();
+
+	assert_true(d->status.reachable);
+	assert_true(d->status.indirect);
+	assert_int_equal(2, d->distance);
+	assert_ptr_equal(c, d->via);
+}
+
+static void test_dijkstra_uses_lowest_weight(void **state) {
+	(void)state;
+
+	latency_routing = true;
+	make_triangle();
+	graph();
+
+	assert_true(d->status.reachable);
+	assert_int_equal(2, d->distance);
+	assert_int_equal(20, d->path_weight);
+	assert_ptr_equal(b, d->nexthop);
+	assert_ptr_equal(d, d->via);
+
+	// Routes follow changes in weight
+
+	edge_set_weight(lookup_edge(b, d), 1000);
+	graph();
+
+	assert_int_equal(1, d->distance);
+	assert_int_equal(500, d->path_weight);
+	assert_ptr_equal(d, d->nexthop);
+}
+
+static void test_dijkstra_picks_fastest_relay(void **state) {
+	(void)state;
+
+	latency_routing = true;
+	make_relays();
+	graph();
+
+	assert_true(d->status.reachable);
+	assert_true(d->status.indirect);
+	assert_int_equal(110, d->path_weight);
+	assert_ptr_equal(b, d->nexthop);
+	assert_ptr_equal(b, d->via);
+
+	// Being able to reach a node directly still matters more than the weight
+
+	connect_nodes(a, d, 500, 0);
+	graph();
+
+	assert_false(d->status.indirect);
+	assert_int_equal(500, d->path_weight);
+	assert_ptr_equal(d, d->nexthop);
+	assert_ptr_equal(d, d->via);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_bfs_uses_fewest_hops, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_bfs_uses_weight_of_last_hop, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_dijkstra_uses_lowest_weight, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_dijkstra_picks_fastest_relay, setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,81 @@
+#include "unittest.h"
+#include "../../src/linkstats.h"
+
+static void test_rtt_is_smoothed(void **state) {
+	(void)state;
+
+	link_stats_t ls;
+	link_stats_reset(&ls);
+	assert_int_equal(-1, ls.srtt);
+
+	link_stats_rtt(&ls, 8000);
+	assert_int_equal(8000, ls.srtt);
+	assert_int_equal(4000, ls.rttvar);
+	assert_int_equal(0, ls.jitter);
+
+	// A single outlier only moves the estimate by an eighth
+
+	link_stats_rtt(&ls, 16000);
+	assert_int_equal(9000, ls.srtt);
+	assert_int_equal(5000, ls.rttvar);
+	assert_int_equal(500, ls.jitter);
+
+	for(int i = 0; i < 200; i++) {
+		link_stats_rtt(&ls, 12000);
+	}
+
+	assert_true(ls.srtt > 11990 && ls.srtt <= 12000);
+	assert_true(ls.jitter < 20);
+	assert_false(link_stats_stable(&ls));
+
+	link_stats_reset_rtt(&ls);
+	assert_int_equal(-1, ls.srtt);
+}
+
+static void test_loss_is_sampled(void **state) {
+	(void)state;
+
+	link_stats_t ls;
+	link_stats_reset(&ls);
+
+	// Nothing happened, nothing to learn
+
+	link_stats_sample(&ls, 0, 0);
+	assert_int_equal(0, ls.samples);
+
+	// 10 of the 98 packets and one of the two probes were lost
+
+	link_stats_rtt(&ls, 1000);
+	link_stats_probe_lost(&ls);
+	link_stats_sample(&ls, 88, 10);
+	assert_int_equal(1, ls.samples);
+	assert_int_equal(110000, ls.loss);
+	assert_true(link_stats_lossy(&ls));
+
+	// Packets that arrive late reduce the counter, but do not count as more loss
+
+	link_stats_sample(&ls, 188, 8);
+	assert_int_equal(110000 - 110000 / 8, ls.loss);
+
+	for(int i = 2; i < 100; i++) {
+		link_stats_sample(&ls, 88 + 100 * i, 8);
+	}
+
+	assert_int_equal(0, ls.loss);
+	assert_false(link_stats_lossy(&ls));
+	assert_true(link_stats_stable(&ls));
+
+	// A new session starts counting from zero
+
+	link_stats_sample(&ls, 50, 50);
+	assert_int_equal(500000 / 8, ls.loss);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_rtt_is_smoothed),
+		cmocka_unit_test(test_loss_is_sampled),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,97 @@
+#include "unittest.h"
+#include "../../src/logger.h"
+#include "../../src/names.h"
+
+static char path[] = "/tmp/tinc-log-XXXXXX";
+
+static int setup(void **state) {
+	(void)state;
+
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	close(fd);
+
+	logfilename = path;
+	debug_level = DEBUG_TRAFFIC;
+	openlogger("test", LOGMODE_FILE);
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	logger_async(false);
+	logger_rate_limit(0);
+	closelogger();
+	logfilename = NULL;
+
+	unlink(path);
+	strcpy(path + strlen(path) - 6, "XXXXXX");
+	return 0;
+}
+
+static int count_lines(const char *needle) {
+	FILE *f = fopen(path, "r");
+	assert_non_null(f);
+
+	char line[1024];
+	int count = 0;
+
+	while(fgets(line, sizeof(line), f)) {
+		if(strstr(line, needle)) {
+			count++;
+		}
+	}
+
+	fclose(f);
+	return count;
+}
+
+static void test_async_writes_everything(void **state) {
+	(void)state;
+
+	logger_async(true);
+
+	for(int i = 0; i < 500; i++) {
+		logger(DEBUG_TRAFFIC, LOG_DEBUG, "async message %d", i);
+	}
+
+	// Stopping the writer waits until the queue is written out
+
+	logger_async(false);
+
+	uint64_t dropped = log_stats.dropped;
+	assert_int_equal(500, count_lines("async message") + dropped);
+	assert_true(count_lines("async message 0\n"));
+}
+
+static void test_rate_limit(void **state) {
+	(void)state;
+
+	uint64_t suppressed = log_stats.suppressed;
+	logger_rate_limit(3);
+
+	for(int i = 0; i < 10; i++) {
+		logger(DEBUG_ALWAYS, LOG_INFO, "limited message %d", i);
+	}
+
+	// All of this normally happens within one second, but it might just cross into the next one
+
+	int lines = count_lines("limited message");
+	assert_true(lines >= 3 && lines <= 6);
+	assert_int_equal(10 - lines, log_stats.suppressed - suppressed);
+
+	// Other call sites are not affected
+
+	logger(DEBUG_ALWAYS, LOG_INFO, "another message");
+	assert_int_equal(1, count_lines("another message"));
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_async_writes_everything, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_rate_limit, setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,120 @@
+#include "unittest.h"
+#include "../../src/meta.h"
+#include "../../src/protocol.h"
+#include "../../src/xalloc.h"
+
+static connection_t *c;
+
+static int setup(void **state) {
+	(void)state;
+
+	c = new_connection();
+	c->name = xstrdup("foo");
+	c->hostname = xstrdup("localhost");
+	c->protocol_minor = PROT_MINOR;
+	c->io.fd = -1;
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	free_connection(c);
+	c = NULL;
+	return 0;
+}
+
+static void send_line(const char *line) {
+	assert_true(send_meta(c, line, strlen(line)));
+}
+
+static void test_requests_go_to_their_lanes(void **state) {
+	(void)state;
+
+	send_line("8\n");
+	send_line("12 1 foo bar 192.0.2.1 655 0 1\n");
+	send_line("15 foo bar 1\n");
+	send_line("9\n");
+
+	assert_int_equal(2, c->outqueue[LANE_CONTROL].count);
+	assert_int_equal(1, c->outqueue[LANE_KEY].count);
+	assert_int_equal(1, c->outqueue[LANE_TOPOLOGY].count);
+	assert_int_equal(0, c->outqueue[LANE_DATA].count);
+	assert_int_equal(0, c->outbuf.len);
+
+	assert_int_equal(2 + 31 + 13 + 2, meta_output_len(c));
+}
+
+static void test_binary_requests_are_topology(void **state) {
+	(void)state;
+
+	assert_true(send_meta_tlv(c, "\x00\x01\x0c", 3));
+	assert_int_equal(1, c->outqueue[LANE_TOPOLOGY].count);
+	assert_int_equal(META_RECORD_TLV, c->outqueue[LANE_TOPOLOGY].items[0]->type);
+}
+
+static void test_packet_payload_stays_with_request(void **state) {
+	(void)state;
+
+	send_line("21 3\n");
+	assert_true(c->status.outpayload);
+	send_meta_raw(c, "abc", 3);
+	assert_false(c->status.outpayload);
+
+	// Requests sent after the payload are not part of the packet
+
+	send_line("8\n");
+
+	const shared_queue_t *data = &c->outqueue[LANE_DATA];
+	assert_int_equal(2, data->count);
+	assert_int_equal(SHARED_MORE, data->items[0]->flags);
+	assert_int_equal(SHARED_RAW, data->items[1]->flags);
+	assert_memory_equal("abc", data->items[1]->data, 3);
+
+	assert_int_equal(1, c->outqueue[LANE_CONTROL].count);
+}
+
+static void test_shared_requests_are_not_copied(void **state) {
+	(void)state;
+
+	shared_buffer_t *buffer = shared_buffer_alloc(0, "13 1 foo bar\n", 13);
+
+	assert_true(send_meta_shared(c, buffer));
+	assert_ptr_equal(buffer, c->outqueue[LANE_TOPOLOGY].items[0]);
+	assert_int_equal(2, buffer->refcount);
+
+	shared_buffer_unref(buffer);
+}
+
+static void test_batch_wakes_writers_at_end(void **state) {
+	(void)state;
+
+	connection_add(c);
+
+	meta_batch_begin();
+	meta_batch_begin();
+	send_line("13 1 foo bar\n");
+	assert_int_equal(1, c->outqueue[LANE_TOPOLOGY].count);
+	assert_int_equal(0, c->io.flags);
+
+	meta_batch_end();
+	assert_int_equal(0, c->io.flags);
+
+	meta_batch_end();
+	assert_int_equal(IO_READ | IO_WRITE, c->io.flags);
+
+	list_node_t *node = connection_list.head;
+	list_unlink_node(&connection_list, node);
+	free(node);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_requests_go_to_their_lanes, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_binary_requests_are_topology, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_packet_payload_stays_with_request, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_shared_requests_are_not_copied, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_batch_wakes_writers_at_end, setup, teardown),
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
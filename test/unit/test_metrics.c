@@ -0,0 +1,165 @@
+#include "unittest.h"
+#include "../../src/connection.h"
+#include "../../src/graph.h"
+#include "../../src/metrics.h"
+#include "../../src/xalloc.h"
+
+static char *format(void) {
+	chunk_buffer_t out = {0};
+	metrics_format(&out);
+
+	char *text = xzalloc(out.len + 1);
+	char *p = text;
+
+	for(buffer_chunk_t *chunk = out.head; chunk; chunk = chunk->next) {
+		memcpy(p, chunk->data + chunk->start, chunk->end - chunk->start);
+		p += chunk->end - chunk->start;
+	}
+
+	chunk_buffer_clear(&out);
+	return text;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	exit_nodes();
+	myself = NULL;
+	memset(&graph_duration, 0, sizeof(graph_duration));
+	return 0;
+}
+
+static void test_histogram_buckets(void **state) {
+	(void)state;
+
+	assert_int_equal(0, histogram_bucket(0));
+	assert_int_equal(0, histogram_bucket(1));
+	assert_int_equal(7, histogram_bucket(8));
+	assert_int_equal(8, histogram_bucket(9));
+	assert_int_equal(16, histogram_bucket(17));
+	assert_int_equal(16, histogram_bucket(18));
+	assert_int_equal(HISTOGRAM_BUCKETS - 1, histogram_bucket(UINT64_C(1) << 40));
+
+	// Every value is in the first bucket whose limit is not smaller, and close to that limit
+
+	for(uint64_t usec = 2; usec < UINT64_C(1) << 26; usec += usec / 7 + 1) {
+		int bucket = histogram_bucket(usec);
+		uint64_t limit = histogram_bucket_limit(bucket);
+
+		assert_true(limit >= usec);
+		assert_true(histogram_bucket_limit(bucket - 1) < usec);
+		assert_true(limit - usec <= usec / HISTOGRAM_SUB_BUCKETS);
+	}
+
+	for(int bucket = HISTOGRAM_SUB_BUCKETS - 1; bucket < HISTOGRAM_BUCKETS; bucket += HISTOGRAM_SUB_BUCKETS) {
+		uint64_t limit = histogram_bucket_limit(bucket);
+		assert_int_equal(0, limit & (limit - 1));
+	}
+}
+
+static void test_histogram_percentiles(void **state) {
+	(void)state;
+
+	histogram_t h = {0};
+	assert_int_equal(0, histogram_percentile(&h, 50));
+
+	for(uint64_t usec = 1; usec <= 1000; usec++) {
+		histogram_add(&h, usec);
+	}
+
+	assert_int_equal(1000, h.count);
+	assert_int_equal(1000, h.max);
+	assert_int_equal(500500, h.sum);
+	assert_int_equal(512, histogram_percentile(&h, 50));
+	assert_int_equal(1000, histogram_percentile(&h, 99));
+	assert_int_equal(1000, histogram_percentile(&h, 100));
+}
+
+static void test_histogram_since(void **state) {
+	(void)state;
+
+	histogram_t h = {0};
+	histogram_t base;
+	histogram_t since;
+
+	histogram_add(&h, 3);
+	histogram_add(&h, 5000);
+	base = h;
+
+	histogram_since(&since, &h, &base);
+	assert_int_equal(0, since.count);
+	assert_int_equal(0, since.max);
+
+	histogram_add(&h, 100);
+	histogram_add(&h, 200);
+	histogram_since(&since, &h, &base);
+
+	assert_int_equal(2, since.count);
+	assert_int_equal(300, since.sum);
+	assert_int_equal(1, since.buckets[histogram_bucket(200)]);
+	assert_int_equal(0, since.buckets[histogram_bucket(5000)]);
+	assert_int_equal(histogram_bucket_limit(histogram_bucket(200)), since.max);
+
+	// The original keeps counting
+
+	assert_int_equal(4, h.count);
+	assert_int_equal(5000, h.max);
+
+	histogram_add(&h, 10000);
+	histogram_since(&since, &h, &base);
+	assert_int_equal(10000, since.max);
+}
+
+static void test_format(void **state) {
+	(void)state;
+
+	myself = new_node();
+	myself->name = xstrdup("foo");
+	node_add(myself);
+
+	node_t *n = new_node();
+	n->name = xstrdup("bar");
+	n->in_packets = 12;
+	n->out_bytes = 3456;
+	n->udp_ping_rtt = 1500;
+	n->status.reachable = true;
+	node_add(n);
+
+	histogram_add(&graph_duration, 3);
+	histogram_add(&graph_duration, 1000);
+
+	char *text = format();
+
+	assert_non_null(strstr(text, "\ntinc_node_received_packets_total{node=\"bar\"} 12\n"));
+	assert_non_null(strstr(text, "\ntinc_node_sent_bytes_total{node=\"bar\"} 3456\n"));
+	assert_non_null(strstr(text, "\ntinc_node_rtt_seconds{node=\"bar\"} 0.001500\n"));
+	assert_non_null(strstr(text, "\ntinc_node_reachable{node=\"bar\"} 1\n"));
+	assert_non_null(strstr(text, "\ntinc_node_reachable{node=\"foo\"} 0\n"));
+
+	// Buckets are cumulative
+
+	assert_null(strstr(text, "\ntinc_graph_duration_seconds_bucket{le=\"2e-06\"}"));
+	assert_non_null(strstr(text, "\ntinc_graph_duration_seconds_bucket{le=\"8e-06\"} 1\n"));
+	assert_non_null(strstr(text, "\ntinc_graph_duration_seconds_bucket{le=\"0.000512\"} 1\n"));
+	assert_non_null(strstr(text, "\ntinc_graph_duration_seconds_bucket{le=\"0.001024\"} 2\n"));
+	assert_non_null(strstr(text, "\ntinc_graph_duration_seconds_bucket{le=\"+Inf\"} 2\n"));
+	assert_non_null(strstr(text, "\ntinc_graph_duration_seconds_count 2\n"));
+	assert_non_null(strstr(text, "\ntinc_graph_duration_seconds_sum 0.001003\n"));
+
+	size_t len = strlen(text);
+	assert_true(len > 6);
+	assert_string_equal("# EOF\n", text + len - 6);
+
+	free(text);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_histogram_buckets),
+		cmocka_unit_test(test_histogram_percentiles),
+		cmocka_unit_test(test_histogram_since),
+		cmocka_unit_test_teardown(test_format, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
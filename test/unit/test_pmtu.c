@@ -0,0 +1,134 @@
+#include "unittest.h"
+#include "../../src/event.h"
+#include "../../src/netutl.h"
+#include "../../src/pmtu.h"
+
+static int teardown(void **state) {
+	(void)state;
+
+	pmtu_exit();
+	return 0;
+}
+
+static void test_shared_between_ports(void **state) {
+	(void)state;
+
+	sockaddr_t a = str2sockaddr("192.0.2.1", "655");
+	sockaddr_t b = str2sockaddr("192.0.2.1", "1000");
+	sockaddr_t c = str2sockaddr("192.0.2.2", "655");
+	sockaddr_t d = str2sockaddr("2001:db8::1", "655");
+
+	pmtu_learn(&a, 1400);
+	pmtu_learn(&d, 1280);
+
+	assert_int_equal(1400, pmtu_lookup(&a));
+	assert_int_equal(1400, pmtu_lookup(&b));
+	assert_int_equal(0, pmtu_lookup(&c));
+	assert_int_equal(1280, pmtu_lookup(&d));
+
+	// Newer information replaces older
+
+	pmtu_learn(&b, 1300);
+	assert_int_equal(1300, pmtu_lookup(&a));
+
+	pmtu_forget(&a);
+	assert_int_equal(0, pmtu_lookup(&b));
+	assert_int_equal(1280, pmtu_lookup(&d));
+}
+
+static void test_expires(void **state) {
+	(void)state;
+
+	sockaddr_t sa = str2sockaddr("192.0.2.1", "655");
+
+	now.tv_sec = 1000;
+	pmtu_learn(&sa, 1400);
+
+	now.tv_sec += PMTU_EXPIRE - 1;
+	assert_int_equal(1400, pmtu_lookup(&sa));
+
+	now.tv_sec++;
+	assert_int_equal(0, pmtu_lookup(&sa));
+}
+
+static void test_ignores_unknown_addresses(void **state) {
+	(void)state;
+
+	sockaddr_t sa = str2sockaddr("example.invalid", "655");
+	assert_int_equal(AF_UNKNOWN, sa.sa.sa_family);
+
+	pmtu_learn(&sa, 1400);
+	assert_int_equal(0, pmtu_lookup(&sa));
+	assert_int_equal(0, pmtu_route_mtu(&sa));
+
+	sockaddrfree(&sa);
+}
+
+static void test_route_mtu(void **state) {
+	(void)state;
+
+	sockaddr_t sa = str2sockaddr("127.0.0.1", "655");
+	int mtu = pmtu_route_mtu(&sa);
+	assert_true(mtu >= 1280);
+
+	// The same socket is reused for the next address
+	sockaddr_t sa2 = str2sockaddr("127.0.0.2", "655");
+	assert_int_equal(mtu, pmtu_route_mtu(&sa2));
+}
+
+#if defined(IP_RECVERR) && defined(HAVE_LINUX_ERRQUEUE_H)
+static void test_error_queue(void **state) {
+	(void)state;
+
+	int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	assert_true(fd >= 0);
+	pmtu_set_socket_options(fd, AF_INET, true);
+
+	sockaddr_t sa;
+	assert_int_equal(-1, pmtu_receive_error(fd, &sa));
+
+	// Find a port nobody listens on, and get an ICMP port unreachable error from it
+
+	int closed = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	assert_true(closed >= 0);
+	sockaddr_t dest = str2sockaddr("127.0.0.1", "0");
+	assert_int_equal(0, bind(closed, &dest.sa, sizeof(dest.in)));
+	socklen_t len = sizeof(dest);
+	assert_int_equal(0, getsockname(closed, &dest.sa, &len));
+	close(closed);
+
+	assert_int_equal(1, sendto(fd, "x", 1, 0, &dest.sa, sizeof(dest.in)));
+
+	int result = -1;
+
+	for(int i = 0; i < 100 && result < 0; i++) {
+		result = pmtu_receive_error(fd, &sa);
+
+		if(result < 0) {
+			usleep(10000);
+		}
+	}
+
+	// The error is not about the path MTU, but it tells us where the packet was sent to
+
+	assert_int_equal(0, result);
+	assert_int_equal(0, sockaddrcmp(&dest, &sa));
+	assert_int_equal(-1, pmtu_receive_error(fd, &sa));
+
+	close(fd);
+}
+#endif
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_teardown(test_shared_between_ports, teardown),
+		cmocka_unit_test_teardown(test_expires, teardown),
+		cmocka_unit_test_teardown(test_ignores_unknown_addresses, teardown),
+		cmocka_unit_test_teardown(test_route_mtu, teardown),
+#if defined(IP_RECVERR) && defined(HAVE_LINUX_ERRQUEUE_H)
+		cmocka_unit_test(test_error_queue),
+#endif
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -1,5 +1,7 @@
 #include "unittest.h"
 #include "../../src/protocol.h"
+#include "../../src/event.h"
+#include "../../src/net.h"
 
 static void test_get_invalid_request(void **state) {
 	(void)state;
@@ -18,10 +20,75 @@ static void test_get_valid_request_returns_nonnull(void **state) {
 	}
 }
 
+static int teardown_requests(void **state) {
+	(void)state;
+
+	exit_requests();
+	memset(&past_request_stats, 0, sizeof(past_request_stats));
+	return 0;
+}
+
+static void test_seen_request_detects_duplicates(void **state) {
+	(void)state;
+
+	now.tv_sec = 1000;
+
+	assert_false(seen_request("12 foo bar", 10));
+	assert_true(seen_request("12 foo bar", 10));
+	assert_false(seen_request("12 foo ba", 9));
+	assert_false(seen_request("\0\0", 2));
+	assert_true(seen_request("\0\0", 2));
+
+	assert_int_equal(2, past_request_stats.hits);
+	assert_int_equal(3, past_request_stats.misses);
+}
+
+static void test_seen_request_ages_out(void **state) {
+	(void)state;
+
+	pinginterval = 60;
+	now.tv_sec = 1000;
+	assert_false(seen_request("a", 1));
+
+	// Requests are remembered for at least pinginterval seconds
+
+	now.tv_sec += 60;
+	assert_true(seen_request("a", 1));
+	assert_false(seen_request("b", 1));
+	assert_true(seen_request("a", 1));
+
+	// and are forgotten after one more pinginterval
+
+	now.tv_sec += 60;
+	assert_false(seen_request("c", 1));
+	assert_false(seen_request("a", 1));
+	assert_true(seen_request("b", 1));
+}
+
+static void test_seen_request_bounded(void **state) {
+	(void)state;
+
+	pinginterval = 60;
+	now.tv_sec = 1000;
+
+	for(uint32_t i = 0; i < 200000; i++) {
+		assert_false(seen_request(&i, sizeof(i)));
+	}
+
+	assert_true(past_request_stats.overflows > 0);
+	assert_int_equal(200000, past_request_stats.misses);
+
+	uint32_t last = 199999;
+	assert_true(seen_request(&last, sizeof(last)));
+}
+
 int main(void) {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_get_invalid_request),
 		cmocka_unit_test(test_get_valid_request_returns_nonnull),
+		cmocka_unit_test_teardown(test_seen_request_detects_duplicates, teardown_requests),
+		cmocka_unit_test_teardown(test_seen_request_ages_out, teardown_requests),
+		cmocka_unit_test_teardown(test_seen_request_bounded, teardown_requests),
 	};
 	return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -0,0 +1,426 @@
+#include "unittest.h"
+#include "../../src/replay.h"
+#include "../../src/xalloc.h"
+
+#include <pthread.h>
+
+static replay_window_t w;
+
+static int teardown(void **state) {
+	(void)state;
+
+	replay_free(&w);
+	return 0;
+}
+
+/* A straightforward model of the window, remembering every sequence number ever seen */
+
+typedef struct model_t {
+	uint64_t base;
+	uint8_t *seen;
+	size_t len;
+	uint64_t next;
+	uint32_t size;
+	uint32_t farfuture;
+	uint32_t farfuture_max;
+} model_t;
+
+static void model_init(model_t *m, unsigned int bytes, uint64_t base, size_t len) {
+	m->base = base;
+	m->seen = xzalloc(len);
+	m->len = len;
+	m->next = 0;
+	m->size = bytes * 8;
+	m->farfuture = 0;
+	m->farfuture_max = bytes >> 2;
+}
+
+static replay_result_t model_update(model_t *m, uint32_t seqno) {
+	replay_result_t result = REPLAY_OK;
+
+	if((uint64_t)seqno + m->size < m->next) {
+		return REPLAY_OLD;
+	}
+
+	if(seqno >= m->next + m->size) {
+		if(m->farfuture++ < m->farfuture_max) {
+			return REPLAY_FUTURE;
+		}
+
+		result = REPLAY_JUMP;
+	}
+
+	assert_true(seqno >= m->base && seqno - m->base < m->len);
+	uint8_t *seen = &m->seen[seqno - m->base];
+
+	if(*seen) {
+		return REPLAY_OLD;
+	}
+
+	*seen = 1;
+
+	if(seqno >= m->next) {
+		m->next = (uint64_t)seqno + 1;
+	}
+
+	m->farfuture = 0;
+	return result;
+}
+
+static void test_disabled(void **state) {
+	(void)state;
+
+	assert_true(replay_init(&w, 0));
+
+	for(int i = 0; i < 3; i++) {
+		assert_int_equal(REPLAY_OK, replay_update(&w, 42));
+		assert_int_equal(REPLAY_OK, replay_update(&w, 0));
+		assert_int_equal(REPLAY_OK, replay_update(&w, UINT32_MAX));
+	}
+}
+
+static void test_in_order_and_replayed(void **state) {
+	(void)state;
+
+	assert_true(replay_init(&w, 4));
+
+	for(uint32_t seqno = 0; seqno < 10000; seqno++) {
+		assert_int_equal(REPLAY_OK, replay_update(&w, seqno));
+		assert_int_equal(REPLAY_OLD, replay_update(&w, seqno));
+
+		if(seqno) {
+			assert_int_equal(REPLAY_OLD, replay_update(&w, seqno - 1));
+		}
+	}
+}
+
+static void test_check_does_not_mark(void **state) {
+	(void)state;
+
+	assert_true(replay_init(&w, 4));
+
+	assert_int_equal(REPLAY_OK, replay_check(&w, 5));
+	assert_int_equal(REPLAY_OK, replay_check(&w, 5));
+	assert_int_equal(REPLAY_OK, replay_update(&w, 5));
+	assert_int_equal(REPLAY_OLD, replay_check(&w, 5));
+	assert_int_equal(REPLAY_OK, replay_check(&w, 4));
+	assert_int_equal(REPLAY_OK, replay_check(&w, 6));
+
+	// Checking far future packets does not count towards jumping ahead
+
+	for(int i = 0; i < 10; i++) {
+		assert_int_equal(REPLAY_FUTURE, replay_check(&w, 1000));
+	}
+
+	assert_int_equal(0, w.farfuture);
+}
+
+/* Fill the window with a pattern ending at one sequence number, then check and receive
+   every sequence number around it, for each alignment of the last one to the blocks. */
+
+static void test_boundaries_exhaustive(void **state) {
+	(void)state;
+
+	static const unsigned int sizes[] = {1, 2, 3, 4, 7, 8, 16, 32};
+
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+		unsigned int bytes = sizes[s];
+		uint32_t size = bytes * 8;
+
+		for(uint32_t last = 3 * size; last < 3 * size + 2 * REPLAY_BLOCK_SIZE; last++) {
+			for(uint32_t seqno = last - 2 * size; seqno <= last + 2 * size; seqno++) {
+				model_t m;
+				model_init(&m, bytes, 0, 6 * size + 2 * REPLAY_BLOCK_SIZE);
+				assert_true(replay_init(&w, bytes));
+
+				// Jump ahead, then receive every third packet up to the last one
+
+				replay_result_t result;
+
+				do {
+					result = model_update(&m, last - size);
+					assert_int_equal(result, replay_update(&w, last - size));
+				} while(result == REPLAY_FUTURE);
+
+				for(uint32_t i = last - size + 3; i <= last; i += 3) {
+					assert_int_equal(model_update(&m, i), replay_update(&w, i));
+				}
+
+				assert_int_equal(model_update(&m, last), replay_update(&w, last));
+
+				replay_result_t checked = replay_check(&w, seqno);
+				replay_result_t expected = model_update(&m, seqno);
+
+				if(expected != REPLAY_JUMP) {
+					assert_int_equal(expected, checked);
+				}
+
+				assert_int_equal(expected, replay_update(&w, seqno));
+
+				replay_free(&w);
+				free(m.seen);
+			}
+		}
+	}
+}
+
+/* Random reordering, duplication and loss, wrapping around the ring of slots many times */
+
+static void test_random_against_model(void **state) {
+	(void)state;
+
+	static const unsigned int sizes[] = {1, 3, 4, 16, 32, 128};
+	const size_t count = 100000;
+
+	srand(1);
+
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+		unsigned int bytes = sizes[s];
+		uint32_t size = bytes * 8;
+		model_t m;
+		model_init(&m, bytes, 0, count * (3 * size / 32 + 8));
+		assert_true(replay_init(&w, bytes));
+
+		uint32_t position = 0;
+
+		for(size_t i = 0; i < count; i++) {
+			uint32_t seqno;
+
+			switch(rand() % 32) {
+			case 0:
+				// A big gap
+				position += rand() % (3 * size);
+				seqno = position;
+				break;
+
+			case 1:
+			case 2:
+			case 3:
+			case 4:
+			case 5:
+			case 6:
+			case 7: {
+				// Something from the past, possibly just out of the window
+				uint32_t back = rand() % (size + 40);
+				seqno = position - MIN(position, back);
+				break;
+			}
+
+			default:
+				// Mostly in order, but a bit reordered
+				position++;
+				seqno = position + rand() % 5;
+				break;
+			}
+
+			replay_result_t expected = model_update(&m, seqno);
+			assert_int_equal(expected, replay_update(&w, seqno));
+		}
+
+		free(m.seen);
+		replay_free(&w);
+	}
+}
+
+static void test_far_future(void **state) {
+	(void)state;
+
+	assert_true(replay_init(&w, 16));
+	uint32_t size = 16 * 8;
+
+	for(uint32_t seqno = 0; seqno < 10; seqno++) {
+		assert_int_equal(REPLAY_OK, replay_update(&w, seqno));
+	}
+
+	// Packets just inside the window are fine, beyond it they are dropped at first
+
+	assert_int_equal(REPLAY_OK, replay_update(&w, 10 + size - 1));
+	uint32_t next = 10 + size;
+
+	for(uint32_t i = 0; i < 4; i++) {
+		assert_int_equal(REPLAY_FUTURE, replay_update(&w, next + size + i));
+	}
+
+	// A packet in the window resets the count
+
+	assert_int_equal(REPLAY_OK, replay_update(&w, 20));
+
+	for(uint32_t i = 0; i < 4; i++) {
+		assert_int_equal(REPLAY_FUTURE, replay_update(&w, next + size + i));
+	}
+
+	// Until so many of them arrive that we give up on the packets in between
+
+	uint32_t far = next + size + 4;
+	assert_int_equal(REPLAY_JUMP, replay_update(&w, far));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, far));
+
+	// Packets that we have never seen before are accepted if they are still in the new window
+
+	assert_int_equal(REPLAY_OK, replay_update(&w, next + size));
+	assert_int_equal(REPLAY_OK, replay_update(&w, far - size + 1));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, far - size));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, 20));
+}
+
+static void test_huge_gap(void **state) {
+	(void)state;
+
+	assert_true(replay_init(&w, 1));
+
+	assert_int_equal(REPLAY_OK, replay_update(&w, 1));
+	assert_int_equal(REPLAY_JUMP, replay_update(&w, 0x80000000));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, 1));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, 0x80000000));
+	assert_int_equal(REPLAY_OK, replay_update(&w, 0x80000000 - 7));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, 0x80000000 - 8));
+	assert_int_equal(REPLAY_OK, replay_update(&w, 0x80000001));
+}
+
+static void test_seqno_wrap(void **state) {
+	(void)state;
+
+	assert_true(replay_init(&w, 4));
+	uint32_t start = UINT32_MAX - 100;
+
+	assert_int_equal(REPLAY_FUTURE, replay_update(&w, start));
+	assert_int_equal(REPLAY_JUMP, replay_update(&w, start));
+
+	for(uint32_t seqno = start + 1; seqno != 0; seqno++) {
+		assert_int_equal(REPLAY_OK, replay_update(&w, seqno));
+	}
+
+	assert_int_equal(REPLAY_OLD, replay_update(&w, UINT32_MAX));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, UINT32_MAX - 1));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, UINT32_MAX - 32));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, UINT32_MAX - 33));
+
+	// Traffic continues after the sequence numbers wrap around
+
+	for(uint32_t seqno = 0; seqno < 100; seqno++) {
+		assert_int_equal(REPLAY_OK, replay_check(&w, seqno));
+		assert_int_equal(REPLAY_OK, replay_update(&w, seqno));
+		assert_int_equal(REPLAY_OLD, replay_update(&w, seqno));
+	}
+
+	assert_int_equal((UINT64_C(1) << 32) + 100, w.next);
+
+	// Packets from before the wrap are still recognized, late or replayed
+
+	assert_int_equal(REPLAY_OLD, replay_update(&w, UINT32_MAX));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, UINT32_MAX - 20));
+	assert_int_equal(REPLAY_OK, replay_update(&w, 102));
+	assert_int_equal(REPLAY_OK, replay_update(&w, 101));
+	assert_int_equal(REPLAY_OK, replay_update(&w, 100));
+}
+
+/* Packets that were lost just before the wrap can still arrive afterwards */
+
+static void test_seqno_wrap_reordered(void **state) {
+	(void)state;
+
+	assert_true(replay_init(&w, 16));
+	uint32_t start = UINT32_MAX - 9;
+
+	while(replay_update(&w, start) == REPLAY_FUTURE) {
+		// jump to the start
+	}
+
+	for(uint32_t seqno = start + 2; seqno != 20; seqno++) {
+		assert_int_equal(REPLAY_OK, replay_update(&w, seqno));
+	}
+
+	assert_int_equal(REPLAY_OK, replay_update(&w, start + 1));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, start + 1));
+	assert_int_equal(REPLAY_OLD, replay_update(&w, 5));
+	assert_int_equal(REPLAY_OK, replay_update(&w, 20));
+}
+
+static void test_reset(void **state) {
+	(void)state;
+
+	assert_true(replay_init(&w, 4));
+
+	for(uint32_t seqno = 1000; seqno < 1100; seqno++) {
+		replay_update(&w, seqno);
+	}
+
+	replay_reset(&w);
+
+	for(uint32_t seqno = 1; seqno < 10; seqno++) {
+		assert_int_equal(REPLAY_OK, replay_update(&w, seqno));
+	}
+}
+
+/* Several threads receive the same sequence numbers, each in its own slightly shuffled order.
+   Every sequence number must be accepted exactly once. */
+
+#define THREADS 4
+#define THREAD_SEQNOS 200000
+#define SHUFFLE 64
+
+static _Atomic uint32_t accepted[THREAD_SEQNOS];
+
+static void *receiver_thread(void *arg) {
+	unsigned int seed = (unsigned int)(uintptr_t)arg;
+	uint32_t order[SHUFFLE];
+
+	for(uint32_t base = 0; base < THREAD_SEQNOS; base += SHUFFLE) {
+		for(uint32_t i = 0; i < SHUFFLE; i++) {
+			order[i] = base + i;
+		}
+
+		for(uint32_t i = SHUFFLE - 1; i > 0; i--) {
+			uint32_t j = rand_r(&seed) % (i + 1);
+			uint32_t tmp = order[i];
+			order[i] = order[j];
+			order[j] = tmp;
+		}
+
+		for(uint32_t i = 0; i < SHUFFLE; i++) {
+			if(replay_update(&w, order[i]) == REPLAY_OK) {
+				atomic_fetch_add(&accepted[order[i]], 1);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void test_concurrent_updates(void **state) {
+	(void)state;
+
+	assert_true(replay_init(&w, 64));
+
+	pthread_t threads[THREADS];
+
+	for(uintptr_t i = 0; i < THREADS; i++) {
+		assert_int_equal(0, pthread_create(&threads[i], NULL, receiver_thread, (void *)(i + 1)));
+	}
+
+	for(int i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	for(uint32_t i = 0; i < THREAD_SEQNOS; i++) {
+		assert_int_equal(1, accepted[i]);
+	}
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_teardown(test_disabled, teardown),
+		cmocka_unit_test_teardown(test_in_order_and_replayed, teardown),
+		cmocka_unit_test_teardown(test_check_does_not_mark, teardown),
+		cmocka_unit_test_teardown(test_boundaries_exhaustive, teardown),
+		cmocka_unit_test_teardown(test_random_against_model, teardown),
+		cmocka_unit_test_teardown(test_far_future, teardown),
+		cmocka_unit_test_teardown(test_huge_gap, teardown),
+		cmocka_unit_test_teardown(test_seqno_wrap, teardown),
+		cmocka_unit_test_teardown(test_seqno_wrap_reordered, teardown),
+		cmocka_unit_test_teardown(test_reset, teardown),
+		cmocka_unit_test_teardown(test_concurrent_updates, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
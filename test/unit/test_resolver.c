@@ -0,0 +1,144 @@
+#include "unittest.h"
+#include "../../src/event.h"
+#include "../../src/resolver.h"
+
+static int called;
+static int cancelled_called;
+static timeout_t deadline;
+
+static void done_cb(void *data) {
+	(void)data;
+	called++;
+	event_exit();
+}
+
+static void cancelled_cb(void *data) {
+	(void)data;
+	cancelled_called++;
+}
+
+static void deadline_cb(void *data) {
+	(void)data;
+	event_exit();
+}
+
+// Run the event loop until a callback stops it, but not forever.
+
+static void run_event_loop(void) {
+	timeout_add(&deadline, deadline_cb, NULL, &(struct timeval) {
+		10, 0
+	});
+	event_loop();
+	timeout_del(&deadline);
+}
+
+static int setup(void **state) {
+	(void)state;
+
+	gettimeofday(&now, NULL);
+	called = 0;
+	cancelled_called = 0;
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	resolver_flush();
+	memset(&resolver_stats, 0, sizeof(resolver_stats));
+	return 0;
+}
+
+static void test_numeric_address_is_immediate(void **state) {
+	(void)state;
+
+	const struct addrinfo *ai;
+
+	assert_int_equal(RESOLVE_OK, resolve_address("192.0.2.1", "655", SOCK_STREAM, &ai, done_cb, NULL));
+	assert_non_null(ai);
+	assert_int_equal(AF_INET, ai->ai_family);
+	assert_int_equal(SOCK_STREAM, ai->ai_socktype);
+
+	assert_int_equal(RESOLVE_OK, resolve_address("192.0.2.1", "655", SOCK_STREAM, &ai, done_cb, NULL));
+	assert_int_equal(1, resolver_stats.hits);
+	assert_int_equal(1, resolver_stats.misses);
+	assert_int_equal(0, called);
+}
+
+static void test_name_is_resolved_in_background(void **state) {
+	(void)state;
+
+	const struct addrinfo *ai;
+
+	assert_int_equal(RESOLVE_PENDING, resolve_address("localhost", "655", SOCK_STREAM, &ai, done_cb, NULL));
+	assert_null(ai);
+
+	// Asking again while the lookup is running does not start another one, or call back twice
+
+	assert_int_equal(RESOLVE_PENDING, resolve_address("localhost", "655", SOCK_STREAM, &ai, done_cb, NULL));
+	assert_int_equal(1, resolver_stats.misses);
+
+	run_event_loop();
+	assert_int_equal(1, called);
+
+	assert_int_equal(RESOLVE_OK, resolve_address("localhost", "655", SOCK_STREAM, &ai, done_cb, NULL));
+	assert_non_null(ai);
+	assert_int_equal(1, resolver_stats.misses);
+
+	resolver_flush();
+
+	assert_int_equal(RESOLVE_PENDING, resolve_address("localhost", "655", SOCK_STREAM, &ai, done_cb, NULL));
+	assert_int_equal(2, resolver_stats.misses);
+	run_event_loop();
+	assert_int_equal(2, called);
+}
+
+static void test_failure_is_cached(void **state) {
+	(void)state;
+
+	const struct addrinfo *ai;
+
+	assert_int_equal(RESOLVE_PENDING, resolve_address("localhost", "no-such-service", SOCK_STREAM, &ai, done_cb, NULL));
+	run_event_loop();
+	assert_int_equal(1, called);
+	assert_int_equal(1, resolver_stats.failures);
+
+	assert_int_equal(RESOLVE_FAILED, resolve_address("localhost", "no-such-service", SOCK_STREAM, &ai, done_cb, NULL));
+	assert_null(ai);
+	assert_int_equal(1, resolver_stats.misses);
+
+	// Failures are forgotten sooner than successes
+
+	now.tv_sec += RESOLVER_NEGATIVE_TTL;
+	assert_int_equal(RESOLVE_PENDING, resolve_address("localhost", "no-such-service", SOCK_STREAM, &ai, done_cb, NULL));
+	run_event_loop();
+	assert_int_equal(2, called);
+}
+
+static void test_cancelled_callback_is_not_called(void **state) {
+	(void)state;
+
+	const struct addrinfo *ai;
+	int data;
+
+	assert_int_equal(RESOLVE_PENDING, resolve_address("localhost", "656", SOCK_STREAM, &ai, cancelled_cb, &data));
+	assert_int_equal(RESOLVE_PENDING, resolve_address("localhost", "656", SOCK_STREAM, &ai, done_cb, NULL));
+	resolve_cancel(&data);
+
+	run_event_loop();
+	assert_int_equal(1, called);
+	assert_int_equal(0, cancelled_called);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_numeric_address_is_immediate, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_name_is_resolved_in_background, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_failure_is_cached, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_cancelled_callback_is_not_called, setup, teardown),
+	};
+
+	int result = cmocka_run_group_tests(tests, NULL, NULL);
+	resolver_exit();
+	return result;
+}
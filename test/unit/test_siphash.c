@@ -0,0 +1,68 @@
+#include "unittest.h"
+#include "../../src/siphash.h"
+
+/* Test vectors from the SipHash reference implementation (vectors_sip128), key 00 01 .. 0f, input 00 01 .. len - 1 */
+
+static const uint8_t vectors[][SIPHASH128_SIZE] = {
+	{0xa3, 0x81, 0x7f, 0x04, 0xba, 0x25, 0xa8, 0xe6, 0x6d, 0xf6, 0x72, 0x14, 0xc7, 0x55, 0x02, 0x93},
+	{0xda, 0x87, 0xc1, 0xd8, 0x6b, 0x99, 0xaf, 0x44, 0x34, 0x76, 0x59, 0x11, 0x9b, 0x22, 0xfc, 0x45},
+	{0x81, 0x77, 0x22, 0x8d, 0xa4, 0xa4, 0x5d, 0xc7, 0xfc, 0xa3, 0x8b, 0xde, 0xf6, 0x0a, 0xff, 0xe4},
+};
+
+static const uint8_t vector63[SIPHASH128_SIZE] = {
+	0x51, 0x50, 0xd1, 0x77, 0x2f, 0x50, 0x83, 0x4a, 0x50, 0x3e, 0x06, 0x9a, 0x97, 0x3f, 0xbd, 0x7c,
+};
+
+static uint8_t key[SIPHASH_KEY_SIZE];
+static uint8_t input[64];
+
+static int setup(void **state) {
+	(void)state;
+
+	for(uint8_t i = 0; i < sizeof(key); i++) {
+		key[i] = i;
+	}
+
+	for(uint8_t i = 0; i < sizeof(input); i++) {
+		input[i] = i;
+	}
+
+	return 0;
+}
+
+static void test_siphash128_reference_vectors(void **state) {
+	(void)state;
+
+	uint8_t out[SIPHASH128_SIZE];
+
+	for(size_t len = 0; len < sizeof(vectors) / sizeof(*vectors); len++) {
+		siphash128(out, input, len, key);
+		assert_memory_equal(vectors[len], out, sizeof(out));
+	}
+
+	siphash128(out, input, 63, key);
+	assert_memory_equal(vector63, out, sizeof(out));
+}
+
+static void test_siphash128_depends_on_key(void **state) {
+	(void)state;
+
+	uint8_t out1[SIPHASH128_SIZE];
+	uint8_t out2[SIPHASH128_SIZE];
+	uint8_t key2[SIPHASH_KEY_SIZE];
+
+	memcpy(key2, key, sizeof(key2));
+	key2[15] ^= 1;
+
+	siphash128(out1, input, 8, key);
+	siphash128(out2, input, 8, key2);
+	assert_memory_not_equal(out1, out2, sizeof(out1));
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_siphash128_reference_vectors),
+		cmocka_unit_test(test_siphash128_depends_on_key),
+	};
+	return cmocka_run_group_tests(tests, setup, NULL);
+}
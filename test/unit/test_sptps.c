@@ -0,0 +1,308 @@
+#include "unittest.h"
+#include "../../src/crypto.h"
+#include "../../src/ecdsa.h"
+#include "../../src/ecdsagen.h"
+#include "../../src/random.h"
+#include "../../src/sptps.h"
+#include "../../src/xalloc.h"
+
+#define MAX_MESSAGES 64
+#define MAX_JOBS 8
+
+typedef struct message_t {
+	size_t len;
+	uint8_t data[2048];
+} message_t;
+
+typedef struct peer_t {
+	sptps_t s;
+	message_t out[MAX_MESSAGES];
+	int nout;
+	int handshakes;
+	int alerts;
+	int records;
+} peer_t;
+
+static ecdsa_t *key1;
+static ecdsa_t *key2;
+static peer_t *peer1;
+static peer_t *peer2;
+
+static sptps_job_t *jobs[MAX_JOBS];
+static int njobs;
+
+static bool offload(sptps_job_t *job) {
+	assert_true(njobs < MAX_JOBS);
+	jobs[njobs++] = job;
+	return true;
+}
+
+// Run all queued jobs, as if the background threads finished them.
+
+static int run_jobs(void) {
+	int count = njobs;
+
+	sptps_job_run_batch(jobs, count);
+
+	for(int i = 0; i < count; i++) {
+		sptps_job_finish(jobs[i]);
+	}
+
+	memmove(jobs, jobs + count, (njobs - count) * sizeof(*jobs));
+	njobs -= count;
+	return count;
+}
+
+static bool send_data(void *handle, uint8_t type, const void *data, size_t len) {
+	(void)type;
+	peer_t *peer = handle;
+
+	assert_true(peer->nout < MAX_MESSAGES);
+	assert_true(len <= sizeof(peer->out[0].data));
+
+	message_t *msg = &peer->out[peer->nout++];
+	memcpy(msg->data, data, len);
+	msg->len = len;
+	return true;
+}
+
+static bool receive_record(void *handle, uint8_t type, const void *data, uint16_t len) {
+	(void)data;
+	(void)len;
+	peer_t *peer = handle;
+
+	if(type == SPTPS_HANDSHAKE) {
+		peer->handshakes++;
+	} else if(type == SPTPS_ALERT) {
+		peer->alerts++;
+	} else {
+		peer->records++;
+	}
+
+	return true;
+}
+
+// Deliver everything one peer has sent to the other. Returns the number of messages.
+
+static int deliver(peer_t *from, peer_t *to) {
+	int count = from->nout;
+	from->nout = 0;
+
+	for(int i = 0; i < count; i++) {
+		const uint8_t *data = from->out[i].data;
+		size_t len = from->out[i].len;
+
+		while(len) {
+			size_t done = sptps_receive_data(&to->s, data, len);
+			assert_true(done);
+			data += done;
+			len -= done;
+		}
+	}
+
+	return count;
+}
+
+static void pump(void) {
+	while(deliver(peer1, peer2) + deliver(peer2, peer1) + run_jobs()) {
+		// Keep going until both sides are quiet
+	}
+}
+
+static void start(bool datagram, ecdsa_t *hiskey) {
+	assert_true(sptps_start(&peer1->s, peer1, true, datagram, key1, key2, "test", 4, send_data, receive_record));
+	assert_true(sptps_start(&peer2->s, peer2, false, datagram, key2, hiskey, "test", 4, send_data, receive_record));
+}
+
+static int setup(void **state) {
+	(void)state;
+
+	peer1 = xzalloc(sizeof(*peer1));
+	peer2 = xzalloc(sizeof(*peer2));
+	njobs = 0;
+	sptps_offload = offload;
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	sptps_stop(&peer1->s);
+	sptps_stop(&peer2->s);
+	run_jobs();
+	free(peer1);
+	free(peer2);
+	sptps_offload = NULL;
+	return 0;
+}
+
+static void test_stream_handshake_is_offloaded(void **state) {
+	(void)state;
+
+	start(false, key1);
+
+	// The initiator signs in the background as soon as it has the responder's KEX
+	deliver(peer1, peer2);
+	deliver(peer2, peer1);
+	assert_int_equal(1, njobs);
+	assert_non_null(peer1->s.job);
+	assert_int_equal(0, peer1->nout);
+
+	pump();
+	assert_int_equal(1, peer1->handshakes);
+	assert_int_equal(1, peer2->handshakes);
+
+	assert_true(sptps_send_record(&peer1->s, 0, "hello", 5));
+	pump();
+	assert_int_equal(1, peer2->records);
+}
+
+static void test_datagram_handshake_is_offloaded(void **state) {
+	(void)state;
+
+	start(true, key1);
+	pump();
+	assert_int_equal(1, peer1->handshakes);
+	assert_int_equal(1, peer2->handshakes);
+
+	assert_true(sptps_send_record(&peer2->s, 0, "hello", 5));
+	pump();
+	assert_int_equal(1, peer1->records);
+}
+
+static void test_data_received_while_suspended_is_replayed(void **state) {
+	(void)state;
+
+	start(false, key1);
+	pump();
+
+	// Renegotiate keys, and stop right before the initiator signs its part
+
+	assert_true(sptps_force_kex(&peer1->s));
+	deliver(peer1, peer2);
+	deliver(peer2, peer1);
+	assert_int_equal(1, njobs);
+
+	assert_true(sptps_send_record(&peer2->s, 0, "one", 3));
+	assert_true(sptps_send_record(&peer2->s, 0, "two", 3));
+	deliver(peer2, peer1);
+	assert_int_equal(0, peer1->records);
+	assert_int_equal(6 + 2 * 19, peer1->s.suspendedlen);
+
+	run_jobs();
+	assert_int_equal(2, peer1->records);
+	assert_null(peer1->s.suspended);
+
+	pump();
+	assert_int_equal(2, peer1->handshakes);
+	assert_int_equal(2, peer2->handshakes);
+	assert_int_equal(0, peer1->alerts);
+}
+
+static void test_jobs_can_run_in_a_batch(void **state) {
+	(void)state;
+
+	peer_t *peer3 = xzalloc(sizeof(*peer3));
+	peer_t *peer4 = xzalloc(sizeof(*peer4));
+
+	start(false, key1);
+	assert_true(sptps_start(&peer3->s, peer3, true, false, key1, key2, "test", 4, send_data, receive_record));
+	assert_true(sptps_start(&peer4->s, peer4, false, false, key2, key1, "test", 4, send_data, receive_record));
+
+	// Let both responders wait for their signature checks at the same time
+
+	deliver(peer1, peer2);
+	deliver(peer3, peer4);
+	deliver(peer2, peer1);
+	deliver(peer4, peer3);
+	assert_int_equal(2, run_jobs());
+
+	deliver(peer1, peer2);
+	deliver(peer3, peer4);
+	assert_int_equal(2, njobs);
+	assert_int_equal(2, run_jobs());
+
+	while(deliver(peer1, peer2) + deliver(peer2, peer1) + deliver(peer3, peer4) + deliver(peer4, peer3) + run_jobs()) {
+		// Finish both handshakes
+	}
+
+	assert_int_equal(1, peer1->handshakes);
+	assert_int_equal(1, peer2->handshakes);
+	assert_int_equal(1, peer3->handshakes);
+	assert_int_equal(1, peer4->handshakes);
+
+	sptps_stop(&peer3->s);
+	sptps_stop(&peer4->s);
+	free(peer3);
+	free(peer4);
+}
+
+static void test_failure_is_reported_as_alert(void **state) {
+	(void)state;
+
+	// The responder expects the wrong key, so the initiator's signature does not verify
+
+	start(false, key2);
+	pump();
+	assert_int_equal(1, peer2->alerts);
+	assert_int_equal(0, peer2->handshakes);
+}
+
+static void test_stop_with_pending_job(void **state) {
+	(void)state;
+
+	start(true, key1);
+	deliver(peer1, peer2);
+	deliver(peer2, peer1);
+	assert_int_equal(1, njobs);
+
+	sptps_stop(&peer1->s);
+	memset(&peer1->s, 0, sizeof(peer1->s));
+
+	run_jobs();
+	assert_int_equal(0, peer1->nout);
+	assert_int_equal(0, peer1->alerts);
+}
+
+static void test_too_much_suspended_data(void **state) {
+	(void)state;
+
+	start(false, key1);
+	deliver(peer1, peer2);
+	deliver(peer2, peer1);
+	assert_int_equal(1, njobs);
+
+	static uint8_t junk[SPTPS_SUSPEND_MAX / 4];
+
+	for(int i = 0; i < 4; i++) {
+		assert_int_equal(sizeof(junk), sptps_receive_data(&peer1->s, junk, sizeof(junk)));
+	}
+
+	assert_int_equal(0, sptps_receive_data(&peer1->s, junk, 1));
+}
+
+int main(void) {
+	random_init();
+	crypto_init();
+	sptps_log = sptps_log_quiet;
+
+	key1 = ecdsa_generate();
+	key2 = ecdsa_generate();
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_stream_handshake_is_offloaded, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_datagram_handshake_is_offloaded, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_data_received_while_suspended_is_replayed, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_jobs_can_run_in_a_batch, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_failure_is_reported_as_alert, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_stop_with_pending_job, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_too_much_suspended_data, setup, teardown),
+	};
+
+	int result = cmocka_run_group_tests(tests, NULL, NULL);
+
+	ecdsa_free(key1);
+	ecdsa_free(key2);
+	random_exit();
+	return result;
+}
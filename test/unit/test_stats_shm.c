@@ -0,0 +1,124 @@
+#include "unittest.h"
+#include "../../src/stats_shm.h"
+
+static char path[] = "/tmp/tinc-stats-XXXXXX";
+
+static int setup(void **state) {
+	(void)state;
+
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	close(fd);
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	unlink(path);
+	strcpy(path + strlen(path) - 6, "XXXXXX");
+	return 0;
+}
+
+static void write_node(stats_shm_t *shm, uint32_t index, const char *name, uint64_t packets) {
+	stats_shm_data_t *d = stats_shm_write_begin(shm, index);
+	memset(d, 0, sizeof(*d));
+	strncpy(d->name, name, sizeof(d->name) - 1);
+	d->in_packets = packets;
+	d->udp_ping_rtt = -1;
+	stats_shm_write_end(shm, index);
+}
+
+static void test_reader_sees_updates(void **state) {
+	(void)state;
+
+	stats_shm_t writer, reader;
+	stats_shm_data_t d;
+
+	assert_true(stats_shm_create(&writer, path));
+	assert_true(stats_shm_resize(&writer, 2));
+	write_node(&writer, 0, "bar", 1);
+	write_node(&writer, 1, "foo", 2);
+
+	assert_true(stats_shm_open(&reader, path));
+	assert_int_equal(2, stats_shm_count(&reader));
+	assert_true(stats_shm_read(&reader, 1, &d));
+	assert_string_equal("foo", d.name);
+	assert_int_equal(2, d.in_packets);
+	assert_false(stats_shm_read(&reader, 2, &d));
+
+	write_node(&writer, 1, "foo", 3);
+	assert_true(stats_shm_read(&reader, 1, &d));
+	assert_int_equal(3, d.in_packets);
+
+	// The reader follows the file when it grows
+
+	assert_true(stats_shm_resize(&writer, 1000));
+
+	for(uint32_t i = 0; i < 1000; i++) {
+		write_node(&writer, i, "node", i);
+	}
+
+	assert_int_equal(1000, stats_shm_count(&reader));
+	assert_true(stats_shm_read(&reader, 999, &d));
+	assert_int_equal(999, d.in_packets);
+
+	// Closing marks the file as closed for readers that still have it open
+
+	stats_shm_close(&writer);
+	assert_int_equal(0, stats_shm_count(&reader));
+	stats_shm_close(&reader);
+
+	assert_false(stats_shm_open(&reader, path));
+}
+
+static void test_replaced_file_is_closed(void **state) {
+	(void)state;
+
+	stats_shm_t old, new, reader;
+
+	assert_true(stats_shm_create(&old, path));
+	assert_true(stats_shm_resize(&old, 1));
+	assert_true(stats_shm_open(&reader, path));
+
+	assert_true(stats_shm_create(&new, path));
+	assert_int_equal(0, stats_shm_count(&reader));
+	stats_shm_close(&reader);
+
+	// The old writer must not remove the new file
+
+	stats_shm_close(&old);
+	assert_true(stats_shm_open(&reader, path));
+	stats_shm_close(&reader);
+
+	stats_shm_close(&new);
+}
+
+static void test_torn_slot_is_not_read(void **state) {
+	(void)state;
+
+	stats_shm_t writer, reader;
+	stats_shm_data_t d;
+
+	assert_true(stats_shm_create(&writer, path));
+	assert_true(stats_shm_resize(&writer, 1));
+	assert_true(stats_shm_open(&reader, path));
+
+	stats_shm_write_begin(&writer, 0);
+	assert_false(stats_shm_read(&reader, 0, &d));
+	stats_shm_write_end(&writer, 0);
+	assert_true(stats_shm_read(&reader, 0, &d));
+
+	stats_shm_close(&reader);
+	stats_shm_close(&writer);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_reader_sees_updates, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_replaced_file_is_closed, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_torn_slot_is_not_read, setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
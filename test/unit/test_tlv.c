@@ -0,0 +1,259 @@
+#include "unittest.h"
+#include "../../src/tlv.h"
+#include "../../src/netutl.h"
+
+static uint8_t buf[1024];
+
+static void test_tlv_uint_roundtrip(void **state) {
+	(void)state;
+
+	static const uint64_t values[] = {0, 1, 127, 128, 255, 16383, 16384, UINT32_MAX, (uint64_t)UINT32_MAX + 1, UINT64_MAX};
+	const size_t count = sizeof(values) / sizeof(*values);
+	tlv_writer_t out;
+	tlv_writer_init(&out, buf, sizeof(buf));
+
+	for(size_t i = 0; i < count; i++) {
+		tlv_put_uint(&out, (uint8_t)i, values[i]);
+	}
+
+	assert_false(out.overflow);
+
+	tlv_reader_t in;
+	tlv_reader_init(&in, buf, out.len);
+	tlv_t field;
+
+	for(size_t i = 0; i < count; i++) {
+		uint64_t value;
+		assert_true(tlv_next(&in, &field));
+		assert_int_equal(i, field.tag);
+		assert_true(tlv_get_uint(&field, &value));
+		assert_true(value == values[i]);
+
+		uint32_t value32;
+		assert_int_equal(values[i] <= UINT32_MAX, tlv_get_uint32(&field, &value32));
+	}
+
+	assert_false(tlv_next(&in, &field));
+	assert_false(in.error);
+}
+
+static void test_tlv_string_roundtrip(void **state) {
+	(void)state;
+
+	tlv_writer_t out;
+	tlv_writer_init(&out, buf, sizeof(buf));
+	tlv_put_string(&out, 1, "");
+	tlv_put_string(&out, 2, "node_01");
+	tlv_put_data(&out, 3, "a\0b", 3);
+
+	tlv_reader_t in;
+	tlv_reader_init(&in, buf, out.len);
+	tlv_t field;
+	char str[8];
+
+	assert_true(tlv_next(&in, &field));
+	assert_true(tlv_get_string(&field, str, sizeof(str)));
+	assert_string_equal("", str);
+
+	assert_true(tlv_next(&in, &field));
+	assert_true(tlv_get_string(&field, str, sizeof(str)));
+	assert_string_equal("node_01", str);
+	assert_false(tlv_get_string(&field, str, 7));
+
+	assert_true(tlv_next(&in, &field));
+	assert_false(tlv_get_string(&field, str, sizeof(str)));
+}
+
+static void test_tlv_writer_overflow(void **state) {
+	(void)state;
+
+	uint8_t small[8];
+	tlv_writer_t out;
+	tlv_writer_init(&out, small, sizeof(small));
+
+	tlv_put_string(&out, 1, "123456");
+	assert_false(out.overflow);
+	assert_int_equal(8, out.len);
+
+	tlv_put_uint(&out, 2, 0);
+	assert_true(out.overflow);
+	assert_int_equal(8, out.len);
+}
+
+static void check_sockaddr_roundtrip(const char *address, const char *port) {
+	sockaddr_t sa = str2sockaddr(address, port);
+	sockaddr_t result;
+	tlv_writer_t out;
+	tlv_reader_t in;
+	tlv_t field;
+
+	tlv_writer_init(&out, buf, sizeof(buf));
+	tlv_put_sockaddr(&out, 4, &sa);
+	assert_false(out.overflow);
+
+	tlv_reader_init(&in, buf, out.len);
+	assert_true(tlv_next(&in, &field));
+	assert_int_equal(4, field.tag);
+	assert_true(tlv_get_sockaddr(&field, &result));
+	assert_int_equal(sa.sa.sa_family, result.sa.sa_family);
+	assert_int_equal(0, sockaddrcmp(&sa, &result));
+
+	sockaddrfree(&sa);
+	sockaddrfree(&result);
+}
+
+static void test_tlv_sockaddr_roundtrip(void **state) {
+	(void)state;
+
+	check_sockaddr_roundtrip("192.0.2.1", "655");
+	check_sockaddr_roundtrip("2001:db8::1", "65535");
+	check_sockaddr_roundtrip("fe80::1%1", "655");
+	check_sockaddr_roundtrip("example.org", "655");
+
+	sockaddr_t unspec = {0}, result;
+	tlv_writer_t out;
+	tlv_reader_t in;
+	tlv_t field;
+
+	tlv_writer_init(&out, buf, sizeof(buf));
+	tlv_put_sockaddr(&out, 1, &unspec);
+	tlv_reader_init(&in, buf, out.len);
+	assert_true(tlv_next(&in, &field));
+	assert_true(tlv_get_sockaddr(&field, &result));
+	assert_int_equal(AF_UNSPEC, result.sa.sa_family);
+}
+
+static void check_subnet_roundtrip(const char *str) {
+	subnet_t subnet = {0}, result;
+	tlv_writer_t out;
+	tlv_reader_t in;
+	tlv_t field;
+
+	assert_true(str2net(&subnet, str));
+
+	tlv_writer_init(&out, buf, sizeof(buf));
+	tlv_put_subnet(&out, 3, &subnet);
+	assert_false(out.overflow);
+
+	tlv_reader_init(&in, buf, out.len);
+	assert_true(tlv_next(&in, &field));
+	assert_true(tlv_get_subnet(&field, &result));
+	assert_int_equal(0, subnet_compare(&subnet, &result));
+	assert_int_equal(subnet.weight, result.weight);
+}
+
+static void test_tlv_subnet_roundtrip(void **state) {
+	(void)state;
+
+	check_subnet_roundtrip("fe:ed:de:ad:be:ef");
+	check_subnet_roundtrip("10.0.0.0/8");
+	check_subnet_roundtrip("192.0.2.1#-5");
+	check_subnet_roundtrip("2001:db8::/32#100");
+	check_subnet_roundtrip("::/0");
+}
+
+static void test_tlv_subnet_rejects_bad_prefix(void **state) {
+	(void)state;
+
+	const uint8_t bad[] = {SUBNET_IPV4, 33, 10, 0, 0, 0, 0, 0, 0, 10};
+	tlv_t field = {.tag = 3, .len = sizeof(bad), .value = bad};
+	subnet_t result;
+
+	assert_false(tlv_get_subnet(&field, &result));
+
+	field.len--;
+	assert_false(tlv_get_subnet(&field, &result));
+}
+
+static void test_tlv_truncated_input(void **state) {
+	(void)state;
+
+	tlv_writer_t out;
+	tlv_writer_init(&out, buf, sizeof(buf));
+	tlv_put_uint(&out, TLV_REQUEST, 12);
+	tlv_put_uint(&out, 1, 0xdeadbeef);
+	tlv_put_string(&out, 2, "alice");
+	tlv_put_string(&out, 3, "bob");
+
+	// Every proper prefix of a message must either end at a field boundary or be flagged as an error
+
+	for(size_t len = 0; len < out.len; len++) {
+		tlv_reader_t in;
+		tlv_t field;
+		size_t fields = 0;
+
+		tlv_reader_init(&in, buf, len);
+
+		while(tlv_next(&in, &field)) {
+			assert_true(field.value + field.len <= buf + len);
+			fields++;
+		}
+
+		assert_true(in.error || in.pos == len);
+		assert_true(fields < 4);
+	}
+}
+
+static uint32_t xorshift(uint32_t *x) {
+	*x ^= *x << 13;
+	*x ^= *x >> 17;
+	*x ^= *x << 5;
+	return *x;
+}
+
+static void test_tlv_fuzz(void **state) {
+	(void)state;
+
+	uint32_t seed = 0x1234567;
+
+	for(int i = 0; i < 100000; i++) {
+		size_t len = xorshift(&seed) % 64;
+
+		for(size_t j = 0; j < len; j++) {
+			buf[j] = (uint8_t)xorshift(&seed);
+
+			// Keep lengths small so fields are actually parsed most of the time
+			if(j % 3 == 1) {
+				buf[j] &= 0x0f;
+			}
+		}
+
+		tlv_reader_t in;
+		tlv_t field;
+		tlv_reader_init(&in, buf, len);
+
+		while(tlv_next(&in, &field)) {
+			assert_true(field.value >= buf && field.value + field.len <= buf + len);
+
+			uint64_t value;
+			char str[16];
+			sockaddr_t sa;
+			subnet_t subnet;
+
+			tlv_get_uint(&field, &value);
+			tlv_get_string(&field, str, sizeof(str));
+
+			if(tlv_get_sockaddr(&field, &sa)) {
+				sockaddrfree(&sa);
+			}
+
+			tlv_get_subnet(&field, &subnet);
+		}
+
+		assert_true(in.pos <= len);
+	}
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_tlv_uint_roundtrip),
+		cmocka_unit_test(test_tlv_string_roundtrip),
+		cmocka_unit_test(test_tlv_writer_overflow),
+		cmocka_unit_test(test_tlv_sockaddr_roundtrip),
+		cmocka_unit_test(test_tlv_subnet_roundtrip),
+		cmocka_unit_test(test_tlv_subnet_rejects_bad_prefix),
+		cmocka_unit_test(test_tlv_truncated_input),
+		cmocka_unit_test(test_tlv_fuzz),
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}